@@ -0,0 +1,348 @@
+/*
+ * capture.c - Sampled capture of decapsulated packets
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Sampled packets are appended, in pcap record format, to one of two
+ * memory buffers under a mutex. A thread swaps the buffers and writes the
+ * full one to the file, so that packet processing never waits for file
+ * I/O. When a buffer is full, samples are dropped. When the file reaches
+ * its maximum size, it is renamed with a ".1" suffix (replacing the older
+ * one) and a new file is started, so at most twice the maximum size is
+ * used on disk. If that is not possible, typically because privileges
+ * were dropped since the file was created, the file is truncated through
+ * its open descriptor instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <gettext.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "teredo.h"
+#include "tunnel.h"
+#include "capture.h"
+
+/* Each buffer holds about 128 full-sized packets */
+#define CAPTURE_BUFSIZE (TEREDO_CAPTURE_SNAPLEN * 128)
+/* Longest time a sample may remain in memory */
+#define CAPTURE_FLUSH_SEC 1
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define LINKTYPE_RAW 101
+
+struct pcap_file_header
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_header
+{
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+typedef struct capture_buf
+{
+	size_t used;
+	uint8_t data[CAPTURE_BUFSIZE];
+} capture_buf;
+
+struct teredo_capture
+{
+	pthread_mutex_t lock;
+	pthread_cond_t wait;
+	pthread_t thread;
+	capture_buf *active, *idle;
+	bool stop;
+
+	unsigned sample;
+	unsigned long seen; /* atomic */
+	unsigned long dropped; /* atomic */
+
+	int fd;
+	size_t file_size, max_size;
+	char *path;
+	bool failed; /* an error was logged */
+};
+
+
+static int capture_write_header (int fd)
+{
+	static const struct pcap_file_header hdr =
+	{
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = TEREDO_CAPTURE_SNAPLEN,
+		.linktype = LINKTYPE_RAW,
+	};
+
+	return (write (fd, &hdr, sizeof (hdr)) == (ssize_t)sizeof (hdr)) ? 0 : -1;
+}
+
+
+/**
+ * Creates a capture file, with its header.
+ * @return a file descriptor, or -1 on error.
+ */
+static int capture_create_file (const char *path)
+{
+	int fd = open (path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+
+	if ((fd != -1) && capture_write_header (fd))
+	{
+		close (fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+
+static void capture_rotate (teredo_capture *c)
+{
+	size_t len = strlen (c->path);
+	char old[len + 3];
+
+	memcpy (old, c->path, len);
+	memcpy (old + len, ".1", 3);
+
+	/* Starts a new file, if the directory is (still) writable */
+	if (rename (c->path, old) == 0)
+	{
+		int fd = capture_create_file (c->path);
+		if (fd != -1)
+		{
+			close (c->fd);
+			c->fd = fd;
+			c->file_size = sizeof (struct pcap_file_header);
+			return;
+		}
+		rename (old, c->path);
+	}
+
+	/* Otherwise, starts over within the open file */
+	if (!c->failed)
+	{
+		syslog (LOG_WARNING, _("Cannot rotate packet capture file %s: %s"),
+		        c->path, _("truncating it instead"));
+		c->failed = true;
+	}
+
+	if ((ftruncate (c->fd, 0) == 0) && (lseek (c->fd, 0, SEEK_SET) == 0)
+	 && (capture_write_header (c->fd) == 0))
+		c->file_size = sizeof (struct pcap_file_header);
+	else
+	{
+		syslog (LOG_ERR, _("Cannot write packet capture file %s: %m"),
+		        c->path);
+		close (c->fd);
+		c->fd = -1;
+	}
+}
+
+
+/* Writes whole pcap records from a buffer. */
+static void capture_write (teredo_capture *c, const capture_buf *buf)
+{
+	if ((c->max_size != 0) && (c->fd != -1)
+	 && (c->file_size + buf->used > c->max_size)
+	 && (c->file_size > sizeof (struct pcap_file_header)))
+		capture_rotate (c);
+
+	if (c->fd == -1)
+		__atomic_fetch_add (&c->dropped, 1, __ATOMIC_RELAXED);
+	else
+	if (write (c->fd, buf->data, buf->used) != (ssize_t)buf->used)
+	{
+		if (!c->failed)
+		{
+			syslog (LOG_ERR, _("Cannot write packet capture file %s: %m"),
+			        c->path);
+			c->failed = true;
+		}
+		__atomic_fetch_add (&c->dropped, 1, __ATOMIC_RELAXED);
+	}
+	else
+		c->file_size += buf->used;
+}
+
+
+static void *capture_thread (void *data)
+{
+	teredo_capture *c = data;
+
+	pthread_mutex_lock (&c->lock);
+	for (;;)
+	{
+		bool stop = c->stop;
+
+		if (c->active->used > 0)
+		{
+			capture_buf *buf = c->active;
+
+			c->active = c->idle;
+			c->idle = buf;
+			pthread_mutex_unlock (&c->lock);
+
+			capture_write (c, buf);
+			buf->used = 0;
+			pthread_mutex_lock (&c->lock);
+			continue;
+		}
+
+		if (stop)
+			break;
+
+		struct timespec ts;
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_sec += CAPTURE_FLUSH_SEC;
+		pthread_cond_timedwait (&c->wait, &c->lock, &ts);
+	}
+	pthread_mutex_unlock (&c->lock);
+	return NULL;
+}
+
+
+teredo_capture *teredo_capture_open (const char *path, unsigned sample,
+                                     size_t max_size)
+{
+	teredo_capture *c = malloc (sizeof (*c));
+	if (c == NULL)
+		return NULL;
+
+	memset (c, 0, sizeof (*c));
+	c->sample = sample ? sample : 1;
+	c->max_size = max_size;
+	c->path = strdup (path);
+	c->active = malloc (sizeof (*c->active));
+	c->idle = malloc (sizeof (*c->idle));
+	if ((c->path == NULL) || (c->active == NULL) || (c->idle == NULL))
+		goto error;
+	c->active->used = c->idle->used = 0;
+
+	c->fd = capture_create_file (c->path);
+	if (c->fd == -1)
+		goto error;
+	c->file_size = sizeof (struct pcap_file_header);
+
+	pthread_mutex_init (&c->lock, NULL);
+	pthread_cond_init (&c->wait, NULL);
+	if (pthread_create (&c->thread, NULL, capture_thread, c))
+	{
+		pthread_cond_destroy (&c->wait);
+		pthread_mutex_destroy (&c->lock);
+		close (c->fd);
+		goto error;
+	}
+	return c;
+
+error:
+	free (c->idle);
+	free (c->active);
+	free (c->path);
+	free (c);
+	return NULL;
+}
+
+
+void teredo_capture_close (teredo_capture *c)
+{
+	pthread_mutex_lock (&c->lock);
+	c->stop = true;
+	pthread_cond_signal (&c->wait);
+	pthread_mutex_unlock (&c->lock);
+	pthread_join (c->thread, NULL);
+
+	if (c->fd != -1)
+		close (c->fd);
+	pthread_cond_destroy (&c->wait);
+	pthread_mutex_destroy (&c->lock);
+	free (c->idle);
+	free (c->active);
+	free (c->path);
+	free (c);
+}
+
+
+void teredo_capture_packet (teredo_capture *c, const void *data, size_t len)
+{
+	if (__atomic_fetch_add (&c->seen, 1, __ATOMIC_RELAXED) % c->sample)
+		return;
+
+	struct timeval now;
+	struct pcap_rec_header rec;
+
+	gettimeofday (&now, NULL);
+	rec.ts_sec = now.tv_sec;
+	rec.ts_usec = now.tv_usec;
+	rec.len = len;
+	rec.caplen = (len < TEREDO_CAPTURE_SNAPLEN) ? len
+	                                            : TEREDO_CAPTURE_SNAPLEN;
+
+	pthread_mutex_lock (&c->lock);
+	capture_buf *buf = c->active;
+
+	if (buf->used + sizeof (rec) + rec.caplen > sizeof (buf->data))
+	{
+		pthread_mutex_unlock (&c->lock);
+		__atomic_fetch_add (&c->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	memcpy (buf->data + buf->used, &rec, sizeof (rec));
+	memcpy (buf->data + buf->used + sizeof (rec), data, rec.caplen);
+	buf->used += sizeof (rec) + rec.caplen;
+
+	if (buf->used >= sizeof (buf->data) / 2)
+		pthread_cond_signal (&c->wait);
+	pthread_mutex_unlock (&c->lock);
+}
+
+
+unsigned long teredo_capture_dropped (teredo_capture *c)
+{
+	return __atomic_load_n (&c->dropped, __ATOMIC_RELAXED);
+}
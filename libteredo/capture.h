@@ -0,0 +1,40 @@
+/*
+ * capture.h - Sampled capture of decapsulated packets
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_CAPTURE_H
+# define LIBTEREDO_CAPTURE_H
+
+/** Bytes kept from each captured packet */
+# define TEREDO_CAPTURE_SNAPLEN 2048
+
+/**
+ * Records an IPv6 packet, if it is sampled and there is room left in the
+ * capture buffer. Never blocks on file I/O. Thread-safe.
+ */
+void teredo_capture_packet (teredo_capture *c, const void *data, size_t len);
+
+/**
+ * @return the number of sampled packets that were dropped, for lack of
+ * buffer space or because of file I/O errors.
+ */
+unsigned long teredo_capture_dropped (teredo_capture *c);
+
+#endif
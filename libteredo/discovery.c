@@ -43,6 +43,7 @@
 
 #include "teredo.h"
 #include "teredo-udp.h"
+#include "io.h"
 #include "packets.h"
 #include "v4global.h"
 #include "security.h"
@@ -55,10 +56,10 @@
 
 struct teredo_discovery
 {
-	void (*proc)(void *, int);
+	void (*proc)(void *, teredo_io *);
 	void *opaque;
-	int send_fd;
-	int recv_fd;
+	teredo_io *send_io;
+	teredo_io *recv_io;
 	struct in6_addr src;
 	teredo_thread *recv_thread;
 	pthread_t send_thread;
@@ -69,19 +70,20 @@ static const struct in6_addr in6addr_allnodes =
 { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x1 } } };
 
 
-static int teredo_discovery_send_bubble (int fd, const struct in6_addr *src)
+static int
+teredo_discovery_send_bubble (teredo_io *io, const struct in6_addr *src)
 {
-	return teredo_send_bubble (fd, htonl (TEREDO_DISCOVERY_IPV4),
+	return teredo_send_bubble (io, htonl (TEREDO_DISCOVERY_IPV4),
 	                           htons (IPPORT_TEREDO), src, &in6addr_allnodes);
 }
 
-void teredo_discovery_send_bubbles (teredo_discovery *d, int fd)
+void teredo_discovery_send_bubbles (teredo_discovery *d, teredo_io *io)
 {
 	const struct in6_addr *src = &d->src;
 #ifdef IP_MULTICAST_IF
 	/* Neither IETF nor POSIX standardized selecting the outgoing interface.
      * But if we can, try to send a packet on each interface. */
-	struct if_nameindex *idx = if_nameindex();
+	struct if_nameindex *idx = (io->fd != -1) ? if_nameindex () : NULL;
 	if (idx != NULL)
 	{
 		struct ip_mreqn mreq;
@@ -92,10 +94,11 @@ void teredo_discovery_send_bubbles (teredo_discovery *d, int fd)
 		{
 			mreq.imr_ifindex = idx[i].if_index;
 
-			if (setsockopt (fd, SOL_IP, IP_MULTICAST_IF, &mreq, sizeof (mreq)))
+			if (setsockopt (io->fd, SOL_IP, IP_MULTICAST_IF,
+			                &mreq, sizeof (mreq)))
 				continue;
 
-			teredo_discovery_send_bubble (fd, src);
+			teredo_discovery_send_bubble (io, src);
 		}
 
 		if_freenameindex (idx);
@@ -105,7 +108,7 @@ void teredo_discovery_send_bubbles (teredo_discovery *d, int fd)
 	}
 #endif
 	/* Fallback to default multicast interface only */
-	teredo_discovery_send_bubble (fd, src);
+	teredo_discovery_send_bubble (io, src);
 }
 
 
@@ -124,7 +127,7 @@ static LIBTEREDO_NORETURN void *teredo_mcast_thread (void *opaque)
 
 	for (;;)
 	{
-		teredo_discovery_send_bubble (d->send_fd, &d->src);
+		teredo_discovery_send_bubble (d->send_io, &d->src);
 
 		int interval = 200 + teredo_get_flbits (teredo_clock ()) % 100;
 
@@ -137,13 +140,13 @@ static void *teredo_discovery_thread (void *data)
 {
 	teredo_discovery *d = data;
 
-	d->proc (d->opaque, d->recv_fd);
+	d->proc (d->opaque, d->recv_io);
 	return NULL; /* dead */
 }
 
 teredo_discovery *
-teredo_discovery_start (int fd, const struct in6_addr *src,
-                        void (*proc)(void *, int fd), void *opaque)
+teredo_discovery_start (teredo_io *io, const struct in6_addr *src,
+                        void (*proc)(void *, teredo_io *), void *opaque)
 {
 	teredo_discovery *d = malloc (sizeof (*d));
 	if (d == NULL)
@@ -151,8 +154,8 @@ teredo_discovery_start (int fd, const struct in6_addr *src,
 
 	/* Setup the multicast-receiving socket */
 
-	d->recv_fd = teredo_socket (0, htons (IPPORT_TEREDO));
-	if (d->recv_fd == -1)
+	d->recv_io = teredo_io_socket (0, htons (IPPORT_TEREDO));
+	if (d->recv_io == NULL)
 	{
 		debug ("Could not create the local discovery socket");
 		free (d);
@@ -164,13 +167,13 @@ teredo_discovery_start (int fd, const struct in6_addr *src,
 		.imr_multiaddr = { .s_addr = htonl (TEREDO_DISCOVERY_IPV4) },
 	};
 
-	if (setsockopt (d->recv_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+	if (setsockopt (d->recv_io->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
 	                &mreq, sizeof mreq))
 		debug ("Local discovery multicast subscription failure: %m");
 
 	d->opaque = opaque;
 	d->proc = proc;
-	d->send_fd = fd;
+	d->send_io = io;
 	d->src = *src;
 
 	d->recv_thread = teredo_thread_start (teredo_discovery_thread, d);
@@ -182,7 +185,7 @@ teredo_discovery_start (int fd, const struct in6_addr *src,
 		if (d->recv_thread != NULL)
 			teredo_thread_stop (d->recv_thread);
 
-		teredo_close (d->recv_fd);
+		teredo_io_close (d->recv_io);
 		free (d);
 		return NULL;
 	}
@@ -197,6 +200,6 @@ void teredo_discovery_stop (teredo_discovery *d)
 	pthread_cancel (d->send_thread);
 	pthread_join (d->send_thread, NULL);
 
-	teredo_close(d->recv_fd);
+	teredo_io_close (d->recv_io);
 	free (d);
 }
@@ -27,13 +27,14 @@
  * Teredo local client discovery procedure internal state.
  */
 typedef struct teredo_discovery teredo_discovery;
+struct teredo_io;
 
 /**
  * Sends discovery bubbles to all possible interfaces.
  *
- * @param fd socket to send the bubbles from.
+ * @param io I/O backend to send the bubbles from.
  */
-void teredo_discovery_send_bubbles (teredo_discovery *d, int fd);
+void teredo_discovery_send_bubbles (teredo_discovery *d, struct teredo_io *io);
 
 /**
  * Returns true if the given @p packet looks like a discovery bubble.
@@ -45,14 +46,15 @@ bool IsDiscoveryBubble (const teredo_packet *restrict packet);
  * A list of interfaces suitable for the exchange of multicast local discovery
  * bubbles will be assembled for later use by SendDiscoveryBubble().
  *
- * @param fd socket used for sending the discovery bubbles.
+ * @param io I/O backend used for sending the discovery bubbles.
  * @param src source Teredo IPv6 address for the discovery bubbles.
  * @param proc IO procedure to use for receiving multicast traffic
  * @param opaque pointer passed to @p proc
  */
 teredo_discovery *
-teredo_discovery_start (int fd, const struct in6_addr *src,
-                        void (*proc)(void *, int fd), void *opaque);
+teredo_discovery_start (struct teredo_io *io, const struct in6_addr *src,
+                        void (*proc)(void *, struct teredo_io *),
+                        void *opaque);
 
 /**
  * Stops and destroys discovery threads created by teredo_discovery_start().
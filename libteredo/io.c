@@ -0,0 +1,496 @@
+/*
+ * io.c - Teredo packets I/O backends
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "teredo-udp.h"
+#include "io.h"
+
+/*
+ * Kernel UDP socket backend
+ */
+static int
+socket_sendv (teredo_io *io, const struct iovec *iov, size_t count,
+              uint32_t ip, uint16_t port)
+{
+	return teredo_sendv (io->fd, iov, count, ip, port);
+}
+
+
+static unsigned
+socket_recv (teredo_io *io, struct teredo_packet *p, unsigned n)
+{
+	unsigned i = 0, val;
+
+	while ((i < n) && ((val = teredo_recv_batch (io->fd, p + i, n - i)) > 0))
+		i += val;
+	return i;
+}
+
+
+static int socket_wait (teredo_io *io, struct teredo_packet *p, unsigned usec)
+{
+	return teredo_spin_recv (io->fd, p, usec);
+}
+
+
+static void socket_close (teredo_io *io)
+{
+	teredo_close (io->fd);
+	free (io);
+}
+
+
+static const teredo_io_ops socket_ops =
+{
+	.sendv = socket_sendv,
+	.recv = socket_recv,
+	.wait = socket_wait,
+	.flush = NULL,
+	.close = socket_close,
+};
+
+
+teredo_io *teredo_io_socket (uint32_t bind_ip, uint16_t port)
+{
+	teredo_io *io = malloc (sizeof (*io));
+	if (io == NULL)
+		return NULL;
+
+	io->ops = &socket_ops;
+	io->fd = teredo_socket (bind_ip, port);
+	if (io->fd == -1)
+	{
+		free (io);
+		return NULL;
+	}
+	return io;
+}
+
+
+/*
+ * Batched kernel UDP socket backend
+ */
+typedef struct mmsg_slot
+{
+	struct sockaddr_in addr;
+	size_t len;
+	uint8_t data[MIN_TEREDO_PACKET_SIZE];
+} mmsg_slot;
+
+typedef struct mmsg_io
+{
+	teredo_io io;
+	pthread_mutex_t lock;
+	unsigned batch, count;
+	mmsg_slot *slots;
+} mmsg_io;
+
+
+static void mmsg_send_one (int fd, const mmsg_slot *s)
+{
+	struct iovec iov = { (void *)s->data, s->len };
+	teredo_sendv (fd, &iov, 1, s->addr.sin_addr.s_addr, s->addr.sin_port);
+}
+
+
+/* Sends all held datagrams. Called with the lock held. */
+static void mmsg_flush_locked (mmsg_io *m)
+{
+	unsigned i = 0;
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[m->count];
+	struct iovec iov[m->count];
+
+	memset (msgs, 0, sizeof (msgs));
+	for (unsigned j = 0; j < m->count; j++)
+	{
+		mmsg_slot *s = m->slots + j;
+
+		iov[j].iov_base = s->data;
+		iov[j].iov_len = s->len;
+		msgs[j].msg_hdr.msg_name = &s->addr;
+		msgs[j].msg_hdr.msg_namelen = sizeof (s->addr);
+		msgs[j].msg_hdr.msg_iov = iov + j;
+		msgs[j].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (i < m->count)
+	{
+		int val = sendmmsg (m->io.fd, msgs + i, m->count - i, 0);
+		if (val <= 0)
+			break; /* the rest goes through the error handling below */
+		i += val;
+	}
+#endif
+
+	for (; i < m->count; i++)
+		mmsg_send_one (m->io.fd, m->slots + i);
+	m->count = 0;
+}
+
+
+static int
+mmsg_sendv (teredo_io *io, const struct iovec *iov, size_t count,
+            uint32_t ip, uint16_t port)
+{
+	mmsg_io *m = (mmsg_io *)io;
+	size_t len = 0;
+
+	for (size_t i = 0; i < count; i++)
+		len += iov[i].iov_len;
+
+	pthread_mutex_lock (&m->lock);
+	if (len > sizeof (m->slots[0].data))
+	{
+		/* Too big to be held back, keep the sending order nevertheless */
+		mmsg_flush_locked (m);
+		pthread_mutex_unlock (&m->lock);
+		return teredo_sendv (io->fd, iov, count, ip, port);
+	}
+
+	mmsg_slot *s = m->slots + m->count;
+	uint8_t *ptr = s->data;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy (ptr, iov[i].iov_base, iov[i].iov_len);
+		ptr += iov[i].iov_len;
+	}
+	memset (&s->addr, 0, sizeof (s->addr));
+	s->addr.sin_family = AF_INET;
+#ifdef HAVE_SA_LEN
+	s->addr.sin_len = sizeof (s->addr);
+#endif
+	s->addr.sin_port = port;
+	s->addr.sin_addr.s_addr = ip;
+	s->len = len;
+
+	if (++m->count >= m->batch)
+		mmsg_flush_locked (m);
+	pthread_mutex_unlock (&m->lock);
+	return len;
+}
+
+
+static void mmsg_flush (teredo_io *io)
+{
+	mmsg_io *m = (mmsg_io *)io;
+
+	pthread_mutex_lock (&m->lock);
+	if (m->count > 0)
+		mmsg_flush_locked (m);
+	pthread_mutex_unlock (&m->lock);
+}
+
+
+static void mmsg_close (teredo_io *io)
+{
+	mmsg_io *m = (mmsg_io *)io;
+
+	mmsg_flush (io);
+	teredo_close (io->fd);
+	pthread_mutex_destroy (&m->lock);
+	free (m->slots);
+	free (m);
+}
+
+
+static const teredo_io_ops mmsg_ops =
+{
+	.sendv = mmsg_sendv,
+	.recv = socket_recv,
+	.wait = socket_wait,
+	.flush = mmsg_flush,
+	.close = mmsg_close,
+};
+
+
+teredo_io *teredo_io_mmsg_fd (int fd, unsigned batch)
+{
+	if (batch == 0)
+		batch = 1;
+	if (batch > 1024) /* flushing uses the stack */
+		batch = 1024;
+
+	mmsg_io *m = malloc (sizeof (*m));
+	if (m == NULL)
+		return NULL;
+
+	m->slots = malloc (batch * sizeof (*m->slots));
+	if (m->slots == NULL)
+	{
+		free (m);
+		return NULL;
+	}
+
+	m->io.ops = &mmsg_ops;
+	m->io.fd = fd;
+	pthread_mutex_init (&m->lock, NULL);
+	m->batch = batch;
+	m->count = 0;
+	return &m->io;
+}
+
+
+teredo_io *teredo_io_mmsg (uint32_t bind_ip, uint16_t port, unsigned batch)
+{
+	int fd = teredo_socket (bind_ip, port);
+	if (fd == -1)
+		return NULL;
+
+	teredo_io *io = teredo_io_mmsg_fd (fd, batch);
+	if (io == NULL)
+		teredo_close (fd);
+	return io;
+}
+
+
+/*
+ * In-memory backend
+ */
+#define LOOPBACK_SLOTS 256
+#define LOOPBACK_MTU   2048
+
+typedef struct loopback_slot
+{
+	uint32_t ip;
+	uint16_t port;
+	uint16_t len;
+	uint8_t data[LOOPBACK_MTU];
+} loopback_slot;
+
+typedef struct loopback_io
+{
+	teredo_io io;
+	pthread_mutex_t lock;
+	struct loopback_io *peer;
+	uint32_t ip;
+	uint16_t port;
+	unsigned long sent;
+	unsigned head, count;
+	loopback_slot slots[LOOPBACK_SLOTS];
+} loopback_io;
+
+
+static int
+loopback_push (loopback_io *l, const struct iovec *iov, size_t count,
+               uint32_t ip, uint16_t port)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < count; i++)
+		len += iov[i].iov_len;
+	if (len > LOOPBACK_MTU)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	int val = -1;
+
+	pthread_mutex_lock (&l->lock);
+	if (l->count < LOOPBACK_SLOTS)
+	{
+		loopback_slot *s =
+			l->slots + ((l->head + l->count++) % LOOPBACK_SLOTS);
+		uint8_t *ptr = s->data;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			memcpy (ptr, iov[i].iov_base, iov[i].iov_len);
+			ptr += iov[i].iov_len;
+		}
+		s->ip = ip;
+		s->port = port;
+		s->len = len;
+		val = len;
+	}
+	else
+		errno = ENOBUFS;
+	pthread_mutex_unlock (&l->lock);
+	return val;
+}
+
+
+static int
+loopback_sendv (teredo_io *io, const struct iovec *iov, size_t count,
+                uint32_t ip, uint16_t port)
+{
+	loopback_io *l = (loopback_io *)io;
+
+	pthread_mutex_lock (&l->lock);
+	l->sent++;
+	pthread_mutex_unlock (&l->lock);
+
+	if (l->peer != NULL)
+		loopback_push (l->peer, iov, count, l->ip, l->port);
+
+	/* Like UDP, datagrams lost on the way are not errors */
+	size_t len = 0;
+	for (size_t i = 0; i < count; i++)
+		len += iov[i].iov_len;
+	(void)ip;
+	(void)port;
+	return len;
+}
+
+
+static unsigned
+loopback_recv (teredo_io *io, struct teredo_packet *p, unsigned n)
+{
+	loopback_io *l = (loopback_io *)io;
+	unsigned i = 0;
+
+	while (i < n)
+	{
+		pthread_mutex_lock (&l->lock);
+		if (l->count == 0)
+		{
+			pthread_mutex_unlock (&l->lock);
+			break;
+		}
+
+		const loopback_slot *s = l->slots + l->head;
+		size_t len = s->len;
+
+		memcpy (p[i].buf.fill + TEREDO_HEADROOM, s->data, len);
+		p[i].source_ipv4 = s->ip;
+		p[i].source_port = s->port;
+		l->head = (l->head + 1) % LOOPBACK_SLOTS;
+		l->count--;
+		pthread_mutex_unlock (&l->lock);
+
+		p[i].dest_ipv4 = l->ip;
+		if (teredo_parse (p + i, len) == 0)
+			i++;
+	}
+	return i;
+}
+
+
+static int
+loopback_wait (teredo_io *io, struct teredo_packet *p, unsigned usec)
+{
+	(void)usec;
+	return (loopback_recv (io, p, 1) == 1) ? 0 : -1;
+}
+
+
+static void loopback_close (teredo_io *io)
+{
+	loopback_io *l = (loopback_io *)io;
+
+	pthread_mutex_destroy (&l->lock);
+	free (l);
+}
+
+
+static const teredo_io_ops loopback_ops =
+{
+	.sendv = loopback_sendv,
+	.recv = loopback_recv,
+	.wait = loopback_wait,
+	.flush = NULL,
+	.close = loopback_close,
+};
+
+
+teredo_io *teredo_io_loopback (uint32_t ip, uint16_t port)
+{
+	loopback_io *l = malloc (sizeof (*l));
+	if (l == NULL)
+		return NULL;
+
+	l->io.ops = &loopback_ops;
+	l->io.fd = -1;
+	pthread_mutex_init (&l->lock, NULL);
+	l->peer = NULL;
+	l->ip = ip;
+	l->port = port;
+	l->sent = 0;
+	l->head = l->count = 0;
+	return &l->io;
+}
+
+
+void teredo_io_loopback_connect (teredo_io *a, teredo_io *b)
+{
+	loopback_io *la = (loopback_io *)a;
+	loopback_io *lb = (loopback_io *)b;
+
+	la->peer = lb;
+	lb->peer = la;
+}
+
+
+int teredo_io_loopback_inject (teredo_io *io, const void *data, size_t len,
+                               uint32_t ip, uint16_t port)
+{
+	struct iovec iov = { (void *)data, len };
+
+	return (loopback_push ((loopback_io *)io, &iov, 1, ip,
+	                       port) == -1) ? -1 : 0;
+}
+
+
+unsigned long teredo_io_loopback_sent (teredo_io *io)
+{
+	loopback_io *l = (loopback_io *)io;
+	unsigned long sent;
+
+	pthread_mutex_lock (&l->lock);
+	sent = l->sent;
+	pthread_mutex_unlock (&l->lock);
+	return sent;
+}
+
+
+/*
+ * Helpers
+ */
+int teredo_io_send (teredo_io *io, const void *data, size_t len,
+                    uint32_t ip, uint16_t port)
+{
+	struct iovec iov = { (void *)data, len };
+	return teredo_io_sendv (io, &iov, 1, ip, port);
+}
+
+
+int teredo_io_send_buf (teredo_io *io, const teredo_buf *b,
+                        uint32_t ip, uint16_t port)
+{
+	return teredo_io_send (io, b->data, b->len, ip, port);
+}
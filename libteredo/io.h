@@ -0,0 +1,191 @@
+/*
+ * io.h - Teredo packets I/O backends
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_IO_H
+# define LIBTEREDO_IO_H
+
+struct iovec;
+struct teredo_packet;
+struct teredo_buf;
+
+typedef struct teredo_io teredo_io;
+
+/**
+ * Operations of a Teredo I/O backend, i.e. a way to exchange Teredo
+ * UDP/IPv4 datagrams. Addresses and ports are in network byte order.
+ */
+typedef struct teredo_io_ops
+{
+	/**
+	 * Sends an UDP/IPv4 datagram. Thread-safe.
+	 * @return number of bytes sent (or held back), or -1 on error.
+	 */
+	int (*sendv) (teredo_io *io, const struct iovec *iov, size_t count,
+	              uint32_t ip, uint16_t port);
+	/**
+	 * Receives and parses up to n Teredo packets. Never blocks.
+	 * @return the number of packets received.
+	 */
+	unsigned (*recv) (teredo_io *io, struct teredo_packet *p, unsigned n);
+	/**
+	 * Waits for, receives and parses one Teredo packet, spinning up to
+	 * usec microseconds before blocking (see teredo_spin_recv()).
+	 * Cancellation point.
+	 * @return 0 on success, -1 on error.
+	 */
+	int (*wait) (teredo_io *io, struct teredo_packet *p, unsigned usec);
+	/**
+	 * Sends the datagrams that the backend held back, if any.
+	 * NULL if the backend never holds datagrams back.
+	 */
+	void (*flush) (teredo_io *io);
+	/** Releases all resources of the backend. */
+	void (*close) (teredo_io *io);
+} teredo_io_ops;
+
+/**
+ * Teredo I/O backend instance. Backends extend this structure.
+ */
+struct teredo_io
+{
+	const teredo_io_ops *ops;
+	/** Underlying socket, for polling and socket options, or -1 */
+	int fd;
+};
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/**
+ * Opens an I/O backend for a kernel UDP/IPv4 socket (see teredo_socket()).
+ *
+ * @return NULL on error.
+ */
+teredo_io *teredo_io_socket (uint32_t bind_ip, uint16_t port);
+
+/**
+ * Opens an I/O backend for a kernel UDP/IPv4 socket, whose datagrams are
+ * copied and held back, then sent in batches (with sendmmsg() if available)
+ * when the batch is full or when the backend is flushed. Sent datagrams
+ * must not exceed MIN_TEREDO_PACKET_SIZE bytes; larger ones are sent
+ * immediately.
+ *
+ * @param batch maximum number of datagrams held back
+ *
+ * @return NULL on error.
+ */
+teredo_io *teredo_io_mmsg (uint32_t bind_ip, uint16_t port, unsigned batch);
+
+/**
+ * Opens a batched I/O backend (see teredo_io_mmsg()) for an already
+ * opened Teredo socket, such as one from teredo_socket_reuseport().
+ * On success, the backend owns the socket.
+ *
+ * @return NULL on error.
+ */
+teredo_io *teredo_io_mmsg_fd (int fd, unsigned batch);
+
+/**
+ * Creates an in-memory I/O backend, for tests and benchmarks.
+ * Datagrams sent through it are counted, then delivered to the connected
+ * peer backend, if any, or discarded. Received datagrams come from the peer
+ * or from teredo_io_loopback_inject(). Waiting for a packet never blocks.
+ *
+ * @param ip IPv4 address of the backend, as seen by its peer
+ * @param port UDP port of the backend, as seen by its peer
+ *
+ * @return NULL on error.
+ */
+teredo_io *teredo_io_loopback (uint32_t ip, uint16_t port);
+
+/**
+ * Connects two in-memory I/O backends to one another.
+ * Both must remain valid until either is closed.
+ */
+void teredo_io_loopback_connect (teredo_io *a, teredo_io *b);
+
+/**
+ * Queues an UDP datagram payload (Teredo headers and IPv6 packet) for
+ * reception by an in-memory I/O backend.
+ *
+ * @return 0 on success, -1 if the datagram is too big or the queue is full.
+ */
+int teredo_io_loopback_inject (teredo_io *io, const void *data, size_t len,
+                               uint32_t ip, uint16_t port);
+
+/**
+ * @return the number of datagrams sent through an in-memory I/O backend.
+ */
+unsigned long teredo_io_loopback_sent (teredo_io *io);
+
+/**
+ * Sends an UDP/IPv4 datagram through an I/O backend.
+ * @return number of bytes sent, or -1 on error.
+ */
+int teredo_io_send (teredo_io *io, const void *data, size_t len,
+                    uint32_t ip, uint16_t port);
+
+/**
+ * Sends the content of a packet buffer through an I/O backend.
+ * @return number of bytes sent, or -1 on error.
+ */
+int teredo_io_send_buf (teredo_io *io, const struct teredo_buf *b,
+                        uint32_t ip, uint16_t port);
+
+# ifdef __cplusplus
+}
+# endif
+
+static inline int
+teredo_io_sendv (teredo_io *io, const struct iovec *iov, size_t count,
+                 uint32_t ip, uint16_t port)
+{
+	return io->ops->sendv (io, iov, count, ip, port);
+}
+
+static inline unsigned
+teredo_io_recv (teredo_io *io, struct teredo_packet *p, unsigned n)
+{
+	return io->ops->recv (io, p, n);
+}
+
+static inline int
+teredo_io_wait (teredo_io *io, struct teredo_packet *p, unsigned usec)
+{
+	return io->ops->wait (io, p, usec);
+}
+
+static inline void teredo_io_flush (teredo_io *io)
+{
+	if (io->ops->flush != NULL)
+		io->ops->flush (io);
+}
+
+/**
+ * Closes an I/O backend.
+ */
+static inline void teredo_io_close (teredo_io *io)
+{
+	io->ops->close (io);
+}
+
+#endif
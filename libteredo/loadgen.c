@@ -0,0 +1,726 @@
+/*
+ * loadgen.c - Synthetic Teredo clients load generator
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Simulates a number of Teredo clients, each with its own UDP socket and
+ * hence its own mapped address. The clients qualify against a Teredo server,
+ * optionally discover their relay by pinging a native IPv6 host through the
+ * server, hole punch toward the target relay with bubbles, and then stream
+ * ICMPv6 Echo Requests at a fixed aggregate rate. Round-trip times of each
+ * phase are reported as histograms.
+ *
+ * The target can be a Teredo relay or teredo-mire, whose client port answers
+ * Echo Requests from anyone.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_GETOPT_H
+# include <getopt.h>
+#endif
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "packets.h"
+#include "io.h"
+#include "security.h"
+#include "tools.h"
+
+/** Number of logarithmic histogram buckets (1 microsecond to ~1 hour) */
+#define HIST_BUCKETS 32
+
+typedef struct lg_hist
+{
+	unsigned long sent, received;
+	uint64_t sum, max;
+	unsigned long bucket[HIST_BUCKETS];
+} lg_hist;
+
+typedef struct lg_client
+{
+	union teredo_addr addr;
+	uint64_t sent; /* time of the last RS, ping or bubble (ns) */
+	uint32_t relay_ip;
+	uint16_t relay_port;
+	bool qualified;
+	bool discovered;
+	uint8_t nonce[LIBTEREDO_NONCE_LEN];
+} lg_client;
+
+enum
+{
+	PHASE_QUALIFY,
+	PHASE_PING,
+	PHASE_BUBBLE,
+	PHASE_DATA,
+	PHASE_MAX
+};
+
+static const char *const phase_names[PHASE_MAX] =
+	{ "qualification", "ping", "bubble", "data" };
+
+typedef struct loadgen
+{
+	struct pollfd *ufd;
+	teredo_io **io;
+	lg_client *clients;
+	unsigned count;
+
+	uint32_t server_ip;
+	uint32_t target_ip;
+	uint16_t target_port;
+	struct in6_addr dst; /* destination of data packets */
+	size_t size; /* data packets ICMPv6 payload size */
+
+	int phase;
+	uint64_t start;
+	lg_hist hist[PHASE_MAX];
+} loadgen;
+
+/* Data packets payload header */
+typedef struct lg_stamp
+{
+	uint32_t client;
+	uint32_t seq;
+	uint64_t time;
+} lg_stamp;
+
+static teredo_packet packet;
+
+
+static void hist_add (lg_hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned i = 0;
+
+	while ((us >> i) && (i < HIST_BUCKETS - 1))
+		i++;
+
+	h->received++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->bucket[i]++;
+}
+
+
+/* @return the upper bound (in microseconds) of the given quantile */
+static unsigned long hist_quantile (const lg_hist *h, double q)
+{
+	unsigned long rank = (unsigned long)(q * h->received), n = 0;
+
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+	{
+		n += h->bucket[i];
+		if (n > rank)
+			return 1UL << i;
+	}
+	return 1UL << (HIST_BUCKETS - 1);
+}
+
+
+static void hist_print (const char *name, const lg_hist *h, double secs)
+{
+	if (h->sent == 0)
+		return;
+
+	printf ("%s: %lu sent, %lu received (%.2f%% loss) in %.3f s,"
+	        " %.0f packets/s\n", name, h->sent, h->received,
+	        (h->received < h->sent)
+	            ? 100. * (h->sent - h->received) / h->sent : 0.,
+	        secs, h->sent / secs);
+	if (h->received == 0)
+		return;
+
+	printf (" RTT: mean %.1f us, p50 < %lu us, p90 < %lu us, p99 < %lu us,"
+	        " max %.1f us\n", h->sum / 1000. / h->received,
+	        hist_quantile (h, .5), hist_quantile (h, .9),
+	        hist_quantile (h, .99), h->max / 1000.);
+
+	unsigned long top = 0;
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+		if (h->bucket[i] > top)
+			top = h->bucket[i];
+
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (h->bucket[i] == 0)
+			continue;
+
+		int bar = (int)(50 * h->bucket[i] / top);
+		printf ("  < %10lu us: %9lu %.*s\n", 1UL << i, h->bucket[i],
+		        bar ? bar : 1,
+		        "##################################################");
+	}
+}
+
+
+static void
+make_teredo_addr (union teredo_addr *addr, uint32_t server, uint32_t ipv4,
+                  uint16_t port)
+{
+	addr->teredo.prefix = htonl (TEREDO_PREFIX);
+	addr->teredo.server_ip = server;
+	addr->teredo.flags = 0;
+	addr->teredo.client_port = ~port;
+	addr->teredo.client_ip = ~ipv4;
+}
+
+
+static int
+send_echo (teredo_io *io, const struct in6_addr *src, const struct in6_addr *dst,
+           const lg_stamp *stamp, size_t size, uint32_t ip, uint16_t port)
+{
+	struct ip6_hdr ip6;
+	struct icmp6_hdr icmp6;
+	static const uint8_t fill[65535 - sizeof (lg_stamp)];
+
+	if (size < sizeof (*stamp))
+		size = sizeof (*stamp);
+
+	struct iovec iov[] =
+	{
+		{ &ip6, sizeof (ip6) },
+		{ &icmp6, sizeof (icmp6) },
+		{ (void *)stamp, sizeof (*stamp) },
+		{ (void *)fill, size - sizeof (*stamp) }
+	};
+
+	ip6.ip6_flow = htonl (0x60000000);
+	ip6.ip6_plen = htons (sizeof (icmp6) + size);
+	ip6.ip6_nxt = IPPROTO_ICMPV6;
+	ip6.ip6_hlim = 128;
+	ip6.ip6_src = *src;
+	ip6.ip6_dst = *dst;
+
+	icmp6.icmp6_type = ICMP6_ECHO_REQUEST;
+	icmp6.icmp6_code = 0;
+	icmp6.icmp6_cksum = 0;
+	icmp6.icmp6_id = htons (stamp->client);
+	icmp6.icmp6_seq = htons (stamp->seq);
+	icmp6.icmp6_cksum = teredo_cksum (src, dst, IPPROTO_ICMPV6, iov + 1, 3);
+
+	return teredo_io_sendv (io, iov, 4, ip, port) > 0 ? 0 : -1;
+}
+
+
+static void send_one (loadgen *lg, unsigned i)
+{
+	lg_hist *h = lg->hist + lg->phase;
+	lg_client *c = lg->clients + (i % lg->count);
+	teredo_io *io = lg->io[i % lg->count];
+	int val = 0;
+
+	if ((lg->phase != PHASE_QUALIFY) && !c->qualified)
+		return;
+
+	c->sent = tool_now_ns ();
+
+	switch (lg->phase)
+	{
+		case PHASE_QUALIFY:
+			for (unsigned j = 0; j < sizeof (c->nonce); j++)
+				c->nonce[j] = rand ();
+			val = teredo_send_rs (io, lg->server_ip, c->nonce, false);
+			break;
+
+		case PHASE_PING:
+			val = SendPing (io, &c->addr, &lg->dst);
+			break;
+
+		case PHASE_BUBBLE:
+			val = teredo_send_bubble (io, lg->target_ip, lg->target_port,
+			                          &c->addr.ip6, &lg->dst);
+			break;
+
+		case PHASE_DATA:
+		{
+			lg_stamp stamp = { i % lg->count, i / lg->count, c->sent };
+			uint32_t ip = lg->target_ip;
+			uint16_t port = lg->target_port;
+
+			if (ip == 0)
+			{
+				if (!c->discovered)
+					return;
+				ip = c->relay_ip;
+				port = c->relay_port;
+			}
+			val = send_echo (io, &c->addr.ip6, &lg->dst, &stamp, lg->size,
+			                 ip, port);
+			break;
+		}
+	}
+
+	if (val == 0)
+		h->sent++;
+}
+
+
+static void recv_one (loadgen *lg, unsigned i, const teredo_packet *p)
+{
+	const struct ip6_hdr *ip6 = p->ip6;
+	lg_client *c = lg->clients + i;
+	uint64_t now = tool_now_ns ();
+
+	if (p->ip6_len < sizeof (*ip6)
+	 || (ntohs (ip6->ip6_plen) + sizeof (*ip6)) > p->ip6_len)
+		return;
+
+	if (IsBubble (ip6))
+	{
+		if (p->orig_ipv4 != 0)
+		{
+			/* Indirect bubble from a relay: hole punching */
+			if (c->qualified)
+				teredo_reply_bubble (lg->io[i], p->orig_ipv4,
+				                     p->orig_port, ip6);
+			return;
+		}
+
+		if (lg->phase == PHASE_BUBBLE)
+			hist_add (lg->hist + PHASE_BUBBLE, now - c->sent);
+		return;
+	}
+
+	if (ip6->ip6_nxt != IPPROTO_ICMPV6)
+		return;
+
+	const struct icmp6_hdr *icmp6 = (const struct icmp6_hdr *)(ip6 + 1);
+
+	switch (lg->phase)
+	{
+		case PHASE_QUALIFY:
+		{
+			union teredo_addr addr;
+			uint16_t mtu;
+
+			if (c->qualified || !p->auth_present
+			 || memcmp (p->auth_nonce, c->nonce, sizeof (c->nonce))
+			 || teredo_parse_ra (p, &addr, false, &mtu))
+				return;
+
+			c->addr = addr;
+			c->qualified = true;
+			hist_add (lg->hist + PHASE_QUALIFY, now - c->sent);
+			break;
+		}
+
+		case PHASE_PING:
+			if (c->discovered || CheckPing (p))
+				return;
+
+			c->relay_ip = p->source_ipv4;
+			c->relay_port = p->source_port;
+			c->discovered = true;
+			hist_add (lg->hist + PHASE_PING, now - c->sent);
+			break;
+
+		case PHASE_DATA:
+		{
+			lg_stamp stamp;
+
+			if ((icmp6->icmp6_type != ICMP6_ECHO_REPLY)
+			 || (ntohs (ip6->ip6_plen) < sizeof (*icmp6) + sizeof (stamp)))
+				return;
+
+			memcpy (&stamp, icmp6 + 1, sizeof (stamp));
+			if ((stamp.client != i) || (stamp.time < lg->start)
+			 || (stamp.time > now))
+				return;
+
+			hist_add (lg->hist + PHASE_DATA, now - stamp.time);
+			break;
+		}
+	}
+}
+
+
+static void poll_clients (loadgen *lg, int timeout)
+{
+	int n = poll (lg->ufd, lg->count, timeout);
+
+	for (unsigned i = 0; (n > 0) && (i < lg->count); i++)
+	{
+		if (lg->ufd[i].revents == 0)
+			continue;
+		n--;
+
+		for (unsigned j = 0; j < 16; j++)
+		{
+			if (teredo_io_recv (lg->io[i], &packet, 1) == 0)
+				break;
+			recv_one (lg, i, &packet);
+		}
+	}
+}
+
+
+/**
+ * Sends count packets at a given aggregate rate, round-robin across clients,
+ * while processing replies, then waits for late replies.
+ *
+ * @return the phase duration in seconds.
+ */
+static double
+run_phase (loadgen *lg, int phase, unsigned long count, unsigned long pps,
+           unsigned linger_ms)
+{
+	uint64_t start = tool_now_ns (), end = 0;
+	unsigned long sent = 0;
+
+	lg->phase = phase;
+	lg->start = start;
+
+	for (;;)
+	{
+		uint64_t now = tool_now_ns ();
+		int timeout;
+
+		if (sent < count)
+		{
+			unsigned long due = (now - start) * pps / 1000000000 + 1;
+
+			while ((sent < due) && (sent < count))
+				send_one (lg, sent++);
+
+			/* Milliseconds until the next packet is due */
+			uint64_t next = start + sent * UINT64_C(1000000000) / pps;
+
+			timeout = 0;
+			if (sent >= count)
+				end = now;
+			else
+			if (next > now)
+				timeout = (next - now) / 1000000;
+			if (timeout > 100)
+				timeout = 100;
+		}
+		else
+		{
+			uint64_t linger = linger_ms * UINT64_C(1000000);
+
+			if (now - end >= linger)
+				break;
+			timeout = (linger - (now - end)) / 1000000 + 1;
+		}
+
+		poll_clients (lg, timeout);
+	}
+
+	return (end - start) / 1e9;
+}
+
+
+static int parse_uint (const char *str, unsigned long *value)
+{
+	char *end;
+	unsigned long l = strtoul (str, &end, 0);
+
+	if (*end || (l == 0) || (l > UINT_MAX))
+	{
+		fprintf (stderr, "Invalid number: %s\n", str);
+		return -1;
+	}
+	*value = l;
+	return 0;
+}
+
+
+static int
+open_clients (loadgen *lg, uint32_t bind_ip, unsigned naddr)
+{
+	struct rlimit lim;
+
+	if ((getrlimit (RLIMIT_NOFILE, &lim) == 0)
+	 && (lim.rlim_cur < lg->count + 16))
+	{
+		lim.rlim_cur = lg->count + 16;
+		if (lim.rlim_cur > lim.rlim_max)
+			lim.rlim_cur = lim.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &lim);
+	}
+
+	for (unsigned i = 0; i < lg->count; i++)
+	{
+		uint32_t ip = bind_ip
+			? htonl (ntohl (bind_ip) + (i % naddr)) : INADDR_ANY;
+		struct sockaddr_in addr;
+		socklen_t len = sizeof (addr);
+		teredo_io *io = teredo_io_socket (ip, 0);
+
+		if (io == NULL)
+		{
+			perror ("teredo_socket");
+			fprintf (stderr, "Only %u clients could be created\n", i);
+			return -1;
+		}
+
+		lg->io[i] = io;
+		lg->ufd[i].fd = io->fd;
+		lg->ufd[i].events = POLLIN;
+		if (getsockname (io->fd, (struct sockaddr *)&addr, &len))
+			return -1;
+
+		/* Address used if qualification is skipped */
+		if (ip == INADDR_ANY)
+			ip = htonl (INADDR_LOOPBACK);
+		make_teredo_addr (&lg->clients[i].addr, lg->server_ip, ip,
+		                  addr.sin_port);
+	}
+	return 0;
+}
+
+
+static int usage (const char *path)
+{
+	printf ("Usage: %s [OPTIONS] <server IPv4> [target IPv4[:port]]\n"
+"Simulates Teredo clients to load a Teredo server and relay\n"
+"\n"
+"  -a, --addresses  number of consecutive local IPv4 addresses (default: 1)\n"
+"  -b, --bind       first local IPv4 address of the clients\n"
+"  -c, --clients    number of simulated clients (default: 1000)\n"
+"  -d, --duration   data streaming duration in seconds (default: 10)\n"
+"  -h, --help       display this help and exit\n"
+"  -n, --no-qualify skip qualification, derive Teredo addresses locally\n"
+"  -P, --ping       native IPv6 host to ping for relay discovery,\n"
+"                   and destination of data packets\n"
+"  -r, --rate       packets per second, all clients together\n"
+"                   (default: 10000)\n"
+"  -s, --size       data packets ICMPv6 payload size (default: 64)\n"
+"  -V, --version    display program version and exit\n"
+"\n"
+"The target port defaults to %u (teredo-mire Echo responder).\n",
+	        path, IPPORT_TEREDO + 1);
+	return 0;
+}
+
+
+static int version (void)
+{
+	puts (PACKAGE_NAME" v"PACKAGE_VERSION);
+	return 0;
+}
+
+
+int main (int argc, char *argv[])
+{
+	static const struct option opts[] =
+	{
+		{ "addresses",  required_argument, NULL, 'a' },
+		{ "bind",       required_argument, NULL, 'b' },
+		{ "clients",    required_argument, NULL, 'c' },
+		{ "duration",   required_argument, NULL, 'd' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "no-qualify", no_argument,       NULL, 'n' },
+		{ "ping",       required_argument, NULL, 'P' },
+		{ "rate",       required_argument, NULL, 'r' },
+		{ "size",       required_argument, NULL, 's' },
+		{ "version",    no_argument,       NULL, 'V' },
+		{ NULL,         no_argument,       NULL, '\0'}
+	};
+	unsigned long naddr = 1, clients = 1000, duration = 10, pps = 10000,
+	              size = 64;
+	uint32_t bind_ip = INADDR_ANY;
+	bool qualify = true, ping = false;
+	loadgen lg;
+
+	memset (&lg, 0, sizeof (lg));
+
+	int c;
+	while ((c = getopt_long (argc, argv, "a:b:c:d:hnP:r:s:V", opts,
+	                         NULL)) != -1)
+		switch (c)
+		{
+			case 'a':
+				if (parse_uint (optarg, &naddr))
+					return 1;
+				break;
+
+			case 'b':
+				if (tool_parse_ipv4 (optarg, &bind_ip, NULL))
+				{
+					fprintf (stderr, "Invalid IPv4 address: %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'c':
+				if (parse_uint (optarg, &clients))
+					return 1;
+				break;
+
+			case 'd':
+				if (parse_uint (optarg, &duration))
+					return 1;
+				break;
+
+			case 'h':
+				return usage (argv[0]);
+
+			case 'n':
+				qualify = false;
+				break;
+
+			case 'P':
+				if (inet_pton (AF_INET6, optarg, &lg.dst) != 1)
+				{
+					fprintf (stderr, "Invalid IPv6 address: %s\n", optarg);
+					return 1;
+				}
+				ping = true;
+				break;
+
+			case 'r':
+				if (parse_uint (optarg, &pps))
+					return 1;
+				break;
+
+			case 's':
+				if (parse_uint (optarg, &size))
+					return 1;
+				break;
+
+			case 'V':
+				return version ();
+
+			default:
+				return 1;
+		}
+
+	if ((optind >= argc) || (argc - optind > 2))
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	if (tool_parse_ipv4 (argv[optind], &lg.server_ip, NULL))
+	{
+		fprintf (stderr, "Invalid server IPv4 address: %s\n", argv[optind]);
+		return 1;
+	}
+
+	lg.target_port = htons (IPPORT_TEREDO + 1);
+	if ((argc - optind == 2)
+	 && tool_parse_ipv4 (argv[optind + 1], &lg.target_ip,
+	                     &lg.target_port))
+	{
+		fprintf (stderr, "Invalid target: %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	if ((lg.target_ip == 0) && !ping)
+	{
+		fprintf (stderr, "Either a target or a host to ping is needed\n");
+		return 1;
+	}
+
+	if (size > 65535 - sizeof (struct icmp6_hdr))
+		size = 65535 - sizeof (struct icmp6_hdr);
+
+	if (!ping)
+	{
+		/* Data packets are sent to the target own Teredo address */
+		union teredo_addr dst;
+
+		make_teredo_addr (&dst, lg.server_ip, lg.target_ip,
+		                  lg.target_port);
+		lg.dst = dst.ip6;
+	}
+
+	lg.count = clients;
+	lg.size = size;
+	lg.ufd = calloc (clients, sizeof (*lg.ufd));
+	lg.io = calloc (clients, sizeof (*lg.io));
+	lg.clients = calloc (clients, sizeof (*lg.clients));
+	if ((lg.ufd == NULL) || (lg.io == NULL) || (lg.clients == NULL)
+	 || teredo_init_HMAC ())
+	{
+		perror ("Error");
+		return 1;
+	}
+
+	int retval = 1;
+	unsigned long ready = 0;
+	double secs[PHASE_MAX] = { 0., 0., 0., 0. };
+
+	if (open_clients (&lg, bind_ip, naddr))
+		goto out;
+
+	srand (tool_now_ns ());
+	if (qualify)
+		secs[PHASE_QUALIFY] = run_phase (&lg, PHASE_QUALIFY, clients,
+		                                 pps, 4000);
+	else
+		for (unsigned i = 0; i < clients; i++)
+			lg.clients[i].qualified = true;
+
+	for (unsigned i = 0; i < clients; i++)
+		if (lg.clients[i].qualified)
+			ready++;
+	printf ("%lu of %lu clients qualified\n", ready, clients);
+	if (ready == 0)
+		goto out;
+
+	if (ping)
+		secs[PHASE_PING] = run_phase (&lg, PHASE_PING, clients, pps, 4000);
+	if (lg.target_ip != 0)
+		secs[PHASE_BUBBLE] = run_phase (&lg, PHASE_BUBBLE, clients, pps,
+		                                1000);
+
+	secs[PHASE_DATA] = run_phase (&lg, PHASE_DATA, pps * duration, pps,
+	                              1000);
+
+	for (unsigned i = 0; i < PHASE_MAX; i++)
+		hist_print (phase_names[i], lg.hist + i, secs[i]);
+	retval = 0;
+
+out:
+	for (unsigned i = 0; i < clients; i++)
+		if (lg.io[i] != NULL)
+			teredo_io_close (lg.io[i]);
+	teredo_deinit_HMAC ();
+	free (lg.clients);
+	free (lg.io);
+	free (lg.ufd);
+	return retval;
+}
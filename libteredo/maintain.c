@@ -48,6 +48,7 @@
 #include "clock.h"
 #include "teredo.h"
 #include "teredo-udp.h"
+#include "io.h"
 #include "packets.h"
 
 #include "security.h"
@@ -61,7 +62,7 @@ struct teredo_maintenance
 	pthread_mutex_t lock;
 	pthread_cond_t received;
 
-	int fd;
+	teredo_io *io;
 	struct
 	{
 		teredo_state state;
@@ -266,7 +267,7 @@ void maintenance_thread (teredo_maintenance *m)
 		pthread_mutex_lock(&m->lock);
 		teredo_get_nonce (deadline.tv_sec, server_ip, htons (IPPORT_TEREDO),
 		                  m->nonce);
-		teredo_send_rs (m->fd, server_ip, m->nonce, false);
+		teredo_send_rs (m->io, server_ip, m->nonce, false);
 		m->server_ip = server_ip;
 		ostate = *state;
 
@@ -359,7 +360,7 @@ static const unsigned RefreshDelay = 30; // seconds
 static const unsigned RestartDelay = 100; // seconds
 
 teredo_maintenance *
-teredo_maintenance_create (int fd, teredo_state_cb cb, void *opaque,
+teredo_maintenance_create (teredo_io *io, teredo_state_cb cb, void *opaque,
                            const char *s1, const char *s2,
                            unsigned q_sec, unsigned q_retries,
                            unsigned refresh_sec, unsigned restart_sec)
@@ -370,7 +371,7 @@ teredo_maintenance_create (int fd, teredo_state_cb cb, void *opaque,
 		return NULL;
 
 	memset (m, 0, sizeof (*m));
-	m->fd = fd;
+	m->io = io;
 	m->state.cb = cb;
 	m->state.opaque = opaque;
 
@@ -46,6 +46,7 @@ typedef struct teredo_state
  * Teredo client maintenance procedure internal state.
  */
 typedef struct teredo_maintenance teredo_maintenance;
+struct teredo_io;
 
 /**
  * Callback prototype for the maintenance procedure to notify about Teredo
@@ -58,7 +59,7 @@ typedef void (*teredo_state_cb) (const struct teredo_state *s, void *opaque);
 /**
  * Creates a Teredo client maintenance procedure instance.
  *
- * @param fd socket to send router solicitation with
+ * @param io I/O backend to send router solicitation with
  * @param cb status change notification callback
  * @param opaque data for @a cb callback
  * @param s1 primary server address/hostname
@@ -71,7 +72,7 @@ typedef void (*teredo_state_cb) (const struct teredo_state *s, void *opaque);
  * @return NULL on error.
  */
 teredo_maintenance *
-teredo_maintenance_create (int fd, teredo_state_cb cb, void *opaque,
+teredo_maintenance_create (struct teredo_io *io, teredo_state_cb cb, void *opaque,
                            const char *s1, const char *s2,
                            unsigned q_sec, unsigned q_retries,
                            unsigned refresh_sec, unsigned restart_sec);
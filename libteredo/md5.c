@@ -324,6 +324,228 @@ md5_process(md5_state_t *pms, const md5_byte_t *data /*[64]*/)
     pms->abcd[3] += d;
 }
 
+#if (defined(__GNUC__) && (__GNUC__ >= 5)) || defined(__clang__)
+/* Multi-buffer compression: one lane per message, same code as above. */
+typedef md5_word_t md5_vec_t
+    __attribute__((vector_size(sizeof(md5_word_t) * MD5_LANES)));
+
+static void
+md5_process_lanes(md5_word_t abcd[4][MD5_LANES],
+		  const md5_byte_t *const data[MD5_LANES])
+{
+    md5_vec_t a, b, c, d, t, X[16];
+    int i, k;
+
+    memcpy(&a, abcd[0], sizeof(a));
+    memcpy(&b, abcd[1], sizeof(b));
+    memcpy(&c, abcd[2], sizeof(c));
+    memcpy(&d, abcd[3], sizeof(d));
+
+    for (k = 0; k < 16; ++k)
+	for (i = 0; i < MD5_LANES; ++i) {
+	    const md5_byte_t *xp = data[i] + 4 * k;
+
+	    X[k][i] = xp[0] + (xp[1] << 8) + (xp[2] << 16)
+		+ ((md5_word_t)xp[3] << 24);
+	}
+
+#define SET(a, b, c, d, k, s, Ti)\
+  t = a + F(b,c,d) + X[k] + Ti;\
+  a = ROTATE_LEFT(t, s) + b
+    SET(a, b, c, d,  0,  7,  T1);
+    SET(d, a, b, c,  1, 12,  T2);
+    SET(c, d, a, b,  2, 17,  T3);
+    SET(b, c, d, a,  3, 22,  T4);
+    SET(a, b, c, d,  4,  7,  T5);
+    SET(d, a, b, c,  5, 12,  T6);
+    SET(c, d, a, b,  6, 17,  T7);
+    SET(b, c, d, a,  7, 22,  T8);
+    SET(a, b, c, d,  8,  7,  T9);
+    SET(d, a, b, c,  9, 12, T10);
+    SET(c, d, a, b, 10, 17, T11);
+    SET(b, c, d, a, 11, 22, T12);
+    SET(a, b, c, d, 12,  7, T13);
+    SET(d, a, b, c, 13, 12, T14);
+    SET(c, d, a, b, 14, 17, T15);
+    SET(b, c, d, a, 15, 22, T16);
+#undef SET
+#define SET(a, b, c, d, k, s, Ti)\
+  t = a + G(b,c,d) + X[k] + Ti;\
+  a = ROTATE_LEFT(t, s) + b
+    SET(a, b, c, d,  1,  5, T17);
+    SET(d, a, b, c,  6,  9, T18);
+    SET(c, d, a, b, 11, 14, T19);
+    SET(b, c, d, a,  0, 20, T20);
+    SET(a, b, c, d,  5,  5, T21);
+    SET(d, a, b, c, 10,  9, T22);
+    SET(c, d, a, b, 15, 14, T23);
+    SET(b, c, d, a,  4, 20, T24);
+    SET(a, b, c, d,  9,  5, T25);
+    SET(d, a, b, c, 14,  9, T26);
+    SET(c, d, a, b,  3, 14, T27);
+    SET(b, c, d, a,  8, 20, T28);
+    SET(a, b, c, d, 13,  5, T29);
+    SET(d, a, b, c,  2,  9, T30);
+    SET(c, d, a, b,  7, 14, T31);
+    SET(b, c, d, a, 12, 20, T32);
+#undef SET
+#define SET(a, b, c, d, k, s, Ti)\
+  t = a + H(b,c,d) + X[k] + Ti;\
+  a = ROTATE_LEFT(t, s) + b
+    SET(a, b, c, d,  5,  4, T33);
+    SET(d, a, b, c,  8, 11, T34);
+    SET(c, d, a, b, 11, 16, T35);
+    SET(b, c, d, a, 14, 23, T36);
+    SET(a, b, c, d,  1,  4, T37);
+    SET(d, a, b, c,  4, 11, T38);
+    SET(c, d, a, b,  7, 16, T39);
+    SET(b, c, d, a, 10, 23, T40);
+    SET(a, b, c, d, 13,  4, T41);
+    SET(d, a, b, c,  0, 11, T42);
+    SET(c, d, a, b,  3, 16, T43);
+    SET(b, c, d, a,  6, 23, T44);
+    SET(a, b, c, d,  9,  4, T45);
+    SET(d, a, b, c, 12, 11, T46);
+    SET(c, d, a, b, 15, 16, T47);
+    SET(b, c, d, a,  2, 23, T48);
+#undef SET
+#define SET(a, b, c, d, k, s, Ti)\
+  t = a + I(b,c,d) + X[k] + Ti;\
+  a = ROTATE_LEFT(t, s) + b
+    SET(a, b, c, d,  0,  6, T49);
+    SET(d, a, b, c,  7, 10, T50);
+    SET(c, d, a, b, 14, 15, T51);
+    SET(b, c, d, a,  5, 21, T52);
+    SET(a, b, c, d, 12,  6, T53);
+    SET(d, a, b, c,  3, 10, T54);
+    SET(c, d, a, b, 10, 15, T55);
+    SET(b, c, d, a,  1, 21, T56);
+    SET(a, b, c, d,  8,  6, T57);
+    SET(d, a, b, c, 15, 10, T58);
+    SET(c, d, a, b,  6, 15, T59);
+    SET(b, c, d, a, 13, 21, T60);
+    SET(a, b, c, d,  4,  6, T61);
+    SET(d, a, b, c, 11, 10, T62);
+    SET(c, d, a, b,  2, 15, T63);
+    SET(b, c, d, a,  9, 21, T64);
+#undef SET
+
+    {
+	const md5_vec_t r[4] = { a, b, c, d };
+
+	for (k = 0; k < 4; ++k) {
+	    memcpy(&t, abcd[k], sizeof(t));
+	    t += r[k];
+	    memcpy(abcd[k], &t, sizeof(t));
+	}
+    }
+}
+#else
+/* Portable fallback: one message after the other. */
+static void
+md5_process_lanes(md5_word_t abcd[4][MD5_LANES],
+		  const md5_byte_t *const data[MD5_LANES])
+{
+    int i, w;
+
+    for (i = 0; i < MD5_LANES; ++i) {
+	md5_state_t st;
+
+	for (w = 0; w < 4; ++w)
+	    st.abcd[w] = abcd[w][i];
+	md5_process(&st, data[i]);
+	for (w = 0; w < 4; ++w)
+	    abcd[w][i] = st.abcd[w];
+    }
+}
+#endif
+
+/*
+ * Copy the part of src, located at offset start of the tail of a message,
+ * that falls within the 64-bytes block located at offset base.
+ */
+static void
+md5_copy_range(md5_byte_t block[64], int base, const md5_byte_t *src,
+	       int start, int len)
+{
+    int from = start > base ? start : base;
+    int to = start + len < base + 64 ? start + len : base + 64;
+
+    if (from < to)
+	memcpy(block + from - base, src + from - start, to - from);
+}
+
+/*
+ * Build the k-th block of what remains to be hashed, i.e. the buffered
+ * bytes of *pms, the appended data, the padding and the message length.
+ */
+static void
+md5_tail_block(const md5_state_t *pms, const md5_byte_t *data, int nbytes,
+	       int k, int nblocks, md5_byte_t block[64])
+{
+    int offset = (pms->count[0] >> 3) & 63;
+    int base = 64 * k, i;
+
+    memset(block, 0, 64);
+    md5_copy_range(block, base, pms->buf, 0, offset);
+    md5_copy_range(block, base, data, offset, nbytes);
+    if (offset + nbytes >= base && offset + nbytes < base + 64)
+	block[offset + nbytes - base] = 0x80;
+
+    if (k == nblocks - 1) {
+	md5_word_t lo = pms->count[0] + ((md5_word_t)nbytes << 3);
+	md5_word_t hi = pms->count[1] + (nbytes >> 29) + (lo < pms->count[0]);
+
+	for (i = 0; i < 4; ++i) {
+	    block[56 + i] = (md5_byte_t)(lo >> (8 * i));
+	    block[60 + i] = (md5_byte_t)(hi >> (8 * i));
+	}
+    }
+}
+
+void
+md5_finish_multi(const md5_state_t *const pms[],
+		 const md5_byte_t *const data[], int nbytes,
+		 md5_byte_t *const digest[], unsigned n)
+{
+    md5_word_t abcd[4][MD5_LANES];
+    md5_byte_t blocks[MD5_LANES][64];
+    const md5_byte_t *ptr[MD5_LANES];
+    unsigned base, lanes, i;
+    int k, nblocks, w;
+
+    if (n == 0)
+	return;
+    if (nbytes < 0)
+	nbytes = 0;
+    nblocks = ((((pms[0]->count[0] >> 3) & 63) + nbytes + 8) >> 6) + 1;
+
+    for (base = 0; base < n; base += MD5_LANES) {
+	lanes = (n - base < MD5_LANES) ? (n - base) : MD5_LANES;
+
+	for (i = 0; i < MD5_LANES; ++i) {
+	    /* Unused lanes redo the first message. */
+	    unsigned m = base + (i < lanes ? i : 0);
+
+	    for (w = 0; w < 4; ++w)
+		abcd[w][i] = pms[m]->abcd[w];
+	    ptr[i] = blocks[i < lanes ? i : 0];
+	}
+
+	for (k = 0; k < nblocks; ++k) {
+	    for (i = 0; i < lanes; ++i)
+		md5_tail_block(pms[base + i], data[base + i], nbytes, k,
+			       nblocks, blocks[i]);
+	    md5_process_lanes(abcd, ptr);
+	}
+
+	for (i = 0; i < lanes; ++i)
+	    for (k = 0; k < 16; ++k)
+		digest[base + i][k] =
+		    (md5_byte_t)(abcd[k >> 2][i] >> ((k & 3) << 3));
+    }
+}
+
 void
 md5_init(md5_state_t *pms)
 {
@@ -84,6 +84,19 @@ void md5_append(md5_state_t *pms, const md5_byte_t *data, int nbytes);
 /* Finish the message and return the digest. */
 void md5_finish(md5_state_t *pms, md5_byte_t digest[16]);
 
+/* Number of messages hashed in parallel by md5_finish_multi(). */
+#define MD5_LANES 4
+
+/*
+ * Append nbytes of data[i] to a copy of *pms[i], finish it, and return
+ * the digest in digest[i], for i in [0, n). The states are not modified;
+ * they must all have absorbed the same number of bytes. Several messages
+ * are hashed at once with SIMD instructions where available (multi-buffer).
+ */
+void md5_finish_multi(const md5_state_t *const pms[],
+		      const md5_byte_t *const data[], int nbytes,
+		      md5_byte_t *const digest[], unsigned n);
+
 #ifdef __cplusplus
 }  /* end extern "C" */
 #endif
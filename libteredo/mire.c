@@ -26,6 +26,10 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h> // strtoul()
+#include <limits.h> // UINT_MAX
+#include <time.h>
+#include <unistd.h> // sleep()
 
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -44,33 +48,36 @@
 #include <libteredo/teredo.h>
 #include <stdbool.h>
 #include "packets.h"
+#include "io.h"
 #include "debug.h"
+#include "tools.h"
 
-//#define MIRE_COUNTER 1
+/** Largest number of packets handled at once by a worker */
+#define MIRE_BATCH 32
 
-#ifdef MIRE_COUNTER
-#include <signal.h>
-static unsigned long count_pkt = 0;
-static unsigned long count_bytes = 0;
-static void handler (int signum)
+static unsigned spin_poll = 0; // microseconds
+static bool echo_udp = false;
+static bool stats = false;
+
+typedef struct mire_worker
 {
-	signal (signum, handler);
-	count_bytes /= 1000;
-	printf ("%lu packets/s, %lu.%03lu Mbits/s\n", count_pkt,
-		count_bytes / 125, count_bytes % 125 * 8);
-	count_pkt = count_bytes = 0;
-	if (signum == SIGALRM)
-		alarm (1);
-}
-#endif
+	teredo_io *in; /* socket to receive from */
+	teredo_io *out; /* socket to reply from */
+	bool server; /* Teredo server port: bubbles only */
+	pthread_t thread;
 
+	/* Statistics, reset by the reader */
+	unsigned long received, sent, bytes, batches;
+	uint64_t time_sum, time_max; /* processing time per batch (ns) */
+} mire_worker;
 
-static void
-process_icmpv6 (int fd, struct ip6_hdr *ip6, size_t plen,
+
+static int
+process_icmpv6 (teredo_io *io, struct ip6_hdr *ip6, size_t plen,
                 uint32_t ipv4, uint16_t port)
 {
 	if (plen < sizeof (struct icmp6_hdr))
-		return;
+		return -1;
 
 	struct icmp6_hdr *hdr = (struct icmp6_hdr *)(ip6 + 1);
 	/*
@@ -82,7 +89,7 @@ process_icmpv6 (int fd, struct ip6_hdr *ip6, size_t plen,
 	 * - Other informational messages can be ignored.
 	 */
 	if (hdr->icmp6_type != ICMP6_ECHO_REQUEST)
-		return;
+		return -1;
 
 	ip6->ip6_hlim = 255;
 
@@ -91,28 +98,60 @@ process_icmpv6 (int fd, struct ip6_hdr *ip6, size_t plen,
 	ip6->ip6_dst = ip6->ip6_src;
 	ip6->ip6_src = buf;;
 
+	/*
+	 * Swapping addresses leaves the checksum unchanged, only the type and
+	 * code are accounted for (RFC 1624). The payload, with any sender
+	 * timestamp, is echoed untouched.
+	 */
+	uint32_t sum = ~ntohs (hdr->icmp6_cksum) & 0xffff;
+	sum += ~((hdr->icmp6_type << 8) | hdr->icmp6_code) & 0xffff;
+	sum += ICMP6_ECHO_REPLY << 8;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
 	hdr->icmp6_type = ICMP6_ECHO_REPLY;
 	hdr->icmp6_code = 0;
-	hdr->icmp6_cksum = 0;
-	hdr->icmp6_cksum = icmp6_checksum (ip6, hdr);
+	hdr->icmp6_cksum = htons (~sum & 0xffff);
+
+	return teredo_io_send (io, ip6, sizeof (*ip6) + plen, ipv4, port);
+}
+
 
-	teredo_send (fd, ip6, sizeof (*ip6) + plen, ipv4, port);
+static int
+process_udp (teredo_io *io, struct ip6_hdr *ip6, size_t plen,
+             uint32_t ipv4, uint16_t port)
+{
+	if (plen < 8)
+		return -1;
+
+	/* Swapping addresses and ports leaves the checksum unchanged */
+	uint16_t *ports = (uint16_t *)(ip6 + 1), buf16 = ports[0];
+	ports[0] = ports[1];
+	ports[1] = buf16;
+
+	struct in6_addr buf;
+	buf = ip6->ip6_dst;
+	ip6->ip6_dst = ip6->ip6_src;
+	ip6->ip6_src = buf;
+	ip6->ip6_hlim = 255;
+
+	return teredo_io_send (io, ip6, sizeof (*ip6) + plen, ipv4, port);
 }
 
 
-static void
-process_none (int fd, const struct ip6_hdr *ip6, size_t plen,
+static int
+process_none (teredo_io *io, const struct ip6_hdr *ip6, size_t plen,
               uint32_t ipv4, uint16_t port)
 {
 	if (plen != 0)
-		return;
+		return -1;
 
-	teredo_reply_bubble (fd, ipv4, port, ip6);
+	return teredo_reply_bubble (io, ipv4, port, ip6);
 }
 
 
-static void
-process_unknown (int fd, const struct ip6_hdr *in, size_t plen,
+static int
+process_unknown (teredo_io *io, const struct ip6_hdr *in, size_t plen,
                  uint32_t ipv4, uint16_t port)
 {
 	plen += sizeof (struct ip6_hdr);
@@ -143,23 +182,17 @@ process_unknown (int fd, const struct ip6_hdr *in, size_t plen,
 	icmp6.icmp6_cksum = teredo_cksum (&ip6.ip6_src, &ip6.ip6_dst,
 	                                  IPPROTO_ICMPV6, iov + 1, 2);
 
-	teredo_sendv (fd, iov, sizeof (iov) / sizeof (iov[0]), ipv4, port);
+	return teredo_io_sendv (io, iov, sizeof (iov) / sizeof (iov[0]),
+	                        ipv4, port);
 }
 
 
 /**
- * Receives and validates Teredo packet.
- * @param fd socket from which to receive a packet.
- * @param p pointer to structure where the received packet will be stored.
- *
- * @return payload byte length of received packet, or -1 on error.
+ * Validates and answers a received Teredo packet.
+ * @return the number of bytes sent, or -1 if nothing was sent.
  */
-static ssize_t
-recv_packet (int fd, teredo_packet *p)
+static int process_packet (const mire_worker *w, teredo_packet *p)
 {
-	if (teredo_wait_recv (fd, p))
-		return -1;
-
 	struct ip6_hdr *ip6 = p->ip6;
 	uint16_t plen;
 
@@ -169,68 +202,151 @@ recv_packet (int fd, teredo_packet *p)
 
 	// Check packet validity
 	plen = ntohs (ip6->ip6_plen);
-#ifdef MIRE_COUNTER
-	count_pkt++;
-	count_bytes += plen + 40;
-#endif
-
 	if (((ip6->ip6_vfc >> 4) != 6)
 	 || ((plen + sizeof (*ip6)) > p->ip6_len))
 		return -1;
 
-	return plen;
+	if (w->server)
+		return (ip6->ip6_nxt == IPPROTO_NONE)
+			? process_none (w->out, ip6, plen, p->source_ipv4,
+			                p->source_port) : -1;
+
+	switch (ip6->ip6_nxt)
+	{
+		// TODO: support routing and hop-by-hop headers?
+
+		case IPPROTO_ICMPV6:
+			return process_icmpv6 (w->out, ip6, plen,
+			                       p->source_ipv4, p->source_port);
+
+		case IPPROTO_UDP:
+			if (echo_udp)
+				return process_udp (w->out, ip6, plen,
+				                    p->source_ipv4, p->source_port);
+			break;
+
+		case IPPROTO_NONE: // ignore direct bubbles
+		case IPPROTO_ROUTING:
+			return -1;
+	}
+	return process_unknown (w->out, ip6, plen, p->source_ipv4,
+	                        p->source_port);
 }
 
 
-static LIBTEREDO_NORETURN void *server_thread (void *data)
+static LIBTEREDO_NORETURN void *mire_thread (void *data)
 {
-	int fdserv = ((int *)data)[0], fd = ((int *)data)[1];
+	mire_worker *w = data;
+	teredo_packet *p = malloc (MIRE_BATCH * sizeof (*p));
+
+	if (p == NULL)
+		abort ();
 
 	for (;;)
 	{
-		struct teredo_packet p;
-		ssize_t plen = recv_packet (fdserv, &p);
-		if (plen == -1)
+		if (teredo_io_wait (w->in, p, spin_poll))
 			continue;
 
-		if (p.ip6->ip6_nxt == IPPROTO_NONE)
-			process_none (fd, p.ip6, plen, p.source_ipv4, p.source_port);
+		uint64_t start = stats ? tool_now_ns () : 0;
+		unsigned n = 1 + teredo_io_recv (w->in, p + 1, MIRE_BATCH - 1);
+		unsigned long sent = 0, bytes = 0;
+
+		for (unsigned i = 0; i < n; i++)
+		{
+			bytes += p[i].ip6_len;
+			if (process_packet (w, p + i) >= 0)
+				sent++;
+		}
+		teredo_io_flush (w->out);
+
+		if (!stats)
+			continue;
+
+		uint64_t elapsed = tool_now_ns () - start;
+
+		__atomic_fetch_add (&w->received, n, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&w->sent, sent, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&w->bytes, bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&w->batches, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&w->time_sum, elapsed, __ATOMIC_RELAXED);
+		if (elapsed > __atomic_load_n (&w->time_max, __ATOMIC_RELAXED))
+			__atomic_store_n (&w->time_max, elapsed, __ATOMIC_RELAXED);
 	}
 }
 
 
-static LIBTEREDO_NORETURN int client_thread (int fd)
+/* Prints and resets the statistics of all workers every second. */
+static LIBTEREDO_NORETURN void print_stats (mire_worker **w, unsigned n)
 {
+	uint64_t last = tool_now_ns ();
+
 	for (;;)
 	{
-		struct teredo_packet p;
-		ssize_t plen = recv_packet (fd, &p);
-		if (plen == -1)
-			continue;
+		unsigned long received = 0, sent = 0, bytes = 0, batches = 0;
+		uint64_t time_sum = 0, time_max = 0;
 
-		switch (p.ip6->ip6_nxt)
-		{
-			// TODO: support routing and hop-by-hop headers?
+		sleep (1);
 
-			case IPPROTO_ICMPV6:
-				process_icmpv6 (fd, p.ip6, plen,
-				                p.source_ipv4, p.source_port);
-				break;
+		for (unsigned i = 0; i < n; i++)
+		{
+			uint64_t max;
+
+			received += __atomic_exchange_n (&w[i]->received, 0,
+			                                 __ATOMIC_RELAXED);
+			sent += __atomic_exchange_n (&w[i]->sent, 0, __ATOMIC_RELAXED);
+			bytes += __atomic_exchange_n (&w[i]->bytes, 0,
+			                              __ATOMIC_RELAXED);
+			batches += __atomic_exchange_n (&w[i]->batches, 0,
+			                                __ATOMIC_RELAXED);
+			time_sum += __atomic_exchange_n (&w[i]->time_sum, 0,
+			                                 __ATOMIC_RELAXED);
+			max = __atomic_exchange_n (&w[i]->time_max, 0, __ATOMIC_RELAXED);
+			if (max > time_max)
+				time_max = max;
+		}
 
-			case IPPROTO_NONE: // ignore direct bubbles
-			case IPPROTO_ROUTING:
-				break;
+		uint64_t now = tool_now_ns ();
+		double secs = (now - last) / 1e9;
 
-			default:
-				process_unknown (fd, p.ip6, plen, p.source_ipv4, p.source_port);
-		}
+		last = now;
+		printf ("%.0f packets/s in, %.0f packets/s out, %.2f Mbit/s,"
+		        " processing time per batch mean %.1f us, max %.1f us\n",
+		        received / secs, sent / secs, bytes * 8 / secs / 1e6,
+		        batches ? time_sum / 1000. / batches : 0.,
+		        time_max / 1000.);
+		fflush (stdout);
 	}
 }
 
 
 static int usage (const char *path)
 {
-	printf ("Usage: %s\n", path);
+	printf ("Usage: %s [OPTIONS]\n"
+"Stateless Teredo IPv6 responder\n"
+"\n"
+"  -b, --busy-poll  kernel busy polling time (microseconds)\n"
+"  -e, --echo       reflect UDP datagrams to their sender, payload unchanged\n"
+"  -h, --help       display this help and exit\n"
+"  -r, --rcvbuf     socket receive buffer size (bytes)\n"
+"  -S, --stats      print traffic statistics every second\n"
+"  -s, --spin       spinning time before sleeping (microseconds)\n"
+"  -t, --threads    number of worker threads (default: 1)\n"
+"  -V, --version    display program version and exit\n", path);
+	return 0;
+}
+
+
+static int parse_uint (const char *str, unsigned *value)
+{
+	char *end;
+	unsigned long l = strtoul (str, &end, 0);
+
+	if ((*end) || (l > UINT_MAX))
+	{
+		fprintf (stderr, "Invalid number: %s\n", str);
+		return -1;
+	}
+	*value = l;
 	return 0;
 }
 
@@ -244,15 +360,52 @@ int main(int argc, char *argv[])
 {
 	static const struct option opts[] =
 	{
+		{ "busy-poll",  required_argument, NULL, 'b' },
+		{ "echo",       no_argument,       NULL, 'e' },
 		{ "help",       no_argument,       NULL, 'h' },
+		{ "rcvbuf",     required_argument, NULL, 'r' },
+		{ "stats",      no_argument,       NULL, 'S' },
+		{ "spin",       required_argument, NULL, 's' },
+		{ "threads",    required_argument, NULL, 't' },
 		{ "version",    no_argument,       NULL, 'V' },
 		{ NULL,         no_argument,       NULL, '\0'}
 	};
+	unsigned busy_poll = 0, rcvbuf = 0, threads = 1;
 
 	int c;
-	while ((c = getopt_long (argc, argv, "hV", opts, NULL)) != -1)
+	while ((c = getopt_long (argc, argv, "b:ehr:Ss:t:V", opts, NULL)) != -1)
 		switch (c)
 		{
+			case 'b':
+				if (parse_uint (optarg, &busy_poll))
+					return 1;
+				break;
+
+			case 'e':
+				echo_udp = true;
+				break;
+
+			case 'r':
+				if (parse_uint (optarg, &rcvbuf))
+					return 1;
+				break;
+
+			case 'S':
+				stats = true;
+				break;
+
+			case 's':
+				if (parse_uint (optarg, &spin_poll))
+					return 1;
+				break;
+
+			case 't':
+				if (parse_uint (optarg, &threads))
+					return 1;
+				if (threads == 0)
+					threads = 1;
+				break;
+
 			case 'h':
 				return usage(argv[0]);
 
@@ -263,37 +416,85 @@ int main(int argc, char *argv[])
 				return 1;
 		}
 
-	int socks[2] = { -1, -1 }, retval = -1;
-	pthread_t thserv;
+	/*
+	 * One worker for the server port, which only answers bubbles, and
+	 * the others for the client port. Client port workers have their own
+	 * socket each, the kernel spreads incoming flows across them.
+	 */
+	unsigned count = threads + 1;
+	mire_worker **workers = calloc (count, sizeof (*workers));
+	int retval = -1;
+
+	if (workers == NULL)
+	{
+		perror ("calloc");
+		return -1;
+	}
 
-	socks[0] = teredo_socket (0, htons (IPPORT_TEREDO));
-	if (socks[0] != -1)
+	for (unsigned i = 0; i < count; i++)
 	{
-		socks[1] = teredo_socket (0, htons (IPPORT_TEREDO + 1));
-		if (socks[1] != -1)
+		mire_worker *w = calloc (1, sizeof (*w));
+		if (w == NULL)
+			goto out;
+		workers[i] = w;
+
+		uint16_t port = htons (IPPORT_TEREDO + (i > 0));
+		int fd = (threads > 1) && (i > 0)
+			? teredo_socket_reuseport (0, port) : teredo_socket (0, port);
+		if (fd == -1)
+		{
+			perror ((i == 0) ? "teredo_socket(server)" : "teredo_socket");
+			goto out;
+		}
+
+		w->in = teredo_io_mmsg_fd (fd, MIRE_BATCH);
+		if (w->in == NULL)
 		{
-			errno = pthread_create (&thserv, NULL, server_thread, socks);
-			if (errno == 0)
+			teredo_close (fd);
+			goto out;
+		}
+
+		if (teredo_socket_set_busy_poll (fd, busy_poll))
+			perror ("SO_BUSY_POLL");
+		if (teredo_socket_set_buffers (fd, rcvbuf, 0))
+			perror ("SO_RCVBUF");
+	}
+
+	/* Bubbles are answered from the client port */
+	workers[0]->server = true;
+	workers[0]->out = workers[1]->in;
+	for (unsigned i = 1; i < count; i++)
+		workers[i]->out = workers[i]->in;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		errno = pthread_create (&workers[i]->thread, NULL, mire_thread,
+		                        workers[i]);
+		if (errno)
+		{
+			perror ("pthread_create");
+			while (i > 0)
 			{
-#ifdef MIRE_COUNTER
-				signal (SIGALRM, handler);
-				alarm (1);
-#endif
-				retval = -client_thread (socks[1]);
+				pthread_cancel (workers[--i]->thread);
+				pthread_join (workers[i]->thread, NULL);
 			}
-			else
-				perror ("pthread_create");
-
-			teredo_close (socks[1]);
+			goto out;
 		}
-		else
-			perror ("teredo_socket");
-		teredo_close (socks[0]);
 	}
-	else
-		perror ("teredo_socket(server)");
 
-	return retval;
+	if (stats)
+		print_stats (workers, count);
+	pthread_join (workers[0]->thread, NULL);
 
-	return 0;
+out:
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (workers[i] == NULL)
+			continue;
+		if (workers[i]->in != NULL)
+			teredo_io_close (workers[i]->in);
+		free (workers[i]);
+	}
+	free (workers);
+	return retval;
 }
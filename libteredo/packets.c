@@ -31,6 +31,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <assert.h>
 
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -42,16 +43,20 @@
 #include "teredo.h"
 #include "v4global.h"
 #include "teredo-udp.h"
+#include "io.h"
 
 #include <time.h>
+#include <pthread.h>
 #include "security.h"
+#include "clock.h"
 
 #include "packets.h"
 #include "checksum.h"
+#include "probes.h"
 
 
 int
-teredo_send_bubble (int fd, uint32_t ip, uint16_t port,
+teredo_send_bubble (teredo_io *io, uint32_t ip, uint16_t port,
                     const struct in6_addr *src, const struct in6_addr *dst)
 {
 	static const uint8_t head[] =
@@ -66,21 +71,122 @@ teredo_send_bubble (int fd, uint32_t ip, uint16_t port,
 		{ (void *)dst, 16 }
 	};
 
-	return teredo_sendv (fd, iov, 3, ip, port) == 40 ? 0 : -1;
+	TEREDO_PROBE3 (bubble_send, ip, port, dst);
+	return teredo_io_sendv (io, iov, 3, ip, port) == 40 ? 0 : -1;
+}
+
+
+/*
+ * Bubble source addresses are derived from a nonce of the destination
+ * IPv4 address and port, and of the current epoch. Recently derived
+ * nonces are cached, since bubbles are sent repeatedly to the same peers.
+ */
+#define BUBBLE_CACHE_SIZE 256 /* must be a power of two */
+
+static struct bubble_cache_entry
+{
+	uint32_t epoch;
+	uint32_t ipv4;
+	uint16_t port;
+	bool valid;
+	uint8_t nonce[LIBTEREDO_NONCE_LEN];
+} bubble_cache[BUBBLE_CACHE_SIZE];
+static pthread_mutex_t bubble_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static inline uint32_t BubbleEpoch (void)
+{
+	return teredo_clock () / TEREDO_BUBBLE_EPOCH;
+}
+
+
+static inline struct bubble_cache_entry *
+BubbleCacheSlot (uint32_t ipv4, uint16_t port)
+{
+	uint32_t h = (ipv4 ^ (((uint32_t)port) << 16) ^ port) * 2654435761u;
+	return bubble_cache + (h >> 24) % BUBBLE_CACHE_SIZE;
+}
+
+
+/**
+ * Computes the bubble nonces of several IPv4/port pairs for a given
+ * epoch. Only nonces of the current epoch are cached.
+ */
+static void
+GetBubbleNonces (uint32_t epoch, bool current, unsigned n,
+                 const uint32_t *ipv4, const uint16_t *port,
+                 uint8_t (*restrict nonce)[LIBTEREDO_NONCE_LEN])
+{
+	uint32_t miss_ipv4[32];
+	uint16_t miss_port[32];
+	uint8_t miss_nonce[32][LIBTEREDO_NONCE_LEN];
+	uint8_t miss_idx[32];
+	unsigned misses = 0;
+
+	assert (n <= 32);
+
+	pthread_mutex_lock (&bubble_cache_lock);
+	for (unsigned i = 0; i < n; i++)
+	{
+		const struct bubble_cache_entry *e = BubbleCacheSlot (ipv4[i], port[i]);
+
+		if (e->valid && (e->epoch == epoch) && (e->ipv4 == ipv4[i])
+		 && (e->port == port[i]))
+			memcpy (nonce[i], e->nonce, LIBTEREDO_NONCE_LEN);
+		else
+		{
+			miss_ipv4[misses] = ipv4[i];
+			miss_port[misses] = port[i];
+			miss_idx[misses++] = i;
+		}
+	}
+	pthread_mutex_unlock (&bubble_cache_lock);
+
+	if (misses == 0)
+		return;
+
+	teredo_get_nonces (epoch, misses, miss_ipv4, miss_port, miss_nonce);
+
+	if (current)
+		pthread_mutex_lock (&bubble_cache_lock);
+	for (unsigned i = 0; i < misses; i++)
+	{
+		miss_nonce[i][0] &= 0xfc; /* Modified EUI-64 */
+		memcpy (nonce[miss_idx[i]], miss_nonce[i], LIBTEREDO_NONCE_LEN);
+
+		if (current)
+		{
+			struct bubble_cache_entry *e =
+				BubbleCacheSlot (miss_ipv4[i], miss_port[i]);
+
+			e->epoch = epoch;
+			e->ipv4 = miss_ipv4[i];
+			e->port = miss_port[i];
+			e->valid = true;
+			memcpy (e->nonce, miss_nonce[i], LIBTEREDO_NONCE_LEN);
+		}
+	}
+	if (current)
+		pthread_mutex_unlock (&bubble_cache_lock);
+}
+
+
+void GetBubbleSource (uint32_t ipv4, uint16_t port, struct in6_addr *src)
+{
+	memcpy (src->s6_addr, "\xfe\x80\x00\x00\x00\x00\x00\x00", 8);
+	GetBubbleNonces (BubbleEpoch (), true, 1, &ipv4, &port,
+	                 (uint8_t (*)[LIBTEREDO_NONCE_LEN])(src->s6_addr + 8));
 }
 
 
 int
-SendBubbleFromDst (int fd, const struct in6_addr *dst, bool indirect)
+SendBubbleFromDst (teredo_io *io, const struct in6_addr *dst, bool indirect)
 {
 	uint32_t ip = IN6_TEREDO_IPV4 (dst);
 	uint16_t port = IN6_TEREDO_PORT (dst);
 
 	struct in6_addr src;
-	memcpy (src.s6_addr, "\xfe\x80\x00\x00\x00\x00\x00\x00", 8);
-	/* TODO: use some time information */
-	teredo_get_nonce (0, ip, port, src.s6_addr + 8);
-	src.s6_addr[8] &= 0xfc; /* Modified EUI-64 */
+	GetBubbleSource (ip, port, &src);
 
 	if (indirect)
 	{
@@ -91,21 +197,66 @@ SendBubbleFromDst (int fd, const struct in6_addr *dst, bool indirect)
 	if (!is_ipv4_global_unicast (ip))
 		return 0;
 
-	return teredo_send_bubble (fd, ip, port, &src, dst);
+	return teredo_send_bubble (io, ip, port, &src, dst);
 }
 
 
 int CheckBubble (const teredo_packet *packet)
 {
-	const struct ip6_hdr *ip6 = packet->ip6;
-	const struct in6_addr *me = &ip6->ip6_dst, *it = &ip6->ip6_src;
+	return (CheckBubbles (packet, 1, 1) & 1) ? 0 : -1;
+}
 
-	uint8_t hash[8];
-	/* TODO: use some time information */
-	teredo_get_nonce (0, IN6_TEREDO_IPV4 (it), IN6_TEREDO_PORT (it), hash);
-	hash[0] &= 0xfc; /* Modified EUI-64: non-global, non-group address */
 
-	return memcmp (hash, me->s6_addr + 8, 8) ? -1 : 0;
+uint32_t CheckBubbles (const teredo_packet *packets, unsigned n,
+                       uint32_t which)
+{
+	uint32_t ipv4[32];
+	uint16_t port[32];
+	uint8_t hash[32][LIBTEREDO_NONCE_LEN];
+	uint8_t idx[32];
+	unsigned count = 0;
+
+	assert (n <= 32);
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		const teredo_packet *packet = packets + i;
+		const struct ip6_hdr *ip6 = packet->ip6;
+
+		if (!((which >> i) & 1)
+		 || (packet->ip6_len < sizeof (*ip6)) || !IsBubble (ip6))
+			continue;
+
+		ipv4[count] = IN6_TEREDO_IPV4 (&ip6->ip6_src);
+		port[count] = IN6_TEREDO_PORT (&ip6->ip6_src);
+		idx[count++] = i;
+	}
+
+	uint32_t mask = 0, epoch = BubbleEpoch ();
+
+	/* Bubbles are valid for the current and the previous epochs */
+	for (unsigned pass = 0; (pass < 2) && (count > 0); pass++)
+	{
+		unsigned left = 0;
+
+		GetBubbleNonces (epoch - pass, pass == 0, count, ipv4, port, hash);
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			const struct ip6_hdr *ip6 = packets[idx[i]].ip6;
+
+			if (memcmp (hash[i], ip6->ip6_dst.s6_addr + 8, 8) == 0)
+				mask |= UINT32_C(1) << idx[i];
+			else
+			{	/* retry with the previous epoch */
+				ipv4[left] = ipv4[i];
+				port[left] = port[i];
+				idx[left++] = idx[i];
+			}
+		}
+		count = left;
+	}
+	return mask;
 }
 
 
@@ -114,28 +265,19 @@ static const struct in6_addr in6addr_allrouters =
 { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x2 } } };
 
 int
-teredo_send_rs (int fd, uint32_t server_ip,
+teredo_send_rs (teredo_io *io, uint32_t server_ip,
                 const unsigned char *nonce, bool cone)
 {
-	uint8_t auth[13] = { 0, 1 };
 	struct
 	{
+		uint8_t head[TEREDO_HEADROOM];
 		struct ip6_hdr ip6;
 		struct nd_router_solicit rs;
 	} rs;
-	struct iovec iov[] =
-	{
-		{ auth, 13 },
-		{ &rs, sizeof (rs) }
-	};
-
-	// Authentication header
-	// TODO: secure qualification
-
-	memcpy (auth + 4, nonce, 8);
+	teredo_buf b;
 
 	rs.ip6.ip6_flow = htonl (0x60000000);
-	rs.ip6.ip6_plen = htons (sizeof (rs) - sizeof (rs.ip6));
+	rs.ip6.ip6_plen = htons (sizeof (rs.rs));
 	rs.ip6.ip6_nxt = IPPROTO_ICMPV6;
 	rs.ip6.ip6_hlim = 255;
 	rs.ip6.ip6_src = cone ? teredo_cone : teredo_restrict;
@@ -147,8 +289,15 @@ teredo_send_rs (int fd, uint32_t server_ip,
 	rs.rs.nd_rs_cksum = cone ? htons (0x125d) : htons (0x7d37);
 	rs.rs.nd_rs_reserved = 0;
 
-	return (teredo_sendv (fd, iov, sizeof (iov) / sizeof (iov[0]),
-	                      server_ip, htons (IPPORT_TEREDO)) > 0) ? 0 : -1;
+	teredo_buf_init (&b, &rs.ip6, sizeof (rs.ip6) + sizeof (rs.rs),
+	                 sizeof (rs.head));
+
+	// Authentication header
+	// TODO: secure qualification
+	teredo_buf_push_auth (&b, nonce);
+
+	return (teredo_io_send_buf (io, &b, server_ip,
+	                            htons (IPPORT_TEREDO)) > 0) ? 0 : -1;
 }
 
 
@@ -270,7 +419,7 @@ teredo_parse_ra (const teredo_packet *restrict packet,
 
 #define PING_PAYLOAD (LIBTEREDO_HMAC_LEN - 4)
 int
-SendPing (int fd, const union teredo_addr *src, const struct in6_addr *dst)
+SendPing (teredo_io *io, const union teredo_addr *src, const struct in6_addr *dst)
 {
 	struct
 	{
@@ -297,10 +446,12 @@ SendPing (int fd, const union teredo_addr *src, const struct in6_addr *dst)
 	                     &ping.ip6.ip6_dst, (uint8_t *)&ping.icmp6.icmp6_id);
 
 	ping.icmp6.icmp6_cksum = icmp6_checksum (&ping.ip6, &ping.icmp6);
+	TEREDO_PROBE1 (ping_send, dst);
 
-	return teredo_send (fd, &ping, sizeof (ping.ip6) + sizeof (ping.icmp6)
-	                    + PING_PAYLOAD, IN6_TEREDO_SERVER(&src->ip6),
-	                    htons (IPPORT_TEREDO)) > 0 ? 0 : -1;
+	return teredo_io_send (io, &ping, sizeof (ping.ip6)
+	                       + sizeof (ping.icmp6) + PING_PAYLOAD,
+	                       IN6_TEREDO_SERVER(&src->ip6),
+	                       htons (IPPORT_TEREDO)) > 0 ? 0 : -1;
 }
 
 
@@ -26,6 +26,7 @@
 struct in6_addr;
 struct ip6_hdr;
 struct icmp6_hdr;
+struct teredo_io;
 
 /**
  * Checks that the packet is an ICMPv6 Echo reply and authenticates it.
@@ -33,8 +34,36 @@ struct icmp6_hdr;
  * @return 0 if that is the case, -1 otherwise.
  */
 int CheckPing (const teredo_packet *packet);
+
+/**
+ * Lifetime (in seconds) of the nonces used to authenticate bubbles.
+ * Bubbles are accepted for one to two epochs after they were sent.
+ */
+# define TEREDO_BUBBLE_EPOCH 30
+
+/**
+ * Checks that the packet is a Teredo bubble whose link-local destination
+ * address was generated by GetBubbleSource() within the current or the
+ * previous epoch.
+ *
+ * @return 0 if that is the case, -1 otherwise.
+ */
 int CheckBubble (const teredo_packet *packet);
 
+/**
+ * Authenticates the source address of each Teredo bubble within an array of
+ * packets, as CheckBubble() does, but using multi-buffer hashing.
+ * Packets that are not bubbles are ignored.
+ *
+ * @param n number of packets (at most 32)
+ * @param which bit mask of the packets to check (bit i for packets[i])
+ *
+ * @return a bit mask whose bit i is set if packets[i] is a checked bubble
+ * with a valid source address.
+ */
+uint32_t CheckBubbles (const teredo_packet *packets, unsigned n,
+                       uint32_t which);
+
 
 /**
  * Returns true if the packet whose header is passed as a parameter looks
@@ -55,11 +84,22 @@ static inline bool IsBubble (const struct ip6_hdr *hdr)
  *
  * @return 0 on success, -1 on error.
  */
-int SendBubbleFromDst (int fd, const struct in6_addr *dst, bool indirect);
+int SendBubbleFromDst (struct teredo_io *io, const struct in6_addr *dst,
+                       bool indirect);
+
+/**
+ * Generates the link-local source address of bubbles sent to a given
+ * Teredo peer, from the current nonce epoch.
+ *
+ * @param ipv4 peer mapped IPv4 address (network byte order)
+ * @param port peer mapped UDP port (network byte order)
+ */
+void GetBubbleSource (uint32_t ipv4, uint16_t port, struct in6_addr *src);
 
 /**
  * Sends a Teredo Bubble.
  *
+ * @param io I/O backend through which the bubble will be sent
  * @param ip destination IPv4
  * @param port destination UDP port
  * @param src pointer to source IPv6 address
@@ -67,20 +107,21 @@ int SendBubbleFromDst (int fd, const struct in6_addr *dst, bool indirect);
  *
  * @return 0 on success, -1 on error.
  */
-int teredo_send_bubble (int fd, uint32_t ip, uint16_t port,
+int teredo_send_bubble (struct teredo_io *io, uint32_t ip, uint16_t port,
                         const struct in6_addr *src,
                         const struct in6_addr *dst);
 
-static inline int teredo_reply_bubble (int fd, uint32_t ip, uint16_t port,
-                                       const struct ip6_hdr *req)
+static inline int
+teredo_reply_bubble (struct teredo_io *io, uint32_t ip, uint16_t port,
+                     const struct ip6_hdr *req)
 {
-	return teredo_send_bubble (fd, ip, port, &req->ip6_dst, &req->ip6_src);
+	return teredo_send_bubble (io, ip, port, &req->ip6_dst, &req->ip6_src);
 }
 
 /**
  * Sends a router solication with an Authentication header.
  *
- * @param fd socket through which the RS will be sent
+ * @param io I/O backend through which the RS will be sent
  * @param server_ip server IPv4 address toward which the solicitation should
  * be encapsulated (network byte order)
  * @param nonce pointer to the 8-bytes authentication nonce
@@ -88,7 +129,7 @@ static inline int teredo_reply_bubble (int fd, uint32_t ip, uint16_t port,
  *
  * @return 0 on success, -1 on error.
  */
-int teredo_send_rs (int fd, uint32_t server_ip,
+int teredo_send_rs (struct teredo_io *io, uint32_t server_ip,
                     const unsigned char *nonce, bool cone);
 
 /**
@@ -119,7 +160,7 @@ int teredo_parse_ra (const teredo_packet *restrict packet,
 /**
  * Sends an ICMPv6 Echo request toward an IPv6 node through the Teredo server.
  */
-int SendPing (int fd, const union teredo_addr *src,
+int SendPing (struct teredo_io *io, const union teredo_addr *src,
               const struct in6_addr *dst);
 
 /**
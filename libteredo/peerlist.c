@@ -47,9 +47,13 @@
 
 #include "teredo.h"
 #include "teredo-udp.h" // FIXME: ugly
+#include "io.h"
 #include "debug.h"
 #include "clock.h"
 #include "peerlist.h"
+#include "topn.h"
+#include "tunnel.h"
+#include "probes.h"
 
 /*
  * Packets queueing
@@ -64,13 +68,10 @@ struct teredo_queue
 	uint8_t data[];
 };
 
-static const unsigned teredo_MaxQueueBytes = 1280;
-
-
-static inline void teredo_peer_init (teredo_peer *peer)
+static inline void teredo_peer_init (teredo_peer *peer, size_t max_queue)
 {
 	peer->queue = NULL;
-	peer->queue_left = teredo_MaxQueueBytes;
+	peer->queue_left = max_queue;
 }
 
 
@@ -96,8 +97,12 @@ static void teredo_peer_queue (teredo_peer *restrict peer,
 	teredo_queue *p;
 
 	if (len > peer->queue_left)
+	{
+		TEREDO_PROBE2 (queue_drop, len, incoming);
 		return;
+	}
 	peer->queue_left -= len;
+	TEREDO_PROBE3 (queue_enqueue, len, incoming, peer->queue_left);
 
 	p = malloc (sizeof (*p) + len);
 	p->length = len;
@@ -125,18 +130,12 @@ void teredo_enqueue_out (teredo_peer *restrict peer,
 }
 
 
-teredo_queue *teredo_peer_queue_yield (teredo_peer *peer)
-{
-	teredo_queue *q = peer->queue;
-	peer->queue = NULL;
-	peer->queue_left = teredo_MaxQueueBytes;
-	return q;
-}
-
-
-void teredo_queue_emit (teredo_queue *q, int fd, uint32_t ipv4, uint16_t port,
+void teredo_queue_emit (teredo_queue *q, teredo_io *io,
+                        uint32_t ipv4, uint16_t port,
                         teredo_dequeue_cb cb, void *opaque)
 {
+	unsigned count = 0;
+
 	while (q != NULL)
 	{
 		teredo_queue *buf;
@@ -148,10 +147,12 @@ void teredo_queue_emit (teredo_queue *q, int fd, uint32_t ipv4, uint16_t port,
 				cb (opaque, q->data, q->length);
 		}
 		else
-			teredo_send (fd, q->data, q->length, ipv4, port);
+			teredo_io_send (io, q->data, q->length, ipv4, port);
 		free (q);
 		q = buf;
+		count++;
 	}
+	TEREDO_PROBE1 (queue_emit, count);
 }
 
 
@@ -159,16 +160,78 @@ void teredo_queue_emit (teredo_queue *q, int fd, uint32_t ipv4, uint16_t port,
 typedef struct teredo_listitem
 {
 	union teredo_addr key; /* must be first (for listitem_cmp()) */
-	struct teredo_listitem **pprev, *next;
+	struct teredo_listitem *next; /* in the timer wheel */
+	teredo_clock_t deadline;
 	teredo_peer peer;
 } teredo_listitem;
 
+/*
+ * Peers expire through a two-level hierarchical timer wheel. The first
+ * level has one slot per second, the second one slot per WHEEL_SIZE
+ * seconds. Entries beyond the second level range are put in its last
+ * slot. Lookups only refresh the entry deadline: entries that are found
+ * still alive when their slot expires are rescheduled (lazily).
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+/* Maximum number of entries processed by a lookup for expiry */
+#define SWEEP_SLICE 64
+
+/*** Admission control ***/
+#define ADMIT_DEPTH 4
+#define ADMIT_MIN_WIDTH 64 /* powers of two */
+#define ADMIT_MAX_WIDTH 1048576
+/* Number of counters decayed per unit of the sweep budget */
+#define ADMIT_DECAY_SLICE 64
+
+/*
+ * Count-min sketch of the number of peers recently created per key.
+ * Counters are halved once per expiration delay, so that they follow the
+ * live peers. Halving is done a slice at a time by the sweep, from a
+ * cursor: counters before the cursor still owe decay_lo halvings, those
+ * from the cursor on owe decay_hi.
+ */
+typedef struct admission_sketch
+{
+	unsigned max; /* quota, 0 if unlimited */
+	unsigned mask; /* width - 1 */
+	uint64_t salt[ADMIT_DEPTH];
+	uint16_t *count; /* ADMIT_DEPTH rows of width counters */
+	size_t decay_pos;
+	unsigned decay_lo, decay_hi;
+} admission_sketch;
+
+/*
+ * Separate sketches for the mapped IPv4 addresses and the /64 prefixes,
+ * as their quotas differ by orders of magnitude.
+ */
+typedef struct teredo_admission
+{
+	admission_sketch ipv4, prefix;
+} teredo_admission;
+
 struct teredo_peerlist
 {
-	teredo_listitem *recent, *old;
-	unsigned left;
+	teredo_listitem *wheel[2][WHEEL_SIZE];
+	teredo_listitem *garbage; /* expired, to be freed without the lock */
+	teredo_clock_t now; /* time up to which the wheel is processed */
+	bool cascaded; /* second level slot of "now" was processed */
+	bool swept; /* first level slot of "now" was processed */
+	struct timespec locked_at;
+	unsigned long max_hold; /* nanoseconds */
+	unsigned left, max;
+	/* Garbage collection statistics */
+	unsigned long expired, sweeps;
+	unsigned long max_sweep; /* nanoseconds */
+	uint64_t sweep_time; /* nanoseconds */
 	unsigned expiration;
-	pthread_t gc;
+	size_t max_queue;
+	teredo_admission *admission;
+	teredo_topn *topn; /* heavy hitters, NULL if disabled */
+	/* Preallocated entries */
+	teredo_listitem *pool, *pool_free;
+	unsigned pool_size;
 	pthread_mutex_t lock;
 #ifdef HAVE_LIBJUDY
 	Pvoid_t PJHSArray;
@@ -178,30 +241,64 @@ struct teredo_peerlist
 };
 
 
-static inline teredo_listitem *listitem_create (void)
+teredo_queue *teredo_peer_queue_yield (teredo_peerlist *list,
+                                      teredo_peer *peer)
 {
-	teredo_listitem *entry = malloc (sizeof (*entry));
-	if (entry != NULL)
-		teredo_peer_init (&entry->peer);
-	return entry;
+	teredo_queue *q = peer->queue;
+	peer->queue = NULL;
+	peer->queue_left = list->max_queue;
+	return q;
 }
 
 
-static inline void listitem_destroy (teredo_listitem *entry)
+/**
+ * Allocates an entry, from the preallocated pool if possible.
+ * Must be called with the lock held.
+ */
+static inline teredo_listitem *listitem_create (teredo_peerlist *l)
 {
-	teredo_peer_destroy (&entry->peer);
-	free (entry);
+	teredo_listitem *entry = l->pool_free;
+
+	if (entry != NULL)
+		l->pool_free = entry->next;
+	else
+		entry = malloc (sizeof (*entry));
+
+	if (entry != NULL)
+		teredo_peer_init (&entry->peer, l->max_queue);
+	return entry;
 }
 
 
-static void listitem_recdestroy (teredo_listitem *entry)
+/**
+ * Releases a chain of entries. Must be called without the lock.
+ */
+static void listitem_recdestroy (teredo_peerlist *l, teredo_listitem *entry)
 {
+	teredo_listitem *pooled = NULL, **tail = &pooled;
+
 	while (entry != NULL)
 	{
 		teredo_listitem *buf = entry->next;
-		listitem_destroy (entry);
+
+		teredo_peer_destroy (&entry->peer);
+		if ((entry >= l->pool) && (entry < l->pool + l->pool_size))
+		{
+			*tail = entry;
+			tail = &entry->next;
+		}
+		else
+			free (entry);
 		entry = buf;
 	}
+
+	if (pooled != NULL)
+	{	/* Gives entries back to the pool */
+		pthread_mutex_lock (&l->lock);
+		*tail = l->pool_free;
+		l->pool_free = pooled;
+		pthread_mutex_unlock (&l->lock);
+	}
 }
 
 #ifndef HAVE_LIBJUDY
@@ -218,63 +315,390 @@ static int listitem_cmp (const void *pa, const void *pb)
 }
 #endif
 
-#include <sched.h>
+static inline unsigned admission_hash (uint64_t key, uint64_t salt)
+{
+	key ^= salt;
+	key = (key ^ (key >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	key = (key ^ (key >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return key ^ (key >> 31);
+}
+
+
+static inline uint16_t *admission_cell (const admission_sketch *sk,
+                                        unsigned d, uint64_t key)
+{
+	return sk->count + d * (sk->mask + 1)
+	     + (admission_hash (key, sk->salt[d]) & sk->mask);
+}
+
+
+static unsigned admission_estimate (const admission_sketch *sk, uint64_t key)
+{
+	unsigned min = UINT16_MAX;
+
+	for (unsigned d = 0; d < ADMIT_DEPTH; d++)
+	{
+		unsigned c = *admission_cell (sk, d, key);
+		if (c < min)
+			min = c;
+	}
+	return min;
+}
+
+
+static void admission_add (admission_sketch *sk, uint64_t key)
+{
+	/* Conservative update: only increment the smallest counters */
+	unsigned min = admission_estimate (sk, key);
+	if (min == UINT16_MAX)
+		return;
+
+	for (unsigned d = 0; d < ADMIT_DEPTH; d++)
+	{
+		uint16_t *c = admission_cell (sk, d, key);
+		if (*c == min)
+			(*c)++;
+	}
+}
+
+
+/* Schedules the halving of all the counters of a sketch */
+static void admission_decay (admission_sketch *sk)
+{
+	if (sk->decay_pos > 0)
+		sk->decay_lo++;
+	sk->decay_hi++;
+}
+
 
 /**
- * Peer list garbage collector entry point.
- *
- * @return never ever.
+ * Halves up to budget * ADMIT_DECAY_SLICE counters whose decay is due.
+ * @return the unused budget.
  */
-static LIBTEREDO_NORETURN void *garbage_collector (void *data)
+static unsigned admission_decay_step (admission_sketch *sk, unsigned budget)
 {
-	struct teredo_peerlist *l = (struct teredo_peerlist *)data;
+	size_t n = ADMIT_DEPTH * (size_t)(sk->mask + 1);
 
-	for (;;)
+	while (sk->decay_hi > 0)
 	{
-		struct timespec delay = { .tv_sec = l->expiration };
-		teredo_sleep (&delay);
+		if (budget == 0)
+			break;
+		budget--;
+
+		/* Catches up with the counters before the cursor */
+		unsigned shift = sk->decay_hi - sk->decay_lo;
+		size_t end = sk->decay_pos + ADMIT_DECAY_SLICE;
+		if (end > n)
+			end = n;
+
+		for (size_t i = sk->decay_pos; i < end; i++)
+			sk->count[i] = (shift < 16) ? (sk->count[i] >> shift) : 0;
+		sk->decay_pos = end;
+
+		if (end == n)
+		{	/* All counters owe the same number of halvings again */
+			sk->decay_pos = 0;
+			sk->decay_hi = sk->decay_lo;
+			sk->decay_lo = 0;
+		}
+	}
+	return budget;
+}
 
-		int state;
-		pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
-		/* cancel-unsafe section starts */
-		pthread_mutex_lock (&l->lock);
 
-		// remove expired peers from hash table
-		for (teredo_listitem *p = l->old; p != NULL; p = p->next)
-		{
+static void admission_clear (admission_sketch *sk)
+{
+	sk->decay_pos = 0;
+	sk->decay_lo = sk->decay_hi = 0;
+	if (sk->count != NULL)
+		memset (sk->count, 0,
+		        ADMIT_DEPTH * (size_t)(sk->mask + 1) * sizeof (uint16_t));
+}
+
+
+/**
+ * Sets up a sketch for a given quota. The width is chosen so that the
+ * peers of a full list add up to less than half of the quota per counter
+ * on average, and thus seldom cause legitimate sources to be rejected.
+ *
+ * @param peers maximum number of peers of the list
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+static int admission_init (admission_sketch *sk, unsigned max,
+                           unsigned peers, uint64_t *seed)
+{
+	sk->max = max;
+	sk->count = NULL;
+	sk->decay_pos = 0;
+	sk->decay_lo = sk->decay_hi = 0;
+	if (max == 0)
+		return 0; /* unlimited */
+
+	uint64_t need = 2 * (uint64_t)peers / max;
+	unsigned width = ADMIT_MIN_WIDTH;
+	while ((width < need) && (width < ADMIT_MAX_WIDTH))
+		width <<= 1;
+
+	sk->mask = width - 1;
+	sk->count = calloc (ADMIT_DEPTH * (size_t)width, sizeof (uint16_t));
+	if (sk->count == NULL)
+		return -1;
+
+	/* Randomized hashes, so that collisions cannot be forced */
+	for (unsigned d = 0; d < ADMIT_DEPTH; d++)
+	{
+		*seed += UINT64_C(0x9e3779b97f4a7c15);
+		sk->salt[d] = *seed * UINT64_C(0xbf58476d1ce4e5b9);
+	}
+	return 0;
+}
+
+
+static void admission_destroy (teredo_admission *a)
+{
+	if (a == NULL)
+		return;
+	free (a->ipv4.count);
+	free (a->prefix.count);
+	free (a);
+}
+
+
+/* Sketch keys: the mapped IPv4 address of Teredo peers, and the /64 */
+static inline uint64_t admission_ipv4_key (const union teredo_addr *addr)
+{
+	return (UINT64_C(1) << 32) | addr->teredo.client_ip;
+}
+
+static inline uint64_t admission_prefix_key (const union teredo_addr *addr)
+{
+	uint64_t key;
+	memcpy (&key, addr->ip6.s6_addr, sizeof (key));
+	return key;
+}
+
+static inline bool admission_is_teredo (const union teredo_addr *addr)
+{
+	return addr->teredo.prefix == htonl (TEREDO_PREFIX);
+}
+
+
+/**
+ * @return whether a new peer can be created for a given address.
+ */
+static bool admission_check (const teredo_admission *a,
+                             const union teredo_addr *addr)
+{
+	if (a->prefix.max
+	 && (admission_estimate (&a->prefix, admission_prefix_key (addr))
+	      >= a->prefix.max))
+		return false;
+
+	if (a->ipv4.max && admission_is_teredo (addr)
+	 && (admission_estimate (&a->ipv4, admission_ipv4_key (addr))
+	      >= a->ipv4.max))
+		return false;
+
+	return true;
+}
+
+
+static void admission_count (teredo_admission *a,
+                             const union teredo_addr *addr)
+{
+	if (a->prefix.max)
+		admission_add (&a->prefix, admission_prefix_key (addr));
+	if (a->ipv4.max && admission_is_teredo (addr))
+		admission_add (&a->ipv4, admission_ipv4_key (addr));
+}
+
+
+/* Whether counters of the admission sketches remain to be halved */
+static inline bool admission_pending (const teredo_peerlist *l)
+{
+	const teredo_admission *a = l->admission;
+
+	return (a != NULL) && (a->ipv4.decay_hi || a->prefix.decay_hi);
+}
+
+
+/**
+ * Files an entry into the timer wheel slot matching its deadline.
+ */
+static void wheel_insert (teredo_peerlist *l, teredo_listitem *p)
+{
+	teredo_clock_t delta = p->deadline - l->now;
+	teredo_listitem **slot;
+
+	if ((long)delta < WHEEL_SIZE)
+		/*
+		 * Deadline within this round. It can be now only when cascading,
+		 * before the current first level slot is processed.
+		 */
+		slot = l->wheel[0]
+		     + (((long)delta > 0 ? p->deadline : l->now) & WHEEL_MASK);
+	else
+	if (delta < (WHEEL_SIZE << WHEEL_BITS))
+		slot = l->wheel[1] + ((p->deadline >> WHEEL_BITS) & WHEEL_MASK);
+	else
+		slot = l->wheel[1]
+		     + (((l->now >> WHEEL_BITS) + WHEEL_MASK) & WHEEL_MASK);
+
+	p->next = *slot;
+	*slot = p;
+}
+
+
+/**
+ * Removes an expired entry from the lookup index.
+ */
+static void listitem_unindex (teredo_peerlist *l, teredo_listitem *p)
+{
 #ifdef HAVE_LIBJUDY
-			int Rc_int;
+	int Rc_int;
 
-			JHSD (Rc_int, l->PJHSArray, (uint8_t *)&p->key, 16);
-			assert (Rc_int);
+	JHSD (Rc_int, l->PJHSArray, (uint8_t *)&p->key, 16);
+	assert (Rc_int);
 #else
-                        teredo_listitem **pp;
+	teredo_listitem **pp;
 
-                        pp = tdelete (&p->key.ip6, &l->root, listitem_cmp);
-                        assert (pp != NULL);
+	pp = tdelete (&p->key.ip6, &l->root, listitem_cmp);
+	assert (pp != NULL);
+	(void)pp;
 #endif
-			l->left++;
+	l->left++;
+}
+
+
+/**
+ * Advances the timer wheel toward the current time, expiring peers whose
+ * deadline has passed. At most SWEEP_SLICE entries are processed per
+ * call, so that the lock is never held for long, even when many peers
+ * expire at once; the sweep resumes from there on the next call. Each
+ * peer is processed a bounded number of times per expiration delay, so
+ * that is amortized O(1) per lookup. The admission counters are halved
+ * with the remaining budget, ADMIT_DECAY_SLICE counters per unit.
+ *
+ * Expired entries are not released, but queued to l->garbage.
+ * Must be called with the lock held.
+ */
+static void wheel_advance (teredo_peerlist *l, teredo_clock_t now)
+{
+	unsigned budget = SWEEP_SLICE, expired = 0;
+
+	if (l->swept && ((long)(now - l->now) <= 0) && !admission_pending (l))
+		return; /* up to date */
+
+	TEREDO_PROBE1 (gc_sweep_start, now - l->now);
+	for (;;)
+	{
+		if (l->swept)
+		{
+			if ((long)(now - l->now) <= 0)
+				break; /* up to date */
+
+			l->now++;
+			l->swept = false;
+			l->cascaded = (l->now & WHEEL_MASK) != 0;
 		}
 
-		// unlinks old peers
-		teredo_listitem *old = l->old;
+		teredo_clock_t t = l->now;
+		teredo_listitem **slot, *p;
 
-		// moves recent peers to old peers area
-		l->old = l->recent;
-		l->recent = NULL;
-		if (l->old != NULL)
-			l->old->pprev = &l->old;
+		if (!l->cascaded)
+		{
+			/* Cascades second level entries to the first level */
+			slot = l->wheel[1] + ((t >> WHEEL_BITS) & WHEEL_MASK);
+			while ((p = *slot) != NULL)
+			{
+				if (budget == 0)
+					goto out;
+				budget--;
+				*slot = p->next;
+				wheel_insert (l, p);
+			}
+			l->cascaded = true;
+		}
 
-		pthread_mutex_unlock (&l->lock);
+		slot = l->wheel[0] + (t & WHEEL_MASK);
+		while ((p = *slot) != NULL)
+		{
+			if (budget == 0)
+				goto out;
+			budget--;
+			*slot = p->next;
+
+			if ((long)(p->deadline - t) <= 0)
+			{
+				listitem_unindex (l, p);
+				p->next = l->garbage;
+				l->garbage = p;
+				expired++;
+			}
+			else
+				wheel_insert (l, p); /* refreshed since it was filed */
+		}
 
-		// Perform possibly expensive memory release without the lock
-		sched_yield ();
-		listitem_recdestroy (old);
+		if ((l->admission != NULL) && ((t % l->expiration) == 0))
+		{
+			if (l->admission->ipv4.max)
+				admission_decay (&l->admission->ipv4);
+			if (l->admission->prefix.max)
+				admission_decay (&l->admission->prefix);
+		}
+		l->swept = true;
+	}
 
-		/* cancel-unsafe section ends */
-		pthread_setcancelstate (state, NULL);
-		sched_yield ();
+	/* Halves the admission counters in slices too */
+	if (l->admission != NULL)
+	{
+		budget = admission_decay_step (&l->admission->ipv4, budget);
+		admission_decay_step (&l->admission->prefix, budget);
 	}
+out:
+	TEREDO_PROBE1 (gc_sweep_end, expired);
+
+	/* The sweep started right after the lock was taken */
+	struct timespec ts;
+	teredo_gettime (&ts);
+
+	unsigned long took = (ts.tv_sec - l->locked_at.tv_sec) * 1000000000UL
+	                   + ts.tv_nsec - l->locked_at.tv_nsec;
+	if (took > l->max_sweep)
+		l->max_sweep = took;
+	l->sweep_time += took;
+	l->sweeps++;
+	l->expired += expired;
+}
+
+
+/**
+ * Unlocks the list and releases expired entries, without the lock.
+ * Tracks how long the lock was held too.
+ */
+static void list_unlock (teredo_peerlist *l)
+{
+	struct timespec ts;
+	teredo_gettime (&ts);
+
+	unsigned long held = (ts.tv_sec - l->locked_at.tv_sec) * 1000000000UL
+	                   + ts.tv_nsec - l->locked_at.tv_nsec;
+	if (held > l->max_hold)
+		l->max_hold = held;
+
+	teredo_listitem *garbage = l->garbage;
+	l->garbage = NULL;
+	pthread_mutex_unlock (&l->lock);
+
+	listitem_recdestroy (l, garbage);
+}
+
+
+static void list_lock (teredo_peerlist *l)
+{
+	pthread_mutex_lock (&l->lock);
+	teredo_gettime (&l->locked_at);
 }
 
 
@@ -288,30 +712,25 @@ teredo_peerlist *teredo_list_create (unsigned max, unsigned expiration)
 	if (l == NULL)
 		return NULL;
 
+	teredo_clock_init ();
 	pthread_mutex_init (&l->lock, NULL);
-	l->recent = l->old = NULL;
-	l->left = max;
+	l->now = teredo_clock ();
+	l->swept = true;
+	l->left = l->max = max;
 	l->expiration = expiration;
+	l->max_queue = MAXQUEUE;
 #ifdef HAVE_LIBJUDY
 	l->PJHSArray = (Pvoid_t)NULL;
 #else
 	l->root = NULL;
 #endif
-
-	if (pthread_create (&l->gc, NULL, garbage_collector, l))
-	{
-		pthread_mutex_destroy (&l->lock);
-		free (l);
-		return NULL;
-	}
-
 	return l;
 }
 
 
 void teredo_list_reset (teredo_peerlist *l, unsigned max)
 {
-	pthread_mutex_lock (&l->lock);
+	list_lock (l);
 
 #ifdef HAVE_LIBJUDY
 	// detach old array
@@ -322,16 +741,26 @@ void teredo_list_reset (teredo_peerlist *l, unsigned max)
 	l->root = NULL;
 #endif
 
-	teredo_listitem *recent = l->recent, *old = l->old;
-	// unlinks peers and resets lists
-	l->recent = l->old = NULL;
-	l->left = max;
+	// unlinks peers and resets the timer wheel
+	teredo_listitem *wheel[2][WHEEL_SIZE];
+	memcpy (wheel, l->wheel, sizeof (wheel));
+	memset (l->wheel, 0, sizeof (l->wheel));
+	l->swept = true;
+	l->left = l->max = max;
+	if (l->admission != NULL)
+	{
+		admission_clear (&l->admission->ipv4);
+		admission_clear (&l->admission->prefix);
+	}
+	if (l->topn != NULL)
+		teredo_topn_reset (l->topn);
 
-	pthread_mutex_unlock (&l->lock);
+	list_unlock (l);
 
 	/* the mutex is not needed for actual memory release */
-	listitem_recdestroy (old);
-	listitem_recdestroy (recent);
+	for (unsigned i = 0; i < 2; i++)
+		for (unsigned j = 0; j < WHEEL_SIZE; j++)
+			listitem_recdestroy (l, wheel[i][j]);
 
 #ifdef HAVE_LIBJUDY
 	// destroy the old array that was detached before unlocking
@@ -346,22 +775,153 @@ void teredo_list_reset (teredo_peerlist *l, unsigned max)
 void teredo_list_destroy (teredo_peerlist *l)
 {
 	teredo_list_reset (l, 0);
-
-	pthread_cancel (l->gc);
-	pthread_join (l->gc, NULL);
 	pthread_mutex_destroy (&l->lock);
 
+	free (l->pool);
+	admission_destroy (l->admission);
+	if (l->topn != NULL)
+		teredo_topn_destroy (l->topn);
 	free (l);
 }
 
 
+void teredo_list_set_max_queue (teredo_peerlist *l, size_t bytes)
+{
+	pthread_mutex_lock (&l->lock);
+	l->max_queue = bytes;
+	pthread_mutex_unlock (&l->lock);
+}
+
+
+int teredo_list_prealloc (teredo_peerlist *l)
+{
+	assert (l->pool == NULL);
+
+	unsigned n = l->left;
+	teredo_listitem *pool = calloc (n, sizeof (*pool));
+	if (pool == NULL)
+		return -1;
+
+	for (unsigned i = 1; i < n; i++)
+		pool[i - 1].next = pool + i;
+
+	pthread_mutex_lock (&l->lock);
+	l->pool = pool;
+	l->pool_size = n;
+	l->pool_free = (n > 0) ? pool : NULL;
+	pthread_mutex_unlock (&l->lock);
+	return 0;
+}
+
+
+int teredo_list_set_max (teredo_peerlist *l, unsigned max, bool prealloc)
+{
+	teredo_list_reset (l, max);
+
+	/* Releases the old pool first, so the memory peak does not double */
+	pthread_mutex_lock (&l->lock);
+	teredo_listitem *pool = l->pool;
+	l->pool = l->pool_free = NULL;
+	l->pool_size = 0;
+	pthread_mutex_unlock (&l->lock);
+	free (pool);
+
+	/* Resizes the admission sketches to the new maximum */
+	if ((l->admission != NULL)
+	 && teredo_list_set_quotas (l, l->admission->ipv4.max,
+	                            l->admission->prefix.max))
+		return -1;
+
+	return prealloc ? teredo_list_prealloc (l) : 0;
+}
+
+
+void teredo_list_set_expiration (teredo_peerlist *l, unsigned expiration)
+{
+	assert (expiration > 0);
+
+	pthread_mutex_lock (&l->lock);
+	l->expiration = expiration;
+	pthread_mutex_unlock (&l->lock);
+}
+
+
+int teredo_list_set_quotas (teredo_peerlist *l, unsigned max_ipv4,
+                            unsigned max_prefix)
+{
+	teredo_admission *a = NULL;
+
+	if (max_ipv4 || max_prefix)
+	{
+		a = malloc (sizeof (*a));
+		if (a == NULL)
+			return -1;
+
+		struct timespec ts;
+		clock_gettime (CLOCK_REALTIME, &ts);
+		uint64_t seed = ((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec
+		              ^ (uintptr_t)a;
+		int err = admission_init (&a->ipv4, max_ipv4, l->max, &seed);
+		err |= admission_init (&a->prefix, max_prefix, l->max, &seed);
+		if (err)
+		{
+			admission_destroy (a);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock (&l->lock);
+	teredo_admission *old = l->admission;
+	l->admission = a;
+	pthread_mutex_unlock (&l->lock);
+
+	admission_destroy (old);
+	return 0;
+}
+
+
+int teredo_list_set_top (teredo_peerlist *l, unsigned size)
+{
+	teredo_topn *t = NULL;
+
+	if (size > 0)
+	{
+		t = teredo_topn_create (size);
+		if (t == NULL)
+			return -1;
+	}
+
+	pthread_mutex_lock (&l->lock);
+	teredo_topn *old = l->topn;
+	l->topn = t;
+	pthread_mutex_unlock (&l->lock);
+
+	if (old != NULL)
+		teredo_topn_destroy (old);
+	return 0;
+}
+
+
 teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
                                  const struct in6_addr *restrict addr,
                                  bool *restrict create)
 {
 	teredo_listitem *p;
-
-	pthread_mutex_lock (&list->lock);
+	teredo_clock_t now = teredo_clock ();
+
+	list_lock (list);
+	wheel_advance (list, now);
+
+	/*
+	 * Abusive sources are rejected before the peer is inserted. Only a
+	 * plain lookup is done in that case, so that existing peers are
+	 * still found.
+	 */
+	bool insert = (create != NULL);
+	if (insert && (list->admission != NULL)
+	 && !admission_check (list->admission,
+	                      (const union teredo_addr *)addr))
+		insert = false;
 
 #ifdef HAVE_LIBJUDY
 	teredo_listitem **pp = NULL;
@@ -370,7 +930,7 @@ teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
 	{
 		void *PValue;
 
-		if (create != NULL)
+		if (insert)
 		{
 			JHSI (PValue, list->PJHSArray, (uint8_t *)addr, 16);
 			if (PValue == PJERR)
@@ -389,7 +949,7 @@ teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
 #else
 	void **pp;
 
-	if (create != NULL)
+	if (insert)
 	{
 		pp = tsearch (addr, &list->root, listitem_cmp);
 		if (pp == NULL)
@@ -406,44 +966,25 @@ teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
 	if (p != NULL)
 	{
 		/* peer was already in list */
-		assert (*(p->pprev) == p);
-		assert ((p->next == NULL) || (p->next->pprev == &p->next));
-
 		if (create != NULL)
 			*create = false;
 
-		/* move peer to the top of the head of the "recent" list */
-		if (list->recent != p)
-		{
-			// unlinks
-			if (p->next != NULL)
-				p->next->pprev = p->pprev;
-			*(p->pprev) = p->next;
-
-			// inserts at head
-			p->next = list->recent;
-			if (p->next != NULL)
-				p->next->pprev = &p->next;
-
-			list->recent = p;
-			p->pprev = &list->recent;
-
-			assert (*(p->pprev) == p);
-			assert ((p->next == NULL) || (p->next->pprev == &p->next));
-		}
-
+		/* postpone expiry; the wheel slot is updated lazily */
+		p->deadline = now + list->expiration;
+		TEREDO_PROBE1 (peer_hit, addr);
 		return &p->peer;
 	}
 
 	/* otherwise, peer was not in list */
 	assert (p == NULL);
-	if (create == NULL)
-		goto error; /* not found and not created */
+	TEREDO_PROBE1 (peer_miss, addr);
+	if (!insert)
+		goto error; /* not found and not created (or rejected) */
 	*create = true;
 
 	/* Allocates a new peer entry */
 	if (list->left > 0)
-		p = listitem_create ();
+		p = listitem_create (list);
 
 	if (p == NULL)
 	{
@@ -456,31 +997,98 @@ teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
 		goto error; /* out of memory */
 	}
 
-	/* Puts new entry at the head of the list */
-	p->next = list->recent;
-	if (p->next != NULL)
-		p->next->pprev = &p->next;
-
-	p->pprev = &list->recent;
-	list->recent = p;
-	p->pprev = &list->recent;
+	/* Schedules expiry of the new entry */
+	p->deadline = now + list->expiration;
+	wheel_insert (list, p);
 
 	list->left--;
-
-	assert (*(p->pprev) == p);
-	assert ((p->next == NULL) || (p->next->pprev == &p->next));
+	TEREDO_PROBE2 (peer_create, addr, list->left);
 
 	*pp = p;
 	p->key.ip6 = *addr;
+	if (list->admission != NULL)
+		admission_count (list->admission, &p->key);
 	return &p->peer;
 
 error:
-	pthread_mutex_unlock (&list->lock);
+	list_unlock (list);
 	return NULL;
 }
 
 
 void teredo_list_release (teredo_peerlist *l)
 {
+	list_unlock (l);
+}
+
+
+void teredo_list_account (teredo_peerlist *restrict l,
+                          const struct in6_addr *restrict addr,
+                          size_t bytes, bool rx)
+{
+	if (l->topn != NULL)
+		teredo_topn_add (l->topn, addr, bytes, rx);
+}
+
+
+unsigned teredo_list_top (teredo_peerlist *restrict l,
+                          teredo_peer_stats *restrict tab, unsigned n,
+                          bool reset)
+{
+	teredo_topn_item *items = malloc ((n + 1) * sizeof (*items));
+	if (items == NULL)
+		return 0;
+
+	pthread_mutex_lock (&l->lock);
+	if (l->topn != NULL)
+	{
+		n = teredo_topn_get (l->topn, items, n);
+		if (reset)
+			teredo_topn_reset (l->topn);
+	}
+	else
+		n = 0;
+
+	pthread_mutex_unlock (&l->lock);
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		tab[i].addr = items[i].addr;
+		tab[i].bytes = items[i].bytes;
+		tab[i].error = items[i].error;
+		tab[i].packets = items[i].packets;
+		tab[i].rx_packets = items[i].rx_packets;
+		tab[i].tx_packets = items[i].tx_packets;
+		tab[i].rx_bytes = items[i].rx_bytes;
+		tab[i].tx_bytes = items[i].tx_bytes;
+	}
+
+	free (items);
+	return n;
+}
+
+
+unsigned long teredo_list_max_hold (teredo_peerlist *l, bool reset)
+{
+	pthread_mutex_lock (&l->lock);
+	unsigned long max = l->max_hold;
+	if (reset)
+		l->max_hold = 0;
+	pthread_mutex_unlock (&l->lock);
+	return max;
+}
+
+
+void teredo_list_stats (teredo_peerlist *restrict l,
+                        struct teredo_tunnel_stats *restrict st)
+{
+	pthread_mutex_lock (&l->lock);
+	st->peers = l->max - l->left;
+	st->max_peers = l->max;
+	st->expired = l->expired;
+	st->sweeps = l->sweeps;
+	st->sweep_time = l->sweep_time;
+	st->max_sweep = l->max_sweep;
+	st->max_hold = l->max_hold;
 	pthread_mutex_unlock (&l->lock);
 }
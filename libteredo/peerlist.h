@@ -27,6 +27,10 @@
 # define MAXQUEUE 1280u // bytes
 
 typedef struct teredo_queue teredo_queue;
+struct teredo_peerlist;
+struct teredo_io;
+struct teredo_peer_stats;
+struct teredo_tunnel_stats;
 
 typedef struct teredo_peer
 {
@@ -51,8 +55,10 @@ void teredo_enqueue_in (teredo_peer *restrict peer, const void *restrict data,
 
 void teredo_enqueue_out (teredo_peer *restrict peer,
                          const void *restrict data, size_t len);
-teredo_queue *teredo_peer_queue_yield (teredo_peer *peer);
-void teredo_queue_emit (teredo_queue *q, int fd, uint32_t ipv4, uint16_t port,
+teredo_queue *teredo_peer_queue_yield (struct teredo_peerlist *list,
+                                      teredo_peer *peer);
+void teredo_queue_emit (teredo_queue *q, struct teredo_io *io,
+                        uint32_t ipv4, uint16_t port,
                         teredo_dequeue_cb cb, void *r);
 
 static inline void SetMapping (teredo_peer *peer, uint32_t ip, uint16_t port)
@@ -72,10 +78,14 @@ static inline void TouchTransmit (teredo_peer *peer, teredo_clock_t now)
 }
 
 
+/**
+ * @param timeout delay (seconds) after which a non-local peer is no longer
+ * valid if nothing was received from it (normally TEREDO_TIMEOUT)
+ */
 static inline
-bool IsValid (const teredo_peer *peer, teredo_clock_t now)
+bool IsValid (const teredo_peer *peer, teredo_clock_t now, unsigned timeout)
 {
-	return (now - peer->last_rx) <= (peer->local ? 600 : 30);
+	return (now - peer->last_rx) <= (peer->local ? 600 : timeout);
 }
 
 
@@ -87,8 +97,9 @@ struct in6_addr;
  * Creates an empty peer list.
  *
  * @param max maximum number of peers in the list
- * @param expiration minimum delay (seconds) before a peer can be removed
- * by the garbage collector. Must not be 0.
+ * @param expiration delay (seconds) after its last lookup before a peer
+ * expires. Expired peers are removed by subsequent lookups.
+ * Must not be 0.
  *
  * @return NULL on error (see errno for actual problem).
  */
@@ -111,6 +122,73 @@ void teredo_list_destroy (teredo_peerlist *list);
 void teredo_list_reset (teredo_peerlist *list, unsigned max);
 
 
+/**
+ * Sets the maximum number of bytes of packets queued per peer, pending
+ * hole punching. It only applies to peers created afterward.
+ */
+void teredo_list_set_max_queue (teredo_peerlist *list, size_t bytes);
+
+/**
+ * Preallocates entries for the current maximum number of peers of an empty
+ * list, so that memory allocation is not needed when peers are created
+ * (that does not include the lookup index).
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_list_prealloc (teredo_peerlist *list);
+
+/**
+ * Changes the maximum number of peers of an unlocked list, and empties it.
+ * Previously preallocated entries are released first.
+ *
+ * @param max new maximum number of peers
+ * @param prealloc whether to preallocate entries for all peers
+ *
+ * @return 0 on success, -1 on error (out of memory), in which case no
+ * entries are preallocated.
+ */
+int teredo_list_set_max (teredo_peerlist *list, unsigned max, bool prealloc);
+
+/**
+ * Changes the expiration delay of an unlocked list. That only applies to
+ * peers looked up afterward.
+ *
+ * @param expiration delay (seconds), must not be 0
+ */
+void teredo_list_set_expiration (teredo_peerlist *list, unsigned expiration);
+
+
+/**
+ * Sets admission quotas on an unlocked list. Once either quota has been
+ * reached, no new peers are created for the corresponding source, until
+ * older peers expire. The numbers of peers are estimated with count-min
+ * sketches, so that the check is cheap and uses bounded memory.
+ * Estimates can only exceed actual numbers, never fall short of them.
+ * The sketches are sized from the maximum number of peers of the list,
+ * so that other sources seldom push a source over its quota.
+ *
+ * @param max_ipv4 maximum number of Teredo peers with the same mapped
+ * IPv4 address (0 means unlimited)
+ * @param max_prefix maximum number of peers within the same /64 IPv6
+ * prefix, i.e. the same Teredo server for Teredo peers (0 means unlimited)
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_list_set_quotas (teredo_peerlist *list, unsigned max_ipv4,
+                            unsigned max_prefix);
+
+
+/**
+ * Enables or disables tracking of the peers with the most traffic in an
+ * unlocked list.
+ *
+ * @param size number of tracked peers (0 disables tracking)
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_list_set_top (teredo_peerlist *list, unsigned size);
+
+
 /**
  * Locks the list and looks up a peer in an unlocked list.
  * On success, the list must be unlocked with teredo_list_release(), otherwise
@@ -125,7 +203,8 @@ void teredo_list_reset (teredo_peerlist *list, unsigned max);
  * *create is undefined on return in case of error.
  *
  * @return peer if found or created. NULL on error (when @a create is not
- * NULL), or if the peer was not found (when @a create is NULL).
+ * NULL), if the peer was not found (when @a create is NULL), or if it was
+ * not found and admission quotas were exceeded.
  */
 teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
                                  const struct in6_addr *restrict addr,
@@ -137,4 +216,44 @@ teredo_peer *teredo_list_lookup (teredo_peerlist *restrict list,
  */
 void teredo_list_release (teredo_peerlist *list);
 
+/**
+ * Accounts for a packet exchanged with a peer in the tracking of the peers
+ * with the most traffic, if enabled. Peers have no counters of their own.
+ * Must be called with the list locked by teredo_list_lookup().
+ *
+ * @param addr IPv6 address of the peer
+ * @param bytes packet size
+ * @param rx whether the packet was received from the peer
+ */
+void teredo_list_account (teredo_peerlist *restrict list,
+                          const struct in6_addr *restrict addr,
+                          size_t bytes, bool rx);
+
+/**
+ * Gets the peers with the most traffic from an unlocked list.
+ *
+ * @param tab [out] table of at most @a n peers, by decreasing traffic
+ * @param reset whether to start a new tracking period
+ *
+ * @return the number of peers in the table (0 if tracking is disabled).
+ */
+unsigned teredo_list_top (teredo_peerlist *restrict list,
+                          struct teredo_peer_stats *restrict tab, unsigned n,
+                          bool reset);
+
+/**
+ * @param reset whether to reset the value
+ * @return the longest time (nanoseconds) the list lock was held for
+ * by teredo_list_lookup() and its callers, since it was last reset.
+ */
+unsigned long teredo_list_max_hold (teredo_peerlist *list, bool reset);
+
+/**
+ * Gets the peers list occupancy and garbage collection statistics
+ * (the peers, max_peers, expired, sweeps, sweep_time, max_sweep and
+ * max_hold members of @a st).
+ */
+void teredo_list_stats (teredo_peerlist *restrict list,
+                        struct teredo_tunnel_stats *restrict st);
+
 #endif /* ifndef LIBTEREDO_PEERLIST_H */
@@ -0,0 +1,202 @@
+/*
+ * pending.c - Teredo relay pending hole punching table
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "pending.h"
+
+/* Maximum number of entries probed per slot (open addressing) */
+#define PENDING_PROBES 4
+
+typedef struct teredo_pending_entry
+{
+	uint32_t ipv4;
+	uint16_t port;
+	uint8_t bubbles; /* 0 if the entry is free */
+	teredo_clock_t last_tx;
+} teredo_pending_entry;
+
+struct teredo_pending
+{
+	pthread_mutex_t lock;
+	struct
+	{
+		teredo_clock_t tick; /* creation time of the slot entries */
+		teredo_pending_entry entries[TEREDO_PENDING_SLOT_SIZE];
+	} wheel[TEREDO_PENDING_SLOTS];
+};
+
+
+teredo_pending *teredo_pending_create (void)
+{
+	teredo_pending *tab = calloc (1, sizeof (*tab));
+	if (tab == NULL)
+		return NULL;
+
+	pthread_mutex_init (&tab->lock, NULL);
+	/* Mark all slots as expired */
+	for (unsigned i = 0; i < TEREDO_PENDING_SLOTS; i++)
+		tab->wheel[i].tick = i + 1;
+	return tab;
+}
+
+
+void teredo_pending_destroy (teredo_pending *tab)
+{
+	pthread_mutex_destroy (&tab->lock);
+	free (tab);
+}
+
+
+static inline unsigned pending_hash (uint32_t ipv4, uint16_t port)
+{
+	return ((ipv4 ^ (((uint32_t)port) << 16) ^ port) * 2654435761u) >> 16;
+}
+
+
+/**
+ * Looks up an entry in the non-expired slots of the wheel.
+ * Must be called with the lock held.
+ */
+static teredo_pending_entry *
+pending_find (teredo_pending *tab, uint32_t ipv4, uint16_t port,
+              teredo_clock_t now)
+{
+	unsigned h = pending_hash (ipv4, port);
+
+	for (unsigned i = 0; i < TEREDO_PENDING_SLOTS; i++)
+	{
+		teredo_clock_t tick = now - i;
+		if (tab->wheel[tick % TEREDO_PENDING_SLOTS].tick != tick)
+			continue; /* expired slot */
+
+		teredo_pending_entry *entries =
+			tab->wheel[tick % TEREDO_PENDING_SLOTS].entries;
+
+		for (unsigned j = 0; j < PENDING_PROBES; j++)
+		{
+			teredo_pending_entry *e =
+				entries + (h + j) % TEREDO_PENDING_SLOT_SIZE;
+
+			if (e->bubbles == 0)
+				break;
+			if ((e->ipv4 == ipv4) && (e->port == port))
+				return e;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Creates an entry in the current slot of the wheel, recycling the slot
+ * if it has expired. Must be called with the lock held.
+ */
+static teredo_pending_entry *
+pending_insert (teredo_pending *tab, uint32_t ipv4, uint16_t port,
+                teredo_clock_t now)
+{
+	unsigned h = pending_hash (ipv4, port);
+	unsigned slot = now % TEREDO_PENDING_SLOTS;
+
+	if (tab->wheel[slot].tick != now)
+	{
+		for (unsigned j = 0; j < TEREDO_PENDING_SLOT_SIZE; j++)
+			tab->wheel[slot].entries[j].bubbles = 0;
+		tab->wheel[slot].tick = now;
+	}
+
+	for (unsigned j = 0; j < PENDING_PROBES; j++)
+	{
+		teredo_pending_entry *e =
+			tab->wheel[slot].entries + (h + j) % TEREDO_PENDING_SLOT_SIZE;
+
+		if (e->bubbles == 0)
+		{
+			e->ipv4 = ipv4;
+			e->port = port;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+
+int teredo_pending_bubble (teredo_pending *tab, uint32_t ipv4,
+                           uint16_t port, teredo_clock_t now)
+{
+	int res;
+
+	pthread_mutex_lock (&tab->lock);
+	teredo_pending_entry *e = pending_find (tab, ipv4, port, now);
+
+	if (e == NULL)
+	{
+		e = pending_insert (tab, ipv4, port, now);
+		if (e == NULL)
+			res = 1; /* full, try again later */
+		else
+		{
+			e->bubbles = 1;
+			e->last_tx = now;
+			res = 0;
+		}
+	}
+	else
+	/* § 5.2.6 - sending bubbles */
+	if (e->bubbles >= 4)
+		res = -1;
+	else
+	if ((now - e->last_tx) <= 2)
+		res = 1;
+	else
+	{
+		e->bubbles++;
+		e->last_tx = now;
+		res = 0;
+	}
+	pthread_mutex_unlock (&tab->lock);
+	return res;
+}
+
+
+void teredo_pending_remove (teredo_pending *tab, uint32_t ipv4,
+                            uint16_t port, teredo_clock_t now)
+{
+	pthread_mutex_lock (&tab->lock);
+	teredo_pending_entry *e = pending_find (tab, ipv4, port, now);
+	/*
+	 * Entries are not actually freed, as that would break the probing
+	 * sequence of other entries. A dummy address is used instead.
+	 */
+	if (e != NULL)
+		e->ipv4 = e->port = 0;
+	pthread_mutex_unlock (&tab->lock);
+}
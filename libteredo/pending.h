@@ -0,0 +1,80 @@
+/*
+ * pending.h - Teredo relay pending hole punching table
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_PENDING_H
+# define LIBTEREDO_PENDING_H
+
+/* Number of one-second slots in the wheel, i.e. entries lifetime */
+# define TEREDO_PENDING_SLOTS 16
+/* Maximum number of entries created within one second */
+# define TEREDO_PENDING_SLOT_SIZE 64
+
+typedef struct teredo_pending teredo_pending;
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/**
+ * Creates an empty pending hole punching table.
+ *
+ * The table records the bubbles sent toward Teredo peers that are not in
+ * the peers list yet. It never allocates memory after creation: entries
+ * are filed into a time wheel according to their creation time, and each
+ * slot of the wheel is recycled as a whole once it has expired. Spoofed
+ * traffic can therefore at worst prevent new entries from being created
+ * for one second.
+ *
+ * @return NULL on error.
+ */
+teredo_pending *teredo_pending_create (void);
+
+/**
+ * Destroys a pending hole punching table.
+ */
+void teredo_pending_destroy (teredo_pending *tab);
+
+/**
+ * Accounts for a bubble to be sent toward a Teredo peer, following the
+ * same rate limiting rules as for peers in the peers list.
+ * Thread-safe.
+ *
+ * @param ipv4 peer mapped IPv4 address (network byte order)
+ * @param port peer mapped UDP port (network byte order)
+ * @param now current time
+ *
+ * @return 0 if a bubble may be sent, -1 if no more bubble may be sent,
+ * 1 if a bubble may be sent later (including if the table is full).
+ */
+int teredo_pending_bubble (teredo_pending *tab, uint32_t ipv4,
+                           uint16_t port, teredo_clock_t now);
+
+/**
+ * Removes the entry of a Teredo peer (if any), typically once the peer
+ * has been committed to the peers list. Thread-safe.
+ */
+void teredo_pending_remove (teredo_pending *tab, uint32_t ipv4,
+                            uint16_t port, teredo_clock_t now);
+
+# ifdef __cplusplus
+}
+# endif
+#endif
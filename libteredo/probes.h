@@ -0,0 +1,73 @@
+/*
+ * probes.h - Static tracing probes
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_PROBES_H
+# define LIBTEREDO_PROBES_H
+
+/*
+ * User-level statically defined tracing (USDT) probes of the "libteredo"
+ * provider. With <sys/sdt.h> (SystemTap), each probe compiles to a single
+ * NOP instruction plus an ELF note, which perf, bpftrace or SystemTap can
+ * attach to at run time, also in release (NDEBUG) builds, e.g.:
+ *
+ *   bpftrace -e 'usdt:libteredo.so:libteredo:peer_miss { @[tid] = count(); }'
+ *
+ * Probe arguments must be cheap to compute, as they are evaluated even
+ * when no tracer is attached. Without <sys/sdt.h>, probes are no-ops
+ * (arguments are not evaluated).
+ *
+ * Probes (arguments):
+ *  recv_entry      (IPv6 length, source IPv4, source port)
+ *  recv_exit       (IPv6 length)
+ *  peer_hit        (IPv6 address)
+ *  peer_miss       (IPv6 address)
+ *  peer_create     (IPv6 address, free entries left)
+ *  queue_enqueue   (length, incoming, queue bytes left)
+ *  queue_drop      (length, incoming)
+ *  queue_emit      (packets)
+ *  gc_sweep_start  (seconds behind)
+ *  gc_sweep_end    (expired peers)
+ *  bubble_send     (IPv4, port, destination IPv6 address)
+ *  ping_send       (destination IPv6 address)
+ *  ra_send         (IPv4, port, secondary)
+ *  ipv6_send_retry (attempt, errno)
+ *
+ * IPv4 addresses and ports are in network byte order.
+ */
+
+# ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define TEREDO_PROBE1(n, a) \
+	DTRACE_PROBE1 (libteredo, n, a)
+#  define TEREDO_PROBE2(n, a, b) \
+	DTRACE_PROBE2 (libteredo, n, a, b)
+#  define TEREDO_PROBE3(n, a, b, c) \
+	DTRACE_PROBE3 (libteredo, n, a, b, c)
+# else
+#  define TEREDO_PROBE1(n, a) \
+	((void)sizeof (a))
+#  define TEREDO_PROBE2(n, a, b) \
+	((void)sizeof (a), (void)sizeof (b))
+#  define TEREDO_PROBE3(n, a, b, c) \
+	((void)sizeof (a), (void)sizeof (b), (void)sizeof (c))
+# endif
+
+#endif /* ifndef LIBTEREDO_PROBES_H */
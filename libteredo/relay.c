@@ -31,6 +31,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <stdlib.h> // malloc()
+#include <unistd.h> // sleep()
 #include <assert.h>
 #include <inttypes.h>
 
@@ -40,18 +41,26 @@
 #include <netinet/ip6.h> // struct ip6_hdr
 #include <netinet/icmp6.h> // ICMP6_DST_UNREACH_*
 #include <arpa/inet.h> // inet_ntop()
+#include <sys/socket.h> // getsockname()
+#include <poll.h>
 #include <pthread.h>
 
 #include "teredo.h"
 #include "v4global.h" // is_ipv4_global_unicast()
 #include "teredo-udp.h"
+#include "io.h"
 
 #include "packets.h"
 #include "tunnel.h"
+#include "relay.h"
 #include "maintain.h"
 #include "clock.h"
 #include "peerlist.h"
+#include "pending.h"
 #include "thread.h"
+#include "xdp.h"
+#include "probes.h"
+#include "capture.h"
 #ifdef MIREDO_TEREDO_CLIENT
 # include "security.h"
 # include "discovery.h"
@@ -64,6 +73,13 @@
 struct teredo_tunnel
 {
 	struct teredo_peerlist *list;
+	teredo_pending *pending; // stateless mode, NULL if disabled
+
+	// Peers list parameters
+	unsigned max_peers;
+	unsigned expiration; // seconds, 0 for the mode default
+	unsigned peer_timeout; // seconds
+	unsigned icmp_rate_limit_ms;
 	void *opaque;
 #ifdef MIREDO_TEREDO_CLIENT
 	struct teredo_maintenance *maintenance;
@@ -83,32 +99,59 @@ struct teredo_tunnel
 	struct
 	{
 		pthread_mutex_t lock;
-		int count;
-		teredo_clock_t last;
+		uint64_t next; // milliseconds, theoretical time of the next error
 	} ratelimit;
 
+	// Statistics, updated atomically
+	struct
+	{
+		unsigned long packets, delivered;
+		uint64_t time; // nanoseconds
+	} rx;
+	struct
+	{
+		unsigned long packets, sent;
+	} tx;
+
 	// Asynchronous packet reception
 	teredo_thread *recv;
+	teredo_xdp *xdp;
+	unsigned recv_spin; // microseconds
+	teredo_capture *capture;
 
-	int fd;
+	teredo_io *io;
 };
 
+/* Default values of the tunable parameters */
 #ifdef HAVE_LIBJUDY
 # define MAX_PEERS 1048576
 #else
 # define MAX_PEERS 1024
 #endif
-#define ICMP_RATE_LIMIT_MS 100
+/* Maximum number of packets processed before the transmitted datagrams
+ * are flushed, if more are already queued on the socket. */
+#define RECV_BURST 32
+/* Number of packets whose bubbles are authenticated at once */
+#define RECV_BATCH 8
+
+/**
+ * Passes a decapsulated IPv6 packet to the receive callback.
+ */
+static void teredo_deliver (void *opaque, const void *data, size_t len)
+{
+	teredo_tunnel *tunnel = opaque;
+
+	if (tunnel->capture != NULL)
+		teredo_capture_packet (tunnel->capture, data, len);
+	__atomic_fetch_add (&tunnel->rx.delivered, 1, __ATOMIC_RELAXED);
+	tunnel->recv_cb (tunnel->opaque, data, len);
+}
 
 #if 0
 static unsigned QualificationRetries; // maintain.c
 static unsigned QualificationTimeOut; // maintain.c
 static unsigned ServerNonceLifetime;  // maintain.c
 static unsigned RestartDelay;         // maintain.c
-
-static unsigned MaxQueueBytes;        // peerlist.c
-static unsigned MaxPeers;             // here
-static unsigned IcmpRateLimitMs;      // here
 #endif
 
 /**
@@ -127,25 +170,31 @@ teredo_send_unreach (teredo_tunnel *restrict tunnel, uint8_t code,
 		struct icmp6_hdr hdr;
 		char fill[1280 - sizeof (struct ip6_hdr) - sizeof (struct icmp6_hdr)];
 	} buf;
-	teredo_clock_t now = teredo_clock ();
 
-	/* ICMPv6 rate limit */
+	/*
+	 * ICMPv6 rate limit: one error per interval on average, with bursts
+	 * of up to one second worth of errors (none for longer intervals).
+	 */
 	pthread_mutex_lock (&tunnel->ratelimit.lock);
-	if (now != tunnel->ratelimit.last)
+	unsigned interval = tunnel->icmp_rate_limit_ms;
+	if (interval)
 	{
-		tunnel->ratelimit.last = now;
-		tunnel->ratelimit.count =
-			ICMP_RATE_LIMIT_MS ? (int)(1000 / ICMP_RATE_LIMIT_MS) : -1;
-	}
+		struct timespec ts;
+		teredo_gettime (&ts);
 
-	if (tunnel->ratelimit.count == 0)
-	{
-		/* rate limit exceeded */
-		pthread_mutex_unlock (&tunnel->ratelimit.lock);
-		return;
+		uint64_t now = ts.tv_sec * UINT64_C(1000) + ts.tv_nsec / 1000000;
+		uint64_t burst = (interval < 1000) ? 1000 - interval : 0;
+
+		if (tunnel->ratelimit.next < now)
+			tunnel->ratelimit.next = now;
+		if (tunnel->ratelimit.next - now > burst)
+		{
+			/* rate limit exceeded */
+			pthread_mutex_unlock (&tunnel->ratelimit.lock);
+			return;
+		}
+		tunnel->ratelimit.next += interval;
 	}
-	if (tunnel->ratelimit.count > 0)
-		tunnel->ratelimit.count--;
 	pthread_mutex_unlock (&tunnel->ratelimit.lock);
 
 	len = BuildICMPv6Error (&buf.hdr, ICMP6_DST_UNREACH, code, in, len);
@@ -174,7 +223,7 @@ TeredoRelay::EmitICMPv6Error (const void *packet, size_t length,
 
 
 #ifdef MIREDO_TEREDO_CLIENT
-static void teredo_recv_loop (void *, int fd);
+static void teredo_recv_loop (void *, teredo_io *);
 
 static void
 teredo_state_change (const teredo_state *state, void *self)
@@ -199,7 +248,7 @@ teredo_state_change (const teredo_state *state, void *self)
 		 * the peer list is locked is STRICTLY FORBIDDEN to avoid an obvious
 		 * inter-locking deadlock.
 		 */
-		teredo_list_reset (tunnel->list, MAX_PEERS);
+		teredo_list_reset (tunnel->list, tunnel->max_peers);
 		tunnel->up_cb (tunnel->opaque,
 		               &tunnel->state.addr.ip6, tunnel->state.mtu);
 
@@ -211,7 +260,7 @@ teredo_state_change (const teredo_state *state, void *self)
 
 		if (tunnel->disc)
 		{
-			tunnel->discovery = teredo_discovery_start (tunnel->fd,
+			tunnel->discovery = teredo_discovery_start (tunnel->io,
 			                                            &state->addr.ip6,
 			                                            teredo_recv_loop,
 			                                            tunnel);
@@ -264,6 +313,12 @@ static inline bool IsClient (const teredo_tunnel *tunnel)
 {
 	return tunnel->maintenance != NULL;
 }
+
+
+void teredo_set_state (teredo_tunnel *t, const teredo_state *s)
+{
+	teredo_state_change (s, t);
+}
 #endif
 
 
@@ -328,13 +383,53 @@ static
 int teredo_encap (teredo_tunnel *restrict tunnel, teredo_peer *restrict peer,
                   const void *restrict data, size_t len, teredo_clock_t now)
 {
+	const struct ip6_hdr *ip6 = data;
 	uint32_t ipv4 = peer->mapped_addr;
 	uint16_t port = peer->mapped_port;
 	TouchTransmit (peer, now);
+	teredo_list_account (tunnel->list, &ip6->ip6_dst, len, false);
 	teredo_list_release (tunnel->list);
+	__atomic_fetch_add (&tunnel->tx.sent, 1, __ATOMIC_RELAXED);
 
-	return (teredo_send (tunnel->fd,
-	                     data, len, ipv4, port) == (int)len) ? 0 : -1;
+	return (teredo_io_send (tunnel->io,
+	                        data, len, ipv4, port) == (int)len) ? 0 : -1;
+}
+
+
+/**
+ * Sends bubbles toward an untrusted non-cone Teredo peer, depending on the
+ * result of the bubble rate limiting (see CountBubble()).
+ *
+ * @return 0 on success, -1 in case of UDP/IPv4 network error.
+ */
+static int
+teredo_send_bubbles (teredo_tunnel *restrict tunnel,
+                     const teredo_state *restrict s, int res,
+                     const struct ip6_hdr *restrict packet, size_t length)
+{
+	const struct in6_addr *dst = &packet->ip6_dst;
+
+	switch (res)
+	{
+		case 0:
+			/*
+			 * Open the return path if we are behind a
+			 * restricted NAT.
+			 */
+			if (!(s->addr.teredo.flags & htons (TEREDO_FLAG_CONE))
+			 && SendBubbleFromDst(tunnel->io, dst, false))
+				return -1;
+
+			return SendBubbleFromDst(tunnel->io, dst, true);
+
+		case -1: // Too many bubbles already sent
+			teredo_send_unreach (tunnel, ICMP6_DST_UNREACH_ADDR,
+			                     packet, length);
+
+		//case 1: -- between two bubbles -- nothing to do
+	}
+
+	return 0;
 }
 
 
@@ -348,6 +443,8 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
    	char b[INET6_ADDRSTRLEN];
 #endif
 
+	__atomic_fetch_add (&tunnel->tx.packets, 1, __ATOMIC_RELAXED);
+
 	/* Drops multicast destination, we cannot handle these */
 	if (dst->s6_addr[0] == 0xff)
 		return 0;
@@ -431,14 +528,37 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 	teredo_clock_t now = teredo_clock ();
 	struct teredo_peerlist *list = tunnel->list;
 
-	teredo_peer *p = teredo_list_lookup(list, dst, &created);
-	if (p == NULL)
-		return -1; /* error */
+	teredo_peer *p;
+
+	if ((tunnel->pending != NULL)
+	 && (IN6_TEREDO_PREFIX(dst) == htonl(TEREDO_PREFIX)))
+	{
+		/*
+		 * Stateless mode: unknown Teredo peers are not added to the list
+		 * until they reply to our (authenticated) bubbles. The packet is
+		 * dropped, as there is no peer to queue it to.
+		 */
+		p = teredo_list_lookup (list, dst, NULL);
+		if (p == NULL)
+		{
+			int res = teredo_pending_bubble (tunnel->pending,
+			                                 IN6_TEREDO_IPV4(dst),
+			                                 IN6_TEREDO_PORT(dst), now);
+			return teredo_send_bubbles (tunnel, &s, res, packet, length);
+		}
+		created = false;
+	}
+	else
+	{
+		p = teredo_list_lookup(list, dst, &created);
+		if (p == NULL)
+			return -1; /* error */
+	}
 
 	if (!created)
 	{
 		/* Case 1 (paragraphs 5.2.4 & 5.4.1): trusted peer */
-		if (p->trusted && IsValid (p, now))
+		if (p->trusted && IsValid (p, now, tunnel->peer_timeout))
 			/* Already known -valid- peer */
 			return teredo_encap (tunnel, p, packet, length, now);
 	}
@@ -452,7 +572,7 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 	                                         b, sizeof (b)),
 	       !p->local        ? "" : "LOCAL, ",
 	       p->trusted       ? "" : "NOT ",
-	       IsValid (p, now) ? "" : "NOT ",
+	       IsValid (p, now, tunnel->peer_timeout) ? "" : "NOT ",
 	       p->pings, p->bubbles);
 
 	// Unknown, untrusted, or too old peer
@@ -479,7 +599,7 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 		teredo_list_release (list);
 
 		if (res == 0)
-			res = SendPing(tunnel->fd, &s.addr, dst);
+			res = SendPing(tunnel->io, &s.addr, dst);
 
 		if (res == -1)
 			teredo_send_unreach (tunnel, ICMP6_DST_UNREACH_ADDR,
@@ -491,7 +611,7 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 	}
 
 	/* Client case 3: untrusted local peer */
-	if (p->local && IsValid (p, now))
+	if (p->local && IsValid (p, now, tunnel->peer_timeout))
 	{
 		teredo_enqueue_out (p, packet, length);
 
@@ -503,11 +623,11 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 
 		if (res == 0)
 		{
-			teredo_send_bubble(tunnel->fd, addr, port, &s.addr.ip6, dst);
+			teredo_send_bubble(tunnel->io, addr, port, &s.addr.ip6, dst);
 
 			pthread_rwlock_rdlock (&tunnel->state_lock);
 			if (tunnel->discovery != NULL)
-				teredo_discovery_send_bubbles (tunnel->discovery, tunnel->fd);
+				teredo_discovery_send_bubbles (tunnel->discovery, tunnel->io);
 			pthread_rwlock_unlock (&tunnel->state_lock);
 		}
 
@@ -542,27 +662,7 @@ int teredo_transmit (teredo_tunnel *restrict tunnel,
 	// Sends bubble, if rate limit allows
 	int res = CountBubble (p, now);
 	teredo_list_release (list);
-	switch (res)
-	{
-		case 0:
-			/*
-			 * Open the return path if we are behind a
-			 * restricted NAT.
-			 */
-			if (!(s.addr.teredo.flags & htons (TEREDO_FLAG_CONE))
-			 && SendBubbleFromDst(tunnel->fd, dst, false))
-				return -1;
-
-			return SendBubbleFromDst(tunnel->fd, dst, true);
-
-		case -1: // Too many bubbles already sent
-			teredo_send_unreach (tunnel, ICMP6_DST_UNREACH_ADDR,
-			                     packet, length);
-
-		//case 1: -- between two bubbles -- nothing to do
-	}
-
-	return 0;
+	return teredo_send_bubbles (tunnel, &s, res, packet, length);
 }
 
 
@@ -597,20 +697,25 @@ teredo_islocal (teredo_tunnel *restrict tunnel,
 
 static
 void teredo_predecap (teredo_tunnel *restrict tunnel,
-                      teredo_peer *restrict peer, teredo_clock_t now)
+                      teredo_peer *restrict peer, teredo_clock_t now,
+                      const struct ip6_hdr *ip6, size_t length)
 {
 	TouchReceive (peer, now);
 	peer->bubbles = peer->pings = 0;
-	teredo_queue *q = teredo_peer_queue_yield (peer);
+	teredo_list_account (tunnel->list, &ip6->ip6_src, length, true);
+	teredo_queue *q = teredo_peer_queue_yield (tunnel->list, peer);
 	teredo_list_release (tunnel->list);
 
 	if (q != NULL)
-		teredo_queue_emit (q, tunnel->fd,
+		teredo_queue_emit (q, tunnel->io,
 		                   peer->mapped_addr, peer->mapped_port,
-		                   tunnel->recv_cb, tunnel->opaque);
+		                   teredo_deliver, tunnel);
 }
 
 
+/* Authentication result of a bubble that was not checked yet */
+#define BUBBLE_UNCHECKED (-1)
+
 /**
  * Receives a packet coming from the Teredo tunnel (as specified per
  * paragraph 5.4.2). That's called “Packet reception”.
@@ -619,10 +724,19 @@ void teredo_predecap (teredo_tunnel *restrict tunnel,
  * will return immediately.
  *
  * Thread-safety: This function is thread-safe.
+ *
+ * @param bubble_ok whether the packet is a bubble with an authenticated
+ * source (1) or not (0), or BUBBLE_UNCHECKED. Bubbles are only
+ * authenticated when they do not come from a trusted peer, and that
+ * cannot be known before the peer is looked up.
+ *
+ * @return true if the packet is a bubble that must be authenticated first,
+ * in which case it was not processed; false otherwise.
  */
-static void
+static bool
 teredo_recv_process (teredo_tunnel *restrict tunnel,
-                     const struct teredo_packet *restrict packet)
+                     const struct teredo_packet *restrict packet,
+                     int bubble_ok)
 {
 	assert (tunnel != NULL);
 	assert (packet != NULL);
@@ -636,7 +750,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 	if (packet->ip6_len < sizeof (*ip6))
      	{
 		debug ("Packet size invalid: %zu bytes.", packet->ip6_len);
-		return; // invalid packet
+		return false; // invalid packet
 	}
 
 	size_t length = sizeof (*ip6) + ntohs (ip6->ip6_plen);
@@ -644,7 +758,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 	 || (length > packet->ip6_len))
      	{
 	   	debug ("Received malformed IPv6 packet.");
-		return; // malformatted IPv6 packet
+		return false; // malformatted IPv6 packet
 	}
 
 	pthread_rwlock_rdlock (&tunnel->state_lock);
@@ -667,13 +781,13 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 		if (teredo_maintenance_process (tunnel->maintenance, packet) == 0)
 		{
 			debug (" packet passed to maintenance procedure");
-			return;
+			return false;
 		}
 
 		if (!s.up)
 		{
 			debug (" packet dropped because tunnel down");
-			return; /* Not qualified -> do not accept incoming packets */
+			return false; /* Not qualified -> do not accept incoming packets */
 		}
 
 		if ((packet->source_ipv4 == s.addr.teredo.server_ip)
@@ -697,10 +811,10 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 			if (is_ipv4_global_unicast (ipv4))
 			{
 				/* TODO: record sending of bubble, create a peer, etc ? */
-				teredo_reply_bubble (tunnel->fd, ipv4, port, ip6);
+				teredo_reply_bubble (tunnel->io, ipv4, port, ip6);
 				debug (" bubble sent");
 				if (IsBubble (ip6))
-					return; // don't pass bubble to kernel
+					return false; // don't pass bubble to kernel
 			}
 		}
 
@@ -731,7 +845,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 		 */
 		if (((ip6->ip6_src.s6_addr[0] & 0xff) == 0xfe) &&
 		    ((ip6->ip6_src.s6_addr[1] & 0xc0) == 0x80))
-			return;
+			return false;
 	}
 	else
 #endif /* MIREDO_TEREDO_CLIENT */
@@ -740,7 +854,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 	{
 		debug ("Source %s is not a Teredo address.",
 		       inet_ntop (AF_INET6, &ip6->ip6_src.s6_addr, b, sizeof b));
-		return;
+		return false;
 	}
 
 	/* Actual packet reception, either as a relay or a client */
@@ -772,7 +886,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 			p = teredo_list_lookup (list, &ip6->ip6_src, &(bool){ false });
 			if (p == NULL) {
 				debug ("Out of memory.");
-				return; // memory error
+				return false; // memory error
 			}
 			p->trusted = 0;
 			p->local = 0;
@@ -788,13 +902,13 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 		teredo_list_release (list);
 
 		if (CountBubble (p, now) != 0)
-			return;
+			return false;
 
 		debug ("Replying to discovery bubble");
-		teredo_send_bubble (tunnel->fd,
+		teredo_send_bubble (tunnel->io,
 		                    packet->source_ipv4, packet->source_port,
 		                    &s.addr.ip6, &ip6->ip6_src);
-		return;
+		return false;
 	}
 #endif
 
@@ -825,7 +939,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 			teredo_list_release (list);
 		debug ("Multicast destination %s not supported.",
 		       inet_ntop (AF_INET6, &ip6->ip6_dst.s6_addr, b, sizeof b));
-		return;
+		return false;
 	}
 
 	if (p != NULL)
@@ -836,9 +950,9 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 		 && (packet->source_ipv4 == p->mapped_addr)
 		 && (packet->source_port == p->mapped_port))
 		{
-			teredo_predecap (tunnel, p, now);
-			tunnel->recv_cb (tunnel->opaque, ip6, length);
-			return;
+			teredo_predecap (tunnel, p, now, ip6, length);
+			teredo_deliver (tunnel, ip6, length);
+			return false;
 		}
 
 #ifdef MIREDO_TEREDO_CLIENT
@@ -852,8 +966,8 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 			p->trusted = 1;
 			SetMappingFromPacket (p, packet);
 
-			teredo_predecap (tunnel, p, now);
-			return; /* don't pass ping to kernel */
+			teredo_predecap (tunnel, p, now, ip6, length);
+			return false; /* don't pass ping to kernel */
 		}
 #endif /* ifdef MIREDO_TEREDO_CLIENT */
 	}
@@ -865,30 +979,69 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 	if (IN6_TEREDO_PREFIX (&ip6->ip6_src) == htonl (TEREDO_PREFIX))
 	{
 		// Client case 3 (unknown or untrusted matching Teredo client):
-		if (IN6_MATCHES_TEREDO_CLIENT (&ip6->ip6_src, packet->source_ipv4,
-		                               packet->source_port)
+		bool matching = IN6_MATCHES_TEREDO_CLIENT (&ip6->ip6_src,
+		                                           packet->source_ipv4,
+		                                           packet->source_port);
 #ifdef MIREDO_TEREDO_CLIENT
+		matching = matching
 		// Client case 5 (untrusted local peer)
 		 || (p != NULL && p->local
 		     && (packet->source_ipv4 == p->mapped_addr)
 		     && (packet->source_port == p->mapped_port))
 		// Extension: packet from unknown local peer (faster discovery)
-		 || (p == NULL && islocal)
+		 || (p == NULL && islocal);
 #endif
+
+		/*
+		 * Only bubbles that could not be accepted otherwise, and those
+		 * that would commit a peer in stateless mode, are authenticated.
+		 */
+		if ((bubble_ok == BUBBLE_UNCHECKED) && IsBubble (ip6)
+		 && (!matching || ((p == NULL) && (tunnel->pending != NULL))))
+		{
+			if (p != NULL)
+				teredo_list_release (list);
+			return true;
+		}
+
 		// Extension: allow mismatch (i.e. clients behind symmetric NATs)
-		 || (IsBubble (ip6) && (CheckBubble (packet) == 0)))
+		if (matching || (bubble_ok > 0))
 		{
 #ifdef MIREDO_TEREDO_CLIENT
-			if (IsClient (tunnel) && (p == NULL))
+			/*
+			 * In stateless mode, only authenticated bubbles replies and
+			 * local peers may add a peer to the list.
+			 */
+			if (IsClient (tunnel) && (p == NULL)
+			 && ((tunnel->pending == NULL) || (bubble_ok > 0) || islocal))
 			{
 				p = teredo_list_lookup (list, &ip6->ip6_src, &(bool){ false });
 				if (p == NULL) {
 					debug ("Out of memory.");
-					return; // memory error
+					return false; // memory error
 				}
 				p->local = islocal;
 			}
 #endif
+			/*
+			 * Stateless mode: the peer is committed to the list once it
+			 * replied to one of our bubbles.
+			 */
+			if ((p == NULL) && (tunnel->pending != NULL) && (bubble_ok > 0))
+			{
+				bool created;
+
+				p = teredo_list_lookup (list, &ip6->ip6_src, &created);
+				if (p == NULL) {
+					debug ("Out of memory.");
+					return false; // memory error
+				}
+				if (created)
+					p->local = p->bubbles = p->pings = 0;
+				teredo_pending_remove (tunnel->pending,
+				                       IN6_TEREDO_IPV4 (&ip6->ip6_src),
+				                       IN6_TEREDO_PORT (&ip6->ip6_src), now);
+			}
 			/*
 			 * Relays are explicitly allowed to drop packets from
 			 * unknown peers. It makes it a little more difficult to route
@@ -901,16 +1054,16 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 				debug ("No peer for %s found. Dropping packet.",
 				       inet_ntop (AF_INET6, &ip6->ip6_src.s6_addr, b,
 				                  sizeof b));
-				return; // list not locked (p = NULL)
+				return false; // list not locked (p = NULL)
 			}
 
 			SetMappingFromPacket (p, packet);
 			p->trusted = 1;
-			teredo_predecap (tunnel, p, now);
+			teredo_predecap (tunnel, p, now, ip6, length);
 
 			if (!IsBubble (ip6)) // discard Teredo bubble
-				tunnel->recv_cb (tunnel->opaque, ip6, length);
-			return;
+				teredo_deliver (tunnel, ip6, length);
+			return false;
 		}
 	}
 #ifdef MIREDO_TEREDO_CLIENT
@@ -936,7 +1089,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 			if (p == NULL)
 		     	{
 				debug ("Out of memory.");
-				return; // memory error
+				return false; // memory error
 			}
 
 			/*
@@ -962,9 +1115,9 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 		teredo_list_release (list);
 
 		if (res == 0)
-			SendPing (tunnel->fd, &s.addr, &ip6->ip6_src);
+			SendPing (tunnel->io, &s.addr, &ip6->ip6_src);
 
-		return;
+		return false;
 	}
 #endif /* ifdef MIREDO_TEREDO_CLIENT */
 
@@ -972,6 +1125,7 @@ teredo_recv_process (teredo_tunnel *restrict tunnel,
 	// Rejected packet
 	if (p != NULL)
 		teredo_list_release (list);
+	return false;
 }
 
 
@@ -1039,7 +1193,10 @@ teredo_tunnel *teredo_create (uint32_t ipv4, uint16_t port)
 	tunnel->state.addr.teredo.client_ip = ~ipv4;
 
 	tunnel->state.up = false;
-	tunnel->ratelimit.count = 1;
+
+	tunnel->max_peers = MAX_PEERS;
+	tunnel->peer_timeout = TEREDO_TIMEOUT;
+	tunnel->icmp_rate_limit_ms = TEREDO_ICMP_RATE_LIMIT_MS;
 
 	tunnel->recv_cb = teredo_dummy_recv_cb;
 	tunnel->icmpv6_cb = teredo_dummy_icmpv6_cb;
@@ -1048,7 +1205,7 @@ teredo_tunnel *teredo_create (uint32_t ipv4, uint16_t port)
 	tunnel->down_cb = teredo_dummy_state_down_cb;
 #endif
 
-	if ((tunnel->fd = teredo_socket (ipv4, port)) != -1)
+	if ((tunnel->io = teredo_io_socket (ipv4, port)) != NULL)
 	{
 		if ((tunnel->list = teredo_list_create (MAX_PEERS, 30)) != NULL)
 		{
@@ -1056,7 +1213,7 @@ teredo_tunnel *teredo_create (uint32_t ipv4, uint16_t port)
 			(void)pthread_mutex_init (&tunnel->ratelimit.lock, NULL);
 			return tunnel;
 		}
-		teredo_close (tunnel->fd);
+		teredo_io_close (tunnel->io);
 	}
 
 	free (tunnel);
@@ -1068,7 +1225,7 @@ teredo_tunnel *teredo_create (uint32_t ipv4, uint16_t port)
 void teredo_destroy (teredo_tunnel *t)
 {
 	assert (t != NULL);
-	assert (t->fd != -1);
+	assert (t->io != NULL);
 	assert (t->list != NULL);
 
 	if (t->recv != NULL)
@@ -1088,36 +1245,198 @@ void teredo_destroy (teredo_tunnel *t)
 #endif
 
 	teredo_list_destroy (t->list);
+	if (t->pending != NULL)
+		teredo_pending_destroy (t->pending);
 	pthread_rwlock_destroy (&t->state_lock);
 	pthread_mutex_destroy (&t->ratelimit.lock);
-	teredo_close (t->fd);
+	teredo_io_close (t->io);
 	free (t);
 	teredo_deinit_HMAC ();
 }
 
 
-static LIBTEREDO_NORETURN void teredo_recv_loop (void *data, int fd)
+void teredo_recv_packets (teredo_tunnel *restrict tunnel,
+                          struct teredo_packet *restrict batch, unsigned n)
+{
+	uint32_t deferred = 0;
+
+	__atomic_fetch_add (&tunnel->rx.packets, n, __ATOMIC_RELAXED);
+	for (unsigned i = 0; i < n; i++)
+	{
+		const struct teredo_packet *p = batch + i;
+
+		TEREDO_PROBE3 (recv_entry, p->ip6_len, p->source_ipv4,
+		               p->source_port);
+		if (teredo_recv_process (tunnel, p, BUBBLE_UNCHECKED))
+			deferred |= UINT32_C(1) << i;
+		else
+			TEREDO_PROBE1 (recv_exit, p->ip6_len);
+	}
+
+	if (deferred == 0)
+		return;
+
+	/* Bubbles that need it are authenticated at once, then processed */
+	uint32_t bubbles = CheckBubbles (batch, n, deferred);
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		if (!((deferred >> i) & 1))
+			continue;
+
+		const struct teredo_packet *p = batch + i;
+
+		teredo_recv_process (tunnel, p, (bubbles >> i) & 1);
+		TEREDO_PROBE1 (recv_exit, p->ip6_len);
+	}
+}
+
+
+void teredo_set_io (teredo_tunnel *t, teredo_io *io)
+{
+	assert (t->recv == NULL);
+
+	teredo_io_close (t->io);
+	t->io = io;
+}
+
+
+/**
+ * Processes received packets by batches of up to RECV_BATCH,
+ * authenticating their bubbles at once, until no more packets are pending
+ * or RECV_BURST packets have been processed. <n> packets are already in
+ * the batch.
+ */
+static void
+teredo_recv_drain (teredo_tunnel *restrict tunnel, teredo_io *io,
+                   teredo_xdp *xdp, struct teredo_packet *batch, unsigned n)
+{
+	for (unsigned total = 0;;)
+	{
+		unsigned room = RECV_BATCH - n;
+
+		if (total + RECV_BATCH > RECV_BURST)
+			room = (total + n < RECV_BURST) ? RECV_BURST - (total + n) : 0;
+
+		if (xdp != NULL)
+			while ((room-- > 0) && (teredo_xdp_recv (xdp, batch + n) == 0))
+				n++;
+		else
+			n += teredo_io_recv (io, batch + n, room);
+
+		if (n > 0)
+		{
+			teredo_recv_packets (tunnel, batch, n);
+			total += n;
+		}
+
+		if ((n < RECV_BATCH) || (total >= RECV_BURST))
+			break;
+		n = 0;
+	}
+}
+
+
+/**
+ * Allocates the packets batch of a receive thread. Packet buffers are too
+ * large for the thread stack, so this waits for memory if it is short.
+ */
+static struct teredo_packet *teredo_batch_alloc (void)
+{
+	struct teredo_packet *batch;
+
+	while ((batch = malloc (RECV_BATCH * sizeof (*batch))) == NULL)
+		sleep (1);
+	return batch;
+}
+
+
+/**
+ * Accounts for the time a receive thread spent processing packets.
+ */
+static void teredo_recv_busy (teredo_tunnel *restrict tunnel,
+                              const struct timespec *restrict start)
+{
+	struct timespec ts;
+	teredo_gettime (&ts);
+
+	uint64_t busy = (ts.tv_sec - start->tv_sec) * UINT64_C(1000000000)
+	              + ts.tv_nsec - start->tv_nsec;
+	__atomic_fetch_add (&tunnel->rx.time, busy, __ATOMIC_RELAXED);
+}
+
+
+static LIBTEREDO_NORETURN void teredo_recv_loop (void *data, teredo_io *io)
 {
 	teredo_tunnel *tunnel = data;
+	/* Only spin on the main socket, not on the local discovery one */
+	unsigned spin = (io == tunnel->io) ? tunnel->recv_spin : 0;
+	struct teredo_packet *batch = teredo_batch_alloc ();
+
+	pthread_cleanup_push (free, batch);
 
 	for (;;)
 	{
-		struct teredo_packet packet;
-
-		if (teredo_wait_recv (fd, &packet) == 0)
+		if (teredo_io_wait (io, batch, spin) == 0)
 		{
+			struct timespec start;
+
 			pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
-			teredo_recv_process (tunnel, &packet);
+			teredo_gettime (&start);
+			/* Process whatever else is already pending as one burst */
+			teredo_recv_drain (tunnel, io, NULL, batch, 1);
+			teredo_io_flush (tunnel->io);
+			teredo_recv_busy (tunnel, &start);
 			pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
 		}
 	}
+
+	pthread_cleanup_pop (1);
+}
+
+
+/**
+ * Receive loop for tunnels with an AF_XDP receive path: packets may come
+ * from either the AF_XDP socket or the UDP socket.
+ */
+static LIBTEREDO_NORETURN void teredo_xdp_recv_loop (teredo_tunnel *tunnel)
+{
+	struct pollfd ufd[2] =
+	{
+		{ .fd = teredo_xdp_fd (tunnel->xdp), .events = POLLIN },
+		{ .fd = tunnel->io->fd, .events = POLLIN },
+	};
+	struct teredo_packet *batch = teredo_batch_alloc ();
+
+	pthread_cleanup_push (free, batch);
+
+	for (;;)
+	{
+		if (teredo_spin_poll (ufd, 2, tunnel->recv_spin) <= 0)
+			continue;
+
+		struct timespec start;
+
+		pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+		teredo_gettime (&start);
+		teredo_recv_drain (tunnel, NULL, tunnel->xdp, batch, 0);
+		teredo_recv_drain (tunnel, tunnel->io, NULL, batch, 0);
+		teredo_io_flush (tunnel->io);
+		teredo_recv_busy (tunnel, &start);
+		pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+	}
+
+	pthread_cleanup_pop (1);
 }
 
 
 static LIBTEREDO_NORETURN void *teredo_recv_thread (void *data)
 {
 	teredo_tunnel *tunnel = data;
-	teredo_recv_loop (tunnel, tunnel->fd);
+
+	if (tunnel->xdp != NULL)
+		teredo_xdp_recv_loop (tunnel);
+	teredo_recv_loop (tunnel, tunnel->io);
 }
 
 
@@ -1170,6 +1489,18 @@ int teredo_set_relay_mode (teredo_tunnel *t)
 }
 
 
+static unsigned teredo_list_expiration (const teredo_tunnel *t)
+{
+	if (t->expiration)
+		return t->expiration;
+#ifdef MIREDO_TEREDO_CLIENT
+	if (IsClient (t))
+		return 600;
+#endif
+	return 30;
+}
+
+
 int teredo_set_client_mode (teredo_tunnel *restrict t,
                             const char *s, const char *s2)
 {
@@ -1179,16 +1510,9 @@ int teredo_set_client_mode (teredo_tunnel *restrict t,
 		return -1;
 
 	/* expand the list's expiration time to handle local peers */
-	teredo_peerlist *newlist = teredo_list_create (MAX_PEERS, 600);
-	if (newlist == NULL)
-	{
-		debug ("Could not create new list for client mode.");
-		return -1;
-	}
-	teredo_list_destroy (t->list);
-	t->list = newlist;
+	teredo_list_set_expiration (t->list, t->expiration ? t->expiration : 600);
 
-	t->maintenance = teredo_maintenance_create (t->fd, teredo_state_change,
+	t->maintenance = teredo_maintenance_create (t->io, teredo_state_change,
 	                                            t, s, s2, 0, 0, 0, 0);
 	return (t->maintenance != NULL) ? 0 : -1;
 #else
@@ -1200,6 +1524,159 @@ int teredo_set_client_mode (teredo_tunnel *restrict t,
 }
 
 
+int teredo_set_stateless_mode (teredo_tunnel *t, bool on)
+{
+	assert (t != NULL);
+
+	if (!on)
+	{
+		if (t->pending != NULL)
+			teredo_pending_destroy (t->pending);
+		t->pending = NULL;
+		return 0;
+	}
+
+	if (t->pending == NULL)
+		t->pending = teredo_pending_create ();
+	return (t->pending != NULL) ? 0 : -1;
+}
+
+
+int teredo_set_max_peers (teredo_tunnel *t, unsigned max, bool prealloc)
+{
+	assert (t != NULL);
+
+	if (max)
+		t->max_peers = max;
+	return teredo_list_set_max (t->list, t->max_peers, prealloc);
+}
+
+
+int teredo_set_peer_timeouts (teredo_tunnel *t, unsigned expiration,
+                              unsigned timeout)
+{
+	assert (t != NULL);
+
+	t->expiration = expiration;
+	teredo_list_set_expiration (t->list, teredo_list_expiration (t));
+	t->peer_timeout = timeout ? timeout : TEREDO_TIMEOUT;
+	return 0;
+}
+
+
+void teredo_set_max_queue (teredo_tunnel *t, size_t bytes)
+{
+	assert (t != NULL);
+
+	teredo_list_set_max_queue (t->list, bytes);
+}
+
+
+void teredo_set_icmp_rate_limit (teredo_tunnel *t, unsigned ms)
+{
+	assert (t != NULL);
+
+	/* Read with the lock held, by teredo_send_unreach() */
+	pthread_mutex_lock (&t->ratelimit.lock);
+	t->icmp_rate_limit_ms = ms;
+	t->ratelimit.next = 0;
+	pthread_mutex_unlock (&t->ratelimit.lock);
+}
+
+
+int teredo_set_peer_quotas (teredo_tunnel *t, unsigned max_ipv4,
+                            unsigned max_prefix)
+{
+	assert (t != NULL);
+
+	return teredo_list_set_quotas (t->list, max_ipv4, max_prefix);
+}
+
+
+int teredo_set_top_peers (teredo_tunnel *t, unsigned size)
+{
+	assert (t != NULL);
+
+	return teredo_list_set_top (t->list, size);
+}
+
+
+unsigned teredo_get_top_peers (teredo_tunnel *restrict t,
+                               teredo_peer_stats *restrict tab, unsigned n,
+                               bool reset)
+{
+	assert (t != NULL);
+
+	return teredo_list_top (t->list, tab, n, reset);
+}
+
+
+unsigned long teredo_get_list_max_hold (teredo_tunnel *t, bool reset)
+{
+	assert (t != NULL);
+
+	return teredo_list_max_hold (t->list, reset);
+}
+
+
+void teredo_get_stats (teredo_tunnel *restrict t,
+                       teredo_tunnel_stats *restrict st)
+{
+	assert (t != NULL);
+
+	st->rx_packets = __atomic_load_n (&t->rx.packets, __ATOMIC_RELAXED);
+	st->rx_delivered = __atomic_load_n (&t->rx.delivered, __ATOMIC_RELAXED);
+	st->tx_packets = __atomic_load_n (&t->tx.packets, __ATOMIC_RELAXED);
+	st->tx_sent = __atomic_load_n (&t->tx.sent, __ATOMIC_RELAXED);
+	st->rx_time = __atomic_load_n (&t->rx.time, __ATOMIC_RELAXED);
+	teredo_list_stats (t->list, st);
+}
+
+
+int teredo_set_xdp (teredo_tunnel *restrict t, teredo_xdp *xdp)
+{
+	assert (t != NULL);
+	assert (xdp != NULL);
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof (addr);
+
+	if (getsockname (t->io->fd, (struct sockaddr *)&addr, &addrlen)
+	 || (addr.sin_port != teredo_xdp_port (xdp)))
+		return -1;
+
+	t->xdp = xdp;
+	return 0;
+}
+
+
+void teredo_set_capture (teredo_tunnel *restrict t, teredo_capture *c)
+{
+	assert (t != NULL);
+
+	t->capture = c;
+}
+
+
+int teredo_set_busy_poll (teredo_tunnel *t, unsigned busy_poll,
+                          unsigned spin)
+{
+	assert (t != NULL);
+
+	t->recv_spin = spin;
+	return teredo_socket_set_busy_poll (t->io->fd, busy_poll);
+}
+
+
+int teredo_set_socket_buffers (teredo_tunnel *t, unsigned rcvbuf,
+                               unsigned sndbuf)
+{
+	assert (t != NULL);
+
+	return teredo_socket_set_buffers (t->io->fd, rcvbuf, sndbuf);
+}
+
+
 void teredo_set_local_discovery (teredo_tunnel *restrict t, bool on)
 {
 	assert (t != NULL);
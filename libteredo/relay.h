@@ -0,0 +1,64 @@
+/*
+ * relay.h - Teredo tunnel internal interfaces
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_RELAY_H
+# define LIBTEREDO_RELAY_H
+
+struct teredo_packet;
+struct teredo_state;
+struct teredo_io;
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/**
+ * Processes a batch of received Teredo packets, as the receive thread does,
+ * without any I/O. This is meant for benchmarks and tests.
+ *
+ * @param batch received packets
+ * @param n number of packets (at most 32)
+ */
+void teredo_recv_packets (teredo_tunnel *restrict t,
+                          struct teredo_packet *restrict batch, unsigned n);
+
+/**
+ * Replaces the I/O backend of a Teredo tunnel, which is a kernel UDP socket
+ * by default. The previous backend is closed. The tunnel takes ownership of
+ * the new one. This must be called before teredo_set_client_mode() and
+ * teredo_run_async(). Datagrams that the backend holds back are flushed
+ * after each burst of received packets; the caller of teredo_transmit()
+ * is responsible for flushing afterward.
+ */
+void teredo_set_io (teredo_tunnel *t, struct teredo_io *io);
+
+# ifdef MIREDO_TEREDO_CLIENT
+/**
+ * Sets the state of a Teredo client tunnel, as its qualification
+ * procedure would. This is meant for benchmarks and tests.
+ */
+void teredo_set_state (teredo_tunnel *t, const struct teredo_state *s);
+# endif
+
+# ifdef __cplusplus
+}
+# endif
+#endif
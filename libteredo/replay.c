@@ -0,0 +1,856 @@
+/*
+ * replay.c - Teredo traffic replay from pcap files
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Sends the Teredo traffic of a pcap file toward a Teredo server or relay.
+ * The whole file is loaded into memory first. Each Teredo UDP/IPv4 datagram
+ * is replayed as is. Raw IPv6 records (such as those written by the
+ * libteredo packet capture) are sent as the payload of a Teredo datagram.
+ *
+ * Datagrams are grouped into flows by their original source (the Teredo
+ * client mapping for raw IPv6 records), and each flow is sent from its own
+ * UDP socket, bound to locally available addresses. Unless disabled, Teredo
+ * IPv6 addresses are rewritten so that they remain consistent with the new
+ * mappings and the target server, and transport checksums are updated
+ * accordingly (RFC 1624).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_GETOPT_H
+# include <getopt.h>
+#endif
+
+#include "teredo.h"
+#include "io.h"
+#include "tools.h"
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+#define LINKTYPE_NULL           0
+#define LINKTYPE_ETHERNET       1
+#define LINKTYPE_RAW          101
+#define LINKTYPE_LINUX_SLL    113
+#define LINKTYPE_IPV4         228
+#define LINKTYPE_IPV6         229
+#define LINKTYPE_LINUX_SLL2   276
+
+typedef struct rp_record
+{
+	uint64_t time; /* since the first record (ns) */
+	uint8_t *data; /* UDP payload */
+	size_t len;
+	unsigned flow;
+} rp_record;
+
+typedef struct rp_flow
+{
+	uint32_t ip; /* original mapping */
+	uint16_t port;
+	uint32_t new_ip; /* replay mapping */
+	uint16_t new_port;
+} rp_flow;
+
+typedef struct replay
+{
+	rp_record *recs;
+	size_t count, alloc;
+	unsigned long skipped;
+
+	rp_flow *flows;
+	unsigned nflows;
+	unsigned *hash; /* flow index + 1, or 0 if free */
+	unsigned hash_size;
+
+	teredo_io **io;
+	unsigned nsock;
+
+	uint32_t target_ip;
+	uint16_t target_port;
+	uint16_t filter_port;
+} replay;
+
+
+static unsigned flow_hash (uint32_t ip, uint16_t port)
+{
+	uint32_t h = ip * 0x9e3779b1 ^ port * 0x85ebca6b;
+
+	return h ^ (h >> 16);
+}
+
+
+/* @return the index of a flow, or -1 if not found and not created. */
+static int
+find_flow (replay *rp, uint32_t ip, uint16_t port, bool create)
+{
+	unsigned mask = rp->hash_size - 1;
+
+	for (unsigned i = flow_hash (ip, port) & mask;; i = (i + 1) & mask)
+	{
+		unsigned n = rp->hash[i];
+
+		if (n == 0)
+		{
+			if (!create)
+				return -1;
+			rp->hash[i] = rp->nflows + 1;
+			break;
+		}
+
+		const rp_flow *f = rp->flows + n - 1;
+		if ((f->ip == ip) && (f->port == port))
+			return n - 1;
+	}
+
+	rp_flow *f = rp->flows + rp->nflows;
+	f->ip = ip;
+	f->port = port;
+	return rp->nflows++;
+}
+
+
+static int add_flow (replay *rp, uint32_t ip, uint16_t port)
+{
+	/* Keep the hash table at most half full */
+	if (2 * (rp->nflows + 1) > rp->hash_size)
+	{
+		unsigned size = rp->hash_size ? 2 * rp->hash_size : 1024;
+		unsigned *hash = calloc (size, sizeof (*hash));
+		rp_flow *flows = realloc (rp->flows, (size / 2) * sizeof (*flows));
+
+		if ((hash == NULL) || (flows == NULL))
+		{
+			free (hash);
+			if (flows != NULL)
+				rp->flows = flows;
+			return -1;
+		}
+
+		free (rp->hash);
+		rp->hash = hash;
+		rp->hash_size = size;
+		rp->flows = flows;
+
+		for (unsigned n = 0; n < rp->nflows; n++)
+		{
+			unsigned mask = size - 1, i;
+
+			i = flow_hash (flows[n].ip, flows[n].port) & mask;
+			while (hash[i])
+				i = (i + 1) & mask;
+			hash[i] = n + 1;
+		}
+	}
+
+	return find_flow (rp, ip, port, true);
+}
+
+
+static int
+add_record (replay *rp, uint64_t time, const uint8_t *data, size_t len,
+            uint32_t ip, uint16_t port)
+{
+	if (rp->count == rp->alloc)
+	{
+		size_t n = rp->alloc ? 2 * rp->alloc : 4096;
+		rp_record *recs = realloc (rp->recs, n * sizeof (*recs));
+
+		if (recs == NULL)
+			return -1;
+		rp->recs = recs;
+		rp->alloc = n;
+	}
+
+	int flow = add_flow (rp, ip, port);
+	rp_record *r = rp->recs + rp->count;
+
+	if (flow == -1)
+		return -1;
+
+	r->data = malloc (len);
+	if (r->data == NULL)
+		return -1;
+	memcpy (r->data, data, len);
+	r->len = len;
+	r->time = time;
+	r->flow = flow;
+	rp->count++;
+	return 0;
+}
+
+
+/**
+ * Skips Teredo authentication and origin indication headers.
+ * @return the offset of the IPv6 packet, or 0 if the headers are truncated.
+ */
+static size_t teredo_hdr_len (const uint8_t *p, size_t len)
+{
+	size_t off = 0;
+
+	if ((len >= 13) && (p[0] == 0) && (p[1] == 1))
+	{
+		off = 13 + p[2] + p[3];
+		if (off > len)
+			return 0;
+	}
+	if ((len >= off + 8) && (p[off] == 0) && (p[off + 1] == 0))
+		off += 8;
+	return off;
+}
+
+
+static int
+add_ipv4 (replay *rp, uint64_t time, const uint8_t *p, size_t len)
+{
+	if ((len < 20) || ((p[0] >> 4) != 4))
+		return -1;
+
+	size_t ihl = (p[0] & 0xf) * 4;
+	size_t tot = (p[2] << 8) | p[3];
+
+	if ((ihl < 20) || (tot < ihl + 8) || (tot > len))
+		return -1;
+	/* Fragments are not reassembled */
+	if (((p[6] & 0x3f) | p[7]) != 0)
+		return -1;
+	if (p[9] != IPPROTO_UDP)
+		return -1;
+
+	const uint8_t *udp = p + ihl;
+	size_t ulen = (udp[4] << 8) | udp[5];
+	uint16_t sport, dport;
+	uint32_t src;
+
+	memcpy (&sport, udp, 2);
+	memcpy (&dport, udp + 2, 2);
+	memcpy (&src, p + 12, 4);
+	if ((ulen < 8) || (ihl + ulen > tot))
+		return -1;
+	if (rp->filter_port && (dport != rp->filter_port))
+		return -1;
+
+	return add_record (rp, time, udp + 8, ulen - 8, src, sport);
+}
+
+
+static int
+add_ipv6 (replay *rp, uint64_t time, const uint8_t *p, size_t len)
+{
+	if ((len < sizeof (struct ip6_hdr)) || ((p[0] >> 4) != 6))
+		return -1;
+
+	size_t plen = (p[4] << 8) | p[5];
+	if (sizeof (struct ip6_hdr) + plen > len)
+		return -1;
+	len = sizeof (struct ip6_hdr) + plen;
+
+	/* Flows of native sources are merged */
+	struct in6_addr src;
+	uint32_t ip = 0;
+	uint16_t port = 0;
+
+	memcpy (&src, p + 8, sizeof (src));
+	if (IN6_TEREDO_PREFIX (&src) == htonl (TEREDO_PREFIX))
+	{
+		ip = IN6_TEREDO_IPV4 (&src);
+		port = IN6_TEREDO_PORT (&src);
+	}
+
+	return add_record (rp, time, p, len, ip, port);
+}
+
+
+static int
+add_packet (replay *rp, unsigned linktype, uint64_t time,
+            const uint8_t *p, size_t len)
+{
+	unsigned proto = 0;
+	size_t off;
+
+	switch (linktype)
+	{
+		case LINKTYPE_NULL:
+			off = 4;
+			break;
+
+		case LINKTYPE_ETHERNET:
+			off = 14;
+			if (len < off)
+				return -1;
+			proto = (p[12] << 8) | p[13];
+			/* 802.1Q and 802.1ad tags */
+			while (((proto == 0x8100) || (proto == 0x88a8))
+			    && (len >= off + 4))
+			{
+				proto = (p[off + 2] << 8) | p[off + 3];
+				off += 4;
+			}
+			if ((proto != 0x0800) && (proto != 0x86dd))
+				return -1;
+			break;
+
+		case LINKTYPE_RAW:
+		case LINKTYPE_IPV4:
+		case LINKTYPE_IPV6:
+			off = 0;
+			break;
+
+		case LINKTYPE_LINUX_SLL:
+			off = 16;
+			break;
+
+		case LINKTYPE_LINUX_SLL2:
+			off = 20;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if (len <= off)
+		return -1;
+	p += off;
+	len -= off;
+
+	switch (p[0] >> 4)
+	{
+		case 4:
+			return add_ipv4 (rp, time, p, len);
+		case 6:
+			return add_ipv6 (rp, time, p, len);
+	}
+	return -1;
+}
+
+
+static uint32_t get32 (const uint8_t *p, bool swap)
+{
+	uint32_t v;
+
+	memcpy (&v, p, 4);
+	if (swap)
+		v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000)
+		  | (v << 24);
+	return v;
+}
+
+
+static int load_pcap (replay *rp, const char *path)
+{
+	FILE *f = fopen (path, "rb");
+	if (f == NULL)
+	{
+		perror (path);
+		return -1;
+	}
+
+	uint8_t *buf = NULL;
+	long size = -1;
+
+	if (fseek (f, 0, SEEK_END) == 0)
+		size = ftell (f);
+	if ((size >= 0) && (fseek (f, 0, SEEK_SET) == 0))
+		buf = malloc (size ? size : 1);
+	if ((buf == NULL) || (fread (buf, 1, size, f) != (size_t)size))
+	{
+		perror (path);
+		fclose (f);
+		free (buf);
+		return -1;
+	}
+	fclose (f);
+
+	uint32_t magic;
+	bool swap, nano;
+
+	if (size < 24)
+		goto bad;
+	memcpy (&magic, buf, 4);
+	swap = (magic == 0xd4c3b2a1) || (magic == 0x4d3cb2a1);
+	magic = get32 (buf, swap);
+	if ((magic != PCAP_MAGIC_US) && (magic != PCAP_MAGIC_NS))
+		goto bad;
+	nano = (magic == PCAP_MAGIC_NS);
+
+	unsigned linktype = get32 (buf + 20, swap) & 0x0fffffff;
+	uint64_t first = 0;
+	size_t off = 24;
+
+	while (off + 16 <= (size_t)size)
+	{
+		const uint8_t *rec = buf + off;
+		uint32_t caplen = get32 (rec + 8, swap), len = get32 (rec + 12, swap);
+		uint64_t time = get32 (rec, swap) * UINT64_C(1000000000)
+		              + get32 (rec + 4, swap) * (nano ? 1 : 1000);
+
+		off += 16;
+		if (caplen > size - off)
+			break;
+		off += caplen;
+
+		if (rp->count == 0)
+			first = time;
+		time = (time > first) ? time - first : 0;
+
+		/* Truncated packets cannot be replayed */
+		errno = 0;
+		if ((caplen < len)
+		 || add_packet (rp, linktype, time, rec + 16, caplen))
+		{
+			if (errno == ENOMEM)
+			{
+				perror ("Error");
+				free (buf);
+				return -1;
+			}
+			rp->skipped++;
+		}
+	}
+
+	free (buf);
+	return 0;
+
+bad:
+	fprintf (stderr, "%s: not a pcap file\n", path);
+	free (buf);
+	return -1;
+}
+
+
+/* Updates a transport checksum after a change of the covered data. */
+static void
+csum_adjust (uint8_t *sum, const uint8_t *old, const uint8_t *new, size_t len,
+             bool udp)
+{
+	uint32_t s = ~((sum[0] << 8) | sum[1]) & 0xffff;
+
+	for (size_t i = 0; i < len; i += 2)
+	{
+		s += ~((old[i] << 8) | old[i + 1]) & 0xffff;
+		s += (new[i] << 8) | new[i + 1];
+	}
+	while (s >> 16)
+		s = (s & 0xffff) + (s >> 16);
+
+	s = ~s & 0xffff;
+	if (udp && (s == 0))
+		s = 0xffff;
+	sum[0] = s >> 8;
+	sum[1] = s;
+}
+
+
+/* @return the upper layer checksum of an IPv6 packet, or NULL */
+static uint8_t *find_csum (uint8_t *ip6, size_t len, bool *udp)
+{
+	size_t off = sizeof (struct ip6_hdr);
+
+	*udp = false;
+	switch (ip6[6])
+	{
+		case IPPROTO_ICMPV6:
+			off += 2;
+			break;
+		case IPPROTO_UDP:
+			off += 6;
+			*udp = true;
+			break;
+		case IPPROTO_TCP:
+			off += 16;
+			break;
+		default:
+			return NULL;
+	}
+
+	if (off + 2 > len)
+		return NULL;
+	/* No UDP checksum: leave it alone */
+	if (*udp && (ip6[off] == 0) && (ip6[off + 1] == 0))
+		return NULL;
+	return ip6 + off;
+}
+
+
+static void rewrite_addr (const replay *rp, uint8_t *addr, uint8_t *sum,
+                          bool udp)
+{
+	union teredo_addr a;
+
+	memcpy (&a, addr, sizeof (a));
+	if (a.teredo.prefix != htonl (TEREDO_PREFIX))
+		return;
+
+	a.teredo.server_ip = rp->target_ip;
+
+	int n = find_flow ((replay *)rp, ~a.teredo.client_ip,
+	                   ~a.teredo.client_port, false);
+	if (n != -1)
+	{
+		a.teredo.client_ip = ~rp->flows[n].new_ip;
+		a.teredo.client_port = ~rp->flows[n].new_port;
+	}
+
+	if (sum != NULL)
+		csum_adjust (sum, addr, (const uint8_t *)&a, sizeof (a), udp);
+	memcpy (addr, &a, sizeof (a));
+}
+
+
+static void rewrite (const replay *rp)
+{
+	for (size_t i = 0; i < rp->count; i++)
+	{
+		rp_record *r = rp->recs + i;
+		size_t off = teredo_hdr_len (r->data, r->len);
+		if (off > r->len)
+			continue;
+
+		uint8_t *ip6 = r->data + off;
+		size_t len = r->len - off;
+
+		if ((len < sizeof (struct ip6_hdr)) || ((ip6[0] >> 4) != 6))
+			continue;
+
+		bool udp;
+		uint8_t *sum = find_csum (ip6, len, &udp);
+
+		/* Both addresses are covered by the pseudo-header checksum */
+		rewrite_addr (rp, ip6 + 8, sum, udp);
+		rewrite_addr (rp, ip6 + 24, sum, udp);
+	}
+}
+
+
+static int
+open_sockets (replay *rp, uint32_t bind_ip, unsigned naddr, unsigned max)
+{
+	struct rlimit lim;
+
+	rp->nsock = (rp->nflows < max) ? rp->nflows : max;
+	rp->io = calloc (rp->nsock, sizeof (*rp->io));
+	if (rp->io == NULL)
+		return -1;
+
+	if ((getrlimit (RLIMIT_NOFILE, &lim) == 0)
+	 && (lim.rlim_cur < rp->nsock + 16))
+	{
+		lim.rlim_cur = rp->nsock + 16;
+		if (lim.rlim_cur > lim.rlim_max)
+			lim.rlim_cur = lim.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &lim);
+	}
+
+	for (unsigned i = 0; i < rp->nsock; i++)
+	{
+		uint32_t ip = bind_ip
+			? htonl (ntohl (bind_ip) + (i % naddr)) : INADDR_ANY;
+		struct sockaddr_in addr;
+		socklen_t len = sizeof (addr);
+		teredo_io *io = teredo_io_socket (ip, 0);
+
+		if (io == NULL)
+		{
+			perror ("teredo_socket");
+			fprintf (stderr, "Only %u sockets could be created\n", i);
+			return -1;
+		}
+		rp->io[i] = io;
+
+		/* Find the source address toward the target */
+		memset (&addr, 0, sizeof (addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = rp->target_port;
+		addr.sin_addr.s_addr = rp->target_ip;
+		if (connect (io->fd, (struct sockaddr *)&addr, sizeof (addr))
+		 || getsockname (io->fd, (struct sockaddr *)&addr, &len))
+		{
+			perror ("connect");
+			return -1;
+		}
+
+		/* Flows sharing a socket share its mapping */
+		for (unsigned n = i; n < rp->nflows; n += rp->nsock)
+		{
+			rp->flows[n].new_ip = addr.sin_addr.s_addr;
+			rp->flows[n].new_port = addr.sin_port;
+		}
+	}
+	return 0;
+}
+
+
+static void
+run (replay *rp, double speed, unsigned long loops)
+{
+	unsigned long sent = 0, errors = 0;
+	uint64_t bytes = 0, late = 0, start = tool_now_ns (), end;
+
+	for (unsigned long l = 0; l < loops; l++)
+	{
+		uint64_t base = tool_now_ns ();
+
+		for (size_t i = 0; i < rp->count; i++)
+		{
+			const rp_record *r = rp->recs + i;
+
+			if (speed > 0.)
+			{
+				uint64_t due = base + (uint64_t)(r->time / speed);
+				uint64_t now = tool_now_ns ();
+
+				if (due > now)
+				{
+					struct timespec ts =
+					{
+						.tv_sec = due / 1000000000,
+						.tv_nsec = due % 1000000000,
+					};
+
+					while (clock_nanosleep (CLOCK_MONOTONIC,
+					                        TIMER_ABSTIME, &ts, NULL)
+					        == EINTR);
+				}
+				else
+				if (now - due > late)
+					late = now - due;
+			}
+
+			teredo_io *io = rp->io[r->flow % rp->nsock];
+			if (teredo_io_send (io, r->data, r->len, rp->target_ip,
+			                    rp->target_port) == (int)r->len)
+			{
+				sent++;
+				bytes += r->len;
+			}
+			else
+				errors++;
+		}
+	}
+	end = tool_now_ns ();
+
+	double secs = (end - start) / 1e9;
+	if (secs <= 0.)
+		secs = 1e-9;
+
+	printf ("%lu packets sent, %lu errors in %.3f s\n", sent, errors, secs);
+	printf (" %.0f packets/s, %.2f Mbit/s (UDP payload)\n", sent / secs,
+	        bytes * 8 / secs / 1e6);
+	if (speed > 0.)
+		printf (" maximum lateness: %.1f us\n", late / 1000.);
+}
+
+
+static int
+parse_uint (const char *str, unsigned long *value, unsigned long max)
+{
+	char *end;
+	unsigned long l = strtoul (str, &end, 0);
+
+	if (*end || (l > max))
+	{
+		fprintf (stderr, "Invalid number: %s\n", str);
+		return -1;
+	}
+	*value = l;
+	return 0;
+}
+
+
+static int usage (const char *path)
+{
+	printf ("Usage: %s [OPTIONS] <file.pcap> <target IPv4[:port]>\n"
+"Replays the Teredo traffic of a pcap file toward a Teredo server or relay\n"
+"\n"
+"  -a, --addresses  number of consecutive local IPv4 addresses (default: 1)\n"
+"  -b, --bind       first local IPv4 address of the sockets\n"
+"  -c, --sockets    maximum number of sockets (default: 1024)\n"
+"  -h, --help       display this help and exit\n"
+"  -l, --loops      number of times the file is replayed (default: 1)\n"
+"  -n, --no-rewrite do not rewrite Teredo IPv6 addresses\n"
+"  -p, --port       Teredo UDP port in the file, 0 for any (default: %u)\n"
+"  -s, --speed      speed factor, 0 for as fast as possible (default: 1)\n"
+"  -V, --version    display program version and exit\n"
+"\n"
+"The target port defaults to %u. Teredo servers and relays ignore\n"
+"non-global IPv4 sources: bind the sockets to local addresses from\n"
+"a benchmarking range such as 198.18.0.0/15 when replaying over\n"
+"a loopback or private network.\n",
+	        path, IPPORT_TEREDO, IPPORT_TEREDO);
+	return 0;
+}
+
+
+static int version (void)
+{
+	puts (PACKAGE_NAME" v"PACKAGE_VERSION);
+	return 0;
+}
+
+
+int main (int argc, char *argv[])
+{
+	static const struct option opts[] =
+	{
+		{ "addresses",  required_argument, NULL, 'a' },
+		{ "bind",       required_argument, NULL, 'b' },
+		{ "sockets",    required_argument, NULL, 'c' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "loops",      required_argument, NULL, 'l' },
+		{ "no-rewrite", no_argument,       NULL, 'n' },
+		{ "port",       required_argument, NULL, 'p' },
+		{ "speed",      required_argument, NULL, 's' },
+		{ "version",    no_argument,       NULL, 'V' },
+		{ NULL,         no_argument,       NULL, '\0'}
+	};
+	unsigned long naddr = 1, sockets = 1024, loops = 1,
+	              port = IPPORT_TEREDO;
+	uint32_t bind_ip = INADDR_ANY;
+	double speed = 1.;
+	bool rewrite_addrs = true;
+	replay rp;
+
+	memset (&rp, 0, sizeof (rp));
+
+	int c;
+	while ((c = getopt_long (argc, argv, "a:b:c:hl:np:s:V", opts,
+	                         NULL)) != -1)
+		switch (c)
+		{
+			case 'a':
+				if (parse_uint (optarg, &naddr, UINT_MAX) || (naddr == 0))
+					return 1;
+				break;
+
+			case 'b':
+				if (tool_parse_ipv4 (optarg, &bind_ip, NULL))
+				{
+					fprintf (stderr, "Invalid IPv4 address: %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'c':
+				if (parse_uint (optarg, &sockets, UINT_MAX)
+				 || (sockets == 0))
+					return 1;
+				break;
+
+			case 'h':
+				return usage (argv[0]);
+
+			case 'l':
+				if (parse_uint (optarg, &loops, ULONG_MAX))
+					return 1;
+				break;
+
+			case 'n':
+				rewrite_addrs = false;
+				break;
+
+			case 'p':
+				if (parse_uint (optarg, &port, 65535))
+					return 1;
+				break;
+
+			case 's':
+			{
+				char *end;
+
+				speed = strtod (optarg, &end);
+				if (*end || !(speed >= 0.))
+				{
+					fprintf (stderr, "Invalid speed: %s\n", optarg);
+					return 1;
+				}
+				break;
+			}
+
+			case 'V':
+				return version ();
+
+			default:
+				return 1;
+		}
+
+	if (argc - optind != 2)
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	rp.filter_port = htons (port);
+	rp.target_port = htons (IPPORT_TEREDO);
+	if (tool_parse_ipv4 (argv[optind + 1], &rp.target_ip, &rp.target_port))
+	{
+		fprintf (stderr, "Invalid target: %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	if (load_pcap (&rp, argv[optind]))
+		return 1;
+
+	printf ("%zu packets in %u flows loaded, %lu records skipped\n",
+	        rp.count, rp.nflows, rp.skipped);
+	if (rp.count == 0)
+		return 1;
+
+	int retval = 1;
+
+	if (open_sockets (&rp, bind_ip, naddr, sockets))
+		goto out;
+
+	if (rewrite_addrs)
+		rewrite (&rp);
+
+	run (&rp, speed, loops);
+	retval = 0;
+
+out:
+	for (unsigned i = 0; i < rp.nsock; i++)
+		if (rp.io[i] != NULL)
+			teredo_io_close (rp.io[i]);
+	free (rp.io);
+	for (size_t i = 0; i < rp.count; i++)
+		free (rp.recs[i].data);
+	free (rp.recs);
+	free (rp.flows);
+	free (rp.hash);
+	return retval;
+}
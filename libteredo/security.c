@@ -39,6 +39,9 @@
 #include "security.h"
 #include "debug.h"
 #include "md5.h"
+#ifdef TEREDO_SIPHASH
+# include "siphash.h"
+#endif
 
 #if defined (__OpenBSD__) || defined (__OpenBSD_kernel__)
 static const char randfile[] = "/dev/srandom";
@@ -66,6 +69,15 @@ static union
 	unsigned char opad[HMAC_BLOCK_LEN];
 } outer_key;
 
+/* MD5 states after the inner and outer padded keys have been absorbed */
+static md5_state_t inner_ctx, outer_ctx;
+#ifdef TEREDO_SIPHASH
+# if LIBTEREDO_KEY_LEN != SIPHASH_KEY_LEN
+#  error SipHash key length mismatch.
+# endif
+static uint8_t siphash_key[SIPHASH_KEY_LEN];
+#endif
+
 // PID cannot be zero (otherwise, have fun using fork()!)
 static uint16_t hmac_pid = 0;
 
@@ -94,6 +106,10 @@ int teredo_init_HMAC (void)
 		}
 		close (fd);
 
+#ifdef TEREDO_SIPHASH
+		memcpy (siphash_key, inner_key.key, sizeof (siphash_key));
+#endif
+
 		/* Precomputes HMAC padding */
 		memcpy (&outer_key, &inner_key, sizeof (outer_key));
 	
@@ -103,6 +119,11 @@ int teredo_init_HMAC (void)
 			outer_key.opad[i] ^= 0x5c;
 		}
 
+		md5_init (&inner_ctx);
+		md5_append (&inner_ctx, inner_key.ipad, sizeof (inner_key.ipad));
+		md5_init (&outer_ctx);
+		md5_append (&outer_ctx, outer_key.opad, sizeof (outer_key.opad));
+
 		hmac_pid = htons ((uint16_t)getpid ());
 	}
 	retval = 0;
@@ -122,24 +143,40 @@ void teredo_deinit_HMAC (void)
 
 #define LIBTEREDO_HASH_LEN 16
 
+/*
+ * The hash is only ever checked by the same process that generated it
+ * (bubble nonces, ping payloads and flow labels), so the pseudo-random
+ * function can be changed at will.
+ */
 static void
 teredo_hash (const void *src, size_t slen, const void *dst, size_t dlen,
              uint8_t *restrict hash, uint32_t timestamp)
 {
+#ifdef TEREDO_SIPHASH
+	uint8_t buf[2 * sizeof (struct in6_addr) + sizeof (hmac_pid)
+	            + sizeof (timestamp)];
+
+	assert (slen + dlen <= 2 * sizeof (struct in6_addr));
+	memcpy (buf, src, slen);
+	memcpy (buf + slen, dst, dlen);
+	memcpy (buf + slen + dlen, &hmac_pid, sizeof (hmac_pid));
+	memcpy (buf + slen + dlen + sizeof (hmac_pid), &timestamp,
+	        sizeof (timestamp));
+	teredo_siphash (siphash_key, buf, slen + dlen + sizeof (hmac_pid)
+	                + sizeof (timestamp), hash, LIBTEREDO_HASH_LEN);
+#else
 	/* compute hash */
-	md5_state_t ctx;
-	md5_init (&ctx);
-	md5_append (&ctx, inner_key.ipad, sizeof (inner_key.ipad));
+	md5_state_t ctx = inner_ctx;
 	md5_append (&ctx, (const unsigned char *)src, slen);
 	md5_append (&ctx, (const unsigned char *)dst, dlen);
 	md5_append (&ctx, (const unsigned char *)&hmac_pid, sizeof (hmac_pid));
 	md5_append (&ctx, (const unsigned char *)&timestamp, sizeof (timestamp));
 	md5_finish (&ctx, hash);
 
-	md5_init (&ctx);
-	md5_append (&ctx, outer_key.opad, sizeof (outer_key.opad));
+	ctx = outer_ctx;
 	md5_append (&ctx, hash, LIBTEREDO_HASH_LEN);
 	md5_finish (&ctx, hash);
+#endif
 }
 
 
@@ -246,3 +283,58 @@ teredo_get_nonce (uint32_t timestamp, uint32_t ipv4, uint16_t port,
 	teredo_hash (&ipv4, 4, &port, 2, buf, timestamp);
 	memcpy (nonce, buf, LIBTEREDO_NONCE_LEN);
 }
+
+
+/**
+ * Computes the nonces of several IPv4/port pairs at once, as
+ * teredo_get_nonce() would. Multi-buffer hashing is used if possible.
+ */
+void
+teredo_get_nonces (uint32_t timestamp, unsigned n,
+                   const uint32_t *ipv4, const uint16_t *port,
+                   uint8_t (*restrict nonce)[LIBTEREDO_NONCE_LEN])
+{
+#ifdef TEREDO_SIPHASH
+	for (unsigned i = 0; i < n; i++)
+		teredo_get_nonce (timestamp, ipv4[i], port[i], nonce[i]);
+#else
+	uint8_t msg[MD5_LANES][4 + 2 + sizeof (hmac_pid) + sizeof (timestamp)];
+	uint8_t inner[MD5_LANES][LIBTEREDO_HASH_LEN];
+	uint8_t outer[MD5_LANES][LIBTEREDO_HASH_LEN];
+	const md5_state_t *pms[MD5_LANES];
+	const md5_byte_t *data[MD5_LANES];
+	md5_byte_t *digest[MD5_LANES];
+
+	for (unsigned base = 0; base < n; base += MD5_LANES)
+	{
+		unsigned lanes = n - base;
+		if (lanes > MD5_LANES)
+			lanes = MD5_LANES;
+
+		/* Same layout as teredo_hash() */
+		for (unsigned i = 0; i < lanes; i++)
+		{
+			memcpy (msg[i], ipv4 + base + i, 4);
+			memcpy (msg[i] + 4, port + base + i, 2);
+			memcpy (msg[i] + 6, &hmac_pid, sizeof (hmac_pid));
+			memcpy (msg[i] + 6 + sizeof (hmac_pid), &timestamp,
+			        sizeof (timestamp));
+			pms[i] = &inner_ctx;
+			data[i] = msg[i];
+			digest[i] = inner[i];
+		}
+		md5_finish_multi (pms, data, sizeof (msg[0]), digest, lanes);
+
+		for (unsigned i = 0; i < lanes; i++)
+		{
+			pms[i] = &outer_ctx;
+			data[i] = inner[i];
+			digest[i] = outer[i];
+		}
+		md5_finish_multi (pms, data, LIBTEREDO_HASH_LEN, digest, lanes);
+
+		for (unsigned i = 0; i < lanes; i++)
+			memcpy (nonce[base + i], outer[i], LIBTEREDO_NONCE_LEN);
+	}
+#endif
+}
@@ -37,6 +37,9 @@ int teredo_verify_pinghash (uint32_t now, const struct in6_addr *src,
 
 void teredo_get_nonce (uint32_t timestamp, uint32_t ipv4, uint16_t port,
                        uint8_t *restrict nonce);
+void teredo_get_nonces (uint32_t timestamp, unsigned n,
+                        const uint32_t *ipv4, const uint16_t *port,
+                        uint8_t (*restrict nonce)[LIBTEREDO_NONCE_LEN]);
 uint16_t teredo_get_flbits (uint32_t timestamp);
 
 #endif
@@ -34,6 +34,7 @@
 #include <errno.h> // errno
 #include <stdio.h> // snprintf()
 #include <stdlib.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <unistd.h> // close()
@@ -51,9 +52,11 @@
 #include "teredo.h"
 #include <sys/uio.h>
 #include "teredo-udp.h"
+#include "io.h"
 #include "checksum.h"
 #include "debug.h"
 #include "packets.h"
+#include "probes.h"
 
 static pthread_mutex_t raw_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int raw_fd; // raw IPv6 socket
@@ -63,12 +66,15 @@ struct teredo_server
 {
 	pthread_t t1, t2;
 
-	int fd_primary, fd_secondary; // UDP/IPv4 sockets
+	teredo_io *io_primary, *io_secondary; // UDP/IPv4 I/O backends
+	unsigned recv_spin; // microseconds
 
 	/* These are all in network byte order (including MTU!!) */
 	uint32_t server_ip, server_ip2, advLinkMTU;
 
 	union teredo_addr lladdr; // server link-local IPv6 address
+
+	teredo_server_stats stats[2]; // primary and secondary threads
 };
 
 /**
@@ -78,44 +84,23 @@ static bool
 SendRA (const teredo_server *restrict s, const struct teredo_packet *p,
         const struct in6_addr *dest_ip6, bool secondary)
 {
-	const uint8_t *nonce;
 	struct in6_addr *addr;
-	uint8_t auth[13] = { 0, 1 };
-	struct teredo_orig_ind orig;
 	struct
 	{
+		uint8_t                   head[TEREDO_HEADROOM];
 		struct ip6_hdr            ip6;
 		struct nd_router_advert   ra;
 		struct nd_opt_prefix_info pi;
 		struct nd_opt_mtu         mtu;
 	} ra;
-	struct iovec iov[] =
-	{
-		{ auth, 13 },
-		{ &orig, 8 },
-		{ &ra, sizeof (ra) }
-	};
+	teredo_buf b;
         uint32_t prefix = htonl(TEREDO_PREFIX);
 
-	// Authentification header
-	// TODO: support for secure qualification
-	nonce = p->auth_nonce;
-	if (nonce != NULL)
-		memcpy (auth + 4, nonce, 8);
-	else
-		iov[0].iov_len = 0;
-
-	// Origin indication header
-	//memset (&orig, 0, sizeof (orig));
-	orig.orig_zero = 0;
-	orig.orig_code = teredo_orig_ind;
-	orig.orig_port = ~p->source_port; // obfuscate
-	orig.orig_addr = ~p->source_ipv4; // obfuscate
-
 	// IPv6 header
 	memset (&ra, 0, sizeof (ra));
 	ra.ip6.ip6_flow = htonl (0x60000000);
-	ra.ip6.ip6_plen = htons (sizeof (ra) - sizeof (ra.ip6));
+	ra.ip6.ip6_plen = htons (sizeof (ra) - sizeof (ra.head)
+	                         - sizeof (ra.ip6));
 	ra.ip6.ip6_nxt = IPPROTO_ICMPV6;
 	ra.ip6.ip6_hlim = 255;
 	ra.ip6.ip6_src = s->lladdr.ip6;
@@ -155,8 +140,19 @@ SendRA (const teredo_server *restrict s, const struct teredo_packet *p,
 	if (IN6_IS_TEREDO_ADDR_CONE (dest_ip6))
 		secondary = !secondary;
 
-	return teredo_sendv (secondary ? s->fd_secondary : s->fd_primary,
-	                     iov, 3, p->source_ipv4, p->source_port) > 0;
+	teredo_buf_init (&b, &ra.ip6, sizeof (ra) - sizeof (ra.head),
+	                 sizeof (ra.head));
+
+	// Origin indication header
+	teredo_buf_push_orig (&b, p->source_ipv4, p->source_port);
+
+	// Authentification header
+	// TODO: support for secure qualification
+	teredo_buf_push_auth (&b, p->auth_nonce);
+
+	TEREDO_PROBE3 (ra_send, p->source_ipv4, p->source_port, secondary);
+	return teredo_io_send_buf (secondary ? s->io_secondary : s->io_primary,
+	                           &b, p->source_ipv4, p->source_port) > 0;
 }
 
 
@@ -164,11 +160,10 @@ SendRA (const teredo_server *restrict s, const struct teredo_packet *p,
  * Forwards a Teredo packet to a client
  */
 static bool
-teredo_forward_udp (int fd, const struct teredo_packet *packet,
-                       bool insert_orig)
+teredo_forward_udp (teredo_io *io, struct teredo_packet *packet,
+                    bool insert_orig)
 {
-	struct teredo_orig_ind orig;
-	struct iovec iov[2];
+	teredo_buf b;
 
 	/* extract the IPv4 destination directly from the Teredo IPv6 destination
 	   within the IPv6 header */
@@ -177,26 +172,17 @@ teredo_forward_udp (int fd, const struct teredo_packet *packet,
 	if (!is_ipv4_global_unicast (dest_ipv4))
 		return 0; // ignore invalid client IP
 
+	teredo_packet_buf (packet, &b);
+
 	// Origin indication header
 	// if the Teredo server's address is ours
 	// NOTE: I wonder in which legitimate case insert_orig might be
 	// false... but the spec implies it could
-	iov[0].iov_base = &orig;
+	// (the IPv6 packet is received with enough headroom for it)
 	if (insert_orig)
-	{
-		iov[0].iov_len = sizeof (orig);
-		orig.orig_zero = 0;
-		orig.orig_code = teredo_orig_ind;
-		orig.orig_port = ~packet->source_port; // obfuscate
-		orig.orig_addr = ~packet->source_ipv4; // obfuscate
-	}
-	else
-		iov[0].iov_len = 0;
-
-	iov[1].iov_base = packet->ip6;
-	iov[1].iov_len = packet->ip6_len;
+		teredo_buf_push_orig (&b, packet->source_ipv4, packet->source_port);
 
-	return teredo_sendv (fd, iov, 2, dest_ipv4, dest_port) > 0;
+	return teredo_io_send_buf (io, &b, dest_ipv4, dest_port) > 0;
 }
 
 
@@ -233,6 +219,7 @@ teredo_send_ipv6 (const struct ip6_hdr *p, size_t len)
 #ifdef EPROTO
 			case EPROTO: /* ICMPv6 param prob (and other errors) */
 #endif
+				TEREDO_PROBE2 (ipv6_send_retry, tries, errno);
 				break;
 
 			default:
@@ -281,7 +268,7 @@ static void debug_error_header (const uint32_t *v4src,
 #endif
 
 /**
- * Checks and handles an Teredo-encapsulated packet.
+ * Checks and handles a received Teredo-encapsulated packet.
  * Thread-safety note: prefix and advLinkMTU might be changed by another
  * thread.
  * @return -1 in case of I/O error, -2 if the packet was discarded,
@@ -290,27 +277,23 @@ static void debug_error_header (const uint32_t *v4src,
  * 3 if it was forwarded over UDP/IPv4 (hole punching).
  */
 static int
-teredo_process_packet (const teredo_server *s, bool sec)
+teredo_process_packet (const teredo_server *restrict s, bool sec,
+                       struct teredo_packet *restrict packet)
 {
-	struct teredo_packet packet;
-
-	if (teredo_wait_recv (sec ? s->fd_secondary : s->fd_primary, &packet))
-		return -1;
-
 	// Check IPv6 packet (Teredo server case number 1)
-	const struct ip6_hdr *ip6 = packet.ip6;
-	if (packet.ip6_len < sizeof (*ip6))
+	const struct ip6_hdr *ip6 = packet->ip6;
+	if (packet->ip6_len < sizeof (*ip6))
      	{
-		debug_error_header (&packet.source_ipv4, NULL, NULL);
-		debug ("Packet too small: %d bytes", packet.ip6_len);
+		debug_error_header (&packet->source_ipv4, NULL, NULL);
+		debug ("Packet too small: %d bytes", packet->ip6_len);
 		return -2; // too small
 	}
 
 	size_t plen = ntohs (ip6->ip6_plen);
 	if (((ip6->ip6_vfc >> 4) != 6)
-	 || ((sizeof (*ip6) + plen) > packet.ip6_len))
+	 || ((sizeof (*ip6) + plen) > packet->ip6_len))
      	{
-		debug_error_header (&packet.source_ipv4, NULL, NULL);
+		debug_error_header (&packet->source_ipv4, NULL, NULL);
 		debug ("Not an IPv6 packet: Version %d", ip6->ip6_vfc >> 4);
 		return -2; // not an IPv6 packet
 	}
@@ -321,16 +304,16 @@ teredo_process_packet (const teredo_server *s, bool sec)
 	if (!IsBubble (ip6) // neither a bubble...
 	 && (ip6->ip6_nxt != IPPROTO_ICMPV6)) // nor an ICMPv6 message
      	{
-		debug_error_header (&packet.source_ipv4,
+		debug_error_header (&packet->source_ipv4,
 		                    &ip6->ip6_src, &ip6->ip6_dst);
 		debug ("Packet not allowed: Protocol %d", ip6->ip6_nxt);
 		return -2; // packet not allowed through server
 	}
 
 	// Teredo server case number 3
-	if (!is_ipv4_global_unicast (packet.source_ipv4))
+	if (!is_ipv4_global_unicast (packet->source_ipv4))
      	{
-	   	debug_error_header (&packet.source_ipv4,
+	   	debug_error_header (&packet->source_ipv4,
 		                    &ip6->ip6_src, &ip6->ip6_dst);
 		debug ("Source is not IPv4 unicast.");
 		return -2;
@@ -348,8 +331,8 @@ teredo_process_packet (const teredo_server *s, bool sec)
 	{
 		/** Source address is Teredo **/
 		// Teredo server case number 5
-		if (IN6_MATCHES_TEREDO_CLIENT (&ip6->ip6_src, packet.source_ipv4,
-		                               packet.source_port))
+		if (IN6_MATCHES_TEREDO_CLIENT (&ip6->ip6_src, packet->source_ipv4,
+		                               packet->source_port))
 			goto accept;
 	}
 	else
@@ -362,7 +345,7 @@ teredo_process_packet (const teredo_server *s, bool sec)
 	}
 
 	// Teredo server case number 7
-	debug_error_header (&packet.source_ipv4, &ip6->ip6_src, &ip6->ip6_dst);
+	debug_error_header (&packet->source_ipv4, &ip6->ip6_src, &ip6->ip6_dst);
 	debug ("Drop packet.");
 	return -2;
 
@@ -370,14 +353,14 @@ accept:
 	/** Packet "accepted" for processing **/
 
 	/* Security fix: Prevent infinite local UDP packet loops */
-	if (((packet.source_ipv4 == s->server_ip)
-	  || (packet.source_ipv4 == s->server_ip2))
-	 && (packet.source_port == htons (IPPORT_TEREDO)))
+	if (((packet->source_ipv4 == s->server_ip)
+	  || (packet->source_ipv4 == s->server_ip2))
+	 && (packet->source_port == htons (IPPORT_TEREDO)))
      	{
-	   	debug_error_header (&packet.source_ipv4, &ip6->ip6_src,
+	   	debug_error_header (&packet->source_ipv4, &ip6->ip6_src,
 		                    &ip6->ip6_dst);
 		debug ("Prevent infinite local UDP packet loops from port %d",
-		       ntohs (packet.source_port));
+		       ntohs (packet->source_port));
 		return -2;
 	}
 
@@ -389,15 +372,15 @@ accept:
 		if ((ip6->ip6_nxt == IPPROTO_ICMPV6)
 		 && (plen >= sizeof (struct nd_router_solicit))
 		 && (icmp->icmp6_type == ND_ROUTER_SOLICIT))
-			return SendRA (s, &packet, &ip6->ip6_src, sec) ? 1 : -1;
+			return SendRA (s, packet, &ip6->ip6_src, sec) ? 1 : -1;
 		if(ip6->ip6_nxt == IPPROTO_ICMPV6)
 	     	{
-			debug_error_header(&packet.source_ipv4,
+			debug_error_header(&packet->source_ipv4,
 			                   &ip6->ip6_src, &ip6->ip6_dst);
 			debug ("Unhandled router message: ICMP type %d",
 			       icmp->icmp6_type);
 		} else {
-			debug_error_header(&packet.source_ipv4,
+			debug_error_header(&packet->source_ipv4,
 			                   &ip6->ip6_src, &ip6->ip6_dst);
 			debug ("Unhandled router message: Protocol %d",
 			       ip6->ip6_nxt);
@@ -408,7 +391,7 @@ accept:
 	/* Servers must not forward packets with non-global destination */
 	if (!IN6_IS_ADDR_GLOBAL (&ip6->ip6_dst))
      	{
-		debug_error_header (&packet.source_ipv4,
+		debug_error_header (&packet->source_ipv4,
 		                    &ip6->ip6_src, &ip6->ip6_dst);
 		debug ("Destination is no global IPv6 address");
 		return -2;
@@ -430,39 +413,94 @@ accept:
 	 */
 	if ((ip6->ip6_nxt != IPPROTO_NONE) && (plen > 88))
      	{
-		debug_error_header (&packet.source_ipv4,
+		debug_error_header (&packet->source_ipv4,
 		                    &ip6->ip6_src, &ip6->ip6_dst);
 		debug ("ICMPv6 too large (%zu bytes)", plen);
 		return -2;
 	}
 
 	if (IN6_TEREDO_PREFIX (&ip6->ip6_dst) != htonl (TEREDO_PREFIX))
-		return teredo_send_ipv6 (packet.ip6,
+		return teredo_send_ipv6 (packet->ip6,
 		                         sizeof (*ip6) + plen) ? 2 : -1;
 
 	// Forwards packet over Teredo (destination is a Teredo IPv6 address)
-	return teredo_forward_udp (s->fd_primary, &packet,
+	return teredo_forward_udp (s->io_primary, packet,
 		IN6_TEREDO_SERVER (&ip6->ip6_dst) == s->server_ip) ? 3 : -1;
 }
 
 
-static LIBTEREDO_NORETURN void *thread_primary (void *data)
+/**
+ * Sends the replies that the I/O backends hold back, if any.
+ */
+static void teredo_server_flush (const teredo_server *s)
 {
+	teredo_io_flush (s->io_primary);
+	teredo_io_flush (s->io_secondary);
+}
+
+
+/*
+ * Increments a statistics counter. Each counter has a single writer (its
+ * thread), so that an atomic store is enough.
+ */
+#define stat_add(counter, n) \
+	__atomic_store_n (&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+
+static LIBTEREDO_NORETURN void teredo_server_loop (teredo_server *s,
+                                                   bool sec)
+{
+	teredo_io *io = sec ? s->io_secondary : s->io_primary;
+	teredo_server_stats *st = s->stats + sec;
+
 	for (;;)
 	{
+		struct teredo_packet packet;
+		struct timespec start, end;
+
 		pthread_testcancel ();
-		teredo_process_packet ((teredo_server *)data, false);
+		if (teredo_io_wait (io, &packet, s->recv_spin))
+			continue;
+
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		int res = teredo_process_packet (s, sec, &packet);
+		teredo_server_flush (s);
+		clock_gettime (CLOCK_MONOTONIC, &end);
+
+		stat_add (st->packets, 1);
+		switch (res)
+		{
+			case 1:
+				stat_add (st->ra, 1);
+				break;
+			case 2:
+				stat_add (st->ipv6, 1);
+				break;
+			case 3:
+				stat_add (st->udp, 1);
+				break;
+			case -2:
+				stat_add (st->dropped, 1);
+				break;
+			default:
+				stat_add (st->errors, 1);
+		}
+		stat_add (st->busy_time,
+		          (end.tv_sec - start.tv_sec) * UINT64_C(1000000000)
+		          + end.tv_nsec - start.tv_nsec);
 	}
 }
 
 
+static LIBTEREDO_NORETURN void *thread_primary (void *data)
+{
+	teredo_server_loop (data, false);
+}
+
+
 static LIBTEREDO_NORETURN void *thread_secondary (void *data)
 {
-	for (;;)
-	{
-		pthread_testcancel ();
-		teredo_process_packet ((teredo_server *)data, true);
-	}
+	teredo_server_loop (data, true);
 }
 
 
@@ -516,8 +554,6 @@ teredo_server *teredo_server_create (uint32_t ip1, uint32_t ip2)
 
 	if (s != NULL)
 	{
-		int fd;
-
 		memset (s, 0, sizeof (*s));
 		s->server_ip = ip1;
 		s->server_ip2 = ip2;
@@ -528,11 +564,11 @@ teredo_server *teredo_server_create (uint32_t ip1, uint32_t ip2)
 		s->lladdr.teredo.client_port = ~htons (IPPORT_TEREDO);
 		s->lladdr.teredo.client_ip = ~s->server_ip;
 
-		fd = s->fd_primary = teredo_socket (ip1, htons (IPPORT_TEREDO));
-		if (fd != -1)
+		s->io_primary = teredo_io_socket (ip1, htons (IPPORT_TEREDO));
+		if (s->io_primary != NULL)
 		{
-			fd = s->fd_secondary = teredo_socket (ip2, htons (IPPORT_TEREDO));
-			if (fd != -1)
+			s->io_secondary = teredo_io_socket (ip2, htons (IPPORT_TEREDO));
+			if (s->io_secondary != NULL)
 				return s;
 			else
 			{
@@ -542,7 +578,7 @@ teredo_server *teredo_server_create (uint32_t ip1, uint32_t ip2)
 				syslog (LOG_ERR, _("Error (%s): %m"), str);
 			}
 
-			teredo_close (s->fd_primary);
+			teredo_io_close (s->io_primary);
 		}
 		else
 		{
@@ -574,6 +610,26 @@ uint16_t teredo_server_get_MTU (const teredo_server *s)
 }
 
 
+int teredo_server_set_busy_poll (teredo_server *s, unsigned busy_poll,
+                                 unsigned spin)
+{
+	s->recv_spin = spin;
+
+	int r1 = teredo_socket_set_busy_poll (s->io_primary->fd, busy_poll);
+	int r2 = teredo_socket_set_busy_poll (s->io_secondary->fd, busy_poll);
+	return (r1 || r2) ? -1 : 0;
+}
+
+
+int teredo_server_set_socket_buffers (teredo_server *s, unsigned rcvbuf,
+                                      unsigned sndbuf)
+{
+	int r1 = teredo_socket_set_buffers (s->io_primary->fd, rcvbuf, sndbuf);
+	int r2 = teredo_socket_set_buffers (s->io_secondary->fd, rcvbuf, sndbuf);
+	return (r1 || r2) ? -1 : 0;
+}
+
+
 int teredo_server_start (teredo_server *s)
 {
 	if (pthread_create (&s->t1, NULL, thread_primary, s) == 0)
@@ -597,10 +653,25 @@ void teredo_server_stop (teredo_server *s)
 }
 
 
+void teredo_server_get_stats (const teredo_server *restrict s, bool sec,
+                              teredo_server_stats *restrict st)
+{
+	const teredo_server_stats *src = s->stats + sec;
+
+	st->packets = __atomic_load_n (&src->packets, __ATOMIC_RELAXED);
+	st->ra = __atomic_load_n (&src->ra, __ATOMIC_RELAXED);
+	st->ipv6 = __atomic_load_n (&src->ipv6, __ATOMIC_RELAXED);
+	st->udp = __atomic_load_n (&src->udp, __ATOMIC_RELAXED);
+	st->dropped = __atomic_load_n (&src->dropped, __ATOMIC_RELAXED);
+	st->errors = __atomic_load_n (&src->errors, __ATOMIC_RELAXED);
+	st->busy_time = __atomic_load_n (&src->busy_time, __ATOMIC_RELAXED);
+}
+
+
 void teredo_server_destroy (teredo_server *s)
 {
-	teredo_close (s->fd_primary);
-	teredo_close (s->fd_secondary);
+	teredo_io_close (s->io_primary);
+	teredo_io_close (s->io_secondary);
 	free (s);
 
 	pthread_mutex_lock (&raw_mutex);
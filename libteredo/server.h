@@ -57,6 +57,35 @@ int teredo_server_set_MTU (teredo_server *s, uint16_t mtu);
  */
 uint16_t teredo_server_get_MTU (const teredo_server *s);
 
+/**
+ * Enables the low-latency receive mode of a Teredo server: the kernel
+ * busy polls the network device for the server sockets (SO_BUSY_POLL),
+ * and the server threads spin before they go to sleep waiting for
+ * packets. This must be called before teredo_server_start().
+ *
+ * @param s server handler as returned from teredo_server_create(),
+ * @param busy_poll kernel busy polling time in microseconds
+ * (0 keeps the system default),
+ * @param spin threads spinning time in microseconds (0 disables).
+ *
+ * @return 0 on success, -1 if kernel busy polling could not be enabled
+ * (spinning is enabled regardless).
+ */
+int teredo_server_set_busy_poll (teredo_server *s, unsigned busy_poll,
+                                 unsigned spin);
+
+/**
+ * Sets the kernel receive and send buffer sizes of the server sockets.
+ *
+ * @param s server handler as returned from teredo_server_create(),
+ * @param rcvbuf receive buffer byte size (0 leaves it unchanged),
+ * @param sndbuf send buffer byte size (0 leaves it unchanged).
+ *
+ * @return 0 on success, -1 on error.
+ */
+int teredo_server_set_socket_buffers (teredo_server *s, unsigned rcvbuf,
+                                      unsigned sndbuf);
+
 /**
  * Starts a Teredo server processing.
  *
@@ -73,6 +102,35 @@ int teredo_server_start (teredo_server *s);
  */
 void teredo_server_stop (teredo_server *s);
 
+/**
+ * Packet counters of a Teredo server thread (see teredo_server_get_stats()).
+ * Counters are cumulative since the server was created.
+ */
+typedef struct teredo_server_stats
+{
+	unsigned long packets; /**< packets received */
+	unsigned long ra; /**< Router Advertisements sent (qualification) */
+	unsigned long ipv6; /**< packets forwarded to the IPv6 Internet */
+	unsigned long udp; /**< packets forwarded over UDP/IPv4 */
+	unsigned long dropped; /**< packets discarded */
+	unsigned long errors; /**< packets not sent due to I/O errors */
+	uint64_t busy_time; /**< nanoseconds spent processing packets */
+} teredo_server_stats;
+
+/**
+ * Gets the counters of one of the threads of a Teredo server.
+ *
+ * @note This function is thread-safe.
+ *
+ * @param s server handler as returned from teredo_server_create(),
+ * @param secondary whether to get the counters of the thread serving the
+ * secondary address rather than the primary one,
+ * @param st [out] counters.
+ */
+void teredo_server_get_stats (const teredo_server *restrict s,
+                              bool secondary,
+                              teredo_server_stats *restrict st);
+
 /**
  * Destroys a Teredo server handle. Behavior is not defined if the associated
  * server is currently running - you must stop it with teredo_server_stop()
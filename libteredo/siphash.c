@@ -0,0 +1,118 @@
+/*
+ * siphash.c - SipHash-2-4 keyed hash function
+ *
+ * Implemented after "SipHash: a fast short-input PRF",
+ * by Jean-Philippe Aumasson and Daniel J. Bernstein.
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "siphash.h"
+
+static inline uint64_t rotl (uint64_t x, unsigned b)
+{
+	return (x << b) | (x >> (64 - b));
+}
+
+static inline uint64_t load64 (const uint8_t *p)
+{
+	return ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)
+	     | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+	     | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+	     | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline void store64 (uint8_t *p, uint64_t v)
+{
+	for (unsigned i = 0; i < 8; i++)
+		p[i] = v >> (8 * i);
+}
+
+static inline void sipround (uint64_t v[4])
+{
+	v[0] += v[1]; v[1] = rotl (v[1], 13); v[1] ^= v[0];
+	v[0] = rotl (v[0], 32);
+	v[2] += v[3]; v[3] = rotl (v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = rotl (v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = rotl (v[1], 17); v[1] ^= v[2];
+	v[2] = rotl (v[2], 32);
+}
+
+static inline uint64_t sipfinal (uint64_t v[4], uint8_t x)
+{
+	v[2] ^= x;
+	for (unsigned i = 0; i < 4; i++)
+		sipround (v);
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+void teredo_siphash (const uint8_t *restrict key, const void *data,
+                     size_t len, uint8_t *restrict out, size_t outlen)
+{
+	assert ((outlen == 8) || (outlen == 16));
+
+	const uint8_t *in = data;
+	uint64_t k0 = load64 (key), k1 = load64 (key + 8);
+	uint64_t v[4] =
+	{
+		k0 ^ UINT64_C(0x736f6d6570736575),
+		k1 ^ UINT64_C(0x646f72616e646f6d),
+		k0 ^ UINT64_C(0x6c7967656e657261),
+		k1 ^ UINT64_C(0x7465646279746573),
+	};
+
+	if (outlen == 16)
+		v[1] ^= 0xee;
+
+	/* Compression (2 rounds per 8-bytes block) */
+	uint64_t m, b = ((uint64_t)len) << 56;
+
+	for (; len >= 8; len -= 8, in += 8)
+	{
+		m = load64 (in);
+		v[3] ^= m;
+		sipround (v);
+		sipround (v);
+		v[0] ^= m;
+	}
+
+	for (unsigned i = 0; i < len; i++)
+		b |= ((uint64_t)in[i]) << (8 * i);
+
+	v[3] ^= b;
+	sipround (v);
+	sipround (v);
+	v[0] ^= b;
+
+	/* Finalization (4 rounds) */
+	store64 (out, sipfinal (v, (outlen == 16) ? 0xee : 0xff));
+	if (outlen == 16)
+	{
+		v[1] ^= 0xdd;
+		store64 (out + 8, sipfinal (v, 0));
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * siphash.h - SipHash-2-4 keyed hash function
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_SIPHASH_H
+# define LIBTEREDO_SIPHASH_H
+
+# define SIPHASH_KEY_LEN 16
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/**
+ * Computes the SipHash-2-4 pseudo-random function of a message.
+ *
+ * @param key secret key (SIPHASH_KEY_LEN bytes)
+ * @param data message
+ * @param len message byte length
+ * @param out buffer for the result
+ * @param outlen result byte length: 8 (SipHash-2-4-64),
+ * or 16 (SipHash-2-4-128)
+ */
+void teredo_siphash (const uint8_t *restrict key, const void *data,
+                     size_t len, uint8_t *restrict out, size_t outlen);
+
+# ifdef __cplusplus
+}
+# endif
+#endif
@@ -34,6 +34,13 @@
 /** Buffer size for Teredo packet reception */
 # define TEREDO_PACKET_SIZE MAX_TEREDO_PACKET_SIZE
 
+/**
+ * Room to reserve in front of an IPv6 packet so that Teredo headers
+ * (authentication header without client identifier nor authentication
+ * value, then origin indication) fit, rounded up for alignment.
+ */
+# define TEREDO_HEADROOM 24
+
 
 /**
  * Structure to receive Teredo-encapsulated IPv6 packets
@@ -67,15 +74,79 @@ typedef struct teredo_packet
 	/** Authentication nonce, if present */
 	uint8_t  auth_nonce[8];
 
-	/** Internal buffer for UDP datagram reception */
+	/**
+	 * Internal buffer for UDP datagram reception.
+	 * At least TEREDO_HEADROOM bytes are always left free in front of
+	 * the IPv6 packet.
+	 */
 	union
 	{
 		uint64_t align[1];
-		uint8_t fill[TEREDO_PACKET_SIZE];
+		uint8_t fill[TEREDO_HEADROOM + TEREDO_PACKET_SIZE];
 	} buf;
 } teredo_packet;
 
+/**
+ * Contiguous packet buffer with reserved headroom, so that Teredo headers
+ * can be written in place in front of an IPv6 packet.
+ */
+typedef struct teredo_buf
+{
+	/** Start of the datagram */
+	uint8_t *data;
+	/** Datagram byte length */
+	size_t len;
+	/** Bytes available in front of the datagram */
+	size_t headroom;
+} teredo_buf;
+
+/**
+ * Initializes a packet buffer.
+ *
+ * @param b packet buffer to initialize
+ * @param data IPv6 packet
+ * @param len IPv6 packet byte length
+ * @param headroom bytes available for use immediately before @p data
+ */
+static inline void
+teredo_buf_init (teredo_buf *b, void *data, size_t len, size_t headroom)
+{
+	b->data = (uint8_t *)data;
+	b->len = len;
+	b->headroom = headroom;
+}
+
+/**
+ * Initializes a packet buffer from a received Teredo packet,
+ * so that the IPv6 packet can be forwarded with new Teredo headers.
+ */
+static inline void
+teredo_packet_buf (teredo_packet *p, teredo_buf *b)
+{
+	uint8_t *data = (uint8_t *)p->ip6;
+
+	teredo_buf_init (b, data, p->ip6_len, data - p->buf.fill);
+}
+
+/**
+ * Prepends room for a header to a packet buffer.
+ *
+ * @return a pointer to the (uninitialized) header,
+ * or NULL if there is not enough headroom left.
+ */
+static inline void *teredo_buf_push (teredo_buf *b, size_t len)
+{
+	if (len > b->headroom)
+		return NULL;
+
+	b->headroom -= len;
+	b->data -= len;
+	b->len += len;
+	return b->data;
+}
+
 struct iovec;
+struct pollfd;
 
 # ifdef __cplusplus
 extern "C" {
@@ -89,6 +160,40 @@ extern "C" {
  */
 int teredo_socket (uint32_t bind_ip, uint16_t port);
 
+/**
+ * Opens a Teredo UDP/IPv4 socket that can share its address and port with
+ * other sockets of the same user (SO_REUSEPORT). The kernel then spreads
+ * received datagrams across those sockets, by flow.
+ * Thread-safe, not cancellation-safe.
+ *
+ * @return -1 on error (including if not supported by the system).
+ */
+int teredo_socket_reuseport (uint32_t bind_ip, uint16_t port);
+
+/**
+ * Sets the socket kernel busy polling time (SO_BUSY_POLL) of a Teredo
+ * socket, to reduce receive latency at the expense of CPU time.
+ * Raising the value above the net.core.busy_read system setting requires
+ * the CAP_NET_ADMIN privilege.
+ *
+ * @param usec busy polling time in microseconds
+ * (0 keeps the system default)
+ *
+ * @return 0 on success, -1 on error (e.g. not supported by the system).
+ */
+int teredo_socket_set_busy_poll (int fd, unsigned usec);
+
+/**
+ * Sets the kernel receive and send buffer sizes of a Teredo socket.
+ * If privileged, the system limits are overridden.
+ *
+ * @param rcvbuf receive buffer byte size (0 leaves it unchanged)
+ * @param sndbuf send buffer byte size (0 leaves it unchanged)
+ *
+ * @return 0 on success, -1 on error.
+ */
+int teredo_socket_set_buffers (int fd, unsigned rcvbuf, unsigned sndbuf);
+
 /**
  * Sends an UDP/IPv4 datagram.
  * Thread-safe, cancellation safe, cancellation point.
@@ -113,6 +218,34 @@ int teredo_send (int fd, const void *data, size_t len,
 int teredo_sendv (int fd, const struct iovec *iov, size_t count,
                   uint32_t ip, uint16_t port);
 
+/**
+ * Prepends a Teredo origin indication header to a packet buffer.
+ *
+ * @param ip origin IPv4 address (network byte order, not obfuscated).
+ * @param port origin UDP port (network byte order, not obfuscated).
+ *
+ * @return 0 on success, -1 if there is not enough headroom.
+ */
+int teredo_buf_push_orig (teredo_buf *b, uint32_t ip, uint16_t port);
+
+/**
+ * Prepends a Teredo authentication header, without client identifier nor
+ * authentication value, to a packet buffer.
+ *
+ * @param nonce 8 bytes authentication nonce.
+ *
+ * @return 0 on success, -1 if there is not enough headroom.
+ */
+int teredo_buf_push_auth (teredo_buf *b, const uint8_t *nonce);
+
+/**
+ * Sends the content of a packet buffer as an UDP/IPv4 datagram.
+ * Thread-safe, cancellation safe, cancellation point.
+ *
+ * @return number of bytes sent, or -1 on error.
+ */
+int teredo_send_buf (int fd, const teredo_buf *b, uint32_t ip, uint16_t port);
+
 /**
  * Receives and parses a Teredo packet from a socket. Never blocks.
  * Thread-safe, cancellation-safe, cancellation point.
@@ -144,6 +277,59 @@ int teredo_recv (int fd, struct teredo_packet *p);
  */
 int teredo_wait_recv (int fd, struct teredo_packet *p);
 
+/** Largest number of packets received at once by teredo_recv_batch() */
+# define TEREDO_RECV_BATCH 64
+
+/**
+ * Receives and parses up to @p n Teredo packets from a socket, with a
+ * single system call if supported (recvmmsg()). Never blocks. Malformed
+ * packets are skipped.
+ * Thread-safe, cancellation-safe, cancellation point.
+ *
+ * @param p array of @p n teredo_packet receive buffers
+ *
+ * @return the number of packets received (at most TEREDO_RECV_BATCH),
+ * stored at the beginning of @p p.
+ */
+unsigned teredo_recv_batch (int fd, struct teredo_packet *p, unsigned n);
+
+/**
+ * Receives and parses a Teredo packet from a socket, spinning (polling
+ * without sleeping) up to a given time before blocking. This trades CPU
+ * time for wake-up latency.
+ * Thread-safe, cancellation-safe, cancellation point.
+ *
+ * @param usec maximum spinning time in microseconds
+ * (if 0, this is the same as teredo_wait_recv())
+ *
+ * @return 0 on success, -1 on error (see teredo_wait_recv()).
+ */
+int teredo_spin_recv (int fd, struct teredo_packet *p, unsigned usec);
+
+/**
+ * Waits for events on a set of file descriptors like poll() with an
+ * infinite timeout, but spins (polls without sleeping) up to a given time
+ * before blocking.
+ * Thread-safe, cancellation-safe, cancellation point.
+ *
+ * @param usec maximum spinning time in microseconds
+ *
+ * @return the poll() return value.
+ */
+int teredo_spin_poll (struct pollfd *ufd, unsigned n, unsigned usec);
+
+/**
+ * Parses the Teredo headers of an UDP datagram payload, that has been
+ * stored TEREDO_HEADROOM bytes into the buffer of a teredo_packet, and
+ * whose source and destination fields are already set.
+ * This is used by receive paths other than teredo_recv().
+ *
+ * @param len UDP payload byte length
+ *
+ * @return 0 on success, -1 if the packet is malformatted.
+ */
+int teredo_parse (struct teredo_packet *p, size_t len);
+
 /**
  * Computes an IPv6 layer-3 checksum.
  * The input buffers do not need to be aligned neither of even length.
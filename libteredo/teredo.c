@@ -27,6 +27,8 @@
 #endif
 
 #include <string.h> // memcpy()
+#include <stddef.h> // offsetof()
+#include <limits.h> // INT_MAX
 #include <stdbool.h>
 #include <assert.h>
 
@@ -39,11 +41,17 @@
 
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 
 #ifndef SOL_IP
 # define SOL_IP IPPROTO_IP
 #endif
+#ifndef SO_RCVBUFFORCE
+# define SO_RCVBUFFORCE SO_RCVBUF
+# define SO_SNDBUFFORCE SO_SNDBUF
+#endif
 
 #include "teredo.h"
 #include "teredo-udp.h"
@@ -64,7 +72,7 @@ const struct in6_addr teredo_cone =
 	{ { { 0xfe, 0x80, 0, 0, 0, 0, 0, 0,
 		    0x80, 0, 'T', 'E', 'R', 'E', 'D', 'O' } } };
 
-int teredo_socket (uint32_t bind_ip, uint16_t port)
+static int teredo_socket_inner (uint32_t bind_ip, uint16_t port, bool reuse)
 {
 	struct sockaddr_in myaddr =
 	{
@@ -89,6 +97,20 @@ int teredo_socket (uint32_t bind_ip, uint16_t port)
 	if (fd == -1)
 		return -1;
 
+	if (reuse)
+	{
+#ifdef SO_REUSEPORT
+		if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &(int){ 1 },
+		                sizeof (int)))
+#else
+		errno = ENOSYS;
+#endif
+		{
+			close (fd);
+			return -1;
+		}
+	}
+
 	if (bind (fd, (struct sockaddr *)&myaddr, sizeof (myaddr)))
 	{
 		close (fd);
@@ -122,6 +144,60 @@ int teredo_socket (uint32_t bind_ip, uint16_t port)
 }
 
 
+int teredo_socket (uint32_t bind_ip, uint16_t port)
+{
+	return teredo_socket_inner (bind_ip, port, false);
+}
+
+
+int teredo_socket_reuseport (uint32_t bind_ip, uint16_t port)
+{
+	return teredo_socket_inner (bind_ip, port, true);
+}
+
+
+int teredo_socket_set_busy_poll (int fd, unsigned usec)
+{
+	if (usec == 0)
+		return 0;
+#ifdef SO_BUSY_POLL
+	if (usec > INT_MAX)
+		usec = INT_MAX;
+	return setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, &(int){ usec },
+	                   sizeof (int));
+#else
+	(void)fd;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+static int teredo_socket_set_buffer (int fd, int opt, int forceopt,
+                                     unsigned size)
+{
+	if (size == 0)
+		return 0;
+	if (size > INT_MAX / 2)
+		size = INT_MAX / 2;
+
+	/* Privileged processes can exceed the system-wide maximum */
+	if ((forceopt != opt)
+	 && (setsockopt (fd, SOL_SOCKET, forceopt, &(int){ size },
+	                 sizeof (int)) == 0))
+		return 0;
+	return setsockopt (fd, SOL_SOCKET, opt, &(int){ size }, sizeof (int));
+}
+
+
+int teredo_socket_set_buffers (int fd, unsigned rcvbuf, unsigned sndbuf)
+{
+	int r1 = teredo_socket_set_buffer (fd, SO_RCVBUF, SO_RCVBUFFORCE, rcvbuf);
+	int r2 = teredo_socket_set_buffer (fd, SO_SNDBUF, SO_SNDBUFFORCE, sndbuf);
+	return (r1 || r2) ? -1 : 0;
+}
+
+
 static ssize_t
 teredo_recverr (int fd)
 {
@@ -178,48 +254,68 @@ int teredo_send (int fd, const void *packet, size_t plen,
 }
 
 
-static int teredo_recv_inner (int fd, struct teredo_packet *p, int flags)
+int teredo_send_buf (int fd, const teredo_buf *b,
+                     uint32_t dest_ip, uint16_t dest_port)
 {
-	struct sockaddr_in ad;
-#ifdef IP_PKTINFO
-	char cbuf[CMSG_SPACE (sizeof (struct in_pktinfo))];
-#elif defined(IP_RECVDSTADDR)
-	char cbuf[CMSG_SPACE (sizeof (struct in_addr))];
-#endif
-	struct iovec iov =
-	{
-		.iov_base = p->buf.fill,
-		.iov_len = TEREDO_PACKET_SIZE
-	};
-	struct msghdr msg =
-	{
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-		.msg_name = &ad,
-		.msg_namelen = sizeof (ad),
-#if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR)
-		.msg_control = cbuf,
-		.msg_controllen = sizeof (cbuf),
-#endif
-	};
+	return teredo_send (fd, b->data, b->len, dest_ip, dest_port);
+}
 
-	// Receive a UDP packet
-	ssize_t length = recvmsg (fd, &msg, flags);
-	if (length == -1)
-		teredo_recverr (fd);
-	if (length < 2) // too small or error
+
+int teredo_buf_push_orig (teredo_buf *b, uint32_t ip, uint16_t port)
+{
+	struct teredo_orig_ind orig;
+	void *hdr = teredo_buf_push (b, sizeof (orig));
+
+	if (hdr == NULL)
+		return -1;
+
+	orig.orig_zero = 0;
+	orig.orig_code = teredo_orig_ind;
+	orig.orig_port = ~port; // obfuscate
+	orig.orig_addr = ~ip; // obfuscate
+	memcpy (hdr, &orig, sizeof (orig));
+	return 0;
+}
+
+
+int teredo_buf_push_auth (teredo_buf *b, const uint8_t *nonce)
+{
+	uint8_t *hdr = teredo_buf_push (b, 13);
+
+	if (hdr == NULL)
 		return -1;
 
-	p->source_ipv4 = ad.sin_addr.s_addr;
-	p->source_port = ad.sin_port;
+	hdr[0] = 0;
+	hdr[1] = teredo_auth_hdr;
+	hdr[2] = 0; /* client identifier length */
+	hdr[3] = 0; /* authentication value length */
+	memcpy (hdr + 4, nonce, 8);
+	hdr[12] = 0; /* confirmation byte */
+	return 0;
+}
+
+
+#if defined(IP_PKTINFO)
+# define TEREDO_CMSG_SPACE CMSG_SPACE (sizeof (struct in_pktinfo))
+#elif defined(IP_RECVDSTADDR)
+# define TEREDO_CMSG_SPACE CMSG_SPACE (sizeof (struct in_addr))
+#endif
+
+/* Sets the source and destination fields of a received packet */
+static void
+teredo_recv_addr (struct teredo_packet *p, const struct sockaddr_in *ad,
+                  struct msghdr *msg)
+{
+	p->source_ipv4 = ad->sin_addr.s_addr;
+	p->source_port = ad->sin_port;
 	p->dest_ipv4 = 0;
 
 #if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR)
 	// Internal outer destination IPv4 address
 	// (mostly useful for funky multi-homed hosts)
-	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (msg);
 	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR (&msg, cmsg))
+	     cmsg = CMSG_NXTHDR (msg, cmsg))
 	{
 # ifdef IP_PKTINFO
 		if ((cmsg->cmsg_level == IPPROTO_IP)
@@ -239,9 +335,54 @@ static int teredo_recv_inner (int fd, struct teredo_packet *p, int flags)
 		}
 # endif
 	}
+#else
+	(void)msg;
+#endif
+}
+
+
+static int teredo_recv_inner (int fd, struct teredo_packet *p, int flags)
+{
+	struct sockaddr_in ad;
+#ifdef TEREDO_CMSG_SPACE
+	char cbuf[TEREDO_CMSG_SPACE];
+#endif
+	struct iovec iov =
+	{
+		.iov_base = p->buf.fill + TEREDO_HEADROOM,
+		.iov_len = TEREDO_PACKET_SIZE
+	};
+	struct msghdr msg =
+	{
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_name = &ad,
+		.msg_namelen = sizeof (ad),
+#ifdef TEREDO_CMSG_SPACE
+		.msg_control = cbuf,
+		.msg_controllen = sizeof (cbuf),
 #endif
+	};
+
+	// Receive a UDP packet
+	ssize_t length = recvmsg (fd, &msg, flags);
+	if (length == -1)
+		teredo_recverr (fd);
+	if (length < 2) // too small or error
+		return -1;
+
+	teredo_recv_addr (p, &ad, &msg);
+	return teredo_parse (p, length);
+}
+
 
-	uint8_t *ptr = p->buf.fill;
+int teredo_parse (struct teredo_packet *p, size_t len)
+{
+	uint8_t *ptr = p->buf.fill + TEREDO_HEADROOM;
+	ssize_t length = len;
+
+	if (length < 2) // too small
+		return -1;
 
 	p->auth_present = false;
 	p->orig_ipv4 = 0;
@@ -276,10 +417,9 @@ static int teredo_recv_inner (int fd, struct teredo_packet *p, int flags)
 		ptr++;
 
 		/* Restore 64-bits alignment of IPv6 and ICMPv6 headers */
-		/* Per ISO/IEC 9899:TC2 §6.5.8.8: All pointers to members of the same
-		 * union object compare equal. */
-		memmove (p->buf.align, ptr, length);
-		ptr = p->buf.fill;
+		/* The union is 64-bits aligned, and so is the headroom size. */
+		memmove (p->buf.fill + TEREDO_HEADROOM, ptr, length);
+		ptr = p->buf.fill + TEREDO_HEADROOM;
 	}
 
 	// Teredo Origin Indication
@@ -323,6 +463,122 @@ int teredo_wait_recv (int fd, struct teredo_packet *p)
 }
 
 
+#ifdef HAVE_RECVMMSG
+/* Moves a parsed packet to another receive buffer */
+static void
+teredo_packet_move (struct teredo_packet *dst, const struct teredo_packet *src)
+{
+	size_t off = (const uint8_t *)src->ip6 - src->buf.fill;
+
+	memcpy (dst, src, offsetof (struct teredo_packet, buf));
+	memcpy (dst->buf.fill + off, src->ip6, src->ip6_len);
+	dst->ip6 = (struct ip6_hdr *)(dst->buf.fill + off);
+}
+#endif
+
+
+unsigned teredo_recv_batch (int fd, struct teredo_packet *p, unsigned n)
+{
+#ifdef HAVE_RECVMMSG
+	if (n > TEREDO_RECV_BATCH)
+		n = TEREDO_RECV_BATCH;
+
+	struct mmsghdr msgs[n];
+	struct iovec iov[n];
+	struct sockaddr_in ad[n];
+# ifdef TEREDO_CMSG_SPACE
+	char cbuf[n][TEREDO_CMSG_SPACE];
+# endif
+
+	memset (msgs, 0, sizeof (msgs));
+	for (unsigned i = 0; i < n; i++)
+	{
+		iov[i].iov_base = p[i].buf.fill + TEREDO_HEADROOM;
+		iov[i].iov_len = TEREDO_PACKET_SIZE;
+		msgs[i].msg_hdr.msg_iov = iov + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = ad + i;
+		msgs[i].msg_hdr.msg_namelen = sizeof (ad[i]);
+# ifdef TEREDO_CMSG_SPACE
+		msgs[i].msg_hdr.msg_control = cbuf[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof (cbuf[i]);
+# endif
+	}
+
+	int val = recvmmsg (fd, msgs, n, MSG_DONTWAIT, NULL);
+	if (val <= 0)
+	{
+		if (val == -1)
+			teredo_recverr (fd);
+		return 0;
+	}
+
+	/* Malformed packets are skipped, the others are kept contiguous */
+	unsigned count = 0;
+	for (int i = 0; i < val; i++)
+	{
+		teredo_recv_addr (p + i, ad + i, &msgs[i].msg_hdr);
+		if (teredo_parse (p + i, msgs[i].msg_len))
+			continue;
+
+		if (count != (unsigned)i)
+			teredo_packet_move (p + count, p + i);
+		count++;
+	}
+	return count;
+#else
+	unsigned i = 0;
+
+	while ((i < n) && (teredo_recv (fd, p + i) == 0))
+		i++;
+	return i;
+#endif
+}
+
+
+int teredo_spin_poll (struct pollfd *ufd, unsigned n, unsigned usec)
+{
+	struct timespec deadline;
+
+	if ((usec > 0) && (clock_gettime (CLOCK_MONOTONIC, &deadline) == 0))
+	{
+		deadline.tv_sec += usec / 1000000;
+		deadline.tv_nsec += (usec % 1000000) * 1000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		struct timespec now;
+		do
+		{
+			int val = poll (ufd, n, 0);
+			if (val)
+				return val;
+			clock_gettime (CLOCK_MONOTONIC, &now);
+		}
+		while ((now.tv_sec < deadline.tv_sec)
+		    || ((now.tv_sec == deadline.tv_sec)
+		     && (now.tv_nsec < deadline.tv_nsec)));
+	}
+
+	return poll (ufd, n, -1);
+}
+
+
+int teredo_spin_recv (int fd, struct teredo_packet *p, unsigned usec)
+{
+	if (usec == 0)
+		return teredo_recv_inner (fd, p, 0);
+
+	struct pollfd ufd = { .fd = fd, .events = POLLIN };
+	if (teredo_spin_poll (&ufd, 1, usec) <= 0)
+		return -1;
+	return teredo_recv_inner (fd, p, MSG_DONTWAIT);
+}
+
+
 /* This does not fit anywhere and is needed by both relay and server */
 #include <stdbool.h>
 
@@ -0,0 +1,396 @@
+/*
+ * benchlist.c - Libteredo peer list benchmark
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Runs a mixed workload of lookups and insertions from several threads
+ * against the peer list, with Zipf-distributed destinations, while peers
+ * expire. Reports throughput and latency percentiles, and the longest
+ * time the list lock was held. As the list is unbounded, a quota makes
+ * the admission sketches as large as they get.
+ * Without arguments, a short run suitable for "make check" is done.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+
+#include <inttypes.h> /* for Mac OS X */
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "teredo.h"
+#include "clock.h"
+#include "peerlist.h"
+
+typedef struct bench_params
+{
+	unsigned peers; /* number of distinct destinations */
+	unsigned threads;
+	unsigned ops; /* per thread */
+	unsigned create_pct; /* percentage of lookups that may insert */
+	unsigned expiration;
+	unsigned quota; /* per-IPv4 peers quota, 0 if none */
+	double zipf; /* exponent, 0 for uniform */
+} bench_params;
+
+typedef struct bench_thread
+{
+	pthread_t th;
+	teredo_peerlist *list;
+	const bench_params *params;
+	uint64_t seed;
+	uint32_t *lat; /* nanoseconds, one per operation */
+	unsigned misses;
+} bench_thread;
+
+
+/*** Pseudo-random numbers ***/
+static inline uint64_t xorshift (uint64_t *s)
+{
+	uint64_t x = *s;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*s = x;
+	return x * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+static inline double uniform (uint64_t *s)
+{
+	return (xorshift (s) >> 11) * (1. / (UINT64_C(1) << 53));
+}
+
+
+/*
+ * Zipf distribution sampling by rejection-inversion, in constant time and
+ * memory whatever the number of elements (W. Hörmann, G. Derflinger).
+ */
+typedef struct zipf
+{
+	unsigned n;
+	double s, h_x1, h_n, sc;
+} zipf_t;
+
+static double helper1 (double x)
+{
+	return (fabs (x) > 1e-8) ? log1p (x) / x : 1. - x / 2. + x * x / 3.;
+}
+
+static double helper2 (double x)
+{
+	return (fabs (x) > 1e-8) ? expm1 (x) / x : 1. + x / 2. + x * x / 6.;
+}
+
+static double zipf_h (const zipf_t *z, double x)
+{
+	return exp (-z->s * log (x));
+}
+
+static double zipf_H (const zipf_t *z, double x)
+{
+	double lx = log (x);
+	return helper2 ((1. - z->s) * lx) * lx;
+}
+
+static double zipf_Hinv (const zipf_t *z, double x)
+{
+	double t = x * (1. - z->s);
+	if (t < -1.)
+		t = -1.;
+	return exp (helper1 (t) * x);
+}
+
+static void zipf_init (zipf_t *z, unsigned n, double s)
+{
+	z->n = n;
+	z->s = s;
+	z->h_x1 = zipf_H (z, 1.5) - 1.;
+	z->h_n = zipf_H (z, n + .5);
+	z->sc = 2. - zipf_Hinv (z, zipf_H (z, 2.5) - zipf_h (z, 2.));
+}
+
+/* @return a rank between 0 (most frequent) and n - 1 */
+static unsigned zipf_sample (const zipf_t *z, uint64_t *seed)
+{
+	if (z->s == 0.)
+		return xorshift (seed) % z->n;
+
+	for (;;)
+	{
+		double u = z->h_n + uniform (seed) * (z->h_x1 - z->h_n);
+		double x = zipf_Hinv (z, u);
+		double k = floor (x + .5);
+
+		if (k < 1.)
+			k = 1.;
+		else
+		if (k > z->n)
+			k = z->n;
+
+		if ((k - x <= z->sc) || (u >= zipf_H (z, k + .5) - zipf_h (z, k)))
+			return (unsigned)k - 1;
+	}
+}
+
+
+/* Maps a rank to a Teredo address, scattering consecutive ranks */
+static void make_address (struct in6_addr *addr, unsigned rank)
+{
+	uint64_t v = (rank + 1) * UINT64_C(0x9E3779B97F4A7C15);
+
+	v ^= v >> 29;
+	memcpy (addr->s6_addr, "\x20\x01\x00\x00\xc0\x00\x02\x01", 8);
+	memcpy (addr->s6_addr + 8, &v, 8);
+}
+
+
+static zipf_t dist;
+
+static void *bench_thread_run (void *data)
+{
+	bench_thread *t = data;
+	const bench_params *p = t->params;
+	struct in6_addr addr;
+
+	for (unsigned i = 0; i < p->ops; i++)
+	{
+		unsigned rank = zipf_sample (&dist, &t->seed);
+		bool create, may_create = (xorshift (&t->seed) % 100) < p->create_pct;
+		struct timespec a, b;
+
+		make_address (&addr, rank);
+
+		clock_gettime (CLOCK_MONOTONIC, &a);
+		teredo_peer *peer = teredo_list_lookup (t->list, &addr,
+		                                        may_create ? &create : NULL);
+		if (peer != NULL)
+		{
+			peer->last_rx = a.tv_sec;
+			teredo_list_release (t->list);
+		}
+		clock_gettime (CLOCK_MONOTONIC, &b);
+
+		if (peer == NULL)
+			t->misses++;
+		t->lat[i] = (b.tv_sec - a.tv_sec) * 1000000000 + b.tv_nsec - a.tv_nsec;
+	}
+	return NULL;
+}
+
+
+static int cmp_u32 (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+
+static int bench_run (const bench_params *p)
+{
+	teredo_peerlist *l = teredo_list_create (UINT_MAX, p->expiration);
+	bench_thread *threads = calloc (p->threads, sizeof (*threads));
+	uint32_t *lat = malloc ((size_t)p->threads * p->ops * sizeof (*lat));
+
+	if ((l == NULL) || (threads == NULL) || (lat == NULL)
+	 || teredo_list_set_quotas (l, p->quota, 0))
+	{
+		perror ("Error");
+		exit (1);
+	}
+
+	zipf_init (&dist, p->peers, p->zipf);
+
+	/* Prefills the list */
+	for (unsigned i = 0; i < p->peers; i++)
+	{
+		struct in6_addr addr;
+		bool create;
+
+		make_address (&addr, i);
+		if (teredo_list_lookup (l, &addr, &create) == NULL)
+		{
+			if (p->quota)
+				continue; /* over quota */
+			return -1;
+		}
+		teredo_list_release (l);
+	}
+	teredo_list_max_hold (l, true);
+
+	struct timespec start, end;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	for (unsigned i = 0; i < p->threads; i++)
+	{
+		threads[i].list = l;
+		threads[i].params = p;
+		threads[i].seed = UINT64_C(0x853C49E6748FEA9B) * (i + 1);
+		threads[i].lat = lat + (size_t)i * p->ops;
+		if (pthread_create (&threads[i].th, NULL, bench_thread_run,
+		                    threads + i))
+			return -1;
+	}
+
+	unsigned misses = 0;
+	for (unsigned i = 0; i < p->threads; i++)
+	{
+		pthread_join (threads[i].th, NULL);
+		misses += threads[i].misses;
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec)
+	            + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	size_t total = (size_t)p->threads * p->ops;
+
+	qsort (lat, total, sizeof (*lat), cmp_u32);
+	printf ("%9u %3u %6.2f %3u%% %11.0f %7"PRIu32" %7"PRIu32" %7"PRIu32
+	        " %7"PRIu32" %9"PRIu32" %9lu %6.2f%%\n",
+	        p->peers, p->threads, p->zipf, p->create_pct, total / secs,
+	        lat[total / 2], lat[total * 9 / 10], lat[total * 99 / 100],
+	        lat[total * 999 / 1000], lat[total - 1],
+	        teredo_list_max_hold (l, false), 100. * misses / total);
+
+	teredo_list_destroy (l);
+	free (lat);
+	free (threads);
+	return 0;
+}
+
+
+static void usage (const char *path)
+{
+	printf (
+"Usage: %s [OPTIONS] [PEERS...]\n"
+"Benchmarks the peer list with a multi-threaded workload.\n"
+"\n"
+"  -c, --create=PCT     percentage of lookups allowed to insert (def. 10)\n"
+"  -e, --expiration=SEC peers expiration delay (default: 1)\n"
+"  -h, --help           display this help and exit\n"
+"  -o, --ops=N          operations per thread (default: 1000000)\n"
+"  -q, --quota=N        per-IPv4 peers quota, 0 for none (default: 0)\n"
+"  -t, --threads=N      number of threads (default: 4)\n"
+"  -z, --zipf=S         Zipf exponent of destinations, 0 for uniform\n"
+"                       (default: 1.0)\n"
+"\n"
+"PEERS are list sizes (default: 1000 10000 100000 1000000 10000000).\n",
+	        path);
+}
+
+
+int main (int argc, char *argv[])
+{
+	static const struct option opts[] =
+	{
+		{ "create",     required_argument, NULL, 'c' },
+		{ "expiration", required_argument, NULL, 'e' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "ops",        required_argument, NULL, 'o' },
+		{ "quota",      required_argument, NULL, 'q' },
+		{ "threads",    required_argument, NULL, 't' },
+		{ "zipf",       required_argument, NULL, 'z' },
+		{ NULL,         no_argument,       NULL, '\0'}
+	};
+	static const unsigned default_sizes[] =
+		{ 1000, 10000, 100000, 1000000, 10000000 };
+
+	bench_params p =
+	{
+		.threads = 4, .ops = 1000000, .create_pct = 10,
+		.expiration = 1, .zipf = 1.
+	};
+	bool quick = (argc <= 1);
+	int c;
+
+	while ((c = getopt_long (argc, argv, "c:e:ho:q:t:z:", opts, NULL)) != -1)
+		switch (c)
+		{
+			case 'c':
+				p.create_pct = strtoul (optarg, NULL, 10);
+				break;
+			case 'e':
+				p.expiration = strtoul (optarg, NULL, 10);
+				break;
+			case 'h':
+				usage (argv[0]);
+				return 0;
+			case 'o':
+				p.ops = strtoul (optarg, NULL, 10);
+				break;
+			case 'q':
+				p.quota = strtoul (optarg, NULL, 10);
+				break;
+			case 't':
+				p.threads = strtoul (optarg, NULL, 10);
+				break;
+			case 'z':
+				p.zipf = strtod (optarg, NULL);
+				break;
+			default:
+				usage (argv[0]);
+				return 2;
+		}
+
+	if ((p.threads == 0) || (p.ops == 0) || (p.expiration == 0)
+	 || (p.create_pct > 100) || (p.zipf < 0.))
+	{
+		usage (argv[0]);
+		return 2;
+	}
+
+	if (quick)
+		p.ops = 50000;
+
+	teredo_clock_init ();
+	puts ("    peers thr   zipf  ins       ops/s  p50/ns  p90/ns  p99/ns"
+	      " p999/ns    max/ns  hold/ns   miss");
+
+	if (optind < argc)
+		for (int i = optind; i < argc; i++)
+		{
+			p.peers = strtoul (argv[i], NULL, 10);
+			if ((p.peers == 0) || bench_run (&p))
+				return 1;
+		}
+	else
+		for (unsigned i = 0; i < sizeof (default_sizes)
+		                         / sizeof (default_sizes[0]); i++)
+		{
+			p.peers = default_sizes[i];
+			if (quick && (p.peers > 100000))
+				break;
+			if (bench_run (&p))
+				return 1;
+		}
+
+	return 0;
+}
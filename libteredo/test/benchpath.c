@@ -0,0 +1,425 @@
+/*
+ * benchpath.c - Libteredo packet processing benchmark
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Feeds pre-generated packets through the relay and client decision logic
+ * (teredo_transmit() and the receive processing) and reports the time spent
+ * per packet in each branch, and the number of UDP/IPv4 datagrams it sends.
+ * No network traffic is generated: the tunnel socket is replaced with an
+ * in-memory I/O backend that only counts sent datagrams.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <inttypes.h> /* for Mac OS X */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <getopt.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "tunnel.h"
+#include "relay.h"
+#include "io.h"
+#include "maintain.h"
+#include "security.h"
+#include "tools.h"
+
+#define PAYLOAD_SIZE 64
+#define BATCH 8
+
+typedef struct bench_pkt
+{
+	uint32_t ipv4;
+	uint16_t port;
+	struct
+	{
+		struct ip6_hdr ip6;
+		uint8_t payload[PAYLOAD_SIZE];
+	} data;
+} bench_pkt;
+
+static unsigned long delivered;
+static teredo_packet *batch;
+static teredo_io *bench_io;
+static unsigned long bench_sent; /* datagrams sent by the last benchmark */
+
+
+static void recv_cb (void *opaque, const void *data, size_t len)
+{
+	(void)opaque;
+	(void)data;
+	(void)len;
+	delivered++;
+}
+
+
+static void icmpv6_cb (void *opaque, const void *data, size_t len,
+                       const struct in6_addr *dst)
+{
+	(void)opaque;
+	(void)data;
+	(void)len;
+	(void)dst;
+}
+
+
+/* Peer mapping: 198.18.x.y (a benchmarking range) */
+static void peer_mapping (unsigned i, uint32_t *ipv4, uint16_t *port)
+{
+	*ipv4 = htonl (0xc6120000 | (i >> 4));
+	*port = htons (1024 + (i & 15));
+}
+
+
+static void teredo_address (union teredo_addr *addr, uint32_t ipv4,
+                            uint16_t port)
+{
+	addr->teredo.prefix = htonl (TEREDO_PREFIX);
+	addr->teredo.server_ip = htonl (0xc0000201); /* 192.0.2.1 */
+	addr->teredo.flags = 0;
+	addr->teredo.client_port = ~port;
+	addr->teredo.client_ip = ~ipv4;
+}
+
+
+static void native_address (struct in6_addr *addr, unsigned i)
+{
+	memcpy (addr->s6_addr, "\x20\x01\x0d\xb8\x00\x00\x00\x00"
+	        "\x00\x00\x00\x00", 12);
+	i = htonl (i + 1);
+	memcpy (addr->s6_addr + 12, &i, 4);
+}
+
+
+static void make_packet (bench_pkt *p, const struct in6_addr *src,
+                         const struct in6_addr *dst, uint8_t proto,
+                         size_t plen)
+{
+	memset (&p->data, 0, sizeof (p->data));
+	p->data.ip6.ip6_flow = htonl (0x60000000);
+	p->data.ip6.ip6_plen = htons (plen);
+	p->data.ip6.ip6_nxt = proto;
+	p->data.ip6.ip6_hlim = 64;
+	p->data.ip6.ip6_src = *src;
+	p->data.ip6.ip6_dst = *dst;
+}
+
+
+/* Packets from (or to) Teredo peers */
+static void make_teredo_packets (bench_pkt *pkts, unsigned n, unsigned first,
+                                 bool bubble, bool inbound)
+{
+	struct in6_addr native;
+
+	native_address (&native, 0);
+	for (unsigned i = 0; i < n; i++)
+	{
+		union teredo_addr peer;
+
+		peer_mapping (first + i, &pkts[i].ipv4, &pkts[i].port);
+		teredo_address (&peer, pkts[i].ipv4, pkts[i].port);
+		if (inbound)
+			make_packet (pkts + i, &peer.ip6, &native,
+			             bubble ? IPPROTO_NONE : IPPROTO_UDP,
+			             bubble ? 0 : PAYLOAD_SIZE);
+		else
+			make_packet (pkts + i, &native, &peer.ip6, IPPROTO_UDP,
+			             PAYLOAD_SIZE);
+	}
+}
+
+
+static double bench_rx (teredo_tunnel *t, const bench_pkt *pkts,
+                        unsigned n, unsigned long count)
+{
+	unsigned long sent = teredo_io_loopback_sent (bench_io);
+	uint64_t start = tool_now_ns ();
+
+	for (unsigned long i = 0; i < count;)
+	{
+		unsigned j;
+
+		for (j = 0; (j < BATCH) && (i < count); j++, i++)
+		{
+			const bench_pkt *p = pkts + (i % n);
+			teredo_packet *b = batch + j;
+
+			b->ip6 = (struct ip6_hdr *)&p->data.ip6;
+			b->ip6_len = sizeof (p->data.ip6) + ntohs (p->data.ip6.ip6_plen);
+			b->source_ipv4 = p->ipv4;
+			b->source_port = p->port;
+			b->orig_ipv4 = 0;
+			b->orig_port = 0;
+			b->dest_ipv4 = htonl (0xc0000202);
+			b->auth_present = false;
+		}
+		teredo_recv_packets (t, batch, j);
+	}
+
+	double ns = (double)(tool_now_ns () - start) / count;
+	bench_sent = teredo_io_loopback_sent (bench_io) - sent;
+	return ns;
+}
+
+
+static double bench_tx (teredo_tunnel *t, const bench_pkt *pkts,
+                        unsigned n, unsigned long count)
+{
+	unsigned long sent = teredo_io_loopback_sent (bench_io);
+	uint64_t start = tool_now_ns ();
+
+	for (unsigned long i = 0; i < count; i++)
+	{
+		const bench_pkt *p = pkts + (i % n);
+
+		teredo_transmit (t, &p->data.ip6,
+		                 sizeof (p->data.ip6) + ntohs (p->data.ip6.ip6_plen));
+	}
+
+	double ns = (double)(tool_now_ns () - start) / count;
+	bench_sent = teredo_io_loopback_sent (bench_io) - sent;
+	return ns;
+}
+
+
+static void report (const char *name, unsigned long count, double ns)
+{
+	printf ("%-28s %10lu %10.1f %8.3f %8.3f\n", name, count, ns, 1000. / ns,
+	        (double)bench_sent / count);
+}
+
+
+static teredo_tunnel *bench_create (void)
+{
+	teredo_tunnel *t = teredo_create (htonl (INADDR_LOOPBACK), 0);
+	if (t == NULL)
+		return NULL;
+
+	/* Replaces the UDP socket so that nothing ever gets sent */
+	bench_io = teredo_io_loopback (htonl (0xc0000202), htons (IPPORT_TEREDO));
+	if (bench_io == NULL)
+	{
+		teredo_destroy (t);
+		return NULL;
+	}
+	teredo_set_io (t, bench_io);
+	teredo_set_recv_callback (t, recv_cb);
+	teredo_set_icmpv6_callback (t, icmpv6_cb);
+	return t;
+}
+
+
+static int bench_relay (unsigned peers, unsigned long count)
+{
+	teredo_tunnel *t = bench_create ();
+	bench_pkt *out = calloc (peers, sizeof (*out));
+	bench_pkt *in = calloc (peers, sizeof (*in));
+	bench_pkt *bubbles = calloc (peers, sizeof (*bubbles));
+	bench_pkt *unknown = calloc (peers, sizeof (*unknown));
+	int ret = -1;
+
+	if ((t == NULL) || (out == NULL) || (in == NULL) || (bubbles == NULL)
+	 || (unknown == NULL) || teredo_set_relay_mode (t)
+	 || teredo_set_max_peers (t, 2 * peers, false))
+		goto out;
+
+	make_teredo_packets (out, peers, 0, false, false);
+	make_teredo_packets (in, peers, 0, false, true);
+	make_teredo_packets (bubbles, peers, 0, true, true);
+	make_teredo_packets (unknown, peers, peers, false, true);
+
+	report ("relay tx new peer (bubble)", peers,
+	        bench_tx (t, out, peers, peers));
+	report ("relay tx untrusted (queue)", count,
+	        bench_tx (t, out, peers, count));
+	report ("relay rx hole punching", peers,
+	        bench_rx (t, bubbles, peers, peers));
+
+	delivered = 0;
+	report ("relay rx trusted", count, bench_rx (t, in, peers, count));
+	if (delivered != count)
+	{
+		fprintf (stderr, "Only %lu of %lu packets delivered\n", delivered,
+		         count);
+		goto out;
+	}
+
+	report ("relay tx trusted", count, bench_tx (t, out, peers, count));
+
+	delivered = 0;
+	report ("relay rx unknown (drop)", count,
+	        bench_rx (t, unknown, peers, count));
+	if (delivered != 0)
+	{
+		fprintf (stderr, "%lu packets from unknown peers delivered\n",
+		         delivered);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	free (unknown);
+	free (bubbles);
+	free (in);
+	free (out);
+	if (t != NULL)
+		teredo_destroy (t);
+	return ret;
+}
+
+
+#ifdef MIREDO_TEREDO_CLIENT
+static int bench_client (unsigned peers, unsigned long count)
+{
+	teredo_tunnel *t = bench_create ();
+	bench_pkt *out = calloc (peers, sizeof (*out));
+	bench_pkt *replies = calloc (peers, sizeof (*replies));
+	int ret = -1;
+
+	if ((t == NULL) || (out == NULL) || (replies == NULL)
+	 || teredo_set_client_mode (t, "192.0.2.1", NULL)
+	 || teredo_set_max_peers (t, 2 * peers, false))
+		goto out;
+
+	teredo_state state;
+
+	memset (&state, 0, sizeof (state));
+	state.ipv4 = htonl (0xc0a80002);
+	state.mtu = 1280;
+	state.up = true;
+	teredo_address (&state.addr, htonl (0xcb007102), htons (40000));
+	teredo_set_state (t, &state);
+
+	for (unsigned i = 0; i < peers; i++)
+	{
+		struct in6_addr native;
+		struct icmp6_hdr *icmp6;
+
+		native_address (&native, i);
+		make_packet (out + i, &state.addr.ip6, &native, IPPROTO_UDP,
+		             PAYLOAD_SIZE);
+
+		/* Echo reply, through a relay, to the ping that SendPing() sends */
+		make_packet (replies + i, &native, &state.addr.ip6, IPPROTO_ICMPV6,
+		             sizeof (*icmp6) + LIBTEREDO_HMAC_LEN - 4);
+		replies[i].ipv4 = htonl (0xcb007101);
+		replies[i].port = htons (IPPORT_TEREDO + 1);
+		icmp6 = (struct icmp6_hdr *)replies[i].data.payload;
+		icmp6->icmp6_type = ICMP6_ECHO_REPLY;
+		teredo_get_pinghash ((uint32_t)time (NULL), &state.addr.ip6, &native,
+		                     (uint8_t *)&icmp6->icmp6_id);
+	}
+
+	report ("client tx new native (ping)", peers,
+	        bench_tx (t, out, peers, peers));
+	report ("client tx untrusted (queue)", count,
+	        bench_tx (t, out, peers, count));
+	report ("client rx ping reply", peers,
+	        bench_rx (t, replies, peers, peers));
+	report ("client tx trusted", count, bench_tx (t, out, peers, count));
+	ret = 0;
+
+out:
+	free (replies);
+	free (out);
+	if (t != NULL)
+		teredo_destroy (t);
+	return ret;
+}
+#endif
+
+
+static void usage (const char *path)
+{
+	printf (
+"Usage: %s [OPTIONS]\n"
+"Benchmarks the Teredo packets processing logic, without I/O.\n"
+"\n"
+"  -h, --help       display this help and exit\n"
+"  -n, --packets=N  packets per benchmark (default: 200000)\n"
+"  -p, --peers=N    number of distinct peers (default: 1000)\n",
+	        path);
+}
+
+
+int main (int argc, char *argv[])
+{
+	static const struct option opts[] =
+	{
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "packets",    required_argument, NULL, 'n' },
+		{ "peers",      required_argument, NULL, 'p' },
+		{ NULL,         no_argument,       NULL, '\0'}
+	};
+	unsigned long count = 200000, peers = 1000;
+	int c;
+
+	while ((c = getopt_long (argc, argv, "hn:p:", opts, NULL)) != -1)
+		switch (c)
+		{
+			case 'h':
+				usage (argv[0]);
+				return 0;
+			case 'n':
+				count = strtoul (optarg, NULL, 10);
+				break;
+			case 'p':
+				peers = strtoul (optarg, NULL, 10);
+				break;
+			default:
+				usage (argv[0]);
+				return 2;
+		}
+
+	/* Peer mappings must remain global unicast IPv4 addresses */
+	if ((count == 0) || (peers == 0) || (peers > 0x80000))
+	{
+		usage (argv[0]);
+		return 2;
+	}
+
+	batch = malloc (BATCH * sizeof (*batch));
+	if (batch == NULL)
+		return 1;
+
+	puts ("branch                          packets  ns/packet     Mpps"
+	      "  UDP/pkt");
+	if (bench_relay (peers, count))
+		return 1;
+#ifdef MIREDO_TEREDO_CLIENT
+	if (bench_client (peers, count))
+		return 1;
+#endif
+	free (batch);
+	return 0;
+}
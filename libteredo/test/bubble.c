@@ -0,0 +1,129 @@
+/*
+ * bubble.c - Teredo bubbles authentication tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "security.h"
+#include "packets.h"
+#include "clock.h"
+
+#define COUNT 11
+
+int main (void)
+{
+	static struct ip6_hdr ip6[COUNT];
+	static teredo_packet packets[COUNT];
+
+	teredo_clock_init ();
+	assert (teredo_init_HMAC () == 0);
+
+	for (unsigned i = 0; i < COUNT; i++)
+	{
+		union teredo_addr *src = (union teredo_addr *)&ip6[i].ip6_src;
+
+		ip6[i].ip6_flow = htonl (0x60000000);
+		ip6[i].ip6_plen = 0;
+		ip6[i].ip6_nxt = IPPROTO_NONE;
+		src->teredo.prefix = htonl (TEREDO_PREFIX);
+		src->teredo.server_ip = htonl (0xC0000201);
+		src->teredo.client_ip = ~htonl (0xC6336401 + i);
+		src->teredo.client_port = ~htons (1024 + i);
+
+		/* Same link-local source as SendBubbleFromDst() would use */
+		GetBubbleSource (IN6_TEREDO_IPV4 (&ip6[i].ip6_src),
+		                 IN6_TEREDO_PORT (&ip6[i].ip6_src),
+		                 &ip6[i].ip6_dst);
+
+		packets[i].ip6 = &ip6[i];
+		packets[i].ip6_len = sizeof (ip6[i]);
+	}
+
+	/* Forged nonce, not a bubble, truncated packet */
+	ip6[2].ip6_dst.s6_addr[15] ^= 1;
+	ip6[5].ip6_plen = htons (8);
+	packets[9].ip6_len = 20;
+
+	const uint32_t expected = ((1 << COUNT) - 1) & ~((1 << 2) | (1 << 5)
+	                                                 | (1 << 9));
+	assert (CheckBubbles (packets, COUNT, UINT32_MAX) == expected);
+	assert (CheckBubbles (packets, 0, UINT32_MAX) == 0);
+
+	for (unsigned n = 1; n <= COUNT; n++)
+		assert (CheckBubbles (packets, n, UINT32_MAX)
+		        == (expected & ((1 << n) - 1)));
+
+	/* Only the selected packets are checked */
+	assert (CheckBubbles (packets, COUNT, 0) == 0);
+	for (uint32_t which = 1; which < (1 << COUNT); which = which * 3 + 1)
+		assert (CheckBubbles (packets, COUNT, which) == (expected & which));
+
+	for (unsigned i = 0; i < COUNT; i++)
+		if ((i != 5) && (i != 9))
+			assert ((CheckBubble (packets + i) == 0)
+			        == !!(expected & (1 << i)));
+
+	/* Cached nonces must match freshly computed ones */
+	for (unsigned i = 0; i < COUNT; i++)
+	{
+		struct in6_addr src;
+
+		GetBubbleSource (IN6_TEREDO_IPV4 (&ip6[i].ip6_src),
+		                 IN6_TEREDO_PORT (&ip6[i].ip6_src), &src);
+		if (i != 2)
+			assert (memcmp (&src, &ip6[i].ip6_dst, sizeof (src)) == 0);
+	}
+
+	/* Nonces from the previous epoch are accepted, older ones are not */
+	for (int age = 1; age <= 2; age++)
+	{
+		const uint32_t epoch = teredo_clock () / TEREDO_BUBBLE_EPOCH;
+
+		for (unsigned i = 0; i < COUNT; i++)
+		{
+			teredo_get_nonce (epoch - age, IN6_TEREDO_IPV4 (&ip6[i].ip6_src),
+			                  IN6_TEREDO_PORT (&ip6[i].ip6_src),
+			                  ip6[i].ip6_dst.s6_addr + 8);
+			ip6[i].ip6_dst.s6_addr[8] &= 0xfc;
+		}
+
+		uint32_t mask = CheckBubbles (packets, COUNT, UINT32_MAX);
+		if (epoch != teredo_clock () / TEREDO_BUBBLE_EPOCH)
+			continue; /* epoch changed while testing */
+		assert (mask == ((age == 1) ? (expected | (1 << 2)) : 0));
+	}
+
+	teredo_deinit_HMAC ();
+	return 0;
+}
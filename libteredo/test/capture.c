@@ -0,0 +1,141 @@
+/*
+ * capture.c - Libteredo packet capture tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h> // mkdir()
+#include <netinet/in.h>
+
+#include "teredo.h"
+#include "tunnel.h"
+#include "capture.h"
+
+static uint8_t pkt[3000];
+
+/* Reads a pcap file, returns the number of records */
+static unsigned check_file (const char *path, size_t *total)
+{
+	FILE *f = fopen (path, "rb");
+	uint32_t hdr[6], rec[4];
+	unsigned n = 0;
+
+	assert (f != NULL);
+	assert (fread (hdr, sizeof (hdr), 1, f) == 1);
+	assert (hdr[0] == 0xa1b2c3d4);
+	assert (hdr[4] == TEREDO_CAPTURE_SNAPLEN);
+	assert (hdr[5] == 101); /* raw IP */
+
+	*total = 0;
+	while (fread (rec, sizeof (rec), 1, f) == 1)
+	{
+		uint8_t buf[TEREDO_CAPTURE_SNAPLEN];
+
+		assert (rec[2] <= TEREDO_CAPTURE_SNAPLEN);
+		assert (rec[2] <= rec[3]);
+		assert (fread (buf, rec[2], 1, f) == 1);
+		assert (memcmp (buf, pkt, rec[2]) == 0);
+		*total += rec[3];
+		n++;
+	}
+	fclose (f);
+	return n;
+}
+
+
+int main (void)
+{
+	char path[64], old[68];
+	size_t total;
+
+	for (unsigned i = 0; i < sizeof (pkt); i++)
+		pkt[i] = i * 7;
+	pkt[0] = 0x60;
+
+	snprintf (path, sizeof (path), "capture-test-%u.pcap",
+	          (unsigned)getpid ());
+	snprintf (old, sizeof (old), "%s.1", path);
+
+	/* One packet out of two, truncated to the snapshot length */
+	teredo_capture *c = teredo_capture_open (path, 2, 0);
+	assert (c != NULL);
+	for (unsigned i = 0; i < 10; i++)
+		teredo_capture_packet (c, pkt, 40 + i);
+	teredo_capture_packet (c, pkt, sizeof (pkt));
+	assert (teredo_capture_dropped (c) == 0);
+	teredo_capture_close (c);
+
+	assert (check_file (path, &total) == 6);
+	assert (total == 40 + 42 + 44 + 46 + 48 + sizeof (pkt));
+	assert (access (old, F_OK) == -1);
+
+	/* File rotation */
+	c = teredo_capture_open (path, 1, 100000);
+	assert (c != NULL);
+	for (unsigned i = 0; i < 40; i++)
+		teredo_capture_packet (c, pkt, TEREDO_CAPTURE_SNAPLEN);
+
+	/* Let the writer thread flush the first batch */
+	struct timespec ts = { 1, 500000000 };
+	nanosleep (&ts, NULL);
+
+	for (unsigned i = 0; i < 30; i++)
+		teredo_capture_packet (c, pkt, TEREDO_CAPTURE_SNAPLEN);
+	assert (teredo_capture_dropped (c) == 0);
+	teredo_capture_close (c);
+
+	assert (check_file (old, &total) == 40);
+	assert (check_file (path, &total) == 30);
+	unlink (old);
+
+	/* Rotation fails (rename() onto a non-empty directory): truncation */
+	char busy[80];
+	snprintf (busy, sizeof (busy), "%s/busy", old);
+	assert (mkdir (old, 0700) == 0);
+	assert (mkdir (busy, 0700) == 0);
+
+	c = teredo_capture_open (path, 1, 100000);
+	assert (c != NULL);
+	for (unsigned i = 0; i < 40; i++)
+		teredo_capture_packet (c, pkt, TEREDO_CAPTURE_SNAPLEN);
+	nanosleep (&ts, NULL);
+	for (unsigned i = 0; i < 30; i++)
+		teredo_capture_packet (c, pkt, TEREDO_CAPTURE_SNAPLEN);
+	assert (teredo_capture_dropped (c) == 0);
+	teredo_capture_close (c);
+
+	assert (check_file (path, &total) == 30);
+	rmdir (busy);
+	rmdir (old);
+	unlink (path);
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * io.c - Libteredo I/O backends tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "packets.h"
+#include "io.h"
+
+static const struct in6_addr src =
+	{ { { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 } } };
+static const struct in6_addr dst =
+	{ { { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2 } } };
+
+static void test_loopback (void)
+{
+	const uint32_t ip_a = htonl (0xc0000201), ip_b = htonl (0xc0000202);
+	const uint16_t port_a = htons (1024), port_b = htons (IPPORT_TEREDO);
+	teredo_io *a = teredo_io_loopback (ip_a, port_a);
+	teredo_io *b = teredo_io_loopback (ip_b, port_b);
+	teredo_packet p;
+
+	assert ((a != NULL) && (b != NULL));
+	assert (a->fd == -1);
+
+	/* Unconnected: sent datagrams are counted, then discarded */
+	assert (teredo_send_bubble (a, ip_b, port_b, &src, &dst) == 0);
+	assert (teredo_io_loopback_sent (a) == 1);
+	assert (teredo_io_recv (b, &p, 1) == 0);
+
+	teredo_io_loopback_connect (a, b);
+	assert (teredo_send_bubble (a, ip_b, port_b, &src, &dst) == 0);
+	assert (teredo_io_loopback_sent (a) == 2);
+	assert (teredo_io_recv (a, &p, 1) == 0);
+	assert (teredo_io_recv (b, &p, 1) == 1);
+	assert (p.source_ipv4 == ip_a);
+	assert (p.source_port == port_a);
+	assert (p.dest_ipv4 == ip_b);
+	assert (p.ip6_len == sizeof (struct ip6_hdr));
+	assert (IsBubble (p.ip6));
+	assert (memcmp (&p.ip6->ip6_src, &src, sizeof (src)) == 0);
+	assert (memcmp (&p.ip6->ip6_dst, &dst, sizeof (dst)) == 0);
+	assert (teredo_io_wait (b, &p, 0) == -1);
+
+	/* Replies go the other way around */
+	assert (teredo_reply_bubble (b, ip_a, port_a, p.ip6) == 0);
+	assert (teredo_io_wait (a, &p, 0) == 0);
+	assert (p.source_ipv4 == ip_b);
+	assert (memcmp (&p.ip6->ip6_src, &dst, sizeof (dst)) == 0);
+
+	/* Injected datagrams, malformed ones are skipped */
+	static const uint8_t junk[1] = { 0 };
+	static uint8_t big[4096];
+	struct ip6_hdr ip6;
+
+	memset (&ip6, 0, sizeof (ip6));
+	ip6.ip6_flow = htonl (0x60000000);
+	ip6.ip6_nxt = IPPROTO_NONE;
+	assert (teredo_io_loopback_inject (b, big, sizeof (big), ip_a,
+	                                   port_a) == -1);
+	assert (teredo_io_loopback_inject (b, junk, sizeof (junk), ip_a,
+	                                   port_a) == 0);
+	assert (teredo_io_loopback_inject (b, &ip6, sizeof (ip6), ip_a,
+	                                   port_a) == 0);
+	assert (teredo_io_recv (b, &p, 1) == 1);
+	assert (IsBubble (p.ip6));
+	assert (teredo_io_recv (b, &p, 1) == 0);
+
+	/* The queue is bounded */
+	unsigned n = 0;
+	while (teredo_io_loopback_inject (b, &ip6, sizeof (ip6), ip_a,
+	                                  port_a) == 0)
+		n++;
+	assert (n > 0);
+
+	teredo_packet batch[4];
+	unsigned got = 0, val;
+	while ((val = teredo_io_recv (b, batch, 4)) > 0)
+	{
+		assert (val <= 4);
+		got += val;
+	}
+	assert (got == n);
+
+	teredo_io_close (b);
+	teredo_io_close (a);
+}
+
+
+static void test_mmsg (void)
+{
+	const uint32_t loopback = htonl (INADDR_LOOPBACK);
+	teredo_io *rx = teredo_io_socket (loopback, 0);
+	teredo_io *tx = teredo_io_mmsg (loopback, 0, 4);
+	teredo_packet p;
+
+	assert ((rx != NULL) && (tx != NULL));
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof (addr);
+	assert (getsockname (rx->fd, (struct sockaddr *)&addr, &addrlen) == 0);
+
+	/* Datagrams are held back until flushed... */
+	for (unsigned i = 0; i < 3; i++)
+		assert (teredo_send_bubble (tx, loopback, addr.sin_port,
+		                            &src, &dst) == 0);
+	assert (teredo_io_recv (rx, &p, 1) == 0);
+
+	teredo_io_flush (tx);
+	for (unsigned i = 0; i < 3; i++)
+	{
+		assert (teredo_io_wait (rx, &p, 0) == 0);
+		assert (IsBubble (p.ip6));
+	}
+	assert (teredo_io_recv (rx, &p, 1) == 0);
+
+	/* ...or until the batch is full */
+	for (unsigned i = 0; i < 4; i++)
+		assert (teredo_send_bubble (tx, loopback, addr.sin_port,
+		                            &src, &dst) == 0);
+	for (unsigned i = 0; i < 4; i++)
+		assert (teredo_io_wait (rx, &p, 0) == 0);
+
+	/* Batched reception skips malformed datagrams */
+	static teredo_packet batch[4];
+	static const uint8_t junk[1] = { 0 };
+
+	assert (teredo_send_bubble (tx, loopback, addr.sin_port,
+	                            &src, &dst) == 0);
+	assert (teredo_io_send (tx, junk, sizeof (junk), loopback,
+	                        addr.sin_port) == sizeof (junk));
+	assert (teredo_send_bubble (tx, loopback, addr.sin_port,
+	                            &dst, &src) == 0);
+	teredo_io_flush (tx);
+	assert (teredo_io_wait (rx, batch, 0) == 0);
+
+	unsigned n = 1, val;
+	while ((n < 2) && ((val = teredo_io_recv (rx, batch + n, 3)) > 0))
+		n += val;
+	assert (n == 2);
+	assert (memcmp (&batch[0].ip6->ip6_src, &src, sizeof (src)) == 0);
+	assert (memcmp (&batch[1].ip6->ip6_src, &dst, sizeof (dst)) == 0);
+	assert (batch[1].source_port != 0);
+	assert (teredo_io_recv (rx, batch, 4) == 0);
+
+	/* Held datagrams are sent when closing */
+	assert (teredo_send_bubble (tx, loopback, addr.sin_port,
+	                            &src, &dst) == 0);
+	teredo_io_close (tx);
+	assert (teredo_io_wait (rx, &p, 0) == 0);
+
+	teredo_io_close (rx);
+}
+
+
+int main (void)
+{
+	test_loopback ();
+	test_mmsg ();
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h> // putenv()
+#include <string.h>
 
 #include <inttypes.h> /* for Mac OS X */
 #include <sys/types.h>
@@ -35,6 +36,7 @@
 #include "teredo.h"
 #include "clock.h"
 #include "peerlist.h"
+#include "tunnel.h"
 
 
 static teredo_peer *
@@ -155,6 +157,126 @@ static int test_list (teredo_peerlist *l)
 }
 
 
+static int test_quotas (teredo_peerlist *l)
+{
+	union teredo_addr addr = { };
+
+	addr.teredo.prefix = htonl (TEREDO_PREFIX);
+	addr.teredo.server_ip = htonl (0xC0000201);
+	addr.teredo.client_ip = ~htonl (0xC6336401);
+
+	puts ("Per-IPv4 quota test...");
+	for (unsigned i = 0; i < 5; i++)
+	{
+		addr.teredo.client_port = ~htons (1024 + i);
+		if (try_insert (l, &addr.ip6) != (i < 3))
+			return -1;
+	}
+
+	/* Existing peers are still found when creating */
+	addr.teredo.client_port = ~htons (1024);
+	bool created;
+	if ((lookup (l, &addr.ip6, &created) == NULL) || created)
+		return -1;
+
+	puts ("Per-prefix quota test...");
+	for (unsigned i = 1; i < 10; i++)
+	{
+		addr.teredo.client_ip = ~htonl (0xC6336401 + i);
+		if (try_insert (l, &addr.ip6) != (i < 8))
+			return -1;
+	}
+
+	addr.teredo.server_ip = htonl (0xC0000202);
+	if (!try_insert (l, &addr.ip6))
+		return -1;
+
+	/* Per-IPv4 quota does not apply to non-Teredo peers */
+	struct in6_addr ip6 = { { } };
+	memcpy (ip6.s6_addr, "\x20\x01\x0d\xb8", 4);
+	for (unsigned i = 0; i < 12; i++)
+	{
+		ip6.s6_addr[15] = i;
+		if (try_insert (l, &ip6) != (i < 10))
+			return -1;
+	}
+
+	puts ("Quota reset test...");
+	teredo_list_reset (l, 255);
+	if (!try_insert (l, &ip6))
+		return -1;
+
+	return 0;
+}
+
+
+static int test_quotas_scale (teredo_peerlist *l)
+{
+	union teredo_addr addr = { };
+
+	addr.teredo.prefix = htonl (TEREDO_PREFIX);
+
+	puts ("Quota with many sources test...");
+	for (unsigned i = 0; i < 5000; i++)
+	{
+		addr.teredo.server_ip = htonl (0xC0000000 + i);
+		addr.teredo.client_ip = ~htonl (0x0A000000 + i);
+		if (!try_insert (l, &addr.ip6))
+			return -1;
+	}
+
+	/* Other sources barely count against the quota of a new one */
+	addr.teredo.client_ip = ~htonl (0xC6336401);
+	for (unsigned i = 0; i < 3; i++)
+	{
+		addr.teredo.client_port = ~htons (1024 + i);
+		if (!try_insert (l, &addr.ip6))
+			return -1;
+	}
+	return 0;
+}
+
+
+static int test_quotas_decay (teredo_peerlist *l)
+{
+	union teredo_addr addr = { };
+	struct in6_addr ip6 = { { } };
+
+	addr.teredo.prefix = htonl (TEREDO_PREFIX);
+	addr.teredo.server_ip = htonl (0xC0000201);
+	addr.teredo.client_ip = ~htonl (0xC6336401);
+
+	puts ("Large sketch decay test...");
+	for (unsigned i = 0; i < 3; i++)
+	{
+		addr.teredo.client_port = ~htons (1024 + i);
+		if (try_insert (l, &addr.ip6) != (i < 2))
+			return -1;
+	}
+
+	/* The peers expire, and the counters are halved twice, but only a
+	 * slice at a time by each lookup. */
+	struct timespec delay = { 2, 200000000 };
+	teredo_sleep (&delay);
+
+	memcpy (ip6.s6_addr, "\x20\x01\x0d\xb8", 4);
+	for (unsigned i = 0; i < 4096; i++)
+	{
+		memcpy (ip6.s6_addr + 12, &i, sizeof (i));
+		if (try_lookup (l, &ip6))
+			return -1;
+	}
+
+	for (unsigned i = 0; i < 2; i++)
+	{
+		addr.teredo.client_port = ~htons (2048 + i);
+		if (!try_insert (l, &addr.ip6))
+			return -1;
+	}
+	return 0;
+}
+
+
 int main (void)
 {
 	struct in6_addr addr = { { } };
@@ -209,6 +331,111 @@ int main (void)
 	if (test_list (l))
 		return 1;
 
+	puts ("Quota list creation test...");
+	teredo_list_destroy (l);
+	l = teredo_list_create (255, 60);
+	if ((l == NULL) || teredo_list_set_quotas (l, 3, 10))
+		return -1;
+
+	if (test_quotas (l))
+		return 1;
+
+	/* The sketches follow the maximum number of peers */
+	if (teredo_list_set_quotas (l, 4, 0)
+	 || teredo_list_set_max (l, 131072, false))
+		return -1;
+	if (test_quotas_scale (l))
+		return 1;
+
+	/* Largest sketches: ADMIT_DEPTH rows of 1048576 counters */
+	teredo_list_destroy (l);
+	l = teredo_list_create (1048576, 1);
+	if ((l == NULL) || teredo_list_set_quotas (l, 2, 0))
+		return -1;
+	if (test_quotas_decay (l))
+		return 1;
+
+	puts ("Expiry test...");
+	teredo_list_destroy (l);
+	l = teredo_list_create (1, 1);
+	if (l == NULL)
+		return -1;
+
+	addr.s6_addr[0] = 2;
+	if (!try_insert (l, &addr) || !try_lookup (l, &addr))
+		return 1;
+	addr.s6_addr[0] = 3;
+	if (try_insert (l, &addr))
+		return 1; // list full
+
+	struct timespec delay = { 2, 200000000 };
+	teredo_sleep (&delay);
+
+	addr.s6_addr[0] = 2;
+	if (try_lookup (l, &addr))
+		return 1; // expired
+	addr.s6_addr[0] = 3;
+	if (!try_insert (l, &addr))
+		return 1; // room was made
+
+	puts ("Statistics test...");
+	teredo_tunnel_stats st;
+	teredo_list_stats (l, &st);
+	if ((st.peers != 1) || (st.max_peers != 1) || (st.expired != 1)
+	 || (st.sweeps == 0) || (st.max_sweep == 0)
+	 || (st.sweep_time < st.max_sweep) || (st.max_hold == 0))
+		return 1;
+
+	puts ("Lock hold time test...");
+	if ((teredo_list_max_hold (l, true) == 0)
+	 || (teredo_list_max_hold (l, false) != 0))
+		return 1;
+
+	puts ("Preallocated list test...");
+	teredo_list_destroy (l);
+	l = teredo_list_create (4, 60);
+	if ((l == NULL) || teredo_list_prealloc (l))
+		return -1;
+	teredo_list_set_max_queue (l, 4000);
+
+	for (unsigned j = 0; j < 2; j++)
+	{
+		for (unsigned i = 0; i < 5; i++)
+		{
+			addr.s6_addr[0] = i;
+			if (try_insert (l, &addr) != (i < 4))
+				return 1;
+		}
+
+		teredo_peer *p = teredo_list_lookup (l, &addr, NULL);
+		if (p != NULL)
+			return 1;
+		addr.s6_addr[0] = 0;
+		p = teredo_list_lookup (l, &addr, NULL);
+		if ((p == NULL) || (p->queue_left != 4000))
+			return 1;
+		teredo_list_release (l);
+		teredo_list_reset (l, 4);
+	}
+
+	/* Resizes the pool of a list, without recreating it */
+	if (teredo_list_set_max (l, 2, true))
+		return -1;
+	for (unsigned i = 0; i < 3; i++)
+	{
+		addr.s6_addr[0] = i;
+		if (try_insert (l, &addr) != (i < 2))
+			return 1;
+	}
+	if (teredo_list_set_max (l, 3, false))
+		return 1;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		addr.s6_addr[0] = i;
+		if (try_insert (l, &addr) != (i < 3))
+			return 1;
+	}
+
 	puts ("Final list release...");
 	teredo_list_destroy (l);
 	puts ("Done.");
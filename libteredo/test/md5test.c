@@ -49,6 +49,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 /*
  * This file builds an executable that performs various functions related
@@ -97,9 +98,113 @@ do_test(void)
     return status;
 }
 
+/* Check the multi-buffer variant against the reference one. */
+static int
+do_multi_test(void)
+{
+    static const int prefixes[] = { 0, 5, 64, 70 };
+    static const int lengths[] = { 0, 1, 12, 55, 56, 63, 64, 65, 119, 200 };
+    md5_byte_t msgs[7][200], digests[7][16], ref[16];
+    const md5_byte_t *data[7];
+    md5_byte_t *out[7];
+    md5_state_t states[7];
+    const md5_state_t *pms[7];
+    unsigned p, l, i, j;
+    int status = 0;
+
+    for (i = 0; i < 7; ++i)
+	for (j = 0; j < sizeof(msgs[i]); ++j)
+	    msgs[i][j] = (md5_byte_t)(i * 31 + j * 7);
+
+    for (p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); ++p)
+	for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+	    for (i = 0; i < 7; ++i) {
+		md5_init(&states[i]);
+		md5_append(&states[i], msgs[6 - i], prefixes[p]);
+		pms[i] = &states[i];
+		data[i] = msgs[i];
+		out[i] = digests[i];
+	    }
+	    md5_finish_multi(pms, data, lengths[l], out, 7);
+
+	    for (i = 0; i < 7; ++i) {
+		md5_state_t st = states[i];
+
+		md5_append(&st, msgs[i], lengths[l]);
+		md5_finish(&st, ref);
+		if (memcmp(ref, digests[i], 16)) {
+		    printf("**** ERROR, multi-buffer MD5 mismatch "
+			   "(prefix %d, length %d, message %u)\n",
+			   prefixes[p], lengths[l], i);
+		    status = 1;
+		}
+	    }
+	}
+    if (status == 0)
+	puts("md5 multi-buffer self-test completed successfully.");
+    return status;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Benchmark HMAC-like short messages hashed after a 64-bytes key block. */
+static void
+do_bench(void)
+{
+    enum { count = 100000, batch = 32, len = 12 };
+    md5_state_t key;
+    const md5_state_t *pms[batch];
+    md5_byte_t ipad[64], msgs[batch][len], digests[batch][16];
+    const md5_byte_t *data[batch];
+    md5_byte_t *out[batch];
+    unsigned i, j;
+    double t0, t1, t2;
+
+    memset(ipad, 0x36, sizeof(ipad));
+    memset(msgs, 0, sizeof(msgs));
+    md5_init(&key);
+    md5_append(&key, ipad, sizeof(ipad));
+
+    for (i = 0; i < batch; ++i) {
+	pms[i] = &key;
+	msgs[i][0] = (md5_byte_t)i;
+	data[i] = msgs[i];
+	out[i] = digests[i];
+    }
+
+    t0 = now();
+    for (i = 0; i < count; i += batch)
+	for (j = 0; j < batch; ++j) {
+	    md5_state_t st = key;
+
+	    md5_append(&st, msgs[j], len);
+	    md5_finish(&st, digests[j]);
+	}
+    t1 = now();
+    for (i = 0; i < count; i += batch)
+	md5_finish_multi(pms, data, len, out, batch);
+    t2 = now();
+
+    printf("md5 %d-bytes messages: reference %.2f Mhash/s, "
+	   "multi-buffer (%d lanes) %.2f Mhash/s\n", len,
+	   count / (t1 - t0) * 1e-6, MD5_LANES, count / (t2 - t1) * 1e-6);
+}
+
 /* Main program */
 int
 main(void)
 {
-    return do_test();
+    int status = do_test();
+
+    if (do_multi_test())
+	status = 1;
+    do_bench();
+    return status;
 }
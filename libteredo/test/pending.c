@@ -0,0 +1,81 @@
+/*
+ * pending.c - Libteredo pending hole punching table tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "clock.h"
+#include "pending.h"
+
+int main (void)
+{
+	teredo_pending *tab = teredo_pending_create ();
+	assert (tab != NULL);
+
+	const uint32_t ip = 0xC0000201;
+	const uint16_t port = 0x1234;
+	teredo_clock_t now = 1000;
+
+	/* Bubbles rate limiting */
+	assert (teredo_pending_bubble (tab, ip, port, now) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now) == 1);
+	assert (teredo_pending_bubble (tab, ip, port, now + 2) == 1);
+	assert (teredo_pending_bubble (tab, ip, port, now + 3) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now + 6) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now + 9) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now + 12) == -1);
+	assert (teredo_pending_bubble (tab, ip + 1, port, now + 12) == 0);
+	assert (teredo_pending_bubble (tab, ip, port + 1, now + 12) == 0);
+
+	/* Expiry */
+	now += TEREDO_PENDING_SLOTS - 1;
+	assert (teredo_pending_bubble (tab, ip, port, now) == -1);
+	now++;
+	assert (teredo_pending_bubble (tab, ip, port, now) == 0);
+
+	/* Removal */
+	teredo_pending_remove (tab, ip, port, now);
+	assert (teredo_pending_bubble (tab, ip, port, now) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now) == 1);
+
+	/* Bounded capacity: the table cannot be exhausted for more than 1 s */
+	now += 100;
+	unsigned created = 0;
+	for (unsigned i = 0; i < 100000; i++)
+		if (teredo_pending_bubble (tab, 0x0A000000 + i, port, now) == 0)
+			created++;
+	assert (created > 0);
+	assert (created <= TEREDO_PENDING_SLOT_SIZE);
+
+	now++;
+	assert (teredo_pending_bubble (tab, ip, port, now) == 0);
+	assert (teredo_pending_bubble (tab, ip, port, now) == 1);
+
+	teredo_pending_destroy (tab);
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * topn.c - Libteredo heavy hitters tracking tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "teredo.h"
+#include "tunnel.h"
+#include "clock.h"
+#include "peerlist.h"
+#include "topn.h"
+
+static void make_addr (struct in6_addr *addr, unsigned i)
+{
+	memset (addr, 0, sizeof (*addr));
+	addr->s6_addr[0] = 0x20;
+	addr->s6_addr[1] = 0x01;
+	memcpy (addr->s6_addr + 12, &i, sizeof (i));
+}
+
+
+static void test_exact (void)
+{
+	teredo_topn *t = teredo_topn_create (64);
+	teredo_topn_item tab[64];
+	struct in6_addr addr;
+
+	assert (t != NULL);
+	/* Fewer addresses than counters: counts are exact */
+	for (unsigned round = 0; round < 10; round++)
+		for (unsigned i = 0; i < 50; i++)
+		{
+			make_addr (&addr, i);
+			teredo_topn_add (t, &addr, i + 1, (round & 1) != 0);
+		}
+
+	assert (teredo_topn_get (t, tab, 64) == 50);
+	for (unsigned i = 0; i < 50; i++)
+	{
+		make_addr (&addr, 49 - i);
+		assert (memcmp (&tab[i].addr, &addr, sizeof (addr)) == 0);
+		assert (tab[i].bytes == 10 * (50 - i));
+		assert (tab[i].error == 0);
+		assert (tab[i].packets == 10);
+		assert ((tab[i].rx_packets == 5) && (tab[i].tx_packets == 5));
+		assert (tab[i].rx_bytes + tab[i].tx_bytes == tab[i].bytes);
+	}
+
+	teredo_topn_reset (t);
+	assert (teredo_topn_get (t, tab, 64) == 0);
+	teredo_topn_destroy (t);
+}
+
+
+static void test_heavy (void)
+{
+	teredo_topn *t = teredo_topn_create (16);
+	teredo_topn_item tab[4];
+	struct in6_addr addr;
+
+	assert (t != NULL);
+	/* 4 heavy hitters hidden among many more light addresses */
+	for (unsigned i = 0; i < 20000; i++)
+	{
+		make_addr (&addr, 1000 + i);
+		teredo_topn_add (t, &addr, 100, true);
+		if ((i % 10) == 0)
+			for (unsigned h = 0; h < 4; h++)
+			{
+				make_addr (&addr, h);
+				teredo_topn_add (t, &addr, 1000 * (4 - h), false);
+			}
+	}
+
+	assert (teredo_topn_get (t, tab, 4) == 4);
+	for (unsigned h = 0; h < 4; h++)
+	{
+		uint64_t actual = 2000 * 1000 * (4 - h);
+
+		make_addr (&addr, h);
+		assert (memcmp (&tab[h].addr, &addr, sizeof (addr)) == 0);
+		assert (tab[h].bytes >= actual);
+		assert (tab[h].bytes - tab[h].error <= actual);
+	}
+	teredo_topn_destroy (t);
+}
+
+
+static void test_list (void)
+{
+	teredo_peerlist *l = teredo_list_create (16, 30);
+	teredo_peer_stats tab[4];
+	struct in6_addr addr;
+	teredo_peer *p;
+	bool create;
+
+	assert (l != NULL);
+	assert (teredo_list_top (l, tab, 4, false) == 0);
+	assert (teredo_list_set_top (l, 8) == 0);
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		make_addr (&addr, i);
+		p = teredo_list_lookup (l, &addr, &create);
+		assert (p != NULL);
+		assert (create);
+		for (unsigned j = 0; j <= i; j++)
+		{
+			teredo_list_account (l, &addr, 100, true);
+			teredo_list_account (l, &addr, 50, false);
+		}
+		teredo_list_release (l);
+	}
+
+	assert (teredo_list_top (l, tab, 4, true) == 3);
+	make_addr (&addr, 2);
+	assert (memcmp (&tab[0].addr, &addr, sizeof (addr)) == 0);
+	assert (tab[0].bytes == 450);
+	assert (tab[0].packets == 6);
+	assert (tab[0].rx_packets == 3);
+	assert (tab[0].tx_packets == 3);
+	assert (tab[0].rx_bytes == 300);
+	assert (tab[0].tx_bytes == 150);
+	assert (tab[2].bytes == 150);
+
+	/* New period, after the list was reset */
+	assert (teredo_list_top (l, tab, 4, false) == 0);
+	teredo_list_reset (l, 16);
+	p = teredo_list_lookup (l, &addr, &create);
+	assert (p != NULL);
+	teredo_list_account (l, &addr, 100, true);
+	teredo_list_release (l);
+	assert (teredo_list_top (l, tab, 4, false) == 1);
+	assert (tab[0].rx_packets == 1);
+	assert (tab[0].tx_packets == 0);
+
+	/* Counters follow the tracked address, whatever the peer */
+	p = teredo_list_lookup (l, &addr, &create);
+	assert (p != NULL);
+	make_addr (&addr, 7);
+	teredo_list_account (l, &addr, 1000, false);
+	teredo_list_release (l);
+	assert (teredo_list_top (l, tab, 4, false) == 2);
+	assert (memcmp (&tab[0].addr, &addr, sizeof (addr)) == 0);
+	assert (tab[0].rx_packets == 0);
+	assert (tab[0].tx_bytes == 1000);
+	assert (tab[1].rx_packets == 1);
+
+	teredo_list_reset (l, 16);
+	assert (teredo_list_top (l, tab, 4, false) == 0);
+
+	assert (teredo_list_set_top (l, 0) == 0);
+	teredo_list_destroy (l);
+}
+
+
+int main (void)
+{
+	test_exact ();
+	test_heavy ();
+	test_list ();
+	return 0;
+}
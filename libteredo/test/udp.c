@@ -0,0 +1,115 @@
+/*
+ * udp.c - Libteredo packet buffer and UDP I/O tests
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+
+int main (void)
+{
+	static const uint8_t nonce[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	const uint32_t loopback = htonl (INADDR_LOOPBACK);
+	const uint32_t orig_ip = htonl (0xC0000201);
+	const uint16_t orig_port = htons (3545);
+
+	int fd = teredo_socket (loopback, 0);
+	assert (fd != -1);
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof (addr);
+	assert (getsockname (fd, (struct sockaddr *)&addr, &addrlen) == 0);
+
+	struct
+	{
+		uint8_t head[TEREDO_HEADROOM];
+		struct ip6_hdr ip6;
+	} out;
+	teredo_buf b;
+
+	memset (&out, 0, sizeof (out));
+	out.ip6.ip6_flow = htonl (0x60000000);
+	out.ip6.ip6_nxt = IPPROTO_NONE;
+	out.ip6.ip6_dst = teredo_restrict;
+
+	/* Headers must fit within the headroom, and nothing more */
+	teredo_buf_init (&b, &out.ip6, sizeof (out.ip6), sizeof (out.head));
+	assert (teredo_buf_push (&b, TEREDO_HEADROOM + 1) == NULL);
+	assert (b.data == (uint8_t *)&out.ip6);
+	assert (teredo_buf_push_orig (&b, orig_ip, orig_port) == 0);
+	assert (teredo_buf_push_auth (&b, nonce) == 0);
+	assert (b.len == 13 + 8 + sizeof (out.ip6));
+	assert (teredo_buf_push_orig (&b, orig_ip, orig_port) == -1);
+
+	assert (teredo_send_buf (fd, &b, loopback, addr.sin_port)
+	        == (int)b.len);
+
+	/* Both headers must be parsed back */
+	teredo_packet p;
+	assert (teredo_wait_recv (fd, &p) == 0);
+	assert (p.auth_present && !p.auth_fail);
+	assert (memcmp (p.auth_nonce, nonce, sizeof (nonce)) == 0);
+	assert (p.orig_ipv4 == orig_ip);
+	assert (p.orig_port == orig_port);
+	assert (p.ip6_len == sizeof (out.ip6));
+	assert (memcmp (p.ip6, &out.ip6, sizeof (out.ip6)) == 0);
+	assert ((((uintptr_t)p.ip6) & 7) == 0);
+
+	/* Received packets can be forwarded with a new origin indication */
+	teredo_packet_buf (&p, &b);
+	assert (b.headroom >= TEREDO_HEADROOM);
+	assert (teredo_buf_push_orig (&b, orig_ip, orig_port) == 0);
+	assert (teredo_send_buf (fd, &b, loopback, addr.sin_port)
+	        == (int)b.len);
+
+	teredo_packet q;
+	assert (teredo_wait_recv (fd, &q) == 0);
+	assert (!q.auth_present);
+	assert (q.orig_ipv4 == orig_ip);
+	assert (q.orig_port == orig_port);
+	assert (q.ip6_len == sizeof (out.ip6));
+	assert (memcmp (q.ip6, &out.ip6, sizeof (out.ip6)) == 0);
+
+	/* Low-latency receive mode */
+	assert (teredo_socket_set_buffers (fd, 65536, 65536) == 0);
+	assert (teredo_socket_set_busy_poll (fd, 0) == 0);
+	assert (teredo_send_buf (fd, &b, loopback, addr.sin_port)
+	        == (int)b.len);
+	assert (teredo_spin_recv (fd, &q, 1000) == 0);
+	assert (q.orig_ipv4 == orig_ip);
+	assert (q.ip6_len == sizeof (out.ip6));
+
+	teredo_close (fd);
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * xdp.c - Libteredo AF_XDP receive path tests
+ *
+ * This test needs root privileges to create a network namespace, and is
+ * skipped without them (or if AF_XDP support was not compiled).
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "tunnel.h"
+#include "xdp.h"
+
+#ifdef HAVE_XDP
+# include <sched.h>
+# include <poll.h>
+# include <unistd.h>
+# include <sys/ioctl.h>
+# include <sys/socket.h>
+# include <net/if.h>
+
+static bool skip (int err)
+{
+	return (err == EPERM) || (err == EACCES) || (err == ENOSYS)
+	    || (err == EOPNOTSUPP) || (err == EAFNOSUPPORT);
+}
+
+int main (void)
+{
+	/* Private network namespace with only the loopback interface */
+	if (unshare (CLONE_NEWNET))
+	{
+		perror ("unshare");
+		return 77;
+	}
+
+	int ctl = socket (AF_INET, SOCK_DGRAM, 0);
+	struct ifreq req;
+	memset (&req, 0, sizeof (req));
+	strcpy (req.ifr_name, "lo");
+	assert (ioctl (ctl, SIOCGIFFLAGS, &req) == 0);
+	req.ifr_flags |= IFF_UP;
+	assert (ioctl (ctl, SIOCSIFFLAGS, &req) == 0);
+	close (ctl);
+
+	const uint32_t loopback = htonl (INADDR_LOOPBACK);
+	int fd = teredo_socket (loopback, 0), sfd = teredo_socket (loopback, 0);
+	assert ((fd != -1) && (sfd != -1));
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof (addr);
+	assert (getsockname (fd, (struct sockaddr *)&addr, &addrlen) == 0);
+
+	teredo_xdp *xdp = teredo_xdp_open ("lo", 0, addr.sin_port);
+	if (xdp == NULL)
+	{
+		perror ("teredo_xdp_open");
+		return skip (errno) ? 77 : 1;
+	}
+	assert (teredo_xdp_port (xdp) == addr.sin_port);
+
+	/* Send a Teredo packet with an origin indication */
+	struct
+	{
+		uint8_t head[TEREDO_HEADROOM];
+		struct ip6_hdr ip6;
+	} out;
+	teredo_buf b;
+
+	memset (&out, 0, sizeof (out));
+	out.ip6.ip6_flow = htonl (0x60000000);
+	out.ip6.ip6_nxt = IPPROTO_NONE;
+	out.ip6.ip6_dst = teredo_restrict;
+	teredo_buf_init (&b, &out.ip6, sizeof (out.ip6), sizeof (out.head));
+	assert (teredo_buf_push_orig (&b, htonl (0xC0000201), htons (3545)) == 0);
+	assert (teredo_send_buf (sfd, &b, loopback, addr.sin_port)
+	        == (int)b.len);
+
+	/* It must be received from AF_XDP, not from the UDP socket */
+	struct pollfd ufd = { .fd = teredo_xdp_fd (xdp), .events = POLLIN };
+	assert (poll (&ufd, 1, 5000) == 1);
+
+	teredo_packet q;
+	assert (teredo_xdp_recv (xdp, &q) == 0);
+	assert (teredo_recv (fd, &q) == -1);
+
+	assert (q.source_ipv4 == loopback);
+	assert (q.dest_ipv4 == loopback);
+	assert (q.orig_ipv4 == htonl (0xC0000201));
+	assert (q.orig_port == htons (3545));
+	assert (q.ip6_len == sizeof (out.ip6));
+	assert (memcmp (q.ip6, &out.ip6, sizeof (out.ip6)) == 0);
+
+	/* Other ports must be left to the kernel */
+	assert (getsockname (sfd, (struct sockaddr *)&addr, &addrlen) == 0);
+	assert (teredo_send_buf (fd, &b, loopback, addr.sin_port)
+	        == (int)b.len);
+	assert (teredo_wait_recv (sfd, &q) == 0);
+	assert (q.orig_ipv4 == htonl (0xC0000201));
+	assert (teredo_xdp_recv (xdp, &q) == -1);
+	assert (poll (&ufd, 1, 0) == 0);
+
+	teredo_xdp_close (xdp);
+	teredo_close (sfd);
+	teredo_close (fd);
+	return 0;
+}
+#else
+int main (void)
+{
+	return 77;
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * tools.c - Helpers shared by the Teredo test and benchmark tools
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tools.h"
+
+int tool_parse_ipv4 (const char *str, uint32_t *ip, uint16_t *port)
+{
+	char buf[INET_ADDRSTRLEN + 6], *sep;
+
+	if (strlen (str) >= sizeof (buf))
+		return -1;
+	strcpy (buf, str);
+
+	sep = strchr (buf, ':');
+	if (sep != NULL)
+	{
+		char *end;
+		unsigned long l;
+
+		*sep++ = '\0';
+		l = strtoul (sep, &end, 10);
+		if ((port == NULL) || *end || (l == 0) || (l > 65535))
+			return -1;
+		*port = htons (l);
+	}
+
+	return (inet_pton (AF_INET, buf, ip) == 1) ? 0 : -1;
+}
@@ -0,0 +1,50 @@
+/*
+ * tools.h - Helpers shared by the Teredo test and benchmark tools
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_TOOLS_H
+# define LIBTEREDO_TOOLS_H
+
+# include <stdint.h>
+# include <time.h>
+
+/**
+ * @return the monotonic clock time in nanoseconds.
+ */
+static inline uint64_t tool_now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/**
+ * Parses an IPv4 address, optionally followed by a colon and a UDP port.
+ *
+ * @param ip [out] IPv4 address (network byte order)
+ * @param port [out] UDP port (network byte order), or NULL if a port is
+ * not allowed; left untouched if no port is specified.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int tool_parse_ipv4 (const char *str, uint32_t *ip, uint16_t *port);
+
+#endif /* ifndef LIBTEREDO_TOOLS_H */
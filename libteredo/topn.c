@@ -0,0 +1,326 @@
+/*
+ * topn.c - Heavy hitters tracking
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Space-saving algorithm (Metwally, Agrawal & El Abbadi, 2005): a fixed
+ * number of addresses are tracked with a byte counter each. When an
+ * untracked address is seen, it replaces the tracked address with the
+ * smallest counter, and inherits that counter, which becomes its error
+ * bound. Tracked addresses are indexed by an open addressing hash table,
+ * and ordered by a binary min-heap of counters.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "topn.h"
+
+typedef struct topn_slot
+{
+	teredo_topn_item item;
+	uint32_t hash;
+	unsigned heap; /* position in the heap */
+} topn_slot;
+
+struct teredo_topn
+{
+	unsigned size, count;
+	unsigned mask; /* hash table size - 1 */
+	uint64_t salt;
+	topn_slot *slots;
+	unsigned *heap; /* slot indices, least counter first */
+	unsigned *index; /* slot indices + 1, 0 if empty */
+};
+
+
+static uint32_t topn_hash (const teredo_topn *t, const struct in6_addr *addr)
+{
+	uint64_t a, b;
+
+	memcpy (&a, addr->s6_addr, 8);
+	memcpy (&b, addr->s6_addr + 8, 8);
+
+	uint64_t h = (a ^ t->salt) * UINT64_C(0xbf58476d1ce4e5b9);
+	h = (h ^ b ^ (h >> 31)) * UINT64_C(0x94d049bb133111eb);
+	return h ^ (h >> 32);
+}
+
+
+/**
+ * @return the hash table position of an address, or of the empty
+ * position where it would be inserted.
+ */
+static unsigned topn_find (const teredo_topn *restrict t,
+                           const struct in6_addr *restrict addr,
+                           uint32_t hash)
+{
+	unsigned i = hash & t->mask;
+
+	while (t->index[i]
+	    && memcmp (&t->slots[t->index[i] - 1].item.addr, addr,
+	               sizeof (*addr)))
+		i = (i + 1) & t->mask;
+	return i;
+}
+
+
+/**
+ * Removes a slot from the hash table, shifting subsequent entries back,
+ * so that no tombstones are needed.
+ */
+static void topn_unindex (teredo_topn *t, unsigned s)
+{
+	unsigned i = t->slots[s].hash & t->mask;
+
+	while (t->index[i] != s + 1)
+		i = (i + 1) & t->mask;
+
+	for (;;)
+	{
+		unsigned j = i, k;
+
+		t->index[i] = 0;
+		do
+		{
+			j = (j + 1) & t->mask;
+			if (t->index[j] == 0)
+				return;
+			k = t->slots[t->index[j] - 1].hash & t->mask;
+		}
+		/* entry j stays if its home k lies cyclically within (i, j] */
+		while ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)));
+
+		t->index[i] = t->index[j];
+		i = j;
+	}
+}
+
+
+static inline uint64_t topn_bytes (const teredo_topn *t, unsigned pos)
+{
+	return t->slots[t->heap[pos]].item.bytes;
+}
+
+
+static void topn_swap (teredo_topn *t, unsigned a, unsigned b)
+{
+	unsigned sa = t->heap[a], sb = t->heap[b];
+
+	t->heap[a] = sb;
+	t->heap[b] = sa;
+	t->slots[sa].heap = b;
+	t->slots[sb].heap = a;
+}
+
+
+static void topn_sift_up (teredo_topn *t, unsigned i)
+{
+	while (i > 0)
+	{
+		unsigned parent = (i - 1) / 2;
+
+		if (topn_bytes (t, parent) <= topn_bytes (t, i))
+			break;
+		topn_swap (t, i, parent);
+		i = parent;
+	}
+}
+
+
+static void topn_sift_down (teredo_topn *t, unsigned i)
+{
+	for (;;)
+	{
+		unsigned child = 2 * i + 1;
+
+		if (child >= t->count)
+			break;
+		if ((child + 1 < t->count)
+		 && (topn_bytes (t, child + 1) < topn_bytes (t, child)))
+			child++;
+		if (topn_bytes (t, i) <= topn_bytes (t, child))
+			break;
+		topn_swap (t, i, child);
+		i = child;
+	}
+}
+
+
+teredo_topn *teredo_topn_create (unsigned size)
+{
+	if (size == 0 || size > (UINT_MAX >> 2))
+		return NULL;
+
+	teredo_topn *t = malloc (sizeof (*t));
+	if (t == NULL)
+		return NULL;
+
+	unsigned buckets = 1;
+	while (buckets < 2 * size)
+		buckets <<= 1;
+
+	t->size = size;
+	t->count = 0;
+	t->mask = buckets - 1;
+	t->slots = malloc (size * sizeof (*t->slots));
+	t->heap = malloc (size * sizeof (*t->heap));
+	t->index = calloc (buckets, sizeof (*t->index));
+	if ((t->slots == NULL) || (t->heap == NULL) || (t->index == NULL))
+	{
+		teredo_topn_destroy (t);
+		return NULL;
+	}
+
+	/* Randomized hash, so that collisions cannot be forced */
+	struct timespec ts;
+	clock_gettime (CLOCK_REALTIME, &ts);
+	t->salt = (((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec ^ (uintptr_t)t)
+	        * UINT64_C(0x9e3779b97f4a7c15);
+	return t;
+}
+
+
+void teredo_topn_destroy (teredo_topn *t)
+{
+	free (t->index);
+	free (t->heap);
+	free (t->slots);
+	free (t);
+}
+
+
+/**
+ * Accounts for a packet in the per-direction counters of a tracked address.
+ */
+static inline void topn_count (teredo_topn_item *item, size_t bytes, bool rx)
+{
+	if (rx)
+	{
+		item->rx_packets++;
+		item->rx_bytes += bytes;
+	}
+	else
+	{
+		item->tx_packets++;
+		item->tx_bytes += bytes;
+	}
+}
+
+
+void teredo_topn_add (teredo_topn *restrict t,
+                      const struct in6_addr *restrict addr, size_t bytes,
+                      bool rx)
+{
+	uint32_t hash = topn_hash (t, addr);
+	unsigned i = topn_find (t, addr, hash), s;
+	topn_slot *slot;
+	bool fill = t->count < t->size;
+
+	if (t->index[i])
+	{
+		/* Tracked address */
+		slot = t->slots + t->index[i] - 1;
+		slot->item.bytes += bytes;
+		slot->item.packets++;
+		topn_count (&slot->item, bytes, rx);
+		topn_sift_down (t, slot->heap);
+		return;
+	}
+
+	if (fill)
+	{
+		s = t->count++;
+		slot = t->slots + s;
+		slot->item.bytes = 0;
+		slot->heap = s;
+		t->heap[s] = s;
+	}
+	else
+	{
+		/* Replaces the address with the least traffic */
+		s = t->heap[0];
+		slot = t->slots + s;
+		topn_unindex (t, s);
+		i = topn_find (t, addr, hash);
+	}
+
+	slot->item.addr = *addr;
+	slot->item.error = slot->item.bytes;
+	slot->item.bytes += bytes;
+	slot->item.packets = 1;
+	slot->item.rx_packets = slot->item.tx_packets = 0;
+	slot->item.rx_bytes = slot->item.tx_bytes = 0;
+	topn_count (&slot->item, bytes, rx);
+	slot->hash = hash;
+	t->index[i] = s + 1;
+
+	if (fill)
+		topn_sift_up (t, slot->heap);
+	else
+		topn_sift_down (t, slot->heap);
+}
+
+
+static int topn_cmp (const void *a, const void *b)
+{
+	const teredo_topn_item *ia = a, *ib = b;
+
+	if (ia->bytes == ib->bytes)
+		return 0;
+	return (ia->bytes < ib->bytes) ? 1 : -1;
+}
+
+
+unsigned teredo_topn_get (const teredo_topn *restrict t,
+                          teredo_topn_item *restrict tab, unsigned n)
+{
+	teredo_topn_item *all = malloc ((t->count + 1) * sizeof (*all));
+	if (all == NULL)
+		return 0;
+
+	for (unsigned i = 0; i < t->count; i++)
+		all[i] = t->slots[i].item;
+	qsort (all, t->count, sizeof (*all), topn_cmp);
+
+	if (n > t->count)
+		n = t->count;
+	memcpy (tab, all, n * sizeof (*tab));
+	free (all);
+	return n;
+}
+
+
+void teredo_topn_reset (teredo_topn *t)
+{
+	t->count = 0;
+	memset (t->index, 0, (t->mask + 1) * sizeof (*t->index));
+}
@@ -0,0 +1,77 @@
+/*
+ * topn.h - Heavy hitters tracking
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_TOPN_H
+# define LIBTEREDO_TOPN_H
+
+typedef struct teredo_topn teredo_topn;
+
+typedef struct teredo_topn_item
+{
+	struct in6_addr addr;
+	uint64_t bytes; /* estimate, never below the actual count */
+	uint64_t error; /* maximum overestimation of bytes */
+	unsigned long packets; /* since the address is tracked */
+	/* Exact traffic since the address is tracked, by direction */
+	unsigned long rx_packets, tx_packets;
+	uint64_t rx_bytes, tx_bytes;
+} teredo_topn_item;
+
+/**
+ * Creates a space-saving sketch of the addresses with the most traffic.
+ * Any address that accounts for more than 1/size of the traffic is
+ * tracked, with bounded error. Memory and update time do not depend on
+ * the number of distinct addresses. The sketch is not thread-safe.
+ *
+ * @param size number of tracked addresses (counters)
+ *
+ * @return NULL on error (out of memory).
+ */
+teredo_topn *teredo_topn_create (unsigned size);
+
+void teredo_topn_destroy (teredo_topn *t);
+
+/**
+ * Accounts for a packet. This is O(log(size)).
+ *
+ * @param rx whether the packet was received from the address
+ */
+void teredo_topn_add (teredo_topn *restrict t,
+                      const struct in6_addr *restrict addr, size_t bytes,
+                      bool rx);
+
+/**
+ * Gets the tracked addresses with the most traffic.
+ *
+ * @param tab [out] table of at most @a n items, sorted by decreasing
+ * byte counts
+ *
+ * @return the number of items in the table.
+ */
+unsigned teredo_topn_get (const teredo_topn *restrict t,
+                          teredo_topn_item *restrict tab, unsigned n);
+
+/**
+ * Forgets all tracked addresses, to start a new period.
+ */
+void teredo_topn_reset (teredo_topn *t);
+
+#endif /* ifndef LIBTEREDO_TOPN_H */
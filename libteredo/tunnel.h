@@ -33,6 +33,8 @@
 
 # include <stdbool.h>
 # include <stddef.h>
+# include <stdint.h>
+# include <netinet/in.h>
 
 # ifdef __cplusplus
 extern "C" {
@@ -257,6 +259,314 @@ typedef void (*teredo_icmpv6_cb) (void *opaque, const void *data, size_t len,
 void teredo_set_icmpv6_callback (teredo_tunnel *restrict t,
                                  teredo_icmpv6_cb cb);
 
+/**
+ * AF_XDP receive path instance.
+ */
+typedef struct teredo_xdp teredo_xdp;
+
+/**
+ * Sets up an AF_XDP socket, and an XDP program that steers IPv4/UDP
+ * datagrams toward a given port from one receive queue of a network
+ * interface to that socket, whatever their destination IPv4 address.
+ * Datagrams received on other queues still go through the kernel.
+ *
+ * This requires Linux 5.9 or more recent, and the CAP_NET_ADMIN,
+ * CAP_NET_RAW and CAP_BPF (or CAP_SYS_ADMIN) capabilities. The
+ * instance can be used after the privileges have been dropped.
+ *
+ * @param ifname network interface name
+ * @param queue network interface receive queue index
+ * @param port UDP port (network byte order)
+ *
+ * @return NULL on error (errno is ENOSYS if libteredo was built without
+ * AF_XDP support).
+ */
+teredo_xdp *teredo_xdp_open (const char *ifname, unsigned queue,
+                             uint16_t port);
+
+/**
+ * Detaches the XDP program and releases an AF_XDP receive path instance.
+ * It must not be used by any Teredo tunnel anymore.
+ */
+void teredo_xdp_close (teredo_xdp *xdp);
+
+/**
+ * Sampled capture of decapsulated packets.
+ */
+typedef struct teredo_capture teredo_capture;
+
+/**
+ * Starts capturing decapsulated IPv6 packets to a pcap file (raw IP link
+ * type). Packets are sampled, truncated to 2048 bytes, and written by a
+ * background thread; samples are dropped rather than delaying packet
+ * processing. When the file reaches its maximum size, it is renamed with
+ * a ".1" suffix, replacing any older such file, and a new one is started.
+ * If the directory is not writable (anymore), the file is truncated
+ * instead, and a warning is logged.
+ *
+ * @param path pcap file path
+ * @param sample capture one packet out of that many (0 means 1)
+ * @param max_size file byte size before rotation (0 means unlimited)
+ *
+ * @return NULL on error.
+ */
+teredo_capture *teredo_capture_open (const char *path, unsigned sample,
+                                     size_t max_size);
+
+/**
+ * Writes pending samples and stops a packet capture.
+ * It must not be used by any Teredo tunnel anymore.
+ */
+void teredo_capture_close (teredo_capture *c);
+
+/**
+ * Enables or disables the stateless mode of a Teredo tunnel. In that mode,
+ * unknown Teredo peers are only added to the peers list once they have
+ * replied to an authenticated bubble, in a way similar to TCP SYN cookies.
+ * Until then, packets toward them are dropped rather than queued, and
+ * bubbles are rate limited through a fixed-size table. This prevents
+ * spoofed traffic from filling the peers list.
+ *
+ * @note This function must <b>not</b> be used after teredo_transmit() or
+ * teredo_run_async() the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param on whether to enable the stateless mode
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_set_stateless_mode (teredo_tunnel *t, bool on);
+
+/**
+ * Sets the maximum number of peers of a Teredo tunnel. By default, that
+ * is 1048576 if libteredo was built with libJudy, 1024 otherwise.
+ *
+ * @note This function must <b>not</b> be used after teredo_transmit() or
+ * teredo_run_async() the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param max maximum number of peers (0 keeps the current value)
+ * @param prealloc whether to allocate memory for all peers upfront,
+ * rather than whenever a peer is created
+ *
+ * @return 0 on success, -1 on error (out of memory), in which case memory
+ * is allocated whenever a peer is created.
+ */
+int teredo_set_max_peers (teredo_tunnel *t, unsigned max, bool prealloc);
+
+/**
+ * Sets the peers timeouts of a Teredo tunnel.
+ *
+ * @note This function must <b>not</b> be used after teredo_transmit() or
+ * teredo_run_async() the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param expiration delay (seconds) after which unused peers are removed
+ * (0 for the default: 30 seconds, or 600 seconds in client mode)
+ * @param timeout delay (seconds) after which a peer that did not send
+ * anything must be checked again (0 for the default: 30 seconds)
+ *
+ * @return 0 (this cannot fail).
+ */
+int teredo_set_peer_timeouts (teredo_tunnel *t, unsigned expiration,
+                              unsigned timeout);
+
+/**
+ * Sets the maximum number of bytes of packets queued toward or from a
+ * single peer, pending hole punching (1280 bytes by default).
+ *
+ * @note This function is thread-safe: it can be used while the tunnel
+ * runs. It applies to peers created afterward.
+ *
+ * @param t Teredo tunnel instance
+ * @param bytes byte size of the queue
+ */
+void teredo_set_max_queue (teredo_tunnel *t, size_t bytes);
+
+/**
+ * Sets the minimum average interval between ICMPv6 error messages emitted
+ * by a Teredo tunnel (TEREDO_ICMP_RATE_LIMIT_MS by default).
+ *
+ * @note This function is thread-safe: it can be used while the tunnel
+ * runs.
+ *
+ * @param t Teredo tunnel instance
+ * @param ms interval in milliseconds (0 disables rate limiting)
+ */
+void teredo_set_icmp_rate_limit (teredo_tunnel *t, unsigned ms);
+
+/** Default ICMPv6 error messages interval (milliseconds) */
+# define TEREDO_ICMP_RATE_LIMIT_MS 100
+
+/**
+ * Sets admission quotas on the peers list of a Teredo tunnel, so that a
+ * few abusive sources cannot fill it. Peers beyond the quotas are
+ * rejected before they are inserted into the list.
+ *
+ * @note This function is thread-safe: it can be used while the tunnel
+ * runs. Existing peers are kept, but the quotas start over empty.
+ *
+ * @param t Teredo tunnel instance
+ * @param max_ipv4 maximum number of Teredo peers sharing one mapped IPv4
+ * address (0 means unlimited)
+ * @param max_prefix maximum number of peers sharing one /64 IPv6 prefix,
+ * i.e. one Teredo server for Teredo peers (0 means unlimited)
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_set_peer_quotas (teredo_tunnel *t, unsigned max_ipv4,
+                            unsigned max_prefix);
+
+/**
+ * Returns the longest time the peers list of a Teredo tunnel was kept
+ * locked, including for the expiry of peers. This directly bounds the
+ * latency added to packets that are processed concurrently.
+ *
+ * @param t Teredo tunnel instance
+ * @param reset whether to reset the value afterward
+ *
+ * @return a duration in nanoseconds.
+ */
+unsigned long teredo_get_list_max_hold (teredo_tunnel *t, bool reset);
+
+/**
+ * Statistics of a Teredo tunnel (see teredo_get_stats()). Counters are
+ * cumulative since the tunnel was created.
+ */
+typedef struct teredo_tunnel_stats
+{
+	unsigned long rx_packets; /**< packets received from the IPv4 network */
+	unsigned long rx_delivered; /**< IPv6 packets passed to the receive callback */
+	unsigned long tx_packets; /**< IPv6 packets given to teredo_transmit() */
+	unsigned long tx_sent; /**< IPv6 packets encapsulated at once (others
+	                            are queued or dropped pending hole punching) */
+	uint64_t rx_time; /**< nanoseconds the receive threads were busy */
+	unsigned peers; /**< peers currently in the list */
+	unsigned max_peers; /**< maximum number of peers in the list */
+	unsigned long expired; /**< peers expired from the list */
+	unsigned long sweeps; /**< garbage collection passes */
+	uint64_t sweep_time; /**< nanoseconds spent in garbage collection */
+	unsigned long max_sweep; /**< longest garbage collection pass (ns) */
+	unsigned long max_hold; /**< see teredo_get_list_max_hold() */
+} teredo_tunnel_stats;
+
+/**
+ * Gets the statistics of a Teredo tunnel.
+ *
+ * @note This function is thread-safe.
+ *
+ * @param t Teredo tunnel instance
+ * @param st [out] statistics
+ */
+void teredo_get_stats (teredo_tunnel *restrict t,
+                       teredo_tunnel_stats *restrict st);
+
+/**
+ * Traffic of a peer among those with the most traffic
+ * (see teredo_get_top_peers()).
+ */
+typedef struct teredo_peer_stats
+{
+	struct in6_addr addr; /**< peer IPv6 address */
+	uint64_t bytes; /**< bytes during the period (an upper bound) */
+	uint64_t error; /**< maximum overestimation of bytes */
+	unsigned long packets; /**< packets since the peer is tracked */
+	/* Exact traffic since the peer is tracked, by direction */
+	unsigned long rx_packets, tx_packets;
+	uint64_t rx_bytes, tx_bytes;
+} teredo_peer_stats;
+
+/**
+ * Enables tracking of the peers of a Teredo tunnel that exchange the most
+ * traffic (bytes received and sent), with a space-saving sketch. The
+ * traffic of any peer with more than 1/size of the total is tracked with
+ * an error of at most 1/size of the total. Memory use is proportional to
+ * the size, whatever the number of peers.
+ *
+ * @param t Teredo tunnel instance
+ * @param size number of tracked peers (0 disables tracking, the default)
+ *
+ * @return 0 on success, -1 on error (out of memory).
+ */
+int teredo_set_top_peers (teredo_tunnel *t, unsigned size);
+
+/**
+ * Gets the peers of a Teredo tunnel that exchanged the most traffic, since
+ * tracking was enabled or last reset.
+ *
+ * @note This function is thread-safe.
+ *
+ * @param t Teredo tunnel instance
+ * @param tab [out] table of at most @a n peers, by decreasing traffic
+ * @param n size of the table
+ * @param reset whether to start a new period afterward
+ *
+ * @return the number of peers in the table (0 if tracking is disabled).
+ */
+unsigned teredo_get_top_peers (teredo_tunnel *restrict t,
+                               teredo_peer_stats *restrict tab, unsigned n,
+                               bool reset);
+
+/**
+ * Makes a Teredo tunnel receive packets from an AF_XDP receive path in
+ * addition to its UDP socket. The instance must steer the port the
+ * tunnel is bound to, and must outlive the tunnel.
+ *
+ * @note This function must <b>not</b> be used after teredo_transmit() or
+ * teredo_run_async() the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param xdp AF_XDP receive path instance
+ *
+ * @return 0 on success, -1 on error.
+ */
+int teredo_set_xdp (teredo_tunnel *restrict t, teredo_xdp *xdp);
+
+/**
+ * Makes a Teredo tunnel record the packets it decapsulates (i.e. passes to
+ * its receive callback) to a packet capture, which must outlive the tunnel.
+ *
+ * @note This function must <b>not</b> be used after teredo_transmit() or
+ * teredo_run_async() the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param c packet capture instance, or NULL to stop capturing
+ */
+void teredo_set_capture (teredo_tunnel *restrict t, teredo_capture *c);
+
+/**
+ * Enables the low-latency receive mode of a Teredo tunnel: the kernel
+ * busy polls the network device for the tunnel socket (SO_BUSY_POLL),
+ * and the receive thread spins before it goes to sleep waiting for
+ * packets. Both burn CPU time to reduce latency.
+ *
+ * @note This function must <b>not</b> be used after teredo_run_async()
+ * the specified tunnel. That is undefined.
+ *
+ * @param t Teredo tunnel instance
+ * @param busy_poll kernel busy polling time in microseconds
+ * (0 keeps the system default)
+ * @param spin receive thread spinning time in microseconds (0 disables)
+ *
+ * @return 0 on success, -1 if kernel busy polling could not be enabled
+ * (spinning is enabled regardless).
+ */
+int teredo_set_busy_poll (teredo_tunnel *t, unsigned busy_poll,
+                          unsigned spin);
+
+/**
+ * Sets the kernel receive and send buffer sizes of the Teredo tunnel
+ * UDP socket. Larger buffers absorb bursts of packets better.
+ *
+ * @param t Teredo tunnel instance
+ * @param rcvbuf receive buffer byte size (0 leaves it unchanged)
+ * @param sndbuf send buffer byte size (0 leaves it unchanged)
+ *
+ * @return 0 on success, -1 on error.
+ */
+int teredo_set_socket_buffers (teredo_tunnel *t, unsigned rcvbuf,
+                               unsigned sndbuf);
+
 /**
  * Prototype for Teredo tunnel readiness event notification.
  * @param opaque private data pointer, set by teredo_set_privdata()
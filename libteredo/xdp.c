@@ -0,0 +1,496 @@
+/*
+ * xdp.c - AF_XDP receive path for Teredo packets
+ *
+ * A minimal XDP program steers IPv4/UDP datagrams for the Teredo port
+ * from one receive queue of a network interface to an AF_XDP socket,
+ * bypassing the kernel UDP/IP stack. Everything else (including
+ * fragments, IPv4 options and datagrams from other receive queues) keeps
+ * going through the kernel. Transmission always uses the UDP socket.
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <gettext.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <syslog.h>
+
+#include "teredo.h"
+#include "teredo-udp.h"
+#include "tunnel.h"
+#include "xdp.h"
+
+#ifdef HAVE_XDP
+# include <stddef.h> // offsetof()
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+# include <net/if.h> // if_nametoindex()
+# include <linux/bpf.h>
+# include <linux/if_xdp.h>
+# ifndef AF_XDP
+#  define AF_XDP 44
+# endif
+# ifndef SOL_XDP
+#  define SOL_XDP 283
+# endif
+
+/* UMEM frames (2 KiB is enough for any standard Ethernet MTU) */
+# define XDP_FRAME_SIZE  2048
+# define XDP_FRAMES      4096
+/* Ring sizes (must be powers of two) */
+# define XDP_FILL_SIZE   XDP_FRAMES
+# define XDP_COMP_SIZE   64
+# define XDP_RX_SIZE     2048
+
+/* Ethernet + IPv4 (without options) + UDP headers */
+# define XDP_MIN_FRAME   (14 + 20 + 8)
+
+struct xdp_ring
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	void *desc;
+	uint32_t mask;
+	uint32_t index; /* our own producer or consumer index */
+	void *map;
+	size_t map_len;
+};
+
+struct teredo_xdp
+{
+	int fd; /* AF_XDP socket */
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	uint16_t port;
+
+	uint8_t *umem;
+	struct xdp_ring fill, comp, rx;
+};
+
+
+static int sys_bpf (int cmd, union bpf_attr *attr)
+{
+	return syscall (__NR_bpf, cmd, attr, sizeof (*attr));
+}
+
+
+# define BPF_INSN(c, d, s, o, i) \
+	{ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) }
+
+/**
+ * Loads the XDP program steering Teredo packets to the XSKMAP.
+ *
+ * @return a BPF program file descriptor, -1 on error.
+ */
+static int teredo_xdp_prog_load (int map_fd, uint16_t port)
+{
+	/* Instruction index of the "pass to kernel" exit */
+	enum { PASS = 23 };
+	/* Jump offsets are relative to the next instruction */
+# define JPASS(next) (PASS - (next))
+	const int32_t eth_ipv4 = htons (0x0800), frag = htons (0x3fff);
+
+	struct bpf_insn prog[] =
+	{
+		/* r6 = context, r2 = data, r3 = data end */
+		BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, 2, 1,
+		          offsetof (struct xdp_md, data), 0),
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, 3, 1,
+		          offsetof (struct xdp_md, data_end), 0),
+		/* Ethernet, IPv4 and UDP headers must be present */
+		BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_MIN_FRAME),
+		BPF_INSN (BPF_JMP | BPF_JGT | BPF_X, 4, 3, JPASS (6), 0),
+		/* EtherType must be IPv4 */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),
+		BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, JPASS (8), eth_ipv4),
+		/* IPv4 without options */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),
+		BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, JPASS (10), 0x45),
+		/* UDP */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14 + 9, 0),
+		BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, JPASS (12), IPPROTO_UDP),
+		/* Fragments are left to the kernel */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, 5, 2, 14 + 6, 0),
+		BPF_INSN (BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, frag),
+		BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, JPASS (15), 0),
+		/* UDP destination port */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_H, 5, 2, 14 + 20 + 2, 0),
+		BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, JPASS (17), port),
+		/* Redirect to the socket of this receive queue if there is one,
+		 * or pass to the kernel otherwise */
+		BPF_INSN (BPF_LDX | BPF_MEM | BPF_W, 2, 6,
+		          offsetof (struct xdp_md, rx_queue_index), 0),
+		BPF_INSN (BPF_LD | BPF_IMM | BPF_DW, 1, BPF_PSEUDO_MAP_FD, 0,
+		          map_fd),
+		BPF_INSN (0, 0, 0, 0, 0),
+		BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		BPF_INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* PASS: */
+		BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+# undef JPASS
+	static const char license[] = "GPL";
+	union bpf_attr attr;
+
+	memset (&attr, 0, sizeof (attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns = (uintptr_t)prog;
+	attr.insn_cnt = sizeof (prog) / sizeof (prog[0]);
+	attr.license = (uintptr_t)license;
+
+	return sys_bpf (BPF_PROG_LOAD, &attr);
+}
+
+
+static int teredo_xdp_ring_map (struct xdp_ring *r, int fd, off_t pgoff,
+                                const struct xdp_ring_offset *off,
+                                unsigned size, size_t desc_size)
+{
+	r->map_len = off->desc + size * desc_size;
+	r->map = mmap (NULL, r->map_len, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED)
+	{
+		r->map = NULL;
+		return -1;
+	}
+
+	r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+	r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+	r->desc = (uint8_t *)r->map + off->desc;
+	r->mask = size - 1;
+	r->index = 0;
+	return 0;
+}
+
+
+static void teredo_xdp_ring_unmap (struct xdp_ring *r)
+{
+	if (r->map != NULL)
+		munmap (r->map, r->map_len);
+}
+
+
+/**
+ * Creates the AF_XDP socket, its UMEM and its rings,
+ * and fills the fill ring with all UMEM frames.
+ */
+static int teredo_xdp_socket (teredo_xdp *x, unsigned ifindex,
+                              unsigned queue)
+{
+	x->fd = socket (AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (x->fd == -1)
+		return -1;
+
+	x->umem = mmap (NULL, XDP_FRAMES * XDP_FRAME_SIZE,
+	                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	                -1, 0);
+	if (x->umem == MAP_FAILED)
+	{
+		x->umem = NULL;
+		return -1;
+	}
+
+	struct xdp_umem_reg reg =
+	{
+		.addr = (uintptr_t)x->umem,
+		.len = XDP_FRAMES * XDP_FRAME_SIZE,
+		.chunk_size = XDP_FRAME_SIZE,
+		.headroom = 0,
+	};
+	struct xdp_mmap_offsets off;
+	socklen_t offlen = sizeof (off);
+
+	if (setsockopt (x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg))
+	 || setsockopt (x->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+	                &(int){ XDP_FILL_SIZE }, sizeof (int))
+	 || setsockopt (x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+	                &(int){ XDP_COMP_SIZE }, sizeof (int))
+	 || setsockopt (x->fd, SOL_XDP, XDP_RX_RING,
+	                &(int){ XDP_RX_SIZE }, sizeof (int))
+	 || getsockopt (x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offlen))
+		return -1;
+
+	if (teredo_xdp_ring_map (&x->fill, x->fd, XDP_UMEM_PGOFF_FILL_RING,
+	                         &off.fr, XDP_FILL_SIZE, sizeof (uint64_t))
+	 || teredo_xdp_ring_map (&x->comp, x->fd,
+	                         XDP_UMEM_PGOFF_COMPLETION_RING,
+	                         &off.cr, XDP_COMP_SIZE, sizeof (uint64_t))
+	 || teredo_xdp_ring_map (&x->rx, x->fd, XDP_PGOFF_RX_RING,
+	                         &off.rx, XDP_RX_SIZE, sizeof (struct xdp_desc)))
+		return -1;
+
+	uint64_t *fill = x->fill.desc;
+	for (unsigned i = 0; i < XDP_FRAMES; i++)
+		fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+	x->fill.index = XDP_FRAMES;
+	__atomic_store_n (x->fill.producer, x->fill.index, __ATOMIC_RELEASE);
+
+	struct sockaddr_xdp addr =
+	{
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = ifindex,
+		.sxdp_queue_id = queue,
+	};
+	return bind (x->fd, (struct sockaddr *)&addr, sizeof (addr));
+}
+
+
+teredo_xdp *teredo_xdp_open (const char *ifname, unsigned queue,
+                             uint16_t port)
+{
+	unsigned ifindex = if_nametoindex (ifname);
+	if (ifindex == 0)
+		return NULL;
+
+	teredo_xdp *x = malloc (sizeof (*x));
+	if (x == NULL)
+		return NULL;
+
+	memset (x, 0, sizeof (*x));
+	x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+	x->port = port;
+
+	if (teredo_xdp_socket (x, ifindex, queue))
+	{
+		syslog (LOG_ERR, _("Error (%s): %m"), "AF_XDP");
+		goto error;
+	}
+
+	union bpf_attr attr;
+
+	/* Map from receive queue to AF_XDP socket */
+	memset (&attr, 0, sizeof (attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof (uint32_t);
+	attr.value_size = sizeof (uint32_t);
+	attr.max_entries = queue + 1;
+	x->map_fd = sys_bpf (BPF_MAP_CREATE, &attr);
+	if (x->map_fd == -1)
+	{
+		syslog (LOG_ERR, _("Error (%s): %m"), "BPF_MAP_CREATE");
+		goto error;
+	}
+
+	uint32_t key = queue, value = x->fd;
+	memset (&attr, 0, sizeof (attr));
+	attr.map_fd = x->map_fd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&value;
+	attr.flags = BPF_ANY;
+	if (sys_bpf (BPF_MAP_UPDATE_ELEM, &attr))
+	{
+		syslog (LOG_ERR, _("Error (%s): %m"), "BPF_MAP_UPDATE_ELEM");
+		goto error;
+	}
+
+	x->prog_fd = teredo_xdp_prog_load (x->map_fd, port);
+	if (x->prog_fd == -1)
+	{
+		syslog (LOG_ERR, _("Error (%s): %m"), "BPF_PROG_LOAD");
+		goto error;
+	}
+
+	/* The program is detached as soon as the link is closed */
+	memset (&attr, 0, sizeof (attr));
+	attr.link_create.prog_fd = x->prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	x->link_fd = sys_bpf (BPF_LINK_CREATE, &attr);
+	if (x->link_fd == -1)
+	{
+		syslog (LOG_ERR, _("Error (%s): %m"), "BPF_LINK_CREATE");
+		goto error;
+	}
+
+	return x;
+
+error:
+	teredo_xdp_close (x);
+	return NULL;
+}
+
+
+void teredo_xdp_close (teredo_xdp *x)
+{
+	if (x->link_fd != -1)
+		close (x->link_fd);
+	if (x->prog_fd != -1)
+		close (x->prog_fd);
+	if (x->map_fd != -1)
+		close (x->map_fd);
+
+	teredo_xdp_ring_unmap (&x->rx);
+	teredo_xdp_ring_unmap (&x->comp);
+	teredo_xdp_ring_unmap (&x->fill);
+	if (x->fd != -1)
+		close (x->fd);
+	if (x->umem != NULL)
+		munmap (x->umem, XDP_FRAMES * XDP_FRAME_SIZE);
+	free (x);
+}
+
+
+int teredo_xdp_fd (const teredo_xdp *x)
+{
+	return x->fd;
+}
+
+
+uint16_t teredo_xdp_port (const teredo_xdp *x)
+{
+	return x->port;
+}
+
+
+/**
+ * Extracts the UDP payload of an Ethernet frame into a teredo_packet,
+ * and parses the Teredo headers.
+ */
+static int teredo_xdp_parse (struct teredo_packet *p,
+                             const uint8_t *frame, size_t len)
+{
+	if ((len < XDP_MIN_FRAME) || (frame[12] != 0x08) || (frame[13] != 0x00))
+		return -1;
+
+	const uint8_t *ip = frame + 14;
+	size_t ihl = (ip[0] & 0xf) * 4;
+	size_t total = (ip[2] << 8) | ip[3];
+
+	if (((ip[0] >> 4) != 4) || (ihl < 20) || (ip[9] != IPPROTO_UDP)
+	 || (((ip[6] & 0x3f) | ip[7]) != 0) /* fragment */
+	 || (total < ihl + 8) || (total > len - 14))
+		return -1;
+
+	/* IPv4 header checksum */
+	uint32_t sum = 0;
+	for (size_t i = 0; i < ihl; i += 2)
+		sum += (ip[i] << 8) | ip[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	if (sum != 0xffff)
+		return -1;
+
+	/*
+	 * NOTE: the UDP checksum is not verified, as it is typically left
+	 * incomplete (checksum offload) on virtual interfaces. The IPv6
+	 * upper layers have their own checksums.
+	 */
+	const uint8_t *udp = ip + ihl;
+	size_t ulen = (udp[4] << 8) | udp[5];
+	if ((ulen < 8) || (ulen > total - ihl)
+	 || (ulen - 8 > TEREDO_PACKET_SIZE))
+		return -1;
+
+	memcpy (&p->source_ipv4, ip + 12, 4);
+	memcpy (&p->dest_ipv4, ip + 16, 4);
+	memcpy (&p->source_port, udp, 2);
+	memcpy (p->buf.fill + TEREDO_HEADROOM, udp + 8, ulen - 8);
+
+	return teredo_parse (p, ulen - 8);
+}
+
+
+int teredo_xdp_recv (teredo_xdp *x, struct teredo_packet *p)
+{
+	uint32_t cons = x->rx.index;
+
+	if (cons == __atomic_load_n (x->rx.producer, __ATOMIC_ACQUIRE))
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	const struct xdp_desc *desc = x->rx.desc;
+	uint64_t addr = desc[cons & x->rx.mask].addr;
+	uint32_t len = desc[cons & x->rx.mask].len;
+
+	int val = teredo_xdp_parse (p, x->umem + addr, len);
+
+	x->rx.index = cons + 1;
+	__atomic_store_n (x->rx.consumer, x->rx.index, __ATOMIC_RELEASE);
+
+	/* Give the frame back to the kernel */
+	uint64_t *fill = x->fill.desc;
+	fill[x->fill.index & x->fill.mask] = addr - (addr % XDP_FRAME_SIZE);
+	x->fill.index++;
+	__atomic_store_n (x->fill.producer, x->fill.index, __ATOMIC_RELEASE);
+
+	return val;
+}
+
+#else /* !HAVE_XDP */
+
+teredo_xdp *teredo_xdp_open (const char *ifname, unsigned queue,
+                             uint16_t port)
+{
+	(void)ifname;
+	(void)queue;
+	(void)port;
+	errno = ENOSYS;
+	return NULL;
+}
+
+
+void teredo_xdp_close (teredo_xdp *x)
+{
+	(void)x;
+}
+
+
+int teredo_xdp_fd (const teredo_xdp *x)
+{
+	(void)x;
+	return -1;
+}
+
+
+uint16_t teredo_xdp_port (const teredo_xdp *x)
+{
+	(void)x;
+	return 0;
+}
+
+
+int teredo_xdp_recv (teredo_xdp *x, struct teredo_packet *p)
+{
+	(void)x;
+	(void)p;
+	errno = EAGAIN;
+	return -1;
+}
+#endif
@@ -0,0 +1,57 @@
+/*
+ * xdp.h - AF_XDP receive path internal declarations
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef LIBTEREDO_XDP_H
+# define LIBTEREDO_XDP_H
+
+struct teredo_packet;
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/**
+ * @return the AF_XDP socket file descriptor, to be polled for input.
+ */
+int teredo_xdp_fd (const teredo_xdp *xdp);
+
+/**
+ * @return the UDP port (network byte order) steered to the AF_XDP socket.
+ */
+uint16_t teredo_xdp_port (const teredo_xdp *xdp);
+
+/**
+ * Receives and parses a Teredo packet from an AF_XDP socket. Never blocks.
+ * Not thread-safe: there must be a single receiving thread per instance.
+ *
+ * @param p teredo_packet receive buffer
+ *
+ * @return 0 on success, -1 on error.
+ * Errors might be caused by:
+ *  - malformatted packets,
+ *  - no data pending.
+ */
+int teredo_xdp_recv (teredo_xdp *xdp, struct teredo_packet *p);
+
+# ifdef __cplusplus
+}
+# endif
+#endif
@@ -0,0 +1,268 @@
+#! /bin/sh
+#
+# bench-netns.sh - End-to-end Teredo relay benchmark in network namespaces
+#
+# ***********************************************************************
+# *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+# *  This program is free software; you can redistribute and/or modify  *
+# *  it under the terms of the GNU General Public License as published  *
+# *  by the Free Software Foundation; version 2 of the license, or (at  *
+# *  your option) any later version.                                    *
+# *                                                                     *
+# *  This program is distributed in the hope that it will be useful,    *
+# *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+# *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+# *  See the GNU General Public License for more details.               *
+# *                                                                     *
+# *  You should have received a copy of the GNU General Public License  *
+# *  along with this program; if not, you can get it from:              *
+# *  http://www.gnu.org/copyleft/gpl.html                               *
+# ***********************************************************************
+
+# Starts miredo-server, a miredo relay and a miredo client in their own
+# network namespaces, then sends UDP traffic from the client tunnel
+# interface to a native IPv6 host behind the relay:
+#
+#   client --+                                  +-- relay --- native
+#            +-- hub (IPv4 bridge, 198.18.0/24) +      (2001:db8:1::/64)
+#   server --+                                         |
+#            +------------- (2001:db8:2::/64) ---------+
+#
+# and reports the packet and bit rates received by the native host, and
+# the CPU time used by each Teredo node per packet.
+#
+# Run "make bench" from the build directory. Without root privileges, the
+# benchmark runs within a new user namespace, if the system allows it.
+#
+# Environment variables:
+#   BENCH_DURATION  seconds of traffic (default: 10)
+#   BENCH_SIZE      UDP payload bytes (default: 1200)
+#   BENCH_RELAY_CONF  extra miredo.conf lines for the relay
+
+set -e
+
+BUILDDIR="${BUILDDIR:-$(pwd)}"
+PKGLIBEXECDIR="${PKGLIBEXECDIR:-/usr/local/libexec/miredo}"
+SYSCONFDIR="${SYSCONFDIR:-/usr/local/etc}"
+DURATION="${BENCH_DURATION:-10}"
+SIZE="${BENCH_SIZE:-1200}"
+NS="mbench$$"
+
+# Mounts below must not leak out of the benchmark
+if [ -z "$BENCH_UNSHARED" ]; then
+	export BENCH_UNSHARED=1
+	if [ "$(id -u)" = "0" ]; then
+		exec unshare --mount --propagation private --fork -- "$0" "$@"
+	fi
+	echo "Not root: trying in a new user namespace..."
+	export BENCH_USERNS=1
+	exec unshare --map-root-user --map-auto --mount --fork -- "$0" "$@"
+fi
+
+for prog in miredo miredo-server miredo-privproc client-hook udp-bench; do
+	if [ ! -f "$BUILDDIR/$prog" ]; then
+		echo "$BUILDDIR/$prog not found: build first." >&2
+		exit 1
+	fi
+done
+
+TMPDIR="$(mktemp -d)"
+overlays=""
+
+cleanup() {
+	set +e
+	for n in client relay server native hub; do
+		pids="$(ip netns pids "$NS-$n" 2>/dev/null)"
+		[ -n "$pids" ] && kill $pids 2>/dev/null
+	done
+	sleep 1
+	for n in client relay server native hub; do
+		ip netns del "$NS-$n" 2>/dev/null
+	done
+	[ -n "$overlays" ] && umount $overlays "$TMPDIR/overlay"
+	rm -rf -- "$TMPDIR"
+}
+trap cleanup EXIT INT TERM
+
+if [ -n "$BENCH_USERNS" ]; then
+	# Private mounts within the user namespace
+	mount -t tmpfs none /run
+	mkdir -p /run/netns
+fi
+
+# Makes a program (run with an optional interpreter) available at a given
+# path within this mount namespace, through an overlay of the nearest
+# existing parent directory.
+provide() {
+	[ -x "$1" ] && return 0
+	dir="$(dirname "$1")"
+	while [ ! -d "$dir" ]; do
+		dir="$(dirname "$dir")"
+	done
+	if [ "$dir" = "/" ]; then
+		echo "Cannot overlay $dir: install miredo first." >&2
+		exit 1
+	fi
+	if [ -z "$overlays" ]; then
+		mkdir "$TMPDIR/overlay"
+		mount -t tmpfs none "$TMPDIR/overlay"
+	fi
+	o="$TMPDIR/overlay/$(echo "$overlays" | wc -w)"
+	mkdir -p "$o/upper" "$o/work"
+	mount -t overlay overlay \
+		-o "lowerdir=$dir,upperdir=$o/upper,workdir=$o/work" "$dir"
+	overlays="$dir $overlays"
+	mkdir -p "$(dirname "$1")"
+	printf '#! /bin/sh\nexec %s "%s" "$@"\n' "$3" "$2" > "$1"
+	chmod 755 "$1"
+}
+
+# miredo spawns its privileged helper, which runs the client hook, from
+# the installation directories.
+provide "$PKGLIBEXECDIR/miredo-privproc" "$BUILDDIR/miredo-privproc"
+provide "$SYSCONFDIR/miredo/client-hook" "$BUILDDIR/client-hook" /bin/sh
+
+nsexec() {
+	netns="$NS-$1"
+	shift
+	ip netns exec "$netns" "$@"
+}
+
+# Topology
+for n in hub client relay server native; do
+	ip netns add "$NS-$n"
+	nsexec "$n" ip link set lo up
+done
+
+nsexec hub ip link add br0 type bridge
+nsexec hub ip link set br0 up
+for n in client relay server; do
+	nsexec hub ip link add "$n" type veth peer name eth0 netns "$NS-$n"
+	nsexec hub ip link set "$n" master br0 up
+	nsexec "$n" ip link set eth0 up
+done
+nsexec server ip addr add 198.18.0.1/24 dev eth0
+nsexec server ip addr add 198.18.0.2/24 dev eth0
+nsexec relay ip addr add 198.18.0.10/24 dev eth0
+nsexec client ip addr add 198.18.0.20/24 dev eth0
+
+nsexec native ip link add relay type veth peer name eth1 netns "$NS-relay"
+nsexec native ip link add server type veth peer name eth1 netns "$NS-server"
+for n in relay server; do
+	nsexec native ip link set "$n" up
+	nsexec "$n" ip link set eth1 up
+	nsexec "$n" sysctl -q -w net.ipv6.conf.all.forwarding=1
+done
+nsexec native ip addr add 2001:db8:1::2/64 dev relay nodad
+nsexec native ip addr add 2001:db8:2::2/64 dev server nodad
+nsexec relay ip addr add 2001:db8:1::1/64 dev eth1 nodad
+nsexec server ip addr add 2001:db8:2::1/64 dev eth1 nodad
+nsexec server ip -6 route add default via 2001:db8:2::2
+nsexec native ip -6 route add 2001::/32 via 2001:db8:1::1
+
+# Teredo nodes
+cat > "$TMPDIR/server.conf" << EOF
+ServerBindAddress 198.18.0.1
+ServerBindAddress2 198.18.0.2
+EOF
+cat > "$TMPDIR/relay.conf" << EOF
+RelayType relay
+InterfaceName teredo
+BindAddress 198.18.0.10
+${BENCH_RELAY_CONF}
+EOF
+cat > "$TMPDIR/client.conf" << EOF
+RelayType client
+InterfaceName teredo
+ServerAddress 198.18.0.1
+BindAddress 198.18.0.20
+EOF
+
+nsexec server "$BUILDDIR/miredo-server" -f -c "$TMPDIR/server.conf" \
+	> "$TMPDIR/server.log" 2>&1 &
+nsexec relay "$BUILDDIR/miredo" -f -c "$TMPDIR/relay.conf" \
+	> "$TMPDIR/relay.log" 2>&1 &
+nsexec client "$BUILDDIR/miredo" -f -c "$TMPDIR/client.conf" \
+	> "$TMPDIR/client.log" 2>&1 &
+
+# Waits for the client Teredo address (qualification)
+i=0
+until nsexec client ip -6 addr show dev teredo scope global 2>/dev/null \
+	| grep -q inet6; do
+	i=$((i + 1))
+	if [ $i -gt 100 ]; then
+		echo "Teredo client qualification failed:" >&2
+		cat "$TMPDIR/server.log" "$TMPDIR/client.log" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+# Relay discovery through the server, then warm-up
+sink() {
+	ip netns exec "$NS-native" "$BUILDDIR/udp-bench" -l -p "$1" \
+		> "$TMPDIR/sink.out" &
+	sink=$!
+	sleep 0.5
+}
+
+i=0
+recv=0
+while [ "$recv" -eq 0 ]; do
+	i=$((i + 1))
+	if [ $i -gt 5 ]; then
+		echo "No connectivity through the relay:" >&2
+		cat "$TMPDIR/relay.log" "$TMPDIR/client.log" >&2
+		exit 1
+	fi
+	sink 9001
+	nsexec client "$BUILDDIR/udp-bench" -d 2 -s "$SIZE" -p 9001 \
+		2001:db8:1::2 > /dev/null
+	kill -TERM $sink
+	wait $sink || true
+	read recv x < "$TMPDIR/sink.out" || recv=0
+done
+
+cpu_ticks() {
+	t=0
+	for pid in $(ip netns pids "$NS-$1"); do
+		set -- $(sed -e 's/^.*) //' "/proc/$pid/stat")
+		t=$((t + ${12} + ${13}))
+	done
+	echo $t
+}
+
+sink 9000
+relay0=$(cpu_ticks relay)
+client0=$(cpu_ticks client)
+nsexec client "$BUILDDIR/udp-bench" -d "$DURATION" -s "$SIZE" \
+	2001:db8:1::2 > "$TMPDIR/source.out"
+relay1=$(cpu_ticks relay)
+client1=$(cpu_ticks client)
+
+sleep 0.5
+kill -TERM $sink
+wait $sink || true
+
+read sent x sent_bytes x secs x < "$TMPDIR/source.out"
+read recv x recv_bytes x recv_secs x < "$TMPDIR/sink.out"
+hz=$(getconf CLK_TCK)
+
+echo "Teredo client -> relay -> native IPv6, $SIZE bytes UDP payload:"
+awk -v sent="$sent" -v recv="$recv" -v bytes="$recv_bytes" \
+	-v secs="$secs" -v hz="$hz" \
+	-v relay=$((relay1 - relay0)) -v client=$((client1 - client0)) '
+BEGIN {
+	if (recv == 0) {
+		print "  no packets received"
+		exit 1
+	}
+	printf "  sent      : %d packets, %.0f packets/s\n", sent, sent / secs
+	printf "  received  : %d packets, %.0f packets/s, %.3f Gbit/s" \
+		" (%.2f%% loss)\n", recv, recv / secs,
+		bytes * 8 / secs / 1e9, 100 * (sent - recv) / sent
+	printf "  relay CPU : %.0f ns/packet (%.0f%% of a CPU)\n",
+		relay / hz * 1e9 / recv, 100 * relay / hz / secs
+	printf "  client CPU: %.0f ns/packet (%.0f%% of a CPU)\n",
+		client / hz * 1e9 / recv, 100 * client / hz / secs
+}'
@@ -0,0 +1,308 @@
+/*
+ * udp-bench.c - UDP/IPv6 traffic source and sink for benchmarks
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+/*
+ * Sends UDP datagrams as fast as possible to an IPv6 address for a given
+ * time, or counts received ones until interrupted. This pushes traffic
+ * through the tunnel interfaces of the end-to-end benchmark
+ * (misc/bench-netns.sh), without depending on third-party tools.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_GETOPT_H
+# include <getopt.h>
+#endif
+
+#include "libteredo/tools.h"
+
+/** Datagrams sent or received per system call */
+#define BENCH_BATCH 32
+#define BENCH_MAX_SIZE 65507
+
+static volatile sig_atomic_t stop = 0;
+
+static void handler (int signum)
+{
+	(void)signum;
+	stop = 1;
+}
+
+
+static int
+run_source (int fd, const struct sockaddr_in6 *dst, size_t size,
+            unsigned duration)
+{
+	static uint8_t payload[BENCH_MAX_SIZE];
+	unsigned long count = 0;
+
+	if (connect (fd, (const struct sockaddr *)dst, sizeof (*dst)))
+	{
+		perror ("connect");
+		return -1;
+	}
+
+	memset (payload, 0x55, size);
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[BENCH_BATCH];
+	struct iovec iov = { payload, size };
+
+	memset (msgs, 0, sizeof (msgs));
+	for (unsigned i = 0; i < BENCH_BATCH; i++)
+	{
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	uint64_t start = tool_now_ns ();
+	uint64_t end = start + duration * UINT64_C(1000000000);
+	uint64_t now = start;
+
+	while (!stop && (now < end))
+	{
+#ifdef HAVE_SENDMMSG
+		int val = sendmmsg (fd, msgs, BENCH_BATCH, 0);
+		if (val > 0)
+			count += val;
+#else
+		for (unsigned i = 0; i < BENCH_BATCH; i++)
+			if (send (fd, payload, size, 0) == (ssize_t)size)
+				count++;
+#endif
+		now = tool_now_ns ();
+	}
+
+	printf ("%lu packets %"PRIu64" bytes %.6f seconds\n", count,
+	        (uint64_t)count * size, (now - start) / 1e9);
+	return 0;
+}
+
+
+static int run_sink (int fd)
+{
+	static uint8_t buf[BENCH_BATCH][BENCH_MAX_SIZE];
+	struct pollfd ufd = { .fd = fd, .events = POLLIN };
+	unsigned long count = 0;
+	uint64_t bytes = 0, first = 0, last = 0;
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[BENCH_BATCH];
+	struct iovec iov[BENCH_BATCH];
+
+	memset (msgs, 0, sizeof (msgs));
+	for (unsigned i = 0; i < BENCH_BATCH; i++)
+	{
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = sizeof (buf[i]);
+		msgs[i].msg_hdr.msg_iov = iov + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	while (!stop)
+	{
+		/* Wake up regularly to check for termination */
+		if (poll (&ufd, 1, 100) <= 0)
+			continue;
+
+#ifdef HAVE_RECVMMSG
+		int val = recvmmsg (fd, msgs, BENCH_BATCH, MSG_DONTWAIT, NULL);
+		if (val <= 0)
+			continue;
+
+		for (int i = 0; i < val; i++)
+			bytes += msgs[i].msg_len;
+#else
+		ssize_t len = recv (fd, buf[0], sizeof (buf[0]), MSG_DONTWAIT);
+		if (len < 0)
+			continue;
+
+		int val = 1;
+		bytes += len;
+#endif
+		last = tool_now_ns ();
+		if (count == 0)
+			first = last;
+		count += val;
+	}
+
+	printf ("%lu packets %"PRIu64" bytes %.6f seconds\n", count, bytes,
+	        (last - first) / 1e9);
+	return 0;
+}
+
+
+static int usage (const char *path)
+{
+	printf ("Usage: %s [OPTIONS] <IPv6 destination>\n"
+"       %s -l [OPTIONS]\n"
+"Sends UDP/IPv6 datagrams as fast as possible, or counts received ones\n"
+"\n"
+"  -d, --duration   sending duration in seconds (default: 10)\n"
+"  -h, --help       display this help and exit\n"
+"  -l, --listen     count received datagrams until interrupted\n"
+"  -p, --port       UDP port number (default: 9000)\n"
+"  -s, --size       datagrams payload size (default: 1200)\n"
+"  -V, --version    display program version and exit\n"
+"\n"
+"Totals are printed on exit, as packets, bytes and elapsed seconds.\n",
+	        path, path);
+	return 0;
+}
+
+
+static int version (void)
+{
+	puts (PACKAGE_NAME" v"PACKAGE_VERSION);
+	return 0;
+}
+
+
+static int
+parse_uint (const char *str, unsigned long *value, unsigned long max)
+{
+	char *end;
+	unsigned long l = strtoul (str, &end, 0);
+
+	if (*end || (l == 0) || (l > max))
+	{
+		fprintf (stderr, "Invalid number: %s\n", str);
+		return -1;
+	}
+	*value = l;
+	return 0;
+}
+
+
+int main (int argc, char *argv[])
+{
+	static const struct option opts[] =
+	{
+		{ "duration",   required_argument, NULL, 'd' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "listen",     no_argument,       NULL, 'l' },
+		{ "port",       required_argument, NULL, 'p' },
+		{ "size",       required_argument, NULL, 's' },
+		{ "version",    no_argument,       NULL, 'V' },
+		{ NULL,         no_argument,       NULL, '\0'}
+	};
+	unsigned long duration = 10, port = 9000, size = 1200;
+	bool listen = false;
+
+	int c;
+	while ((c = getopt_long (argc, argv, "d:hlp:s:V", opts, NULL)) != -1)
+		switch (c)
+		{
+			case 'd':
+				if (parse_uint (optarg, &duration, UINT_MAX))
+					return 1;
+				break;
+
+			case 'h':
+				return usage (argv[0]);
+
+			case 'l':
+				listen = true;
+				break;
+
+			case 'p':
+				if (parse_uint (optarg, &port, 65535))
+					return 1;
+				break;
+
+			case 's':
+				if (parse_uint (optarg, &size, BENCH_MAX_SIZE))
+					return 1;
+				break;
+
+			case 'V':
+				return version ();
+
+			default:
+				return 1;
+		}
+
+	struct sockaddr_in6 addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons (port);
+
+	if (listen ? (optind != argc) : (argc - optind != 1))
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	if (!listen && (inet_pton (AF_INET6, argv[optind], &addr.sin6_addr) != 1))
+	{
+		fprintf (stderr, "Invalid IPv6 address: %s\n", argv[optind]);
+		return 1;
+	}
+
+	signal (SIGINT, handler);
+	signal (SIGTERM, handler);
+
+	int fd = socket (AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd == -1)
+	{
+		perror ("socket");
+		return 1;
+	}
+
+	int retval;
+	if (listen)
+	{
+		if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)))
+		{
+			perror ("bind");
+			close (fd);
+			return 1;
+		}
+		retval = run_sink (fd);
+	}
+	else
+		retval = run_source (fd, &addr, size, duration);
+
+	close (fd);
+	return retval ? 1 : 0;
+}
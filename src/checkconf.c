@@ -118,6 +118,43 @@ static int miredo_checkconf (miredo_conf *conf)
 	if (str != NULL)
 		free (str);
 
+	str = miredo_conf_get (conf, "XDPInterface", NULL);
+	if (str != NULL)
+		free (str);
+	if (!miredo_conf_get_int16 (conf, "XDPQueue", &u16, NULL))
+		res = -1;
+
+	if (!miredo_conf_get_int32 (conf, "BusyPoll", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "SpinPoll", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "ReceiveBufferSize", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "SendBufferSize", &u32, NULL))
+		res = -1;
+
+	bool b;
+	if (!miredo_conf_get_bool (conf, "StatelessBubbles", &b, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeersPerIPv4", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeersPerPrefix", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeers", &u32, NULL)
+	 || !miredo_conf_get_bool (conf, "PreallocatePeers", &b, NULL)
+	 || !miredo_conf_get_int32 (conf, "PeerExpiration", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "PeerTimeout", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxQueueBytes", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "ICMPRateLimit", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "TopPeers", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "TopPeersInterval", &u32, NULL))
+		res = -1;
+
+	str = miredo_conf_get (conf, "CaptureFile", NULL);
+	if (str != NULL)
+		free (str);
+	if (!miredo_conf_get_int32 (conf, "CaptureSample", &u32, NULL)
+	 || !miredo_conf_get_int32 (conf, "CaptureSize", &u32, NULL))
+		res = -1;
+
+	str = miredo_conf_get (conf, "ControlSocket", NULL);
+	if (str != NULL)
+		free (str);
+
 	miredo_conf_clear (conf, 5);
 	return res;
 }
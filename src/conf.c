@@ -333,8 +333,33 @@ bool miredo_conf_get_int16 (miredo_conf *conf, const char *name,
 }
 
 
-#if 0
-/* This is supposedly bad for DSO (but we are not a DSO atm) */
+bool miredo_conf_get_int32 (miredo_conf *conf, const char *name,
+                            uint32_t *value, unsigned *line)
+{
+	char *val = miredo_conf_get (conf, name, line);
+
+	if (val == NULL)
+		return true;
+
+	char *end;
+	unsigned long l;
+
+	errno = 0;
+	l = strtoul (val, &end, 0);
+
+	if ((*end) || (errno) || (l > 4294967295UL))
+	{
+		LogError (conf, _("Invalid integer value \"%s\" for %s: %s"),
+		          val, name, strerror (errno));
+		free (val);
+		return false;
+	}
+	*value = (uint32_t)l;
+	free (val);
+	return true;
+}
+
+
 static const char *true_strings[] = { "yes", "true", "on", "enabled", NULL };
 static const char *false_strings[] =
 	{ "no", "false", "off", "disabled", NULL };
@@ -382,7 +407,6 @@ bool miredo_conf_get_bool (miredo_conf *conf, const char *name,
 	free (val);
 	return false;
 }
-#endif
 
 /* Utilities function */
 
@@ -36,6 +36,8 @@ char *miredo_conf_get (miredo_conf *conf, const char *name, unsigned *line);
 
 bool miredo_conf_get_int16 (miredo_conf *conf, const char *name,
                             uint16_t *value, unsigned *line);
+bool miredo_conf_get_int32 (miredo_conf *conf, const char *name,
+                            uint32_t *value, unsigned *line);
 bool miredo_conf_get_bool (miredo_conf *conf, const char *name,
                            bool *value, unsigned *line);
 
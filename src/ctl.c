@@ -0,0 +1,390 @@
+/*
+ * ctl.c - Control socket for the Miredo daemons
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <gettext.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // strcasecmp()
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+
+struct miredo_ctl
+{
+	int fd;
+	bool started;
+	char *path;
+	pthread_t thread;
+	const miredo_ctl_cmd *cmds;
+	void *opaque;
+};
+
+#define CTL_LINE_MAX 256
+#define CTL_ARGS_MAX 8
+/* Idle clients are disconnected, and stuck ones do not block the daemon */
+#define CTL_RECV_TIMEOUT 60 // seconds
+#define CTL_SEND_TIMEOUT 5 // seconds
+
+static const char *const log_levels[] =
+{
+	"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+
+static int ctl_socket (void)
+{
+	int fd;
+
+#ifdef SOCK_CLOEXEC
+	fd = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if ((fd == -1) && (errno == EINVAL))
+#endif
+	{
+		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+		if (fd != -1)
+			fcntl (fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+}
+
+
+miredo_ctl *miredo_ctl_open (const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen (path) >= sizeof (addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy (addr.sun_path, path);
+
+	miredo_ctl *ctl = malloc (sizeof (*ctl));
+	if (ctl == NULL)
+		return NULL;
+
+	ctl->fd = ctl_socket ();
+	ctl->started = false;
+	ctl->path = strdup (path);
+	if ((ctl->fd == -1) || (ctl->path == NULL))
+		goto error;
+
+	/* Replaces the socket left over by a previous instance, but nothing
+	 * else, in case of a configuration mistake. */
+	struct stat st;
+	if ((lstat (path, &st) == 0) && S_ISSOCK (st.st_mode))
+		unlink (path);
+
+	if (bind (ctl->fd, (struct sockaddr *)&addr, sizeof (addr)))
+		goto error;
+	if (chmod (path, 0600) || listen (ctl->fd, 4))
+	{
+		unlink (path);
+		goto error;
+	}
+	return ctl;
+
+error:
+	{
+		int saved_errno = errno;
+
+		if (ctl->fd != -1)
+			close (ctl->fd);
+		free (ctl->path);
+		free (ctl);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+
+
+static const char *ctl_log_level (FILE *out, unsigned argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		int mask = setlogmask (0);
+		int level = LOG_DEBUG;
+
+		while ((level > 0) && !(mask & LOG_MASK (level)))
+			level--;
+		fprintf (out, "%s\n", log_levels[level]);
+		return NULL;
+	}
+
+	for (int level = 0; level <= LOG_DEBUG; level++)
+		if (strcasecmp (argv[1], log_levels[level]) == 0)
+		{
+			setlogmask (LOG_UPTO (level));
+			syslog (LOG_NOTICE, _("Log level set to %s"), log_levels[level]);
+			return NULL;
+		}
+
+	return "unknown log level";
+}
+
+
+static void ctl_help (const miredo_ctl *ctl, FILE *out)
+{
+	fputs ("help: lists commands\n"
+	       "log-level [emerg|alert|crit|err|warning|notice|info|debug]: "
+	       "shows or sets the log level\n"
+	       "quit: closes the connection\n", out);
+
+	for (const miredo_ctl_cmd *cmd = ctl->cmds; cmd->name != NULL; cmd++)
+		fprintf (out, "%s%s%s: %s\n", cmd->name, (*cmd->usage) ? " " : "",
+		         cmd->usage, cmd->help);
+}
+
+
+/**
+ * Runs a command line, and writes its reply.
+ * @return true if the client asked to close the connection.
+ */
+static bool ctl_exec (const miredo_ctl *ctl, FILE *out, char *line)
+{
+	char *argv[CTL_ARGS_MAX + 1], *saveptr;
+	unsigned argc = 0;
+
+	for (char *arg = strtok_r (line, " \t\r", &saveptr); arg != NULL;
+	     arg = strtok_r (NULL, " \t\r", &saveptr))
+	{
+		if (argc > CTL_ARGS_MAX)
+		{
+			fputs ("ERROR too many arguments\n", out);
+			return false;
+		}
+		argv[argc++] = arg;
+	}
+
+	if (argc == 0)
+		return false; /* empty line */
+
+	const char *err = "unknown command (try help)";
+	bool quit = false;
+
+	if (strcmp (argv[0], "quit") == 0)
+	{
+		err = NULL;
+		quit = true;
+	}
+	else
+	if (strcmp (argv[0], "help") == 0)
+	{
+		ctl_help (ctl, out);
+		err = NULL;
+	}
+	else
+	if (strcmp (argv[0], "log-level") == 0)
+		err = (argc <= 2) ? ctl_log_level (out, argc, argv)
+		                  : "usage: log-level [level]";
+	else
+		for (const miredo_ctl_cmd *cmd = ctl->cmds; cmd->name != NULL; cmd++)
+		{
+			if (strcmp (argv[0], cmd->name))
+				continue;
+
+			if ((argc - 1 < cmd->min_args) || (argc - 1 > cmd->max_args))
+			{
+				fprintf (out, "ERROR usage: %s %s\n", cmd->name,
+				         cmd->usage);
+				return false;
+			}
+			err = cmd->cb (ctl->opaque, out, argc, argv);
+			break;
+		}
+
+	if (err != NULL)
+		fprintf (out, "ERROR %s\n", err);
+	else
+		fputs ("OK\n", out);
+	return quit;
+}
+
+
+/**
+ * Runs a command line, and sends its reply.
+ * @return true if the connection is to be closed.
+ */
+static bool ctl_reply (const miredo_ctl *ctl, int fd, char *line)
+{
+	char *buf;
+	size_t len;
+	FILE *out = open_memstream (&buf, &len);
+	if (out == NULL)
+		return true;
+
+	bool quit = ctl_exec (ctl, out, line);
+	fclose (out);
+
+	for (size_t done = 0; done < len;)
+	{
+		ssize_t val = send (fd, buf + done, len - done, MSG_NOSIGNAL);
+		if (val == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			quit = true;
+			break;
+		}
+		done += val;
+	}
+	free (buf);
+	return quit;
+}
+
+
+static void ctl_cleanup_fd (void *data)
+{
+	close (*(int *)data);
+}
+
+
+/**
+ * Serves commands from one client connection, until the client is done.
+ */
+static void ctl_serve (const miredo_ctl *ctl, int fd)
+{
+	char line[CTL_LINE_MAX];
+	size_t len = 0;
+
+	for (bool quit = false; !quit;)
+	{
+		char *eol = memchr (line, '\n', len);
+
+		if (eol == NULL)
+		{
+			if (len == sizeof (line))
+				break; /* line too long */
+
+			ssize_t val = recv (fd, line + len, sizeof (line) - len, 0);
+			if (val <= 0)
+			{
+				if ((val == -1) && (errno == EINTR))
+					continue;
+				break;
+			}
+			len += val;
+			continue;
+		}
+
+		*eol = '\0';
+		pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+		quit = ctl_reply (ctl, fd, line);
+		pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+
+		len -= eol + 1 - line;
+		memmove (line, eol + 1, len);
+	}
+}
+
+
+/**
+ * Serves one client connection. Cancellation safe.
+ */
+static void ctl_session (const miredo_ctl *ctl, int fd)
+{
+	struct timeval tv = { .tv_sec = CTL_RECV_TIMEOUT };
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	tv.tv_sec = CTL_SEND_TIMEOUT;
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+	pthread_cleanup_push (ctl_cleanup_fd, &fd);
+	ctl_serve (ctl, fd);
+	pthread_cleanup_pop (1);
+}
+
+
+static void *ctl_thread (void *data)
+{
+	const miredo_ctl *ctl = data;
+
+	for (;;)
+	{
+		int fd = accept (ctl->fd, NULL, NULL);
+		if (fd == -1)
+		{
+			/* Out of file descriptors or memory: try again later */
+			if ((errno != EINTR) && (errno != ECONNABORTED))
+				sleep (1);
+			continue;
+		}
+
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+		ctl_session (ctl, fd);
+	}
+	return NULL;
+}
+
+
+int miredo_ctl_start (miredo_ctl *ctl, const miredo_ctl_cmd *cmds,
+                      void *opaque)
+{
+	if (ctl->started)
+		return -1;
+
+	ctl->cmds = cmds;
+	ctl->opaque = opaque;
+	if (pthread_create (&ctl->thread, NULL, ctl_thread, ctl))
+		return -1;
+	ctl->started = true;
+	return 0;
+}
+
+
+void miredo_ctl_stop (miredo_ctl *ctl)
+{
+	if (!ctl->started)
+		return;
+
+	pthread_cancel (ctl->thread);
+	pthread_join (ctl->thread, NULL);
+	ctl->started = false;
+}
+
+
+void miredo_ctl_close (miredo_ctl *ctl)
+{
+	miredo_ctl_stop (ctl);
+	close (ctl->fd);
+	/* Fails if privileges were dropped: the next instance replaces it */
+	unlink (ctl->path);
+	free (ctl->path);
+	free (ctl);
+}
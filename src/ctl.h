@@ -0,0 +1,89 @@
+/*
+ * ctl.h - Control socket for the Miredo daemons
+ */
+
+/***********************************************************************
+ *  Copyright © 2026 Rémi Denis-Courmont and contributors.             *
+ *  This program is free software; you can redistribute and/or modify  *
+ *  it under the terms of the GNU General Public License as published  *
+ *  by the Free Software Foundation; version 2 of the license, or (at  *
+ *  your option) any later version.                                    *
+ *                                                                     *
+ *  This program is distributed in the hope that it will be useful,    *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of     *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.               *
+ *  See the GNU General Public License for more details.               *
+ *                                                                     *
+ *  You should have received a copy of the GNU General Public License  *
+ *  along with this program; if not, you can get it from:              *
+ *  http://www.gnu.org/copyleft/gpl.html                               *
+ ***********************************************************************/
+
+#ifndef MIREDO_CTL_H
+# define MIREDO_CTL_H
+
+/*
+ * The control socket is a UNIX stream socket. Clients send one command
+ * per line, as words separated by spaces. Each reply consists of zero or
+ * more lines of output, followed by a line with "OK", or with "ERROR"
+ * and a message. The "help", "log-level" and "quit" commands are
+ * built-in. Connections are served one at a time, e.g.:
+ *
+ *   echo stats | socat - UNIX-CONNECT:/run/miredo.ctl
+ */
+
+typedef struct miredo_ctl miredo_ctl;
+
+/**
+ * Control command handler. Commands run in the control socket thread.
+ *
+ * @param opaque data pointer given to miredo_ctl_start()
+ * @param out stream for the output lines of the command
+ * @param argc number of arguments, including the command name
+ * @param argv arguments (argv[0] is the command name)
+ *
+ * @return NULL on success, or an error message.
+ */
+typedef const char *(*miredo_ctl_cb) (void *opaque, FILE *out,
+                                      unsigned argc, char *argv[]);
+
+typedef struct miredo_ctl_cmd
+{
+	const char *name;
+	const char *usage; /* arguments, for the help */
+	const char *help;
+	unsigned min_args, max_args; /* not including the command name */
+	miredo_ctl_cb cb;
+} miredo_ctl_cmd;
+
+/**
+ * Creates a control socket, replacing any stale one at the same path.
+ * The socket is only accessible to its owner. This should be called
+ * before privileges are dropped.
+ *
+ * @return NULL on error (errno is set).
+ */
+miredo_ctl *miredo_ctl_open (const char *path);
+
+/**
+ * Starts serving a control socket from a new thread.
+ *
+ * @param cmds table of commands, terminated by a NULL name
+ *
+ * @return 0 on success, -1 on error.
+ */
+int miredo_ctl_start (miredo_ctl *ctl, const miredo_ctl_cmd *cmds,
+                      void *opaque);
+
+/**
+ * Stops serving a control socket, if it was started. The current command,
+ * if any, completes first.
+ */
+void miredo_ctl_stop (miredo_ctl *ctl);
+
+/**
+ * Stops and destroys a control socket.
+ */
+void miredo_ctl_close (miredo_ctl *ctl);
+
+#endif /* ifndef MIREDO_CTL_H */
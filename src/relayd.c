@@ -29,6 +29,8 @@
 #include <inttypes.h>
 #include <stdlib.h> // free()
 #include <stdio.h> // fputs()
+#include <limits.h> // UINT_MAX
+#include <time.h> // clock_gettime()
 #include <sys/types.h>
 #include <string.h> // strcasecmp()
 #include <errno.h>
@@ -64,14 +66,28 @@
 #include "privproc.h"
 #include "miredo.h"
 #include "conf.h"
+#include "ctl.h"
 
 typedef struct miredo_tunnel
 {
 	tun6 *tunnel;
 	int priv_fd;
 	teredo_tunnel *relay;
+	uint16_t mtu;
+	unsigned top_peers; // peers per report, 0 if disabled
+	unsigned top_interval; // seconds between reports, 0 if none
+	miredo_ctl *ctl; // control socket, NULL if disabled
+	uint64_t encap_time; // nanoseconds the encapsulation thread was busy
+	struct
+	{
+		struct timespec time;
+		uint64_t rx_time, encap_time;
+	} last_stats; // at the previous "stats" control command
 } miredo_tunnel;
 
+/* Peers tracked per reported peer, so that reports are accurate */
+#define TOP_PEERS_SKETCH 16
+
 static int icmp6_fd = -1;
 
 static int miredo_init (void)
@@ -409,31 +425,75 @@ setup_relay (teredo_tunnel *relay, bool cone)
 }
 
 
+/**
+ * Encapsulation buffer for one IPv6 packet of up to the tunnel MTU.
+ */
+typedef struct miredo_encap_buf
+{
+	miredo_tunnel *tunnel;
+	size_t mtu;
+	uint64_t packet[]; /* 64-bits aligned for the IPv6 header */
+} miredo_encap_buf;
+
+
+static miredo_encap_buf *miredo_encap_buf_alloc (miredo_tunnel *tunnel)
+{
+	/*
+	 * Clients learn their MTU from the server only after qualification,
+	 * so they need room for anything the tunnel can be configured with.
+	 */
+	size_t mtu = (tunnel->mtu != 0) ? tunnel->mtu : 65535;
+	miredo_encap_buf *b = malloc (sizeof (*b) + mtu);
+
+	if (b != NULL)
+	{
+		b->tunnel = tunnel;
+		b->mtu = mtu;
+	}
+	return b;
+}
+
+
 /**
  * Thread to encapsulate IPv6 packets into UDP.
  * Cancellation safe.
  */
 static LIBTEREDO_NORETURN void *miredo_encap_thread (void *d)
 {
-	teredo_tunnel *relay = ((miredo_tunnel *)d)->relay;
-	tun6 *tunnel = ((miredo_tunnel *)d)->tunnel;
+	miredo_encap_buf *b = d;
+	teredo_tunnel *relay = b->tunnel->relay;
+	tun6 *tunnel = b->tunnel->tunnel;
+	struct ip6_hdr *ip6 = (struct ip6_hdr *)b->packet;
+	/* Busy time is only reported through the control socket */
+	bool timed = b->tunnel->ctl != NULL;
 
 	for (;;)
 	{
-		/* Handle incoming data */
-		struct
-		{
-			struct ip6_hdr ip6;
-			uint8_t fill[65467];
-		} pbuf;
-
 		/* Forwards IPv6 packet to Teredo
 		 * (Packet transmission) */
-		int val = tun6_wait_recv (tunnel, &pbuf.ip6, sizeof (pbuf));
-		if (val >= 40)
+		int val = tun6_wait_recv (tunnel, ip6, b->mtu);
+
+		/* Drops packets that were truncated to the MTU (or malformed) */
+		if ((val >= 40)
+		 && ((size_t)val == sizeof (*ip6) + ntohs (ip6->ip6_plen)))
 		{
+			struct timespec start, end;
+
 			pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
-			teredo_transmit (relay, &pbuf.ip6, val);
+			if (timed)
+				clock_gettime (CLOCK_MONOTONIC, &start);
+			teredo_transmit (relay, ip6, val);
+			if (timed)
+			{
+				clock_gettime (CLOCK_MONOTONIC, &end);
+				/* Single writer: no need for an atomic addition */
+				__atomic_store_n (&b->tunnel->encap_time,
+				                  b->tunnel->encap_time
+				                  + (end.tv_sec - start.tv_sec)
+				                    * UINT64_C(1000000000)
+				                  + end.tv_nsec - start.tv_nsec,
+				                  __ATOMIC_RELAXED);
+			}
 			pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
 		}
 		else
@@ -442,6 +502,282 @@ static LIBTEREDO_NORETURN void *miredo_encap_thread (void *d)
 }
 
 
+/**
+ * Formats the traffic of one of the peers with the most traffic.
+ */
+static void
+format_peer (const teredo_peer_stats *st, char *buf, size_t len)
+{
+	char addr[INET6_ADDRSTRLEN], mapped[INET_ADDRSTRLEN + 10] = "";
+
+	inet_ntop (AF_INET6, &st->addr, addr, sizeof (addr));
+	if (IN6_TEREDO_PREFIX (&st->addr) == htonl (TEREDO_PREFIX))
+	{
+		uint32_t ipv4 = IN6_TEREDO_IPV4 (&st->addr);
+		char ipv4buf[INET_ADDRSTRLEN];
+
+		inet_ntop (AF_INET, &ipv4, ipv4buf, sizeof (ipv4buf));
+		snprintf (mapped, sizeof (mapped), " (%s:%u)", ipv4buf,
+		          (unsigned)ntohs (IN6_TEREDO_PORT (&st->addr)));
+	}
+
+	snprintf (buf, len, "%s%s: %"PRIu64" bytes (error %"PRIu64"), "
+	          "%lu packets, received %lu/%"PRIu64", sent %lu/%"PRIu64,
+	          addr, mapped, st->bytes, st->error, st->packets,
+	          st->rx_packets, st->rx_bytes, st->tx_packets, st->tx_bytes);
+}
+
+
+/**
+ * Logs the peers that exchanged the most traffic.
+ */
+static void
+report_top_peers (miredo_tunnel *tunnel, bool reset)
+{
+	unsigned n = tunnel->top_peers;
+	teredo_peer_stats *tab = malloc (n * sizeof (*tab));
+	if (tab == NULL)
+		return;
+
+	n = teredo_get_top_peers (tunnel->relay, tab, n, reset);
+	syslog (LOG_INFO, _("Top %u peers by traffic:"), n);
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		char buf[256];
+
+		format_peer (tab + i, buf, sizeof (buf));
+		syslog (LOG_INFO, " %2u. %s", i + 1, buf);
+	}
+	free (tab);
+}
+
+
+/**
+ * Waits for a signal other than SIGUSR1, reporting the top peers on
+ * SIGUSR1, and periodically (starting a new period each time).
+ */
+static void
+wait_signal (miredo_tunnel *tunnel)
+{
+	sigset_t dummyset, set;
+	sigemptyset (&dummyset);
+	pthread_sigmask (SIG_BLOCK, &dummyset, &set);
+
+	struct timespec deadline;
+	clock_gettime (CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += tunnel->top_interval;
+
+	for (;;)
+	{
+		int signum;
+
+		if (tunnel->top_peers && tunnel->top_interval)
+		{
+			struct timespec now, ts;
+
+			clock_gettime (CLOCK_MONOTONIC, &now);
+			ts.tv_sec = deadline.tv_sec - now.tv_sec;
+			ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (ts.tv_nsec < 0)
+			{
+				ts.tv_sec--;
+				ts.tv_nsec += 1000000000;
+			}
+
+			signum = (ts.tv_sec >= 0) ? sigtimedwait (&set, NULL, &ts) : -1;
+			if (signum == -1)
+			{
+				if ((ts.tv_sec < 0) || (errno == EAGAIN))
+				{
+					report_top_peers (tunnel, true);
+					deadline.tv_sec += tunnel->top_interval;
+				}
+				continue;
+			}
+		}
+		else
+		if (sigwait (&set, &signum))
+			continue;
+
+		if (signum != SIGUSR1)
+			break;
+		if (tunnel->top_peers)
+			report_top_peers (tunnel, false);
+	}
+}
+
+
+/*
+ * Control socket commands
+ */
+static int parse_uint (const char *str, unsigned *value)
+{
+	char *end;
+	unsigned long val;
+
+	errno = 0;
+	val = strtoul (str, &end, 10);
+	if ((*str < '0') || (*str > '9') || *end || errno || (val > UINT_MAX))
+		return -1;
+
+	*value = val;
+	return 0;
+}
+
+
+static void
+ctl_print_load (FILE *out, const char *name, uint64_t busy, uint64_t last,
+                uint64_t elapsed)
+{
+	fprintf (out, "thread %s busy-ns %"PRIu64" load %.1f%%\n", name, busy,
+	         elapsed ? 100. * (busy - last) / elapsed : 0.);
+}
+
+
+static const char *
+ctl_stats (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	miredo_tunnel *tunnel = opaque;
+	teredo_tunnel_stats st;
+	struct timespec now;
+
+	(void)argc;
+	(void)argv;
+
+	teredo_get_stats (tunnel->relay, &st);
+	uint64_t encap_time = __atomic_load_n (&tunnel->encap_time,
+	                                       __ATOMIC_RELAXED);
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	fprintf (out, "rx-packets %lu\n" "rx-delivered %lu\n"
+	         "tx-packets %lu\n" "tx-sent %lu\n",
+	         st.rx_packets, st.rx_delivered, st.tx_packets, st.tx_sent);
+	fprintf (out, "peers %u\n" "max-peers %u\n" "peers-occupancy %.1f%%\n",
+	         st.peers, st.max_peers,
+	         st.max_peers ? 100. * st.peers / st.max_peers : 0.);
+	fprintf (out, "gc-sweeps %lu\n" "gc-expired %lu\n"
+	         "gc-time-ns %"PRIu64"\n" "gc-max-ns %lu\n"
+	         "list-max-hold-ns %lu\n", st.sweeps, st.expired,
+	         st.sweep_time, st.max_sweep, st.max_hold);
+
+	/* Load since the previous query (or since startup) */
+	uint64_t elapsed =
+		(now.tv_sec - tunnel->last_stats.time.tv_sec) * UINT64_C(1000000000)
+		+ now.tv_nsec - tunnel->last_stats.time.tv_nsec;
+	ctl_print_load (out, "recv", st.rx_time, tunnel->last_stats.rx_time,
+	                elapsed);
+	ctl_print_load (out, "encap", encap_time, tunnel->last_stats.encap_time,
+	                elapsed);
+	tunnel->last_stats.time = now;
+	tunnel->last_stats.rx_time = st.rx_time;
+	tunnel->last_stats.encap_time = encap_time;
+	return NULL;
+}
+
+
+static const char *
+ctl_top (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	miredo_tunnel *tunnel = opaque;
+	unsigned n = tunnel->top_peers;
+
+	if (n == 0)
+		return "peers tracking disabled (see TopPeers)";
+	if ((argc > 1) && (parse_uint (argv[1], &n) || (n == 0)))
+		return "invalid number of peers";
+	if (n > tunnel->top_peers * TOP_PEERS_SKETCH)
+		n = tunnel->top_peers * TOP_PEERS_SKETCH;
+
+	teredo_peer_stats *tab = malloc (n * sizeof (*tab));
+	if (tab == NULL)
+		return "out of memory";
+
+	n = teredo_get_top_peers (tunnel->relay, tab, n, false);
+	for (unsigned i = 0; i < n; i++)
+	{
+		char buf[256];
+
+		format_peer (tab + i, buf, sizeof (buf));
+		fprintf (out, "%u. %s\n", i + 1, buf);
+	}
+	free (tab);
+	return NULL;
+}
+
+
+static const char *
+ctl_icmp_rate_limit (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	miredo_tunnel *tunnel = opaque;
+	unsigned ms;
+
+	(void)out;
+	(void)argc;
+	if (parse_uint (argv[1], &ms))
+		return "invalid interval";
+
+	teredo_set_icmp_rate_limit (tunnel->relay, ms);
+	syslog (LOG_NOTICE, _("ICMPv6 rate limit set to %u ms"), ms);
+	return NULL;
+}
+
+
+static const char *
+ctl_max_queue (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	miredo_tunnel *tunnel = opaque;
+	unsigned bytes;
+
+	(void)out;
+	(void)argc;
+	if (parse_uint (argv[1], &bytes) || (bytes == 0))
+		return "invalid size";
+
+	teredo_set_max_queue (tunnel->relay, bytes);
+	syslog (LOG_NOTICE, _("Peer queue size set to %u bytes"), bytes);
+	return NULL;
+}
+
+
+static const char *
+ctl_peer_quotas (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	miredo_tunnel *tunnel = opaque;
+	unsigned max_ipv4, max_prefix;
+
+	(void)out;
+	(void)argc;
+	if (parse_uint (argv[1], &max_ipv4) || parse_uint (argv[2], &max_prefix))
+		return "invalid quota";
+	if (teredo_set_peer_quotas (tunnel->relay, max_ipv4, max_prefix))
+		return "out of memory";
+
+	syslog (LOG_NOTICE, _("Peers quotas set to %u per IPv4 address and "
+	        "%u per prefix"), max_ipv4, max_prefix);
+	return NULL;
+}
+
+
+static const miredo_ctl_cmd relay_commands[] =
+{
+	{ "stats", "", "shows traffic, peers list and threads statistics",
+	  0, 0, ctl_stats },
+	{ "top", "[count]", "shows the peers with the most traffic",
+	  0, 1, ctl_top },
+	{ "icmp-rate-limit", "<ms>",
+	  "sets the minimum interval between ICMPv6 errors (0: unlimited)",
+	  1, 1, ctl_icmp_rate_limit },
+	{ "max-queue", "<bytes>",
+	  "sets the size of the packet queue of each new peer",
+	  1, 1, ctl_max_queue },
+	{ "peer-quotas", "<per-IPv4> <per-prefix>",
+	  "sets the peers admission quotas (0: unlimited)",
+	  2, 2, ctl_peer_quotas },
+	{ NULL, NULL, NULL, 0, 0, NULL }
+};
+
+
 /**
  * Miredo main daemon function, with UDP datagrams and IPv6 packets
  * receive loop.
@@ -450,17 +786,29 @@ static int
 run_tunnel (miredo_tunnel *tunnel)
 {
 	pthread_t encap_th;
+	miredo_encap_buf *buf = miredo_encap_buf_alloc (tunnel);
+	if (buf == NULL)
+		return -1;
+
 	if (teredo_run_async (tunnel->relay)
-	 || pthread_create (&encap_th, NULL, miredo_encap_thread, tunnel))
+	 || pthread_create (&encap_th, NULL, miredo_encap_thread, buf))
+	{
+		free (buf);
 		return -1;
+	}
 
-	sigset_t dummyset, set;
-	sigemptyset (&dummyset);
-	pthread_sigmask (SIG_BLOCK, &dummyset, &set);
-	while (sigwait (&set, &(int){ 0 }));
+	clock_gettime (CLOCK_MONOTONIC, &tunnel->last_stats.time);
+	if ((tunnel->ctl != NULL)
+	 && miredo_ctl_start (tunnel->ctl, relay_commands, tunnel))
+		syslog (LOG_WARNING, _("Cannot start control socket"));
 
+	wait_signal (tunnel);
+
+	if (tunnel->ctl != NULL)
+		miredo_ctl_stop (tunnel->ctl);
 	pthread_cancel (encap_th);
 	pthread_join (encap_th, NULL);
+	free (buf);
 	return 0;
 }
 
@@ -560,6 +908,71 @@ relay_run (miredo_conf *conf, const char *server_name)
 
 	bind_port = htons (bind_port);
 
+	uint32_t busy_poll = 0, spin_poll = 0, rcvbuf = 0, sndbuf = 0;
+	if (!miredo_conf_get_int32 (conf, "BusyPoll", &busy_poll, NULL)
+	 || !miredo_conf_get_int32 (conf, "SpinPoll", &spin_poll, NULL)
+	 || !miredo_conf_get_int32 (conf, "ReceiveBufferSize", &rcvbuf, NULL)
+	 || !miredo_conf_get_int32 (conf, "SendBufferSize", &sndbuf, NULL))
+	{
+		syslog (LOG_ALERT, _("Fatal configuration error"));
+		return -2;
+	}
+
+	bool stateless = false, prealloc = false;
+	uint32_t quota_ipv4 = 0, quota_prefix = 0, max_peers = 0;
+	uint32_t expiration = 0, timeout = 0, max_queue = 0;
+	uint32_t icmp_limit = TEREDO_ICMP_RATE_LIMIT_MS;
+	if (!miredo_conf_get_bool (conf, "StatelessBubbles", &stateless, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeersPerIPv4", &quota_ipv4, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeersPerPrefix", &quota_prefix,
+	                            NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxPeers", &max_peers, NULL)
+	 || !miredo_conf_get_bool (conf, "PreallocatePeers", &prealloc, NULL)
+	 || !miredo_conf_get_int32 (conf, "PeerExpiration", &expiration, NULL)
+	 || !miredo_conf_get_int32 (conf, "PeerTimeout", &timeout, NULL)
+	 || !miredo_conf_get_int32 (conf, "MaxQueueBytes", &max_queue, NULL)
+	 || !miredo_conf_get_int32 (conf, "ICMPRateLimit", &icmp_limit, NULL))
+	{
+		syslog (LOG_ALERT, _("Fatal configuration error"));
+		return -2;
+	}
+
+	uint32_t top_peers = 0, top_interval = 300;
+	if (!miredo_conf_get_int32 (conf, "TopPeers", &top_peers, NULL)
+	 || !miredo_conf_get_int32 (conf, "TopPeersInterval", &top_interval,
+	                            NULL)
+	 || (top_peers > UINT_MAX / TOP_PEERS_SKETCH))
+	{
+		syslog (LOG_ALERT, _("Fatal configuration error"));
+		return -2;
+	}
+
+	uint16_t xdp_queue = 0;
+	char *xdp_ifname = miredo_conf_get (conf, "XDPInterface", NULL);
+	if (!miredo_conf_get_int16 (conf, "XDPQueue", &xdp_queue, NULL)
+	 || ((xdp_ifname != NULL) && (bind_port == 0)))
+	{
+		if (xdp_ifname != NULL)
+		{
+			syslog (LOG_ALERT, _("XDPInterface requires BindPort"));
+			free (xdp_ifname);
+		}
+		syslog (LOG_ALERT, _("Fatal configuration error"));
+		return -2;
+	}
+
+	uint32_t capture_sample = 100, capture_size = 16 << 20;
+	if (!miredo_conf_get_int32 (conf, "CaptureSample", &capture_sample, NULL)
+	 || !miredo_conf_get_int32 (conf, "CaptureSize", &capture_size, NULL))
+	{
+		if (xdp_ifname != NULL)
+			free (xdp_ifname);
+		syslog (LOG_ALERT, _("Fatal configuration error"));
+		return -2;
+	}
+	char *capture_path = miredo_conf_get (conf, "CaptureFile", NULL);
+	char *ctl_path = miredo_conf_get (conf, "ControlSocket", NULL);
+
 	char *ifname = miredo_conf_get (conf, "InterfaceName", NULL);
 
 	miredo_conf_clear (conf, 5);
@@ -568,6 +981,40 @@ relay_run (miredo_conf *conf, const char *server_name)
 	 * SETUP
 	 */
 
+	// AF_XDP receive path (needs privileges)
+	teredo_xdp *xdp = NULL;
+	if (xdp_ifname != NULL)
+	{
+		xdp = teredo_xdp_open (xdp_ifname, xdp_queue, bind_port);
+		free (xdp_ifname);
+		if (xdp == NULL)
+			syslog (LOG_WARNING, _("Cannot attach AF_XDP socket: %s"),
+			        _("receiving through the UDP socket only"));
+	}
+
+	// Packet capture (the file may be outside the chroot)
+	teredo_capture *capture = NULL;
+	if (capture_path != NULL)
+	{
+		capture = teredo_capture_open (capture_path, capture_sample,
+		                               capture_size);
+		if (capture == NULL)
+			syslog (LOG_WARNING, _("Cannot open packet capture %s: %m"),
+			        capture_path);
+		free (capture_path);
+	}
+
+	// Control socket (the directory is usually not writable afterward)
+	miredo_ctl *ctl = NULL;
+	if (ctl_path != NULL)
+	{
+		ctl = miredo_ctl_open (ctl_path);
+		if (ctl == NULL)
+			syslog (LOG_WARNING, _("Cannot create control socket %s: %m"),
+			        ctl_path);
+		free (ctl_path);
+	}
+
 	// Tunneling interface initialization
 	int privfd = -1;
 	tun6 *tunnel = (mode & TEREDO_CLIENT)
@@ -583,6 +1030,12 @@ relay_run (miredo_conf *conf, const char *server_name)
 	{
 		syslog (LOG_ALERT, _("Miredo setup failure: %s"),
 		        _("Cannot create IPv6 tunnel"));
+		if (xdp != NULL)
+			teredo_xdp_close (xdp);
+		if (capture != NULL)
+			teredo_capture_close (capture);
+		if (ctl != NULL)
+			miredo_ctl_close (ctl);
 		return -1;
 	}
 
@@ -596,11 +1049,56 @@ relay_run (miredo_conf *conf, const char *server_name)
 			teredo_tunnel *relay = teredo_create (bind_ip, bind_port);
 			if (relay != NULL)
 			{
-				miredo_tunnel data = { tunnel, privfd, relay };
+				miredo_tunnel data =
+				{
+					.tunnel = tunnel,
+					.priv_fd = privfd,
+					.relay = relay,
+					.mtu = (mode & TEREDO_CLIENT) ? 0 : mtu,
+					.top_peers = top_peers,
+					.top_interval = top_interval,
+					.ctl = ctl,
+				};
 				teredo_set_privdata (relay, &data);
 				teredo_set_recv_callback (relay, miredo_recv_callback);
 				teredo_set_icmpv6_callback (relay, miredo_icmp6_callback);
 
+				if (teredo_set_busy_poll (relay, busy_poll, spin_poll))
+					syslog (LOG_WARNING,
+					        _("Kernel busy polling not available: %m"));
+				if (teredo_set_socket_buffers (relay, rcvbuf, sndbuf))
+					syslog (LOG_WARNING,
+					        _("Cannot set socket buffer sizes: %m"));
+				if (teredo_set_stateless_mode (relay, stateless))
+					syslog (LOG_WARNING,
+					        _("Stateless bubbles mode not available"));
+				if (teredo_set_peer_quotas (relay, quota_ipv4, quota_prefix))
+					syslog (LOG_WARNING, _("Peers quotas not available"));
+				if ((max_peers || prealloc)
+				 && teredo_set_max_peers (relay, max_peers, prealloc))
+					syslog (LOG_WARNING,
+					        _("Cannot allocate the list of peers"));
+				if (expiration || timeout)
+					teredo_set_peer_timeouts (relay, expiration, timeout);
+				if (max_queue)
+					teredo_set_max_queue (relay, max_queue);
+				teredo_set_icmp_rate_limit (relay, icmp_limit);
+				teredo_set_capture (relay, capture);
+				if (top_peers
+				 && teredo_set_top_peers (relay,
+				                          top_peers * TOP_PEERS_SKETCH))
+					syslog (LOG_WARNING, _("Top peers tracking not available"));
+
+				if ((xdp != NULL) && teredo_set_xdp (relay, xdp))
+				{
+					/* Detaches the program steering the packets */
+					syslog (LOG_WARNING,
+					        _("Cannot attach AF_XDP socket: %s"),
+					        _("receiving through the UDP socket only"));
+					teredo_xdp_close (xdp);
+					xdp = NULL;
+				}
+
 				retval = (mode & TEREDO_CLIENT)
 					? setup_client (relay, server_name, server_name2,
 					                discovery)
@@ -626,6 +1124,12 @@ relay_run (miredo_conf *conf, const char *server_name)
 	else
 		destroy_static_tunnel (tunnel);
 
+	if (xdp != NULL)
+		teredo_xdp_close (xdp);
+	if (capture != NULL)
+		teredo_capture_close (capture);
+	if (ctl != NULL)
+		miredo_ctl_close (ctl);
 	return retval;
 }
 
@@ -636,7 +1140,14 @@ int main (int argc, char *argv[])
 	static const cap_value_t capv[] =
 	{
 		CAP_NET_ADMIN, /* required by libtun6 */
-		CAP_NET_RAW /* required for raw ICMPv6 socket */
+		CAP_NET_RAW, /* required for raw ICMPv6 socket */
+#ifdef HAVE_XDP
+# ifdef CAP_BPF
+		CAP_BPF, /* required to load the XDP program */
+# else
+		CAP_SYS_ADMIN,
+# endif
+#endif
 	};
 
 	miredo_capv = capv;
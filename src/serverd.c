@@ -29,6 +29,8 @@
 #include <string.h> // memset()
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h> // free()
+#include <time.h> // clock_gettime()
 
 #include <sys/types.h>
 #include <sys/select.h>
@@ -47,10 +49,64 @@
 
 #include "miredo.h"
 #include "conf.h"
+#include "ctl.h"
 
 #include <libteredo/server.h>
 
 
+/*
+ * Control socket commands
+ */
+typedef struct miredo_server_ctl
+{
+	teredo_server *server;
+	struct timespec last; // time of the previous "stats" command
+	uint64_t last_busy[2];
+} miredo_server_ctl;
+
+
+static const char *
+ctl_stats (void *opaque, FILE *out, unsigned argc, char *argv[])
+{
+	static const char *const names[2] = { "primary", "secondary" };
+	miredo_server_ctl *ctl = opaque;
+	struct timespec now;
+
+	(void)argc;
+	(void)argv;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	/* Load since the previous query (or since startup) */
+	uint64_t elapsed =
+		(now.tv_sec - ctl->last.tv_sec) * UINT64_C(1000000000)
+		+ now.tv_nsec - ctl->last.tv_nsec;
+	ctl->last = now;
+
+	for (unsigned i = 0; i < 2; i++)
+	{
+		teredo_server_stats st;
+
+		teredo_server_get_stats (ctl->server, i, &st);
+		fprintf (out, "thread %s packets %lu ra %lu ipv6 %lu udp %lu "
+		         "dropped %lu errors %lu busy-ns %"PRIu64" load %.1f%%\n",
+		         names[i], st.packets, st.ra, st.ipv6, st.udp, st.dropped,
+		         st.errors, st.busy_time,
+		         elapsed ? 100. * (st.busy_time - ctl->last_busy[i])
+		                   / elapsed : 0.);
+		ctl->last_busy[i] = st.busy_time;
+	}
+	return NULL;
+}
+
+
+static const miredo_ctl_cmd server_commands[] =
+{
+	{ "stats", "", "shows the packet counters and load of each thread",
+	  0, 0, ctl_stats },
+	{ NULL, NULL, NULL, 0, 0, NULL }
+};
+
+
 static int
 server_run (miredo_conf *conf, const char *server_name)
 {
@@ -95,19 +151,49 @@ server_run (miredo_conf *conf, const char *server_name)
 	if (server_ip2 == INADDR_ANY)
 		server_ip2 = htonl (ntohl (server_ip) + 1);
 
-	if (!miredo_conf_get_int16 (conf, "InterfaceMTU", &mtu, NULL))
+	uint32_t busy_poll = 0, spin_poll = 0, rcvbuf = 0, sndbuf = 0;
+	if (!miredo_conf_get_int16 (conf, "InterfaceMTU", &mtu, NULL)
+	 || !miredo_conf_get_int32 (conf, "BusyPoll", &busy_poll, NULL)
+	 || !miredo_conf_get_int32 (conf, "SpinPoll", &spin_poll, NULL)
+	 || !miredo_conf_get_int32 (conf, "ReceiveBufferSize", &rcvbuf, NULL)
+	 || !miredo_conf_get_int32 (conf, "SendBufferSize", &sndbuf, NULL))
 	{
 		syslog (LOG_ALERT, _("Fatal configuration error"));
 		return -2;
 	}
 
+	char *ctl_path = miredo_conf_get (conf, "ControlSocket", NULL);
+
 	miredo_conf_clear (conf, 5);
 
+	// Control socket (the directory is usually not writable afterward)
+	miredo_ctl *ctl = NULL;
+	if (ctl_path != NULL)
+	{
+		ctl = miredo_ctl_open (ctl_path);
+		if (ctl == NULL)
+			syslog (LOG_WARNING, _("Cannot create control socket %s: %m"),
+			        ctl_path);
+		free (ctl_path);
+	}
+
 	// Sets up server (needs privileges to create raw socket)
 	server = teredo_server_create (server_ip, server_ip2);
+	if (server != NULL)
+	{
+		if (teredo_server_set_busy_poll (server, busy_poll, spin_poll))
+			syslog (LOG_WARNING,
+			        _("Kernel busy polling not available: %m"));
+		if (teredo_server_set_socket_buffers (server, rcvbuf, sndbuf))
+			syslog (LOG_WARNING, _("Cannot set socket buffer sizes: %m"));
+	}
 
 	if (drop_privileges ())
+	{
+		if (ctl != NULL)
+			miredo_ctl_close (ctl);
 		return -1;
+	}
 
 	if (server != NULL)
 	{
@@ -116,14 +202,22 @@ server_run (miredo_conf *conf, const char *server_name)
 		{
 			sigset_t dummyset, set;
 			int dummy;
+			miredo_server_ctl data = { .server = server };
+
+			clock_gettime (CLOCK_MONOTONIC, &data.last);
+			if ((ctl != NULL)
+			 && miredo_ctl_start (ctl, server_commands, &data))
+				syslog (LOG_WARNING, _("Cannot start control socket"));
 
 			/* changes nothing, only gets the current mask */
 			sigemptyset (&dummyset);
 			pthread_sigmask (SIG_BLOCK, &dummyset, &set);
 
 			/* wait for fatal signal */
-			while (sigwait (&set, &dummy) != 0);
+			while ((sigwait (&set, &dummy) != 0) || (dummy == SIGUSR1));
 
+			if (ctl != NULL)
+				miredo_ctl_close (ctl);
 			teredo_server_stop (server);
 			teredo_server_destroy (server);
 
@@ -133,6 +227,8 @@ server_run (miredo_conf *conf, const char *server_name)
 		teredo_server_destroy (server);
 	}
 
+	if (ctl != NULL)
+		miredo_ctl_close (ctl);
 	syslog (LOG_ALERT, _("Teredo server fatal error"));
 	syslog (LOG_NOTICE, _("Make sure another instance "
 	        "of the program is not already running."));